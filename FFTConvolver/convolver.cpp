@@ -2,6 +2,8 @@
 
 #include <pthread.h>
 #include <sndfile.h>
+#include <new>
+#include <vector>
 #include "convolver.h"
 #include "FFTConvolver.h"
 #include "Utilities.h"
@@ -12,12 +14,19 @@ extern "C" void _debug(const char *filename, const int linenumber, int level, co
 #define warn(...) _warn(__FILE__, __LINE__, __VA_ARGS__)
 #define debug(...) _debug(__FILE__, __LINE__, __VA_ARGS__)
 
-fftconvolver::FFTConvolver convolver_l;
-fftconvolver::FFTConvolver convolver_r;
+struct convolver {
+  fftconvolver::FFTConvolver l;
+  fftconvolver::FFTConvolver r;
+  unsigned int generation; // the impulse response generation l and r were initialised with
+};
 
-// always lock use this when accessing the playing conn value
-pthread_mutex_t convolver_lock = PTHREAD_MUTEX_INITIALIZER;
+// the impulse response, shared by all convolvers
+static std::vector<float> ir_l;
+static std::vector<float> ir_r;
+static unsigned int ir_generation = 0; // zero means no impulse response has been loaded
 
+// always lock this when accessing the impulse response
+pthread_mutex_t convolver_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int convolver_init(const char* filename, int max_length) {
   int success = 0;
@@ -34,28 +43,26 @@ int convolver_init(const char* filename, int max_length) {
           size_t l = sf_readf_float(file, buffer, size);
           if (l != 0) {
             pthread_mutex_lock(&convolver_lock);
-            convolver_l.reset(); // it is possible that init could be called more than once
-            convolver_r.reset(); // so it could be necessary to remove all previous settings
-  
+            // it is possible that init could be called more than once, so replace any previous
+            // impulse response; convolvers notice the new generation and reinitialise themselves
+            ir_l.assign(size, 0.0f);
+            ir_r.assign(size, 0.0f);
             if (info.channels == 1) {
-              convolver_l.init(352, buffer, size);
-              convolver_r.init(352, buffer, size);
+              for (size_t i = 0; i < size; ++i) {
+                ir_l[i] = buffer[i];
+                ir_r[i] = buffer[i];
+              }
             } else {
               // deinterleave
-              float buffer_l[size];
-              float buffer_r[size];
-    
-              unsigned int i;
-              for (i=0; i<size; ++i)
-              {
-                buffer_l[i] = buffer[2*i+0];
-                buffer_r[i] = buffer[2*i+1];
+              for (size_t i = 0; i < size; ++i) {
+                ir_l[i] = buffer[2 * i + 0];
+                ir_r[i] = buffer[2 * i + 1];
               }
-    
-              convolver_l.init(352, buffer_l, size);
-              convolver_r.init(352, buffer_r, size);
-              
             }
+            unsigned int next_generation = ir_generation + 1;
+            if (next_generation == 0)
+              next_generation = 1;
+            __atomic_store_n(&ir_generation, next_generation, __ATOMIC_RELEASE);
             pthread_mutex_unlock(&convolver_lock);
             success = 1;
           }
@@ -72,14 +79,35 @@ int convolver_init(const char* filename, int max_length) {
   return success;
 }
 
-void convolver_process_l(float* data, int length) {
-  pthread_mutex_lock(&convolver_lock);
-  convolver_l.process(data, data, length);
-  pthread_mutex_unlock(&convolver_lock);
+convolver_t *convolver_create(void) {
+  convolver_t *c = new (std::nothrow) convolver;
+  if (c)
+    c->generation = 0;
+  return c;
+}
+
+void convolver_free(convolver_t *c) { delete c; }
+
+// bring the convolver up to date with the shared impulse response
+static void convolver_check(convolver_t *c) {
+  // checked without the lock; a new impulse response is picked up at the start of a block
+  if (c->generation != __atomic_load_n(&ir_generation, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&convolver_lock);
+    c->l.reset();
+    c->r.reset();
+    c->l.init(352, ir_l.data(), ir_l.size());
+    c->r.init(352, ir_r.data(), ir_r.size());
+    c->generation = ir_generation;
+    pthread_mutex_unlock(&convolver_lock);
+  }
+}
+
+void convolver_process_l(convolver_t *c, float* data, int length) {
+  convolver_check(c);
+  c->l.process(data, data, length);
 }
 
-void convolver_process_r(float* data, int length) {
-  pthread_mutex_lock(&convolver_lock);
-  convolver_r.process(data, data, length);
-  pthread_mutex_unlock(&convolver_lock);
+void convolver_process_r(convolver_t *c, float* data, int length) {
+  convolver_check(c);
+  c->r.process(data, data, length);
 }
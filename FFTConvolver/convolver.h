@@ -4,11 +4,17 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-  
+
+// The impulse response is loaded once and shared; each playing session has its own convolver,
+// which holds the filter state, and picks up a newly-loaded impulse response on its next block.
+typedef struct convolver convolver_t;
+
 int convolver_init(const char* file, int max_length);
-void convolver_process_l(float* data, int length);
-void convolver_process_r(float* data, int length);
-  
+convolver_t *convolver_create(void);
+void convolver_free(convolver_t *c);
+void convolver_process_l(convolver_t *c, float* data, int length);
+void convolver_process_r(convolver_t *c, float* data, int length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,504 @@
+/*
+ * Content-addressed cover art cache.
+ *
+ * This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "artwork_cache.h"
+#include "common.h"
+
+#ifdef CONFIG_MBEDTLS
+#include <mbedtls/md5.h>
+#include <mbedtls/version.h>
+#endif
+
+#ifdef CONFIG_POLARSSL
+#include <polarssl/md5.h>
+#endif
+
+#ifdef CONFIG_OPENSSL
+#include <openssl/md5.h>
+#endif
+
+// The index is a hash table of entries, keyed by MD5, which are also on a list from the most to
+// the least recently used. Both are only touched with the cache_lock held. Everything that
+// touches the disk after startup is done by the writer thread, in the order it was asked for, so
+// an entry evicted before it was written is written and then deleted.
+
+#define ARTWORK_HASH_BUCKETS 64
+
+typedef struct artwork_entry {
+  uint8_t md5[16];
+  char *pathname;
+  size_t size;
+  int on_disk;
+  struct artwork_entry *hash_next;
+  struct artwork_entry *newer, *older;
+} artwork_entry;
+
+typedef enum {
+  AJ_write = 0,
+  AJ_touch, // mark it as used now, so the order survives a restart
+  AJ_delete,
+} artwork_job_type;
+
+typedef struct artwork_job {
+  artwork_job_type type;
+  char *pathname;
+  uint8_t md5[16];
+  char *data; // for a write
+  size_t length;
+  struct artwork_job *next;
+} artwork_job;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_available = PTHREAD_COND_INITIALIZER;
+static artwork_entry *index_table[ARTWORK_HASH_BUCKETS];
+static artwork_entry *newest, *oldest;
+static size_t cache_size; // the total size of the artwork in the cache
+static size_t cache_limit;
+static artwork_job *first_job, *last_job;
+static int cache_running = 0;
+static pthread_t writer_thread;
+static artwork_cache_ready_callback ready_callback;
+
+static const char prefix[] = "cover-";
+
+static void artwork_md5(const char *buf, size_t len, uint8_t *img_md5) {
+#ifdef CONFIG_OPENSSL
+  MD5_CTX ctx;
+  MD5_Init(&ctx);
+  MD5_Update(&ctx, buf, len);
+  MD5_Final(img_md5, &ctx);
+#endif
+
+#ifdef CONFIG_MBEDTLS
+#if MBEDTLS_VERSION_MINOR >= 7
+  mbedtls_md5_context tctx;
+  mbedtls_md5_starts_ret(&tctx);
+  mbedtls_md5_update_ret(&tctx, (const unsigned char *)buf, len);
+  mbedtls_md5_finish_ret(&tctx, img_md5);
+#else
+  mbedtls_md5_context tctx;
+  mbedtls_md5_starts(&tctx);
+  mbedtls_md5_update(&tctx, (const unsigned char *)buf, len);
+  mbedtls_md5_finish(&tctx, img_md5);
+#endif
+#endif
+
+#ifdef CONFIG_POLARSSL
+  md5_context tctx;
+  md5_starts(&tctx);
+  md5_update(&tctx, (const unsigned char *)buf, len);
+  md5_finish(&tctx, img_md5);
+#endif
+}
+
+static unsigned int artwork_bucket(const uint8_t *md5) {
+  return md5[0] % ARTWORK_HASH_BUCKETS; // it's a hash already
+}
+
+static artwork_entry *artwork_find(const uint8_t *md5) {
+  artwork_entry *e = index_table[artwork_bucket(md5)];
+  while ((e) && (memcmp(e->md5, md5, 16) != 0))
+    e = e->hash_next;
+  return e;
+}
+
+static void artwork_unlink_from_lru(artwork_entry *e) {
+  if (e->newer)
+    e->newer->older = e->older;
+  else
+    newest = e->older;
+  if (e->older)
+    e->older->newer = e->newer;
+  else
+    oldest = e->newer;
+  e->newer = NULL;
+  e->older = NULL;
+}
+
+static void artwork_make_newest(artwork_entry *e) {
+  e->older = newest;
+  e->newer = NULL;
+  if (newest)
+    newest->newer = e;
+  else
+    oldest = e;
+  newest = e;
+}
+
+static void artwork_add(artwork_entry *e) {
+  unsigned int bucket = artwork_bucket(e->md5);
+  e->hash_next = index_table[bucket];
+  index_table[bucket] = e;
+  artwork_make_newest(e);
+  cache_size += e->size;
+}
+
+static void artwork_remove(artwork_entry *e) {
+  artwork_entry **p = &index_table[artwork_bucket(e->md5)];
+  while (*p != e)
+    p = &(*p)->hash_next;
+  *p = e->hash_next;
+  artwork_unlink_from_lru(e);
+  cache_size -= e->size;
+}
+
+static void artwork_entry_free(artwork_entry *e) {
+  free(e->pathname);
+  free(e);
+}
+
+static void artwork_queue_job(artwork_job_type type, const char *pathname, const uint8_t *md5,
+                              char *data, size_t length) {
+  artwork_job *job = calloc(1, sizeof(artwork_job));
+  if (job == NULL) {
+    free(data);
+    return;
+  }
+  job->type = type;
+  job->pathname = strdup(pathname);
+  memcpy(job->md5, md5, 16);
+  job->data = data;
+  job->length = length;
+  if (last_job)
+    last_job->next = job;
+  else
+    first_job = job;
+  last_job = job;
+  pthread_cond_signal(&job_available);
+}
+
+static void artwork_job_free(artwork_job *job) {
+  free(job->pathname);
+  free(job->data);
+  free(job);
+}
+
+// evict the least recently used artwork, but never the newest, until the cache fits
+static void artwork_evict(int from_disk_now) {
+  while ((cache_size > cache_limit) && (oldest) && (oldest != newest)) {
+    artwork_entry *e = oldest;
+    artwork_remove(e);
+    debug(3, "Cover art cache: evicting \"%s\".", e->pathname);
+    if (from_disk_now) {
+      if (unlink(e->pathname) != 0)
+        debug(1, "Error %d deleting cover art file \"%s\".", errno, e->pathname);
+    } else {
+      artwork_queue_job(AJ_delete, e->pathname, e->md5, NULL, 0);
+    }
+    artwork_entry_free(e);
+  }
+}
+
+static int artwork_make_directory(void) {
+  mode_t oldumask = umask(000);
+  int result = mkpath(config.cover_art_cache_dir, 0777);
+  umask(oldumask);
+  if ((result != 0) && (result != -EEXIST)) {
+    debug(1, "Couldn't access or create the cover art cache directory \"%s\".",
+          config.cover_art_cache_dir);
+    return -1;
+  }
+  return 0;
+}
+
+// write it to a temporary file and rename it, so no one ever sees part of it
+static int artwork_write_file(artwork_job *job) {
+  int response = -1;
+  size_t tl = strlen(job->pathname) + 5;
+  char *temporary = malloc(tl);
+  if (temporary) {
+    snprintf(temporary, tl, "%s.tmp", job->pathname);
+    int cover_fd =
+        open(temporary, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRGRP | S_IROTH);
+    if ((cover_fd < 0) && (errno == ENOENT) && (artwork_make_directory() == 0))
+      cover_fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRGRP | S_IROTH);
+    if (cover_fd >= 0) {
+      size_t written = 0;
+      while (written < job->length) {
+        ssize_t ret = write(cover_fd, job->data + written, job->length - written);
+        if (ret > 0)
+          written += ret;
+        else if ((ret < 0) && (errno == EINTR))
+          continue;
+        else
+          break;
+      }
+      close(cover_fd);
+      if ((written == job->length) && (rename(temporary, job->pathname) == 0))
+        response = 0;
+      else
+        unlink(temporary);
+    }
+    if (response != 0)
+      warn("Writing cover art file \"%s\" failed!", job->pathname);
+    free(temporary);
+  }
+  return response;
+}
+
+static void *artwork_writer_thread_code(__attribute__((unused)) void *arg) {
+  pthread_mutex_lock(&cache_lock);
+  while (1) {
+    while ((first_job == NULL) && (cache_running))
+      pthread_cond_wait(&job_available, &cache_lock);
+    artwork_job *job = first_job;
+    if (job == NULL)
+      break; // stopped, and nothing left to do
+    first_job = job->next;
+    if (first_job == NULL)
+      last_job = NULL;
+    pthread_mutex_unlock(&cache_lock);
+
+    int ready = 0;
+    switch (job->type) {
+    case AJ_write:
+      if (artwork_write_file(job) == 0) {
+        pthread_mutex_lock(&cache_lock);
+        artwork_entry *e = artwork_find(job->md5);
+        if (e) {
+          e->on_disk = 1;
+          ready = 1;
+        }
+        pthread_mutex_unlock(&cache_lock);
+      } else {
+        // forget it, so that it's tried again next time
+        pthread_mutex_lock(&cache_lock);
+        artwork_entry *e = artwork_find(job->md5);
+        if ((e) && (e->on_disk == 0)) {
+          artwork_remove(e);
+          artwork_entry_free(e);
+        }
+        pthread_mutex_unlock(&cache_lock);
+      }
+      break;
+    case AJ_touch:
+      if (utimensat(AT_FDCWD, job->pathname, NULL, 0) != 0)
+        debug(2, "Error %d touching cover art file \"%s\".", errno, job->pathname);
+      break;
+    case AJ_delete:
+      if ((unlink(job->pathname) != 0) && (errno != ENOENT))
+        debug(1, "Error %d deleting cover art file \"%s\".", errno, job->pathname);
+      break;
+    }
+    if ((ready) && (ready_callback))
+      ready_callback(job->pathname);
+    artwork_job_free(job);
+    pthread_mutex_lock(&cache_lock);
+  }
+  pthread_mutex_unlock(&cache_lock);
+  pthread_exit(NULL);
+}
+
+typedef struct {
+  char *name;
+  uint8_t md5[16];
+  size_t size;
+  time_t time;
+} artwork_file;
+
+static int artwork_file_compare(const void *a, const void *b) {
+  const artwork_file *fa = a, *fb = b;
+  return (fa->time > fb->time) - (fa->time < fb->time);
+}
+
+// pick up the artwork already in the directory, oldest first
+static void artwork_scan_directory(void) {
+  DIR *d = opendir(config.cover_art_cache_dir);
+  if (d == NULL)
+    return;
+  artwork_file *files = NULL;
+  size_t file_count = 0, files_size = 0;
+  struct dirent *dir;
+  int dir_fd = dirfd(d);
+  while ((dir = readdir(d)) != NULL) {
+    const char *name = dir->d_name;
+    size_t nl = strlen(name);
+    if (strncmp(name, prefix, strlen(prefix)) != 0)
+      continue;
+    if ((nl > 4) && (strcmp(name + nl - 4, ".tmp") == 0)) {
+      unlinkat(dir_fd, name, 0); // left over from a write that didn't finish
+      continue;
+    }
+    uint8_t md5[16];
+    if ((nl != strlen(prefix) + 32 + 4) ||
+        ((strcmp(name + nl - 4, ".jpg") != 0) && (strcmp(name + nl - 4, ".png") != 0)))
+      continue;
+    int i;
+    for (i = 0; i < 16; i++) {
+      unsigned int byte;
+      if (sscanf(name + strlen(prefix) + i * 2, "%2x", &byte) != 1)
+        break;
+      md5[i] = byte;
+    }
+    struct stat st;
+    if ((i != 16) || (fstatat(dir_fd, name, &st, 0) != 0) || (!S_ISREG(st.st_mode)))
+      continue;
+    if (file_count == files_size) {
+      size_t new_size = files_size ? files_size * 2 : 32;
+      artwork_file *new_files = realloc(files, new_size * sizeof(artwork_file));
+      if (new_files == NULL)
+        break;
+      files = new_files;
+      files_size = new_size;
+    }
+    files[file_count].name = strdup(name);
+    memcpy(files[file_count].md5, md5, 16);
+    files[file_count].size = st.st_size;
+    files[file_count].time = st.st_mtime;
+    file_count++;
+  }
+  closedir(d);
+  if (file_count)
+    qsort(files, file_count, sizeof(artwork_file), artwork_file_compare);
+  size_t i;
+  for (i = 0; i < file_count; i++) {
+    artwork_entry *e = calloc(1, sizeof(artwork_entry));
+    size_t pl = strlen(config.cover_art_cache_dir) + 1 + strlen(files[i].name) + 1;
+    if ((e) && (files[i].name) && ((e->pathname = malloc(pl)) != NULL)) {
+      snprintf(e->pathname, pl, "%s/%s", config.cover_art_cache_dir, files[i].name);
+      memcpy(e->md5, files[i].md5, 16);
+      e->size = files[i].size;
+      e->on_disk = 1;
+      if (artwork_find(e->md5) == NULL) // a jpg and a png of the same thing can't both be right
+        artwork_add(e);
+      else
+        artwork_entry_free(e);
+    } else {
+      free(e);
+    }
+    free(files[i].name);
+  }
+  free(files);
+  artwork_evict(1);
+  debug(2, "Cover art cache: %zu bytes of artwork found in \"%s\".", cache_size,
+        config.cover_art_cache_dir);
+}
+
+void artwork_cache_init(artwork_cache_ready_callback ready) {
+  if (strcmp(config.cover_art_cache_dir, "") == 0) // an empty string means do not write files
+    return;
+  ready_callback = ready;
+  cache_limit = config.retain_coverart ? SIZE_MAX : config.cover_art_cache_size;
+  if (artwork_make_directory() == 0)
+    artwork_scan_directory();
+  cache_running = 1;
+  if (pthread_create(&writer_thread, NULL, artwork_writer_thread_code, NULL) != 0) {
+    debug(1, "Could not create the cover art cache writer thread.");
+    cache_running = 0;
+  }
+}
+
+void artwork_cache_stop(void) {
+  pthread_mutex_lock(&cache_lock);
+  int was_running = cache_running;
+  cache_running = 0;
+  pthread_cond_signal(&job_available);
+  pthread_mutex_unlock(&cache_lock);
+  if (was_running)
+    pthread_join(writer_thread, NULL); // it finishes the jobs it has first
+  unsigned int i;
+  for (i = 0; i < ARTWORK_HASH_BUCKETS; i++) {
+    while (index_table[i]) {
+      artwork_entry *e = index_table[i];
+      artwork_remove(e);
+      artwork_entry_free(e);
+    }
+  }
+}
+
+char *artwork_cache_store(const char *buf, size_t len, int *ready) {
+  *ready = 0;
+  uint8_t img_md5[16];
+  artwork_md5(buf, len, img_md5);
+  char *path = NULL;
+  pthread_mutex_lock(&cache_lock);
+  if (cache_running) {
+    artwork_entry *e = artwork_find(img_md5);
+    if (e) {
+      if (e != newest) {
+        artwork_unlink_from_lru(e);
+        artwork_make_newest(e);
+        if (e->on_disk)
+          artwork_queue_job(AJ_touch, e->pathname, e->md5, NULL, 0);
+      }
+      *ready = e->on_disk;
+      path = strdup(e->pathname);
+    } else {
+      char img_md5_str[33];
+      int i;
+      for (i = 0; i < 16; i++)
+        snprintf(&img_md5_str[i * 2], 3, "%02x", (uint8_t)img_md5[i]);
+      // see if the file is a jpeg or a png
+      const char *ext;
+      if (strncmp(buf, "\xFF\xD8\xFF", 3) == 0)
+        ext = "jpg";
+      else if (strncmp(buf, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 8) == 0)
+        ext = "png";
+      else {
+        debug(1, "Unidentified image type of cover art -- jpg extension used.");
+        ext = "jpg";
+      }
+      size_t pl = strlen(config.cover_art_cache_dir) + 1 + strlen(prefix) + 32 + 1 + strlen(ext);
+      e = calloc(1, sizeof(artwork_entry));
+      char *data = malloc(len);
+      if (e)
+        e->pathname = malloc(pl + 1);
+      if ((e) && (e->pathname) && (data)) {
+        snprintf(e->pathname, pl + 1, "%s/%s%s.%s", config.cover_art_cache_dir, prefix,
+                 img_md5_str, ext);
+        memcpy(e->md5, img_md5, 16);
+        e->size = len;
+        artwork_add(e);
+        memcpy(data, buf, len);
+        artwork_queue_job(AJ_write, e->pathname, e->md5, data, len);
+        artwork_evict(0);
+        path = strdup(e->pathname);
+      } else {
+        debug(1, "Can't allocate memory to cache cover art.");
+        if (e)
+          artwork_entry_free(e);
+        free(data);
+      }
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return path;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+// Cover art is kept in config.cover_art_cache_dir in files named for the MD5 of their contents,
+// so the same artwork is only ever written once. The files are kept across restarts, and the
+// least recently used are deleted to keep the cache within config.cover_art_cache_size. Files are
+// written on a thread of the cache's own.
+
+// called, on the cache's thread, with the pathname of artwork once it has been written
+typedef void (*artwork_cache_ready_callback)(const char *pathname);
+
+void artwork_cache_init(artwork_cache_ready_callback ready);
+void artwork_cache_stop(void);
+
+// Returns the pathname, allocated with malloc, of the file for the image, or NULL if it can't
+// be cached. *ready is set if the file is already there; otherwise the callback will be called
+// when it is.
+char *artwork_cache_store(const char *buf, size_t len, int *ready);
@@ -58,6 +58,18 @@ extern audio_output audio_pipe;
 #ifdef CONFIG_STDOUT
 extern audio_output audio_stdout;
 #endif
+#ifdef CONFIG_SHM
+extern audio_output audio_shm;
+#endif
+#ifdef CONFIG_FILE
+extern audio_output audio_file;
+#endif
+#ifdef CONFIG_FANOUT
+extern audio_output audio_fanout;
+#endif
+#ifdef CONFIG_MIXER
+extern audio_output audio_mixer;
+#endif
 
 static audio_output *outputs[] = {
 #ifdef CONFIG_ALSA
@@ -84,8 +96,20 @@ static audio_output *outputs[] = {
 #ifdef CONFIG_STDOUT
     &audio_stdout,
 #endif
+#ifdef CONFIG_SHM
+    &audio_shm,
+#endif
+#ifdef CONFIG_FILE
+    &audio_file,
+#endif
 #ifdef CONFIG_DUMMY
     &audio_dummy,
+#endif
+#ifdef CONFIG_FANOUT
+    &audio_fanout,
+#endif
+#ifdef CONFIG_MIXER
+    &audio_mixer,
 #endif
     NULL};
 
@@ -121,6 +145,44 @@ void audio_ls_outputs(void) {
   }
 }
 
+void audio_nominal_clock_start(audio_nominal_clock *nc, int rate) {
+  nc->rate = rate;
+  audio_nominal_clock_reset(nc);
+}
+
+void audio_nominal_clock_reset(audio_nominal_clock *nc) {
+  nc->time_of_first_frame = 0;
+  nc->frames_sent = 0;
+}
+
+static uint64_t audio_nominal_clock_frames_played(audio_nominal_clock *nc, uint64_t time_now) {
+  uint64_t elapsed_time = time_now - nc->time_of_first_frame;
+  // split into seconds and the remainder so the multiplication can't overflow
+  return (elapsed_time / 1000000000) * nc->rate +
+         ((elapsed_time % 1000000000) * nc->rate) / 1000000000;
+}
+
+void audio_nominal_clock_frames_sent(audio_nominal_clock *nc, int frames) {
+  uint64_t time_now = get_absolute_time_in_ns();
+  // if the model has run dry, the device has been idle, so start again from now
+  if ((nc->time_of_first_frame == 0) ||
+      (audio_nominal_clock_frames_played(nc, time_now) >= nc->frames_sent)) {
+    nc->time_of_first_frame = time_now;
+    nc->frames_sent = 0;
+  }
+  nc->frames_sent += frames;
+}
+
+long audio_nominal_clock_delay(audio_nominal_clock *nc) {
+  long response = 0;
+  if (nc->time_of_first_frame != 0) {
+    uint64_t frames_played = audio_nominal_clock_frames_played(nc, get_absolute_time_in_ns());
+    if (frames_played < nc->frames_sent)
+      response = nc->frames_sent - frames_played;
+  }
+  return response;
+}
+
 void parse_general_audio_options(void) {
   /* this must be called after the output device has been initialised, so that the default values
    * are set before any options are chosen */
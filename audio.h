@@ -42,6 +42,12 @@ typedef struct {
   int (*rate_info)(uint64_t *elapsed_time,
                    uint64_t *frames_played); // use this to get the true rate of the DAC
 
+  // may be NULL. If implemented, it is called just before a block of audio is passed to play()
+  // with the local time, in nanoseconds, at which the first frame of the block should be heard.
+  // Blocks of silence aren't given a presentation time of their own. They follow on from the
+  // audio before them, so a backend may carry the time forward by the frames it has been sent.
+  void (*presentation_time)(uint64_t local_time);
+
   // may be NULL, in which case soft volume is applied
   void (*volume)(double vol);
 
@@ -54,6 +60,20 @@ typedef struct {
 
 } audio_output;
 
+// For backends that can't ask their device how far behind it is, this models a device that
+// consumes frames at exactly the nominal rate, starting from when the first frame was sent.
+// If the model drains completely, it restarts from the next frame sent.
+typedef struct {
+  uint64_t time_of_first_frame; // in nanoseconds, zero if idle
+  uint64_t frames_sent;         // since time_of_first_frame
+  int rate;
+} audio_nominal_clock;
+
+void audio_nominal_clock_start(audio_nominal_clock *nc, int rate);
+void audio_nominal_clock_reset(audio_nominal_clock *nc);
+void audio_nominal_clock_frames_sent(audio_nominal_clock *nc, int frames);
+long audio_nominal_clock_delay(audio_nominal_clock *nc);
+
 audio_output *audio_get_output(char *name);
 void audio_ls_outputs(void);
 void parse_general_audio_options(void);
@@ -28,9 +28,11 @@
 #define ALSA_PCM_NEW_HW_PARAMS_API
 
 #include <alsa/asoundlib.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
 #include <memory.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -99,6 +101,22 @@ static pthread_mutex_t alsa_mixer_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 pthread_t alsa_buffer_monitor_thread;
 
+// when the output device is idle, the buffer monitor thread waits on the device's poll
+// descriptors for up to this long, then checks for state changes anyway
+#define ALSA_MONITOR_POLL_TIMEOUT_MS 250
+// when the output device is disconnected and needn't be kept busy, look this often
+#define ALSA_MONITOR_IDLE_INTERVAL_US 100000
+
+int keep_alive_avail_min_is_set = 0; // set while avail_min is raised for the silence threshold
+int set_keep_alive_avail_min(void);
+void restore_standard_avail_min(void);
+
+// The buffer monitor thread polls the device's descriptors without holding the alsa_mutex, so
+// do_close() counts each closure and writes to this pipe, which is polled too, to wake it. Poll
+// results are only used if the device hasn't been closed in the meantime.
+int alsa_monitor_wake_pipe[2] = {-1, -1};
+unsigned int alsa_device_closures = 0; // under the control of alsa_mutex
+
 // for deciding when to activate mute
 // there are two sources of requests to mute -- the backend itself, e.g. when it
 // is flushing
@@ -256,6 +274,20 @@ static uint64_t frames_sent_for_playing;
 static uint64_t frame_index;
 static int measurement_data_is_valid;
 
+// The delay model. Rather than querying the device for every delay request, the delay is
+// measured occasionally and used as an anchor. In between, the delay is predicted from the
+// anchor, the number of frames written since and the number of frames the DAC should have played
+// since, at its measured rate if that's known, or at its nominal rate otherwise.
+
+// make a real measurement after this many predictions
+#define DELAY_MODEL_MAXIMUM_PREDICTIONS 16
+
+static int delay_model_is_valid; // under the control of alsa_mutex, as are the following
+static uint64_t delay_model_anchor_time;                  // in nanoseconds
+static snd_pcm_sframes_t delay_model_anchor_delay;        // the delay measured at the anchor time
+static uint64_t delay_model_frames_written_since_anchor; // frames written since the anchor time
+static int delay_model_predictions_since_anchor;
+
 static void help(void) {
   printf("    -d output-device    set the output device, default is \"default\".\n"
          "    -c mixer-control    set the mixer control name, default is to use no mixer.\n"
@@ -373,7 +405,8 @@ format_record fr[] = {
     {SND_PCM_FORMAT_S16_LE, 4},  {SND_PCM_FORMAT_S16_BE, 4},  {SND_PCM_FORMAT_S24, 8},
     {SND_PCM_FORMAT_S24_LE, 8},  {SND_PCM_FORMAT_S24_BE, 8},  {SND_PCM_FORMAT_S24_3LE, 6},
     {SND_PCM_FORMAT_S24_3BE, 6}, {SND_PCM_FORMAT_S32, 8},     {SND_PCM_FORMAT_S32_LE, 8},
-    {SND_PCM_FORMAT_S32_BE, 8},  {SND_PCM_FORMAT_UNKNOWN, 0}, // auto
+    {SND_PCM_FORMAT_S32_BE, 8},  {SND_PCM_FORMAT_FLOAT, 8},
+    {SND_PCM_FORMAT_UNKNOWN, 0}, // auto
     {SND_PCM_FORMAT_UNKNOWN, 0},                              // illegal
 };
 
@@ -1349,6 +1382,15 @@ static int init(int argc, char **argv) {
   // length of the queue
   // if the queue gets too short, stuff it with silence
 
+  if (pipe(alsa_monitor_wake_pipe) == 0) {
+    fcntl(alsa_monitor_wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(alsa_monitor_wake_pipe[1], F_SETFL, O_NONBLOCK);
+  } else {
+    debug(1, "alsa: can't create the buffer monitor thread's wake pipe.");
+    alsa_monitor_wake_pipe[0] = -1;
+    alsa_monitor_wake_pipe[1] = -1;
+  }
+
   pthread_create(&alsa_buffer_monitor_thread, NULL, &alsa_buffer_monitor_thread_code, NULL);
 
   return response;
@@ -1363,6 +1405,12 @@ static void deinit(void) {
   pthread_cancel(alsa_buffer_monitor_thread);
   debug(3, "Join buffer monitor thread.");
   pthread_join(alsa_buffer_monitor_thread, NULL);
+  if (alsa_monitor_wake_pipe[0] >= 0) {
+    close(alsa_monitor_wake_pipe[0]);
+    close(alsa_monitor_wake_pipe[1]);
+    alsa_monitor_wake_pipe[0] = -1;
+    alsa_monitor_wake_pipe[1] = -1;
+  }
   pthread_setcancelstate(oldState, NULL);
 }
 
@@ -1409,6 +1457,7 @@ static void start(__attribute__((unused)) int i_sample_rate,
 
   frame_index = 0;
   measurement_data_is_valid = 0;
+  delay_model_is_valid = 0;
 
   stall_monitor_start_time = 0;
   stall_monitor_frame_count = 0;
@@ -1570,6 +1619,44 @@ int precision_delay_and_status(snd_pcm_state_t *state, snd_pcm_sframes_t *delay,
   return ret;
 }
 
+int modelled_delay_and_status(snd_pcm_state_t *state, snd_pcm_sframes_t *delay,
+                              int measurement_required) {
+  // assuming the alsa_mutex has been acquired
+  // returns a predicted delay if the model is valid, otherwise measures it and re-anchors the
+  // model
+  if ((measurement_required == 0) && (delay_model_is_valid != 0) &&
+      (delay_model_predictions_since_anchor < DELAY_MODEL_MAXIMUM_PREDICTIONS)) {
+    uint64_t time_now = get_absolute_time_in_ns();
+    uint64_t elapsed_time, frames_played;
+    double frames_per_ns = config.output_rate * 0.000000001;
+    if ((get_rate_information(&elapsed_time, &frames_played) == 0) && (elapsed_time != 0))
+      frames_per_ns = (1.0 * frames_played) / elapsed_time;
+    snd_pcm_sframes_t frames_played_since_anchor =
+        (snd_pcm_sframes_t)((time_now - delay_model_anchor_time) * frames_per_ns);
+    snd_pcm_sframes_t predicted_delay = delay_model_anchor_delay +
+                                        delay_model_frames_written_since_anchor -
+                                        frames_played_since_anchor;
+    // if the buffer seems to be close to running dry, look at the device itself
+    if (predicted_delay > (snd_pcm_sframes_t)(config.output_rate / 100)) {
+      delay_model_predictions_since_anchor++;
+      *state = SND_PCM_STATE_RUNNING;
+      *delay = predicted_delay;
+      return 0;
+    }
+  }
+  int ret = delay_and_status(state, delay, NULL);
+  if ((ret == 0) && (*state == SND_PCM_STATE_RUNNING)) {
+    delay_model_anchor_time = get_absolute_time_in_ns();
+    delay_model_anchor_delay = *delay;
+    delay_model_frames_written_since_anchor = 0;
+    delay_model_predictions_since_anchor = 0;
+    delay_model_is_valid = 1;
+  } else {
+    delay_model_is_valid = 0;
+  }
+  return ret;
+}
+
 int delay(long *the_delay) {
   // returns 0 if the device is in a valid state -- SND_PCM_STATE_RUNNING or
   // SND_PCM_STATE_PREPARED
@@ -1593,7 +1680,7 @@ int delay(long *the_delay) {
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
     pthread_cleanup_debug_mutex_lock(&alsa_mutex, 10000, 0);
 
-    ret = delay_and_status(&state, &my_delay, NULL);
+    ret = modelled_delay_and_status(&state, &my_delay, 0);
 
     debug_mutex_unlock(&alsa_mutex, 0);
     pthread_cleanup_pop(0);
@@ -1624,9 +1711,18 @@ int do_play(void *buf, int samples) {
   int oldState;
   pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
 
+  const uint64_t start_measurement_from_this_frame =
+      (2 * config.output_rate) / 352; // two seconds of frames
+
+  // the rate measurements must come from the device itself, not from the delay model
+  int measurement_required = 0;
+  if ((frame_index + 1 == start_measurement_from_this_frame) ||
+      ((frame_index + 1 > start_measurement_from_this_frame) && ((frame_index + 1) % 32 == 0)))
+    measurement_required = 1;
+
   snd_pcm_state_t state;
   snd_pcm_sframes_t my_delay;
-  int ret = delay_and_status(&state, &my_delay, NULL);
+  int ret = modelled_delay_and_status(&state, &my_delay, measurement_required);
 
   if (ret == 0) { // will be non-zero if an error or a stall
 
@@ -1643,6 +1739,7 @@ int do_play(void *buf, int samples) {
       ret = alsa_pcm_write(alsa_handle, buf, samples);
       if (ret == samples) {
         stall_monitor_frame_count += samples;
+        delay_model_frames_written_since_anchor += samples;
 
         if (frame_index == 0) {
           frames_sent_for_playing = samples;
@@ -1650,9 +1747,6 @@ int do_play(void *buf, int samples) {
           frames_sent_for_playing += samples;
         }
 
-        const uint64_t start_measurement_from_this_frame =
-            (2 * config.output_rate) / 352; // two seconds of frames
-
         frame_index++;
 
         if ((frame_index == start_measurement_from_this_frame) ||
@@ -1671,6 +1765,7 @@ int do_play(void *buf, int samples) {
       } else {
         frame_index = 0;
         measurement_data_is_valid = 0;
+        delay_model_is_valid = 0;
         if (ret == -EPIPE) { /* underrun */
           debug(1, "alsa: underrun while writing %d samples to alsa device.", samples);
           int tret = snd_pcm_recover(alsa_handle, ret, 1);
@@ -1718,6 +1813,8 @@ int do_open(int do_auto_setup) {
   if (alsa_handle == NULL) {
     // debug(1,"alsa: do_open() -- opening the output device");
     ret = open_alsa_device(do_auto_setup);
+    keep_alive_avail_min_is_set = 0; // a newly-opened device has the standard avail_min
+    delay_model_is_valid = 0;
     if (ret == 0) {
       mute_requested_internally = 0;
       if (audio_alsa.volume)
@@ -1755,9 +1852,16 @@ int do_close() {
     if ((derr = snd_pcm_close(alsa_handle)))
       debug(1, "Error %d (\"%s\") closing the output device.", derr, snd_strerror(derr));
     alsa_handle = NULL;
+    alsa_device_closures++;
+    if (alsa_monitor_wake_pipe[1] >= 0) {
+      char c = 0;
+      if (write(alsa_monitor_wake_pipe[1], &c, 1) != 1)
+        debug(3, "alsa: the buffer monitor thread's wake pipe is full.");
+    }
   } else {
     debug(1, "alsa: do_close() -- output device already closed.");
   }
+  delay_model_is_valid = 0;
   alsa_backend_state = abm_disconnected;
   return derr;
 }
@@ -1784,6 +1888,7 @@ int play(void *buf, int samples) {
     if (alsa_backend_state != abm_playing) {
       debug(2, "alsa: play() -- alsa_backend_state => abm_playing");
       alsa_backend_state = abm_playing;
+      restore_standard_avail_min(); // the buffer monitor may have raised it while idle
 
       // mute_requested_internally = 0; // stop requesting a mute for backend's own
       // reasons, which might have been a flush
@@ -1932,11 +2037,114 @@ void alsa_buffer_monitor_thread_cleanup_function(__attribute__((unused)) void
 }
 */
 
+// The keep-alive silence is taken from a bank of pre-dithered blocks, built once for the current
+// output format and dither setting, rather than being allocated and dithered for every write.
+
+#define SILENCE_BANK_BLOCK_FRAMES 1024
+#define SILENCE_BANK_BLOCKS 8
+
+static char *silence_bank = NULL;
+static sps_format_t silence_bank_format = SPS_FORMAT_UNKNOWN;
+static int silence_bank_frame_size = 0;
+static int silence_bank_uses_dither = -1;
+static int silence_bank_next_block = 0;
+
+// returns a pointer to the next block of silence, or NULL if the bank can't be made
+static char *next_silence_block(int use_dither) {
+  if ((silence_bank == NULL) || (silence_bank_format != config.output_format) ||
+      (silence_bank_frame_size != frame_size) || (silence_bank_uses_dither != use_dither)) {
+    free(silence_bank);
+    silence_bank = malloc(SILENCE_BANK_BLOCKS * SILENCE_BANK_BLOCK_FRAMES * frame_size);
+    if (silence_bank == NULL)
+      return NULL;
+    silence_bank_format = config.output_format;
+    silence_bank_frame_size = frame_size;
+    silence_bank_uses_dither = use_dither;
+    silence_bank_next_block = 0;
+    int i;
+    for (i = 0; i < SILENCE_BANK_BLOCKS; i++)
+      dither_random_number_store = generate_zero_frames(
+          silence_bank + i * SILENCE_BANK_BLOCK_FRAMES * frame_size, SILENCE_BANK_BLOCK_FRAMES,
+          config.output_format, use_dither, dither_random_number_store);
+    debug(2, "alsa: silence bank of %d blocks of %d frames prepared, %s dither.",
+          SILENCE_BANK_BLOCKS, SILENCE_BANK_BLOCK_FRAMES, use_dither ? "with" : "without");
+  }
+  char *block = silence_bank + silence_bank_next_block * SILENCE_BANK_BLOCK_FRAMES * frame_size;
+  silence_bank_next_block = (silence_bank_next_block + 1) % SILENCE_BANK_BLOCKS;
+  return block;
+}
+
+// While the DAC is being kept busy but nothing is playing, the avail_min software parameter is
+// raised so that the device's poll descriptors only become ready when the amount of audio left
+// in the buffer falls to the silence threshold. While playing, it's restored to the period size,
+// which is the ALSA default.
+// The device only signals at period boundaries, so the threshold is never less than a period --
+// otherwise the buffer could run dry before the device said it was low.
+
+static long silence_threshold_frames(void) {
+  // assuming the alsa_mutex has been acquired
+  long threshold = (long)(config.disable_standby_mode_silence_threshold * config.output_rate);
+  snd_pcm_uframes_t buffer_size, period_size;
+  if ((alsa_handle != NULL) &&
+      (snd_pcm_get_params(alsa_handle, &buffer_size, &period_size) == 0) &&
+      (threshold < (long)period_size))
+    threshold = period_size;
+  return threshold;
+}
+
+static int set_avail_min(snd_pcm_uframes_t frames) {
+  // assuming the alsa_mutex has been acquired
+  snd_pcm_sw_params_t *swparams;
+  snd_pcm_sw_params_alloca(&swparams);
+  int ret = snd_pcm_sw_params_current(alsa_handle, swparams);
+  if (ret == 0)
+    ret = snd_pcm_sw_params_set_avail_min(alsa_handle, swparams, frames);
+  if (ret == 0)
+    ret = snd_pcm_sw_params(alsa_handle, swparams);
+  if (ret != 0)
+    debug(1, "alsa: error %d (\"%s\") setting avail_min to %lu frames.", ret, snd_strerror(ret),
+          frames);
+  return ret;
+}
+
+int set_keep_alive_avail_min(void) {
+  // assuming the alsa_mutex has been acquired
+  // returns 0 if the device will signal when the silence threshold is reached
+  int ret = -1;
+  if (keep_alive_avail_min_is_set != 0) {
+    ret = 0;
+  } else if (alsa_handle != NULL) {
+    snd_pcm_uframes_t buffer_size, period_size;
+    snd_pcm_uframes_t threshold = silence_threshold_frames();
+    if ((snd_pcm_get_params(alsa_handle, &buffer_size, &period_size) == 0) &&
+        (threshold < buffer_size) && (set_avail_min(buffer_size - threshold) == 0)) {
+      keep_alive_avail_min_is_set = 1;
+      ret = 0;
+    }
+  }
+  return ret;
+}
+
+void restore_standard_avail_min(void) {
+  // assuming the alsa_mutex has been acquired
+  if ((keep_alive_avail_min_is_set != 0) && (alsa_handle != NULL)) {
+    snd_pcm_uframes_t buffer_size, period_size;
+    if (snd_pcm_get_params(alsa_handle, &buffer_size, &period_size) == 0)
+      set_avail_min(period_size);
+  }
+  keep_alive_avail_min_is_set = 0;
+}
+
+#define MAXIMUM_ALSA_POLL_DESCRIPTORS 8
+
 void *alsa_buffer_monitor_thread_code(__attribute__((unused)) void *arg) {
   int frame_count = 0;
   int error_count = 0;
   int error_detected = 0;
   int okb = -1;
+  // the device's descriptors, then the wake pipe's
+  struct pollfd poll_descriptors[MAXIMUM_ALSA_POLL_DESCRIPTORS + 1];
+  int device_ready = 1; // cleared if the device woke the thread but doesn't need more audio
   while (error_detected ==
          0) { // if too many play errors occur early on, we will turn off the disable stanby mode
     if (okb != config.keep_dac_busy) {
@@ -1950,6 +2158,8 @@ void *alsa_buffer_monitor_thread_code(__attribute__((unused)) void *arg) {
       alsa_device_initialised = 1;
     }
     int sleep_time_us = (int)(config.disable_standby_mode_silence_scan_interval * 1000000);
+    int poll_descriptor_count = 0; // if non-zero, wait on the device rather than sleeping
+    unsigned int closures;
     pthread_cleanup_debug_mutex_lock(&alsa_mutex, 200000, 0);
     // check possible state transitions here
     if ((alsa_backend_state == abm_disconnected) && (config.keep_dac_busy != 0)) {
@@ -1985,52 +2195,92 @@ void *alsa_buffer_monitor_thread_code(__attribute__((unused)) void *arg) {
         debug(1, "alsa: alsa_buffer_monitor_thread_code delay error %d: \"%s\".", reply,
               (char *)errorstring);
       }
-      long buffer_size_threshold =
-          (long)(config.disable_standby_mode_silence_threshold * config.output_rate);
-      size_t size_of_silence_buffer;
-      if (buffer_size < buffer_size_threshold) {
-        int frames_of_silence = 1024;
-        size_of_silence_buffer = frames_of_silence * frame_size;
-        void *silence = malloc(size_of_silence_buffer);
-        if (silence == NULL) {
-          warn("disable_standby_mode has been turned off because a memory allocation error "
-               "occurred.");
-          error_detected = 1;
-        } else {
-          int ret;
-          pthread_cleanup_push(malloc_cleanup, silence);
-          int use_dither = 0;
-          if ((alsa_mix_ctrl == NULL) && (config.ignore_volume_control == 0) &&
-              (config.airplay_volume != 0.0))
-            use_dither = 1;
-          dither_random_number_store =
-              generate_zero_frames(silence, frames_of_silence, config.output_format,
-                                   use_dither, // i.e. with dither
-                                   dither_random_number_store);
-          ret = do_play(silence, frames_of_silence);
-          frame_count++;
-          pthread_cleanup_pop(1); // free malloced buffer
-          if (ret < 0) {
-            error_count++;
-            char errorstring[1024];
-            strerror_r(-ret, (char *)errorstring, sizeof(errorstring));
-            debug(2,
-                  "alsa: alsa_buffer_monitor_thread_code error %d (\"%s\") writing %d samples "
-                  "to alsa device -- %d errors in %d trials.",
-                  ret, (char *)errorstring, frames_of_silence, error_count, frame_count);
-            if ((error_count > 40) && (frame_count < 100)) {
-              warn("disable_standby_mode has been turned off because too many underruns "
-                   "occurred. Is Shairport Sync outputting to a virtual device or running in a "
-                   "virtual machine?");
-              error_detected = 1;
+      long buffer_size_threshold = silence_threshold_frames();
+      if ((device_ready != 0) && (buffer_size < buffer_size_threshold)) {
+        int use_dither = 0;
+        if ((alsa_mix_ctrl == NULL) && (config.ignore_volume_control == 0) &&
+            (config.airplay_volume != 0.0))
+          use_dither = 1;
+        // top the buffer up past the threshold in one go
+        int blocks_of_silence =
+            (buffer_size_threshold - buffer_size) / SILENCE_BANK_BLOCK_FRAMES + 1;
+        if (blocks_of_silence > SILENCE_BANK_BLOCKS)
+          blocks_of_silence = SILENCE_BANK_BLOCKS;
+        while ((blocks_of_silence > 0) && (error_detected == 0)) {
+          char *silence = next_silence_block(use_dither);
+          if (silence == NULL) {
+            warn("disable_standby_mode has been turned off because a memory allocation error "
+                 "occurred.");
+            error_detected = 1;
+          } else {
+            int ret = do_play(silence, SILENCE_BANK_BLOCK_FRAMES);
+            frame_count++;
+            blocks_of_silence--;
+            if (ret < 0) {
+              blocks_of_silence = 0;
+              error_count++;
+              char errorstring[1024];
+              strerror_r(-ret, (char *)errorstring, sizeof(errorstring));
+              debug(2,
+                    "alsa: alsa_buffer_monitor_thread_code error %d (\"%s\") writing %d samples "
+                    "to alsa device -- %d errors in %d trials.",
+                    ret, (char *)errorstring, SILENCE_BANK_BLOCK_FRAMES, error_count,
+                    frame_count);
+              if ((error_count > 40) && (frame_count < 100)) {
+                warn("disable_standby_mode has been turned off because too many underruns "
+                     "occurred. Is Shairport Sync outputting to a virtual device or running in a "
+                     "virtual machine?");
+                error_detected = 1;
+              }
             }
           }
         }
       }
+      // if nothing is playing, the device itself can wake us when the buffer runs low
+      if ((alsa_backend_state == abm_connected) && (error_detected == 0) &&
+          (set_keep_alive_avail_min() == 0)) {
+        int count = snd_pcm_poll_descriptors_count(alsa_handle);
+        if ((count > 0) && (count <= MAXIMUM_ALSA_POLL_DESCRIPTORS))
+          poll_descriptor_count =
+              snd_pcm_poll_descriptors(alsa_handle, poll_descriptors, count);
+      }
+    } else if ((alsa_backend_state == abm_disconnected) && (config.keep_dac_busy == 0)) {
+      // nothing to keep busy, so there's no need to look as often
+      sleep_time_us = ALSA_MONITOR_IDLE_INTERVAL_US;
     }
+    closures = alsa_device_closures;
     debug_mutex_unlock(&alsa_mutex, 0);
     pthread_cleanup_pop(0); // release the mutex
-    usleep(sleep_time_us);  // has a cancellation point in it
+    device_ready = 1;
+    // these have cancellation points in them
+    if (poll_descriptor_count > 0) {
+      int descriptors_polled = poll_descriptor_count;
+      if (alsa_monitor_wake_pipe[0] >= 0) {
+        poll_descriptors[descriptors_polled].fd = alsa_monitor_wake_pipe[0];
+        poll_descriptors[descriptors_polled].events = POLLIN;
+        poll_descriptors[descriptors_polled].revents = 0;
+        descriptors_polled++;
+      }
+      if (poll(poll_descriptors, descriptors_polled, ALSA_MONITOR_POLL_TIMEOUT_MS) > 0) {
+        char wake_buffer[16];
+        if (descriptors_polled > poll_descriptor_count)
+          while (read(alsa_monitor_wake_pipe[0], wake_buffer, sizeof(wake_buffer)) > 0)
+            ;
+        // The descriptors' own events aren't necessarily the device's -- for plugins like dmix
+        // they can be timer events that must be acknowledged -- so ALSA has to interpret them.
+        pthread_cleanup_debug_mutex_lock(&alsa_mutex, 200000, 0);
+        if ((closures == alsa_device_closures) && (alsa_handle != NULL)) {
+          unsigned short revents = 0;
+          if (snd_pcm_poll_descriptors_revents(alsa_handle, poll_descriptors,
+                                               poll_descriptor_count, &revents) == 0)
+            device_ready = ((revents & (POLLOUT | POLLERR)) != 0);
+        }
+        debug_mutex_unlock(&alsa_mutex, 0);
+        pthread_cleanup_pop(0); // release the mutex
+      }
+    } else {
+      usleep(sleep_time_us);
+    }
   }
   pthread_exit(NULL);
 }
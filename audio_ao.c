@@ -33,6 +33,10 @@
 
 ao_device *dev = NULL;
 
+// libao has no way to report latency, but ao_play() blocks when the device is full, so
+// assume the device takes frames at the nominal rate
+static audio_nominal_clock ao_clock;
+
 static void help(void) {
   printf("    -d driver           set the output driver\n"
          "    -o name=value       set an arbitrary ao option\n"
@@ -118,12 +122,22 @@ static void deinit(void) {
   ao_shutdown();
 }
 
-static void start(__attribute__((unused)) int sample_rate,
-                  __attribute__((unused)) int sample_format) {}
+static void start(int sample_rate, __attribute__((unused)) int sample_format) {
+  audio_nominal_clock_start(&ao_clock, sample_rate);
+}
 
-static int play(void *buf, int samples) { return ao_play(dev, buf, samples * 4); }
+static int play(void *buf, int samples) {
+  int response = ao_play(dev, buf, samples * 4);
+  audio_nominal_clock_frames_sent(&ao_clock, samples);
+  return response;
+}
+
+static int delay(long *the_delay) {
+  *the_delay = audio_nominal_clock_delay(&ao_clock);
+  return 0;
+}
 
-static void stop(void) {}
+static void stop(void) { audio_nominal_clock_reset(&ao_clock); }
 
 audio_output audio_ao = {.name = "ao",
                          .help = &help,
@@ -134,7 +148,7 @@ audio_output audio_ao = {.name = "ao",
                          .stop = &stop,
                          .is_running = NULL,
                          .flush = NULL,
-                         .delay = NULL,
+                         .delay = &delay,
                          .play = &play,
                          .volume = NULL,
                          .parameters = NULL,
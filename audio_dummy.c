@@ -30,23 +30,146 @@
 
 #include "audio.h"
 #include "common.h"
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
 #include <unistd.h>
 
-static int init(__attribute__((unused)) int argc, __attribute__((unused)) char **argv) { return 0; }
+// The dummy backend simulates a DAC, so that the synchronisation logic can be exercised and
+// measured without any hardware. By default the simulated DAC is perfect -- it plays frames at
+// exactly the nominal rate with no latency -- but a rate error, a fixed latency and jitter in
+// the reported delay can all be set in the "dummy" stanza. The sync simulator, sync-simulator.c,
+// plays whole sessions into it on the simulated clock.
+
+static double dummy_rate_error_ppm = 0.0;
+static double dummy_latency = 0.0; // seconds
+static double dummy_jitter = 0.0;  // seconds, peak
+
+static int dummy_sample_rate;
+static double dac_rate;                  // frames per second actually consumed
+static uint64_t dac_time_of_first_frame; // zero if the DAC is idle
+static uint64_t dac_frames_sent;         // since dac_time_of_first_frame
+
+// statistics for the session, reported at stop
+static uint64_t dac_frames_played_total;
+static int dac_underruns;
+static uint64_t delay_reports;
+static double occupancy_total;
+static long occupancy_minimum, occupancy_maximum;
+
+static uint64_t dac_frames_played(uint64_t time_now) {
+  return (uint64_t)(((time_now - dac_time_of_first_frame) * 1.0E-9) * dac_rate);
+}
+
+static void dac_reset(void) {
+  dac_time_of_first_frame = 0;
+  dac_frames_sent = 0;
+}
+
+static void reset_statistics(void) {
+  dac_frames_played_total = 0;
+  dac_underruns = 0;
+  delay_reports = 0;
+  occupancy_total = 0.0;
+  occupancy_minimum = 0;
+  occupancy_maximum = 0;
+}
+
+static int init(__attribute__((unused)) int argc, __attribute__((unused)) char **argv) {
+  double dvalue;
+  // do the "general" audio  options. Note, these options are in the "general" stanza!
+  parse_general_audio_options();
+
+  if (config.cfg != NULL) {
+    if (config_lookup_float(config.cfg, "dummy.rate_error_in_ppm", &dvalue))
+      dummy_rate_error_ppm = dvalue;
+    if (config_lookup_float(config.cfg, "dummy.latency_in_seconds", &dvalue)) {
+      if (dvalue < 0.0)
+        die("Invalid dummy latency_in_seconds \"%f\". It must not be negative.", dvalue);
+      dummy_latency = dvalue;
+    }
+    if (config_lookup_float(config.cfg, "dummy.jitter_in_seconds", &dvalue)) {
+      if (dvalue < 0.0)
+        die("Invalid dummy jitter_in_seconds \"%f\". It must not be negative.", dvalue);
+      dummy_jitter = dvalue;
+    }
+  }
+  if ((dummy_rate_error_ppm != 0.0) || (dummy_latency != 0.0) || (dummy_jitter != 0.0))
+    debug(1,
+          "dummy DAC simulation: rate error %.1f ppm, latency %.3f seconds, jitter +/- %.3f "
+          "seconds.",
+          dummy_rate_error_ppm, dummy_latency, dummy_jitter);
+  return 0;
+}
 
 static void deinit(void) {}
 
 static void start(int sample_rate, __attribute__((unused)) int sample_format) {
   debug(1, "dummy audio output started at %d frames per second.", sample_rate);
+  dummy_sample_rate = sample_rate;
+  dac_rate = sample_rate * (1.0 + dummy_rate_error_ppm * 1.0E-6);
+  dac_reset();
+  reset_statistics();
+}
+
+static int play(__attribute__((unused)) void *buf, int samples) {
+  uint64_t time_now = get_absolute_time_in_ns();
+  if (dac_time_of_first_frame != 0) {
+    uint64_t frames_played = dac_frames_played(time_now);
+    if (frames_played >= dac_frames_sent) {
+      // the DAC ran dry, so it has been idle and restarts from now
+      dac_underruns++;
+      dac_frames_played_total += dac_frames_sent;
+      dac_reset();
+    }
+  }
+  if (dac_time_of_first_frame == 0)
+    dac_time_of_first_frame = time_now;
+  dac_frames_sent += samples;
+  return 0;
 }
 
-static int play(__attribute__((unused)) void *buf, __attribute__((unused)) int samples) {
+static int delay(long *the_delay) {
+  long occupancy = 0;
+  if (dac_time_of_first_frame != 0) {
+    uint64_t frames_played = dac_frames_played(get_absolute_time_in_ns());
+    if (frames_played < dac_frames_sent)
+      occupancy = dac_frames_sent - frames_played;
+  }
+
+  if ((delay_reports == 0) || (occupancy < occupancy_minimum))
+    occupancy_minimum = occupancy;
+  if ((delay_reports == 0) || (occupancy > occupancy_maximum))
+    occupancy_maximum = occupancy;
+  occupancy_total += occupancy;
+  delay_reports++;
+
+  double reported_delay = occupancy + dummy_latency * dummy_sample_rate;
+  if (dummy_jitter != 0.0)
+    reported_delay += (2.0 * drand48() - 1.0) * dummy_jitter * dummy_sample_rate;
+  *the_delay = (long)reported_delay;
   return 0;
 }
 
-static void stop(void) { debug(1, "dummy audio stopped\n"); }
+static void flush(void) {
+  if (dac_time_of_first_frame != 0) {
+    uint64_t frames_played = dac_frames_played(get_absolute_time_in_ns());
+    dac_frames_played_total += frames_played < dac_frames_sent ? frames_played : dac_frames_sent;
+  }
+  dac_reset();
+}
+
+static void stop(void) {
+  flush();
+  if (delay_reports != 0)
+    debug(1,
+          "dummy DAC statistics: %" PRIu64 " frames played, %d underruns, buffer occupancy "
+          "minimum %ld, mean %.1f, maximum %ld frames over %" PRIu64 " delay reports.",
+          dac_frames_played_total, dac_underruns, occupancy_minimum,
+          occupancy_total / delay_reports, occupancy_maximum, delay_reports);
+  debug(1, "dummy audio stopped\n");
+}
 
 audio_output audio_dummy = {.name = "dummy",
                             .help = NULL,
@@ -56,8 +179,8 @@ audio_output audio_dummy = {.name = "dummy",
                             .start = &start,
                             .stop = &stop,
                             .is_running = NULL,
-                            .flush = NULL,
-                            .delay = NULL,
+                            .flush = &flush,
+                            .delay = &delay,
                             .play = &play,
                             .volume = NULL,
                             .parameters = NULL,
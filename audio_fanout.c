@@ -0,0 +1,584 @@
+/*
+ * Fan-out output driver. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The fan-out backend sends the same audio to several other backends, so that audio is decoded
+// and processed only once.
+// The first backend in the list is the primary. It is driven directly by the player, and its
+// delay, volume and mute functions are the ones the player sees, so it is the one that is kept
+// in sync.
+// Each of the others has a queue and a writer thread of its own, so that a slow one can't hold up
+// the primary or any of the rest. Blocks carry their presentation times with them, so backends
+// that use them stay in time. If a queue is full, the block is dropped for that backend only.
+// The others' clocks drift from the primary's, so each writer thread keeps its backend in sync
+// itself, if the backend has a delay function driven by a clock. It compares when each block
+// will be heard with its presentation time. How far apart they are to begin with depends on how
+// much each backend buffers, so that is noted over the first blocks; after that, the change from
+// it, smoothed over many blocks, is the drift. A frame is added to or dropped from each block
+// until the drift is back within the tolerance, or, if it is large, a whole block is dropped or
+// silence is played.
+// If the primary has a hardware mixer, the player leaves the volume to it, so the others would get
+// audio at full scale. Their audio is attenuated here instead, by the amount the primary's
+// hardware is set to, and silenced when the primary mutes.
+
+#include "audio.h"
+#include "common.h"
+#include "ring_buffer.h"
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FANOUT_MAXIMUM_OUTPUTS 8
+// beyond this, a secondary is brought back into sync in one go rather than a frame at a time
+#define FANOUT_RESYNC_THRESHOLD 0.05 // seconds
+// the number of blocks over which a secondary's starting offset is measured
+#define FANOUT_SYNC_SETTLING_BLOCKS 128
+// the drift is smoothed over roughly this many blocks
+#define FANOUT_SYNC_SMOOTHING_BLOCKS 32
+
+audio_output audio_fanout;
+
+// each block in a secondary's queue is one of these followed by the audio itself
+typedef struct {
+  uint64_t presentation_time; // zero if there isn't one
+  uint32_t frames;
+  uint32_t generation; // blocks from before the most recent flush or stop are discarded
+} fanout_block_header;
+
+typedef struct {
+  audio_output *output;
+  ring_buffer queue;
+  pthread_t writer_thread;
+  int writer_thread_running;
+  pthread_mutex_t queue_mutex;
+  pthread_cond_t queue_cv;       // signalled when a block arrives
+  pthread_mutex_t backend_mutex; // held whenever the backend itself is being called
+  volatile uint32_t generation;
+  uint8_t *audio; // the writer thread's copy of the current block, with room for a frame more
+  size_t audio_size;
+  // statistics
+  uint64_t blocks_played;
+  uint64_t blocks_dropped;
+  // sync, under the backend_mutex
+  int sync_blocks;          // the number of blocks measured so far while settling
+  int64_t sync_offset;      // the starting offset, in frames, once settled
+  double sync_drift;        // the smoothed drift from the starting offset, in frames
+  uint64_t frames_added;
+  uint64_t frames_removed;
+  uint64_t resyncs;
+  int64_t largest_sync_drift; // in frames, either way
+} fanout_secondary;
+
+static audio_output *primary = NULL;
+static fanout_secondary secondaries[FANOUT_MAXIMUM_OUTPUTS - 1];
+static int number_of_secondaries = 0;
+
+static double fanout_queue_length = 1.0; // seconds
+static int fanout_bytes_per_frame = 4;
+static uint64_t pending_presentation_time = 0;
+
+// the player thread assembles each block here before queueing it in one piece
+static uint8_t *staging = NULL;
+static size_t staging_size = 0;
+
+// the gain for the secondaries' audio, 65536 for unity, when the primary does the volume in
+// hardware
+static int32_t secondary_gain = 65536;
+static int secondary_muted = 0;
+static int32_t primary_maximum_volume_dB = 0; // in hundredths of a dB
+
+// attenuate the samples in place -- gain is 65536 for unity
+static void attenuate(uint8_t *p, size_t samples, sps_format_t format, int32_t gain) {
+  size_t i;
+  int width = 0, big_endian = 0;
+  switch (format) {
+  case SPS_FORMAT_S8:
+    for (i = 0; i < samples; i++)
+      p[i] = (uint8_t)(int8_t)(((int32_t)(int8_t)p[i] * gain) >> 16);
+    return;
+  case SPS_FORMAT_U8:
+    for (i = 0; i < samples; i++)
+      p[i] = (uint8_t)((((int32_t)p[i] - 128) * gain >> 16) + 128);
+    return;
+  case SPS_FORMAT_FLOAT: {
+    float *f = (float *)p;
+    float g = gain / 65536.0f;
+    for (i = 0; i < samples; i++)
+      f[i] *= g;
+  }
+    return;
+  case SPS_FORMAT_S16:
+    width = 2;
+    big_endian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+    break;
+  case SPS_FORMAT_S16_LE:
+    width = 2;
+    break;
+  case SPS_FORMAT_S16_BE:
+    width = 2;
+    big_endian = 1;
+    break;
+  case SPS_FORMAT_S24_3LE:
+    width = 3;
+    break;
+  case SPS_FORMAT_S24_3BE:
+    width = 3;
+    big_endian = 1;
+    break;
+  case SPS_FORMAT_S24: // the 24 bits are sign-extended into 32, so they can be treated as S32
+  case SPS_FORMAT_S32:
+    width = 4;
+    big_endian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+    break;
+  case SPS_FORMAT_S24_LE:
+  case SPS_FORMAT_S32_LE:
+    width = 4;
+    break;
+  case SPS_FORMAT_S24_BE:
+  case SPS_FORMAT_S32_BE:
+    width = 4;
+    big_endian = 1;
+    break;
+  default:
+    return;
+  }
+  int b;
+  for (i = 0; i < samples; i++, p += width) {
+    uint32_t u = 0;
+    for (b = 0; b < width; b++)
+      u |= (uint32_t)p[big_endian ? b : width - 1 - b] << (8 * (width - 1 - b));
+    int32_t v = (int32_t)(u << (8 * (4 - width))) >> (8 * (4 - width)); // sign-extend
+    u = (uint32_t)(int32_t)(((int64_t)v * gain) >> 16);
+    for (b = 0; b < width; b++)
+      p[big_endian ? b : width - 1 - b] = (uint8_t)(u >> (8 * (width - 1 - b)));
+  }
+}
+
+static void write_silence(uint8_t *p, size_t frames) {
+  memset(p, config.output_format == SPS_FORMAT_U8 ? 0x80 : 0, frames * fanout_bytes_per_frame);
+}
+
+// Work out how far the secondary has drifted, and correct the block if it's too far out.
+// Returns the number of frames of the block to play, starting from *start, after playing any
+// silence needed first. Call with the backend_mutex held.
+static uint32_t synchronise(fanout_secondary *s, uint64_t presentation_time, uint32_t frames,
+                            uint8_t **start) {
+  long the_delay;
+  if ((presentation_time == 0) || (s->output->delay == NULL) || (frames < 2) ||
+      (s->output->delay(&the_delay) != 0))
+    return frames;
+  // when this block's first frame will be heard, less when it should be, in frames
+  int64_t heard_at = get_absolute_time_in_ns() + ((int64_t)the_delay * 1000000000) /
+                                                     (int64_t)config.output_rate;
+  int64_t sync_error = ((heard_at - (int64_t)presentation_time) * config.output_rate) /
+                       1000000000;
+  if (s->sync_blocks < FANOUT_SYNC_SETTLING_BLOCKS) {
+    s->sync_offset += sync_error;
+    s->sync_blocks++;
+    if (s->sync_blocks == FANOUT_SYNC_SETTLING_BLOCKS) {
+      s->sync_offset /= FANOUT_SYNC_SETTLING_BLOCKS;
+      s->sync_drift = 0.0;
+    }
+    return frames;
+  }
+  s->sync_drift += (sync_error - s->sync_offset - s->sync_drift) / FANOUT_SYNC_SMOOTHING_BLOCKS;
+  int64_t drift = (int64_t)s->sync_drift;
+  int64_t magnitude = drift < 0 ? -drift : drift;
+  if (magnitude > s->largest_sync_drift)
+    s->largest_sync_drift = magnitude;
+  int64_t tolerance = (int64_t)(config.tolerance * config.output_rate);
+  int64_t resync_threshold = (int64_t)(FANOUT_RESYNC_THRESHOLD * config.output_rate);
+  if (drift > resync_threshold) {
+    // late -- drop as much of the block as needed, up to all of it
+    s->resyncs++;
+    uint32_t frames_to_drop = drift < frames ? (uint32_t)drift : frames;
+    s->frames_removed += frames_to_drop;
+    s->sync_drift -= frames_to_drop;
+    *start += frames_to_drop * fanout_bytes_per_frame;
+    frames -= frames_to_drop;
+  } else if (-drift > resync_threshold) {
+    // early -- play some silence first
+    s->resyncs++;
+    size_t silence_frames = -drift;
+    if (silence_frames > config.output_rate)
+      silence_frames = config.output_rate; // the rest can wait for later blocks
+    uint8_t *silence = malloc(silence_frames * fanout_bytes_per_frame);
+    if (silence) {
+      write_silence(silence, silence_frames);
+      s->output->play(silence, silence_frames);
+      s->frames_added += silence_frames;
+      s->sync_drift += silence_frames;
+      free(silence);
+    }
+  } else if (drift > tolerance) {
+    frames--; // drop the last frame
+    s->frames_removed++;
+    s->sync_drift -= 1.0;
+  } else if (-drift > tolerance) {
+    // repeat the last frame -- the buffer has room for it
+    memcpy(*start + frames * fanout_bytes_per_frame, *start + (frames - 1) * fanout_bytes_per_frame,
+           fanout_bytes_per_frame);
+    frames++;
+    s->frames_added++;
+    s->sync_drift += 1.0;
+  }
+  return frames;
+}
+
+static void *fanout_writer_thread_code(void *arg) {
+  fanout_secondary *s = (fanout_secondary *)arg;
+  fanout_block_header header;
+  while (1) {
+    pthread_mutex_lock(&s->queue_mutex);
+    pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&s->queue_mutex);
+    while (ring_buffer_occupancy(&s->queue) == 0)
+      pthread_cond_wait(&s->queue_cv, &s->queue_mutex); // this is a cancellation point
+    pthread_cleanup_pop(1); // unlock the mutex
+
+    // blocks are queued whole, so if there's anything there, there's a whole block
+    ring_buffer_read(&s->queue, &header, sizeof(header));
+    size_t length = header.frames * fanout_bytes_per_frame;
+    if (length + fanout_bytes_per_frame > s->audio_size) {
+      uint8_t *new_audio = realloc(s->audio, length + fanout_bytes_per_frame);
+      if (new_audio == NULL)
+        die("fanout: can't allocate %zu bytes for the \"%s\" backend.", length, s->output->name);
+      s->audio = new_audio;
+      s->audio_size = length + fanout_bytes_per_frame;
+    }
+    ring_buffer_read(&s->queue, s->audio, length);
+
+    pthread_mutex_lock(&s->backend_mutex);
+    pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&s->backend_mutex);
+    if (header.generation == s->generation) {
+      uint8_t *start = s->audio;
+      uint32_t frames = synchronise(s, header.presentation_time, header.frames, &start);
+      if (frames != 0) {
+        if ((header.presentation_time != 0) && (s->output->presentation_time))
+          s->output->presentation_time(header.presentation_time);
+        s->output->play(start, frames);
+      }
+      s->blocks_played++;
+    }
+    pthread_cleanup_pop(1); // unlock the mutex
+  }
+  pthread_exit(NULL);
+}
+
+static void help(void) {
+  printf("    The fanout backend sends the audio to the backends listed in the fanout \"outputs\" "
+         "setting.\n"
+         "    Any command line options are passed to the first of them.\n");
+}
+
+// the primary does the volume in hardware, so the others have to be attenuated to match
+static void volume(double vol) {
+  primary->volume(vol);
+  if (primary->parameters) {
+    audio_parameters info;
+    primary->parameters(&info);
+    primary_maximum_volume_dB = info.maximum_volume_dB;
+  }
+  double attenuation = vol - primary_maximum_volume_dB; // in hundredths of a dB
+  if (attenuation > 0.0)
+    attenuation = 0.0;
+  __atomic_store_n(&secondary_gain, (int32_t)(65536.0 * pow(10, attenuation / 2000)),
+                   __ATOMIC_RELAXED);
+}
+
+static int mute(int do_mute) {
+  int response = primary->mute(do_mute);
+  if (response == 0) // the primary is using its hardware mute
+    __atomic_store_n(&secondary_muted, do_mute, __ATOMIC_RELAXED);
+  return response;
+}
+
+static int init(int argc, char **argv) {
+  const char *str;
+  double dvalue;
+  char *output_names = NULL;
+
+  if (config.cfg != NULL) {
+    if (config_lookup_string(config.cfg, "fanout.outputs", &str))
+      output_names = strdup(str);
+    if (config_lookup_float(config.cfg, "fanout.queue_length_in_seconds", &dvalue)) {
+      if ((dvalue < 0.1) || (dvalue > 10.0))
+        warn("Invalid fanout queue_length_in_seconds setting \"%f\". It should be between 0.1 "
+             "and 10.0. The default of %f will be used.",
+             dvalue, fanout_queue_length);
+      else
+        fanout_queue_length = dvalue;
+    }
+  }
+  if (output_names == NULL)
+    die("fanout: the backends to use must be given in the fanout \"outputs\" setting.");
+
+  audio_output *outputs[FANOUT_MAXIMUM_OUTPUTS];
+  int number_of_outputs = 0;
+  char *saveptr;
+  char *name = strtok_r(output_names, ", ", &saveptr);
+  while (name != NULL) {
+    audio_output *output = audio_get_output(name);
+    if ((output == NULL) || (output == &audio_fanout))
+      die("fanout: \"%s\" is not an audio backend that can be used here.", name);
+    // each backend has only one device's worth of state, so it can't be used twice
+    int i;
+    for (i = 0; i < number_of_outputs; i++)
+      if (outputs[i] == output)
+        die("fanout: the \"%s\" backend is listed more than once.", name);
+    if (number_of_outputs == FANOUT_MAXIMUM_OUTPUTS)
+      die("fanout: no more than %d backends can be used.", FANOUT_MAXIMUM_OUTPUTS);
+    outputs[number_of_outputs++] = output;
+    name = strtok_r(NULL, ", ", &saveptr);
+  }
+  free(output_names);
+  if (number_of_outputs == 0)
+    die("fanout: no backends are listed in the fanout \"outputs\" setting.");
+
+  primary = outputs[0];
+  if (primary->init(argc, argv) != 0)
+    die("fanout: the \"%s\" backend failed to initialise.", primary->name);
+
+  // The backends all share the audio settings in the config structure. The primary's are the
+  // ones that apply, so put them back after each of the others has been initialised.
+  double desired_length = config.audio_backend_buffer_desired_length;
+  double interpolation_threshold = config.audio_backend_buffer_interpolation_threshold_in_seconds;
+  double latency_offset = config.audio_backend_latency_offset;
+  int silent_lead_in_time_auto = config.audio_backend_silent_lead_in_time_auto;
+  double silent_lead_in_time = config.audio_backend_silent_lead_in_time;
+  int output_format_auto_requested = config.output_format_auto_requested;
+  sps_format_t output_format = config.output_format;
+  int output_rate_auto_requested = config.output_rate_auto_requested;
+  unsigned int output_rate = config.output_rate;
+
+  int i;
+  for (i = 1; i < number_of_outputs; i++) {
+    fanout_secondary *s = &secondaries[number_of_secondaries];
+    memset(s, 0, sizeof(fanout_secondary));
+    s->output = outputs[i];
+    if (s->output->init(0, argv + argc) != 0)
+      die("fanout: the \"%s\" backend failed to initialise.", s->output->name);
+
+    config.audio_backend_buffer_desired_length = desired_length;
+    config.audio_backend_buffer_interpolation_threshold_in_seconds = interpolation_threshold;
+    config.audio_backend_latency_offset = latency_offset;
+    config.audio_backend_silent_lead_in_time_auto = silent_lead_in_time_auto;
+    config.audio_backend_silent_lead_in_time = silent_lead_in_time;
+    config.output_format_auto_requested = output_format_auto_requested;
+    config.output_format = output_format;
+    config.output_rate_auto_requested = output_rate_auto_requested;
+    config.output_rate = output_rate;
+
+    // big enough for the largest frames at the configured rate
+    size_t queue_size = (size_t)(fanout_queue_length * config.output_rate) * 8;
+    if (ring_buffer_init(&s->queue, queue_size) != 0)
+      die("fanout: can't allocate a queue of %f seconds for the \"%s\" backend.",
+          fanout_queue_length, s->output->name);
+    pthread_mutex_init(&s->queue_mutex, NULL);
+    pthread_cond_init(&s->queue_cv, NULL);
+    pthread_mutex_init(&s->backend_mutex, NULL);
+    number_of_secondaries++;
+  }
+
+  // the player sees the primary's capabilities
+  audio_fanout.prepare = primary->prepare;
+  audio_fanout.is_running = primary->is_running;
+  audio_fanout.delay = primary->delay;
+  audio_fanout.rate_info = primary->rate_info;
+  audio_fanout.volume = primary->volume ? &volume : NULL;
+  audio_fanout.parameters = primary->parameters;
+  audio_fanout.mute = primary->mute ? &mute : NULL;
+
+  for (i = 0; i < number_of_secondaries; i++) {
+    if (pthread_create(&secondaries[i].writer_thread, NULL, &fanout_writer_thread_code,
+                       &secondaries[i]) != 0)
+      die("fanout: can't create a writer thread for the \"%s\" backend.",
+          secondaries[i].output->name);
+    secondaries[i].writer_thread_running = 1;
+  }
+
+  debug(1, "fanout: \"%s\" is the primary backend, with %d other%s and queues of %f seconds.",
+        primary->name, number_of_secondaries, number_of_secondaries == 1 ? "" : "s",
+        fanout_queue_length);
+  return 0;
+}
+
+static void deinit(void) {
+  int i;
+  for (i = 0; i < number_of_secondaries; i++) {
+    fanout_secondary *s = &secondaries[i];
+    if (s->writer_thread_running) {
+      pthread_cancel(s->writer_thread);
+      pthread_join(s->writer_thread, NULL);
+      s->writer_thread_running = 0;
+    }
+    if (s->output->deinit)
+      s->output->deinit();
+    ring_buffer_free(&s->queue);
+    free(s->audio);
+    s->audio = NULL;
+    pthread_cond_destroy(&s->queue_cv);
+    pthread_mutex_destroy(&s->queue_mutex);
+    pthread_mutex_destroy(&s->backend_mutex);
+  }
+  number_of_secondaries = 0;
+  if ((primary) && (primary->deinit))
+    primary->deinit();
+  free(staging);
+  staging = NULL;
+  staging_size = 0;
+}
+
+static void start(int sample_rate, int sample_format) {
+  fanout_bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
+  pending_presentation_time = 0;
+  primary->start(sample_rate, sample_format);
+  int i;
+  for (i = 0; i < number_of_secondaries; i++) {
+    fanout_secondary *s = &secondaries[i];
+    pthread_mutex_lock(&s->backend_mutex);
+    s->blocks_played = 0;
+    s->blocks_dropped = 0;
+    s->sync_blocks = 0;
+    s->sync_offset = 0;
+    s->frames_added = 0;
+    s->frames_removed = 0;
+    s->resyncs = 0;
+    s->largest_sync_drift = 0;
+    if (s->output->start)
+      s->output->start(sample_rate, sample_format);
+    pthread_mutex_unlock(&s->backend_mutex);
+  }
+}
+
+static void presentation_time(uint64_t local_time) {
+  pending_presentation_time = local_time;
+  if (primary->presentation_time)
+    primary->presentation_time(local_time);
+}
+
+static int play(void *buf, int samples) {
+  int response = primary->play(buf, samples);
+
+  size_t length = sizeof(fanout_block_header) + samples * fanout_bytes_per_frame;
+  if ((number_of_secondaries != 0) && (length > staging_size)) {
+    uint8_t *new_staging = realloc(staging, length);
+    if (new_staging == NULL)
+      die("fanout: can't allocate %zu bytes for a block.", length);
+    staging = new_staging;
+    staging_size = length;
+  }
+
+  if (number_of_secondaries != 0) {
+    size_t audio_length = length - sizeof(fanout_block_header);
+    uint8_t *audio = staging + sizeof(fanout_block_header);
+    memcpy(audio, buf, audio_length);
+    if (__atomic_load_n(&secondary_muted, __ATOMIC_RELAXED))
+      write_silence(audio, samples);
+    else if (__atomic_load_n(&secondary_gain, __ATOMIC_RELAXED) != 65536)
+      attenuate(audio, samples * 2, config.output_format,
+                __atomic_load_n(&secondary_gain, __ATOMIC_RELAXED));
+  }
+
+  int i;
+  for (i = 0; i < number_of_secondaries; i++) {
+    fanout_secondary *s = &secondaries[i];
+    if (ring_buffer_space(&s->queue) < length) {
+      if ((s->blocks_dropped % 100) == 0)
+        debug(1, "fanout: the \"%s\" backend isn't keeping up -- %" PRIu64 " blocks dropped.",
+              s->output->name, s->blocks_dropped + 1);
+      s->blocks_dropped++;
+    } else {
+      fanout_block_header *header = (fanout_block_header *)staging;
+      header->presentation_time = pending_presentation_time;
+      header->frames = samples;
+      header->generation = s->generation;
+      ring_buffer_write(&s->queue, staging, length);
+      pthread_mutex_lock(&s->queue_mutex);
+      pthread_cond_signal(&s->queue_cv);
+      pthread_mutex_unlock(&s->queue_mutex);
+    }
+  }
+  pending_presentation_time = 0;
+  return response;
+}
+
+static void flush(void) {
+  if (primary->flush)
+    primary->flush();
+  int i;
+  for (i = 0; i < number_of_secondaries; i++) {
+    fanout_secondary *s = &secondaries[i];
+    pthread_mutex_lock(&s->backend_mutex);
+    s->generation++; // anything still queued is now stale
+    s->sync_blocks = 0; // the backend's buffering may be different afterwards
+    s->sync_offset = 0;
+    if (s->output->flush)
+      s->output->flush();
+    pthread_mutex_unlock(&s->backend_mutex);
+  }
+}
+
+static void stop(void) {
+  if (primary->stop)
+    primary->stop();
+  int i;
+  for (i = 0; i < number_of_secondaries; i++) {
+    fanout_secondary *s = &secondaries[i];
+    pthread_mutex_lock(&s->backend_mutex);
+    s->generation++;
+    if (s->output->stop)
+      s->output->stop();
+    debug(2, "fanout: \"%s\" backend: %" PRIu64 " blocks played, %" PRIu64 " dropped.",
+          s->output->name, s->blocks_played, s->blocks_dropped);
+    if (s->output->delay)
+      debug(2,
+            "fanout: \"%s\" backend: kept in sync by adding %" PRIu64 " and removing %" PRIu64
+            " frames, with %" PRIu64 " resyncs. The largest drift was %" PRId64 " frames.",
+            s->output->name, s->frames_added, s->frames_removed, s->resyncs,
+            s->largest_sync_drift);
+    pthread_mutex_unlock(&s->backend_mutex);
+  }
+}
+
+// the optional functions are filled in from the primary backend at init
+audio_output audio_fanout = {.name = "fanout",
+                             .help = &help,
+                             .init = &init,
+                             .deinit = &deinit,
+                             .prepare = NULL,
+                             .start = &start,
+                             .stop = &stop,
+                             .is_running = NULL,
+                             .flush = &flush,
+                             .delay = NULL,
+                             .rate_info = NULL,
+                             .presentation_time = &presentation_time,
+                             .play = &play,
+                             .volume = NULL,
+                             .parameters = NULL,
+                             .mute = NULL};
@@ -0,0 +1,588 @@
+/*
+ * File capture output driver. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The file backend captures exactly what the player would send to a DAC -- including lead-in
+// silence, dither and interpolation -- in WAV or raw files, for archiving and regression testing.
+// The player thread only copies each block into a queue; a writer thread of its own gathers the
+// audio into large aligned buffers and writes them out, optionally with O_DIRECT.
+// Each play session starts a new file, and files can also be rotated after a given length.
+// Beside each file, a text index records the frame offset and presentation time of every block
+// that has one, one block per line: "<frame offset> <presentation time in nanoseconds>".
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for O_DIRECT
+#endif
+
+#include "audio.h"
+#include "common.h"
+#include "ring_buffer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_WRITE_BUFFER_SIZE (1024 * 1024) // a multiple of any likely O_DIRECT alignment
+#define FILE_WRITE_BUFFER_ALIGNMENT 4096
+#define FILE_WAV_HEADER_MAXIMUM_SIZE 68
+
+typedef enum {
+  file_record_audio = 0,
+  file_record_end_of_session, // close the current file
+} file_record_kind;
+
+// each record in the queue is one of these, followed by the audio if there is any
+typedef struct {
+  uint64_t presentation_time; // zero if there isn't one
+  uint32_t frames;
+  uint16_t kind;
+  uint16_t format; // an sps_format_t
+  uint32_t rate;
+  uint32_t bytes_per_frame;
+} file_record_header;
+
+static char *file_name_prefix = NULL;
+static int file_wav = 1;                // otherwise raw
+static int file_use_o_direct = 0;       // if available
+static double file_rotation_length = 0; // seconds, zero means never rotate
+static int file_write_index = 1;
+static double file_queue_length = 2.0; // seconds
+
+static ring_buffer file_queue;
+static pthread_t file_writer_thread;
+static int file_writer_thread_running = 0;
+static pthread_mutex_t file_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t file_writer_cv = PTHREAD_COND_INITIALIZER; // signalled when a record arrives
+
+static unsigned int session_rate = 44100;
+static sps_format_t session_format = SPS_FORMAT_S16_LE;
+static int bytes_per_frame = 4;
+static uint8_t *staging = NULL; // the player thread assembles records here
+static size_t staging_size = 0;
+static uint64_t records_dropped = 0;
+
+// the nominal clock makes the player send a real-time stream, lead-in silence and all
+static audio_nominal_clock file_clock;
+
+// the state of the file being written, owned by the writer thread
+static int fd = -1;
+static FILE *index_file = NULL;
+static uint8_t *write_buffer = NULL;
+static size_t write_buffer_occupancy = 0;
+static size_t wav_header_size = 0;
+static uint64_t frames_in_file = 0;
+static int file_bytes_per_frame = 4;
+static unsigned int file_rate = 44100;
+static sps_format_t file_format = SPS_FORMAT_S16_LE;
+static unsigned int file_sequence_number = 0;
+static int file_opened_this_session = 0; // so that a file that can't be opened is tried only once
+
+static void put_le16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+// Fill in a WAV header for the current file's format, returning its size, or zero if the format
+// can't be described in a WAV file.
+static size_t wav_header(uint8_t *h, uint64_t data_bytes) {
+  int format_tag = 1; // PCM
+  int container_bits, valid_bits;
+  switch (file_format) {
+  case SPS_FORMAT_U8:
+    container_bits = valid_bits = 8;
+    break;
+  case SPS_FORMAT_S16_LE:
+    container_bits = valid_bits = 16;
+    break;
+  case SPS_FORMAT_S24_3LE:
+    container_bits = valid_bits = 24;
+    break;
+  case SPS_FORMAT_S24_LE:
+    container_bits = 32;
+    valid_bits = 24;
+    break;
+  case SPS_FORMAT_S32_LE:
+    container_bits = valid_bits = 32;
+    break;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  case SPS_FORMAT_S16:
+    container_bits = valid_bits = 16;
+    break;
+  case SPS_FORMAT_S24:
+    container_bits = 32;
+    valid_bits = 24;
+    break;
+  case SPS_FORMAT_S32:
+    container_bits = valid_bits = 32;
+    break;
+  case SPS_FORMAT_FLOAT:
+    format_tag = 3; // IEEE float
+    container_bits = valid_bits = 32;
+    break;
+#endif
+  default:
+    return 0;
+  }
+  // when the samples don't fill their containers, the extensible format is needed to say so
+  int extensible = container_bits != valid_bits;
+  size_t fmt_size = extensible ? 40 : 16;
+  size_t header_size = 12 + 8 + fmt_size + 8;
+  if (data_bytes > UINT32_MAX - header_size)
+    data_bytes = UINT32_MAX - header_size; // it's too long to describe, so say as much as we can
+  int block_align = 2 * container_bits / 8;
+
+  memcpy(h, "RIFF", 4);
+  put_le32(h + 4, header_size - 8 + data_bytes);
+  memcpy(h + 8, "WAVE", 4);
+  memcpy(h + 12, "fmt ", 4);
+  put_le32(h + 16, fmt_size);
+  put_le16(h + 20, extensible ? 0xFFFE : format_tag);
+  put_le16(h + 22, 2); // channels
+  put_le32(h + 24, file_rate);
+  put_le32(h + 28, file_rate * block_align);
+  put_le16(h + 32, block_align);
+  put_le16(h + 34, container_bits);
+  uint8_t *p = h + 36;
+  if (extensible) {
+    put_le16(p, 22);
+    put_le16(p + 2, valid_bits);
+    put_le32(p + 4, 3); // front left and front right
+    // the KSDATAFORMAT_SUBTYPE GUID for the format tag
+    static const uint8_t guid_tail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80,
+                                          0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+    put_le16(p + 8, format_tag);
+    memcpy(p + 10, guid_tail, sizeof(guid_tail));
+    p += 24;
+  }
+  memcpy(p, "data", 4);
+  put_le32(p + 4, data_bytes);
+  return header_size;
+}
+
+// _GNU_SOURCE selects the GNU strerror_r in glibc, which returns its string rather than always
+// filling in the buffer
+static const char *error_string(int errnum, char *buf, size_t buflen) {
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+  return strerror_r(errnum, buf, buflen);
+#else
+  if (strerror_r(errnum, buf, buflen) != 0)
+    snprintf(buf, buflen, "error %d", errnum);
+  return buf;
+#endif
+}
+
+static void write_out(size_t length) {
+  char errorstring[1024];
+  size_t written = 0;
+  while ((fd >= 0) && (written < length)) {
+    ssize_t rc = write(fd, write_buffer + written, length - written);
+    if (rc > 0) {
+      written += rc;
+    } else if ((rc < 0) && (errno != EINTR)) {
+      int e = errno;
+      warn("audio_file: error %d writing a capture file: \"%s\". Capture will stop until the "
+           "next file.",
+           e, error_string(e, errorstring, sizeof(errorstring)));
+      close(fd);
+      fd = -1;
+    }
+  }
+}
+
+static void close_file(void) {
+  if (fd >= 0) {
+#ifdef O_DIRECT
+    // the last part of the buffer is unlikely to be aligned, so finish without O_DIRECT
+    if (file_use_o_direct)
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+    write_out(write_buffer_occupancy);
+    if ((fd >= 0) && (wav_header_size != 0)) {
+      uint8_t header[FILE_WAV_HEADER_MAXIMUM_SIZE];
+      wav_header(header, frames_in_file * file_bytes_per_frame);
+      if (pwrite(fd, header, wav_header_size, 0) != (ssize_t)wav_header_size)
+        warn("audio_file: can't complete the WAV header of a capture file.");
+    }
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+  if (index_file) {
+    fclose(index_file);
+    index_file = NULL;
+  }
+  write_buffer_occupancy = 0;
+}
+
+static void open_file(unsigned int rate, sps_format_t format) {
+  char errorstring[1024];
+  char date_and_time[32];
+  time_t now = time(NULL);
+  struct tm local_now;
+  localtime_r(&now, &local_now);
+  strftime(date_and_time, sizeof(date_and_time), "%Y%m%d-%H%M%S", &local_now);
+
+  file_rate = rate;
+  file_format = format;
+  file_bytes_per_frame = sps_format_bytes_per_frame(file_format);
+  frames_in_file = 0;
+  write_buffer_occupancy = 0;
+
+  uint8_t header[FILE_WAV_HEADER_MAXIMUM_SIZE];
+  wav_header_size = 0;
+  if (file_wav) {
+    wav_header_size = wav_header(header, 0);
+    if (wav_header_size == 0)
+      warn("audio_file: the output format \"%s\" can't be written in a WAV file, so the capture "
+           "will be raw.",
+           sps_format_description_string(file_format));
+  }
+
+  size_t name_size = strlen(file_name_prefix) + 64;
+  char *name = malloc(name_size);
+  if (name == NULL)
+    die("audio_file: can't allocate memory for a file name.");
+  snprintf(name, name_size, "%s-%s-%03u.%s", file_name_prefix, date_and_time,
+           file_sequence_number++ % 1000, wav_header_size ? "wav" : "raw");
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+  if (file_use_o_direct)
+    flags |= O_DIRECT;
+#endif
+  fd = open(name, flags, 0644);
+  if (fd < 0) {
+    warn("audio_file: can't open the capture file \"%s\": \"%s\".", name,
+         error_string(errno, errorstring, sizeof(errorstring)));
+  } else {
+    debug(1, "audio_file: capturing to \"%s\".", name);
+    // the header goes at the start of the first buffer, and is completed when the file is closed
+    if (wav_header_size) {
+      memcpy(write_buffer, header, wav_header_size);
+      write_buffer_occupancy = wav_header_size;
+    }
+    if (file_write_index) {
+      strcat(name, ".index");
+      index_file = fopen(name, "w");
+      if (index_file == NULL)
+        warn("audio_file: can't open the index file \"%s\".", name);
+    }
+  }
+  free(name);
+}
+
+static void write_audio(const uint8_t *audio, uint32_t frames, uint64_t presentation_time) {
+  if ((file_rotation_length > 0) && (fd >= 0) &&
+      (frames_in_file >= (uint64_t)(file_rotation_length * file_rate))) {
+    close_file();
+    open_file(file_rate, file_format);
+  }
+  if (fd < 0)
+    return;
+  if ((index_file) && (presentation_time != 0))
+    fprintf(index_file, "%" PRIu64 " %" PRIu64 "\n", frames_in_file, presentation_time);
+  size_t length = frames * file_bytes_per_frame;
+  while (length > 0) {
+    size_t space = FILE_WRITE_BUFFER_SIZE - write_buffer_occupancy;
+    size_t chunk = length < space ? length : space;
+    memcpy(write_buffer + write_buffer_occupancy, audio, chunk);
+    write_buffer_occupancy += chunk;
+    audio += chunk;
+    length -= chunk;
+    if (write_buffer_occupancy == FILE_WRITE_BUFFER_SIZE) {
+      write_out(FILE_WRITE_BUFFER_SIZE);
+      write_buffer_occupancy = 0;
+    }
+  }
+  frames_in_file += frames;
+}
+
+static void file_writer_cleanup_handler(__attribute__((unused)) void *arg) { close_file(); }
+
+static void *file_writer_thread_code(__attribute__((unused)) void *arg) {
+  file_record_header header;
+  uint8_t *audio = NULL;
+  size_t audio_size = 0;
+  pthread_cleanup_push(file_writer_cleanup_handler, NULL);
+  while (1) {
+    pthread_mutex_lock(&file_writer_mutex);
+    pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&file_writer_mutex);
+    while (ring_buffer_occupancy(&file_queue) == 0)
+      pthread_cond_wait(&file_writer_cv, &file_writer_mutex); // this is a cancellation point
+    pthread_cleanup_pop(1); // unlock the mutex
+
+    // records are queued whole, so if there's anything there, there's a whole record
+    ring_buffer_read(&file_queue, &header, sizeof(header));
+    if (header.kind == file_record_end_of_session) {
+      close_file();
+      file_opened_this_session = 0;
+    } else {
+      if (file_opened_this_session == 0) {
+        open_file(header.rate, (sps_format_t)header.format);
+        file_opened_this_session = 1;
+      }
+      size_t length = header.frames * header.bytes_per_frame;
+      if (length > audio_size) {
+        uint8_t *new_audio = realloc(audio, length);
+        if (new_audio == NULL)
+          die("audio_file: can't allocate %zu bytes for a block of audio.", length);
+        audio = new_audio;
+        audio_size = length;
+      }
+      ring_buffer_read(&file_queue, audio, length);
+      write_audio(audio, header.frames, header.presentation_time);
+    }
+  }
+  pthread_cleanup_pop(1);
+  pthread_exit(NULL);
+}
+
+static int queue_record(file_record_kind kind, uint64_t presentation_time, const void *buf,
+                        int samples) {
+  size_t length = sizeof(file_record_header) + samples * bytes_per_frame;
+  if (length > staging_size) {
+    uint8_t *new_staging = realloc(staging, length);
+    if (new_staging == NULL)
+      die("audio_file: can't allocate %zu bytes for a block of audio.", length);
+    staging = new_staging;
+    staging_size = length;
+  }
+  if (ring_buffer_space(&file_queue) < length) {
+    if ((records_dropped % 100) == 0)
+      debug(1, "audio_file: the capture file isn't being written fast enough -- %" PRIu64
+               " blocks dropped.",
+            records_dropped + 1);
+    records_dropped++;
+    return -1;
+  }
+  file_record_header *header = (file_record_header *)staging;
+  header->presentation_time = presentation_time;
+  header->frames = samples;
+  header->kind = kind;
+  header->format = session_format;
+  header->rate = session_rate;
+  header->bytes_per_frame = bytes_per_frame;
+  if (samples)
+    memcpy(staging + sizeof(file_record_header), buf, samples * bytes_per_frame);
+  ring_buffer_write(&file_queue, staging, length);
+  pthread_mutex_lock(&file_writer_mutex);
+  pthread_cond_signal(&file_writer_cv);
+  pthread_mutex_unlock(&file_writer_mutex);
+  return 0;
+}
+
+static uint64_t next_presentation_time = 0; // zero if not known
+
+static void presentation_time(uint64_t local_time) { next_presentation_time = local_time; }
+
+static void start(int sample_rate, __attribute__((unused)) int sample_format) {
+  session_rate = sample_rate;
+  session_format = config.output_format;
+  bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
+  next_presentation_time = 0;
+  audio_nominal_clock_start(&file_clock, sample_rate);
+}
+
+static int play(void *buf, int samples) {
+  queue_record(file_record_audio, next_presentation_time, buf, samples);
+  next_presentation_time = 0;
+  audio_nominal_clock_frames_sent(&file_clock, samples);
+  return 0;
+}
+
+static int delay(long *the_delay) {
+  *the_delay = audio_nominal_clock_delay(&file_clock);
+  return 0;
+}
+
+static void flush(void) { audio_nominal_clock_reset(&file_clock); }
+
+static void stop(void) {
+  audio_nominal_clock_reset(&file_clock);
+  queue_record(file_record_end_of_session, 0, NULL, 0);
+  debug(2, "audio_file: %" PRIu64 " blocks dropped so far.", records_dropped);
+}
+
+static int init(__attribute__((unused)) int argc, __attribute__((unused)) char **argv) {
+  const char *str;
+  double dvalue;
+
+  // set up default values first
+  config.audio_backend_buffer_desired_length = 1.0;
+  config.audio_backend_latency_offset = 0;
+
+  // do the "general" audio  options. Note, these options are in the "general" stanza!
+  parse_general_audio_options();
+
+  if (config.cfg != NULL) {
+    if (config_lookup_string(config.cfg, "file.name", &str))
+      file_name_prefix = (char *)str;
+
+    if (config_lookup_string(config.cfg, "file.type", &str)) {
+      if (strcasecmp(str, "wav") == 0)
+        file_wav = 1;
+      else if (strcasecmp(str, "raw") == 0)
+        file_wav = 0;
+      else
+        warn("Invalid file type choice \"%s\". It should be \"wav\" or \"raw\". It is set to "
+             "\"wav\".",
+             str);
+    }
+
+    if (config_lookup_string(config.cfg, "file.output_format", &str)) {
+      sps_format_t f;
+      for (f = SPS_FORMAT_S8; f < SPS_FORMAT_AUTO; f++)
+        if (strcasecmp(str, sps_format_description_string(f)) == 0)
+          break;
+      if (f == SPS_FORMAT_AUTO)
+        warn("Invalid file output_format \"%s\". The default of \"%s\" will be used.", str,
+             sps_format_description_string(config.output_format));
+      else
+        config.output_format = f;
+    }
+
+    if (config_lookup_string(config.cfg, "file.use_o_direct", &str)) {
+      if (strcasecmp(str, "yes") == 0)
+        file_use_o_direct = 1;
+      else if (strcasecmp(str, "no") == 0)
+        file_use_o_direct = 0;
+      else
+        warn("Invalid file use_o_direct choice \"%s\". It should be \"yes\" or \"no\". It is set "
+             "to \"no\".",
+             str);
+#ifndef O_DIRECT
+      if (file_use_o_direct) {
+        warn("O_DIRECT is not available on this system, so file use_o_direct is ignored.");
+        file_use_o_direct = 0;
+      }
+#endif
+    }
+
+    if (config_lookup_string(config.cfg, "file.write_index", &str)) {
+      if (strcasecmp(str, "yes") == 0)
+        file_write_index = 1;
+      else if (strcasecmp(str, "no") == 0)
+        file_write_index = 0;
+      else
+        warn("Invalid file write_index choice \"%s\". It should be \"yes\" or \"no\". It is set "
+             "to \"yes\".",
+             str);
+    }
+
+    if (config_lookup_float(config.cfg, "file.rotate_after_seconds", &dvalue)) {
+      if (dvalue < 0.0)
+        warn("Invalid file rotate_after_seconds setting \"%f\". It should be 0.0 or greater. "
+             "Files will not be rotated.",
+             dvalue);
+      else
+        file_rotation_length = dvalue;
+    }
+
+    if (config_lookup_float(config.cfg, "file.buffer_length_in_seconds", &dvalue)) {
+      if ((dvalue < 0.1) || (dvalue > 30.0))
+        warn("Invalid file buffer_length_in_seconds setting \"%f\". It should be between 0.1 and "
+             "30.0. The default of %f will be used.",
+             dvalue, file_queue_length);
+      else
+        file_queue_length = dvalue;
+    }
+  }
+
+  if ((file_name_prefix == NULL) && (argc != 1))
+    die("the file backend needs a name to begin its capture files with, either in the \"file\" "
+        "section of the configuration file or as an argument.");
+  if (argc == 1)
+    file_name_prefix = strdup(argv[0]);
+
+  if (posix_memalign((void **)&write_buffer, FILE_WRITE_BUFFER_ALIGNMENT,
+                     FILE_WRITE_BUFFER_SIZE) != 0)
+    die("audio_file: can't allocate a write buffer.");
+
+  // big enough for the largest frames at the configured rate
+  if (ring_buffer_init(&file_queue, (size_t)(file_queue_length * config.output_rate) * 8) != 0)
+    die("audio_file: can't allocate a buffer of %f seconds.", file_queue_length);
+
+  if (pthread_create(&file_writer_thread, NULL, &file_writer_thread_code, NULL) != 0)
+    die("audio_file: can't create the writer thread.");
+  file_writer_thread_running = 1;
+
+  debug(1, "audio_file: capturing %s files beginning \"%s\".", file_wav ? "WAV" : "raw",
+        file_name_prefix);
+  return 0;
+}
+
+static void deinit(void) {
+  if (file_writer_thread_running) {
+    // let the writer finish what's queued, then stop it
+    int i;
+    for (i = 0; (i < 200) && (ring_buffer_occupancy(&file_queue) != 0); i++)
+      usleep(10000);
+    pthread_cancel(file_writer_thread);
+    pthread_join(file_writer_thread, NULL); // the cleanup handler closes any open file
+    file_writer_thread_running = 0;
+  }
+  ring_buffer_free(&file_queue);
+  free(write_buffer);
+  write_buffer = NULL;
+  free(staging);
+  staging = NULL;
+  staging_size = 0;
+}
+
+static void help(void) {
+  printf("    Provide the beginning of the capture file names as the sole argument, or set it\n"
+         "    as \"name\" in the \"file\" section of the configuration file.\n");
+}
+
+audio_output audio_file = {.name = "file",
+                           .help = &help,
+                           .init = &init,
+                           .deinit = &deinit,
+                           .prepare = NULL,
+                           .start = &start,
+                           .stop = &stop,
+                           .is_running = NULL,
+                           .flush = &flush,
+                           .delay = &delay,
+                           .rate_info = NULL,
+                           .presentation_time = &presentation_time,
+                           .play = &play,
+                           .volume = NULL,
+                           .parameters = NULL,
+                           .mute = NULL};
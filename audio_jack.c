@@ -107,20 +107,10 @@ static soxr_quality_spec_t quality_spec;
 static soxr_io_spec_t io_spec;
 #endif
 
-static inline sample_t sample_conv(short sample) {
-  // It sounds correct, but I don't understand it.
-  // Zero int needs to be zero float. Check.
-  // Plus 32767 int is 1.0. Check.
-  // Minus 32767 int is -0.99997. And here my brain shuts down.
-  // In my head, it should be 1.0, and we should tolerate an overflow
-  // at minus 32768. But I'm sure there's a textbook explanation somewhere.
-  return ((sample < 0) ? (-1.0 * sample / SHRT_MIN) : (1.0 * sample / SHRT_MAX));
-}
-
 static void deinterleave(const char *interleaved_input_buffer, sample_t *jack_output_buffer[],
                          jack_nframes_t offset, jack_nframes_t nframes) {
   jack_nframes_t f;
-  // We're dealing with 16bit audio here:
+  // The player hands us interleaved native floats, which is what JACK wants:
   sample_t *ifp = (sample_t *)interleaved_input_buffer;
   // Zero-copy, we're working directly on the target and destination buffers,
   // so deal with an offset for the second part of the input ringbuffer
@@ -211,6 +201,10 @@ int jack_init(__attribute__((unused)) int argc, __attribute__((unused)) char **a
   // Below this, soxr interpolation will not occur -- it'll be basic interpolation
   // instead.
   config.audio_backend_buffer_interpolation_threshold_in_seconds = 0.25;
+  // JACK works in floats, so have the player deliver them directly rather than
+  // quantising to 16 bits and converting back again here.
+  config.output_format = SPS_FORMAT_FLOAT;
+  config.output_format_auto_requested = 0;
 
   // Do the "general" audio  options. Note, these options are in the "general" stanza!
   parse_general_audio_options();
@@ -262,7 +256,7 @@ int jack_init(__attribute__((unused)) int argc, __attribute__((unused)) char **a
 #ifdef CONFIG_SOXR
   if (config.jack_soxr_resample_quality >= SOXR_QQ) {
     quality_spec = soxr_quality_spec(config.jack_soxr_resample_quality, 0);
-    io_spec = soxr_io_spec(SOXR_INT16_I, SOXR_FLOAT32_I);
+    io_spec = soxr_io_spec(SOXR_FLOAT32_I, SOXR_FLOAT32_I);
   } else
 #endif
       if (sample_rate != 44100) {
@@ -350,7 +344,8 @@ void jack_deinit() {
 void jack_start(int i_sample_rate, __attribute__((unused)) int i_sample_format) {
   // Nothing to do, JACK client has already been set up at jack_init().
   // Also, we have no say over the sample rate or sample format of JACK,
-  // We convert the 16bit samples to float, and die if the sample rate is != 44k1 without soxr.
+  // The player delivers floats (see jack_init), and we die if the sample rate is != 44k1
+  // without soxr.
 #ifdef CONFIG_SOXR
   if (config.jack_soxr_resample_quality >= SOXR_QQ) {
     // we might improve a bit with soxr_clear if the sample_rate doesn't change
@@ -400,12 +395,12 @@ int jack_delay(long *the_delay) {
 
 int play(void *buf, int samples) {
   jack_ringbuffer_data_t v[2] = {0};
-  size_t i, j, c;
+  size_t i, j;
   jack_nframes_t thisbuf;
   // It's ok to lock here since we're not in the realtime callback:
   pthread_mutex_lock(&buffer_mutex);
   jack_ringbuffer_get_write_vector(jackbuf, v);
-  short *in = (short *)buf;
+  sample_t *in = (sample_t *)buf;
   sample_t *out;
   for (i = 0; i < 2; ++i) {
     thisbuf = v[i].len / (jack_sample_size * NPORTS); // #samples per channel
@@ -426,12 +421,11 @@ int play(void *buf, int samples) {
       }
     } else {
 #endif
-      j = 0;
-      for (j = 0; j < thisbuf && samples > 0; ++j) {
-        for (c = 0; c < NPORTS; ++c)
-          out[j * NPORTS + c] = sample_conv(*in++);
-        --samples;
-      }
+      // already in the right format, so it's a straight copy
+      j = (size_t)samples < thisbuf ? (size_t)samples : thisbuf;
+      memcpy(out, in, j * jack_sample_size * NPORTS);
+      in += j * NPORTS;
+      samples -= j;
       jack_ringbuffer_write_advance(jackbuf, j * jack_sample_size * NPORTS);
 #ifdef CONFIG_SOXR
     }
@@ -0,0 +1,531 @@
+/*
+ * Mixer output driver. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The mixer backend lets several play sessions share one output device.
+// Each session's player thread is a source. It writes into a timeline of its own, measured in
+// frames of the output, so that it can be kept in sync just as if it were driving the device.
+// A mixer thread keeps the real backend topped up, summing a period of every source's timeline
+// at a time, applying the headroom gain and saturating into the output format.
+// Sources are told apart by their player thread, since all the backend calls for a session are
+// made from it. Volume is left to the player, so each session's own volume is its gain in the mix.
+
+#include "audio.h"
+#include "common.h"
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MIXER_MAXIMUM_SOURCES 8
+
+audio_output audio_mixer;
+
+typedef enum { mixer_s16, mixer_s32, mixer_float } mixer_sample_type;
+
+typedef struct {
+  int in_use;
+  pthread_t player_thread; // the thread making this source's calls
+  int started;             // set when write_position is valid
+  int64_t write_position;  // the timeline frame this source's next frame goes into
+  float *samples;          // interleaved stereo, timeline_frames long, indexed modulo its length
+  // statistics
+  uint64_t frames_played;
+  uint64_t underruns;
+} mixer_source;
+
+static audio_output *backend = NULL;
+static mixer_sample_type sample_type = mixer_s16;
+
+static int maximum_sources = 4;
+static double headroom_db = 0.0;
+static double mixer_buffer_length = 0.1; // seconds, kept between the sources and the backend
+static float headroom_gain = 1.0;
+
+// backend_mutex is held when calling the backend, and is always taken before mixer_mutex
+static pthread_mutex_t backend_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t backend_cv = PTHREAD_COND_INITIALIZER; // signalled when the backend starts
+static int backend_running = 0;
+static long backend_target_frames; // how far ahead of the backend's output the mixer stays
+static audio_nominal_clock backend_clock; // for backends without a delay function
+
+// mixer_mutex protects the sources and the read position
+static pthread_mutex_t mixer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t space_cv = PTHREAD_COND_INITIALIZER; // signalled when the timeline moves on
+static mixer_source sources[MIXER_MAXIMUM_SOURCES];
+static int number_of_sources = 0;
+static int64_t read_position = 0; // the next timeline frame to be mixed
+static int64_t timeline_frames;
+static int period_frames;
+
+static pthread_t mixer_thread;
+static int mixer_thread_running = 0;
+
+// the mixer thread's buffers, period_frames long
+static float *mix_buffer = NULL;
+static uint8_t *output_buffer = NULL;
+
+// call with mixer_mutex held
+static mixer_source *find_source(void) {
+  int i;
+  for (i = 0; i < MIXER_MAXIMUM_SOURCES; i++)
+    if ((sources[i].in_use) && (pthread_equal(sources[i].player_thread, pthread_self())))
+      return &sources[i];
+  return NULL;
+}
+
+// silence the frames of a source's timeline from read_position up to the new write position, which
+// the source hasn't written but which will be mixed
+// call with mixer_mutex held
+static void skip_to(mixer_source *s, int64_t position) {
+  int64_t frames = position - read_position;
+  int64_t index = read_position % timeline_frames;
+  int64_t first_part = frames;
+  if (index + first_part > timeline_frames)
+    first_part = timeline_frames - index;
+  memset(s->samples + index * 2, 0, first_part * 2 * sizeof(float));
+  if (frames > first_part)
+    memset(s->samples, 0, (frames - first_part) * 2 * sizeof(float));
+  s->write_position = position;
+}
+
+// call with mixer_mutex held
+static void start_source(mixer_source *s) {
+  if (s->started == 0) {
+    skip_to(s, read_position + period_frames); // just after the next period to be mixed
+    s->started = 1;
+  }
+}
+
+// The loops below are written so that the compiler can vectorise them.
+
+static void mix_add(float *restrict acc, const float *restrict src, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    acc[i] += src[i];
+}
+
+static void convert_in(float *restrict dst, const void *restrict src, size_t n) {
+  size_t i;
+  switch (sample_type) {
+  case mixer_s16: {
+    const int16_t *s = (const int16_t *)src;
+    for (i = 0; i < n; i++)
+      dst[i] = s[i] * (1.0f / 32768.0f);
+  } break;
+  case mixer_s32: {
+    const int32_t *s = (const int32_t *)src;
+    for (i = 0; i < n; i++)
+      dst[i] = s[i] * (1.0f / 2147483648.0f);
+  } break;
+  default:
+    memcpy(dst, src, n * sizeof(float));
+    break;
+  }
+}
+
+static void convert_out(void *restrict dst, const float *restrict src, size_t n, float gain) {
+  size_t i;
+  switch (sample_type) {
+  case mixer_s16: {
+    int16_t *d = (int16_t *)dst;
+    for (i = 0; i < n; i++) {
+      float v = src[i] * gain * 32768.0f;
+      v = v > 32767.0f ? 32767.0f : v;
+      v = v < -32768.0f ? -32768.0f : v;
+      d[i] = (int16_t)v;
+    }
+  } break;
+  case mixer_s32: {
+    int32_t *d = (int32_t *)dst;
+    for (i = 0; i < n; i++) {
+      float v = src[i] * gain * 2147483648.0f;
+      v = v > 2147483520.0f ? 2147483520.0f : v; // the largest float below 2^31
+      v = v < -2147483648.0f ? -2147483648.0f : v;
+      d[i] = (int32_t)v;
+    }
+  } break;
+  default: {
+    float *d = (float *)dst;
+    for (i = 0; i < n; i++) {
+      float v = src[i] * gain;
+      v = v > 1.0f ? 1.0f : v;
+      v = v < -1.0f ? -1.0f : v;
+      d[i] = v;
+    }
+  } break;
+  }
+}
+
+// call with backend_mutex held
+static long backend_delay(void) {
+  long response = 0;
+  if (backend->delay) {
+    if (backend->delay(&response) != 0)
+      response = 0; // e.g. it has underrun, so it needs more audio now
+  } else {
+    response = audio_nominal_clock_delay(&backend_clock);
+  }
+  if (response < 0)
+    response = 0;
+  return response;
+}
+
+// mix the next period of every source into mix_buffer and move the timeline on
+// call with mixer_mutex held
+static void mix_period(void) {
+  memset(mix_buffer, 0, period_frames * 2 * sizeof(float));
+  int i;
+  for (i = 0; i < MIXER_MAXIMUM_SOURCES; i++) {
+    mixer_source *s = &sources[i];
+    if ((s->in_use) && (s->started) && (s->write_position > read_position)) {
+      int64_t frames = s->write_position - read_position;
+      if (frames > period_frames)
+        frames = period_frames;
+      int64_t index = read_position % timeline_frames;
+      int64_t first_part = frames;
+      if (index + first_part > timeline_frames)
+        first_part = timeline_frames - index;
+      mix_add(mix_buffer, s->samples + index * 2, first_part * 2);
+      if (frames > first_part)
+        mix_add(mix_buffer + first_part * 2, s->samples, (frames - first_part) * 2);
+      s->frames_played += frames;
+    }
+  }
+  read_position += period_frames;
+  pthread_cond_broadcast(&space_cv);
+}
+
+static void *mixer_thread_code(__attribute__((unused)) void *arg) {
+  uint64_t period_ns = ((uint64_t)period_frames * 1000000000) / config.output_rate;
+  while (1) {
+    int mixed = 0;
+    pthread_mutex_lock(&backend_mutex);
+    pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&backend_mutex);
+    while (backend_running == 0)
+      pthread_cond_wait(&backend_cv, &backend_mutex); // this is a cancellation point
+    if (backend_delay() < backend_target_frames) {
+      pthread_mutex_lock(&mixer_mutex);
+      mix_period();
+      pthread_mutex_unlock(&mixer_mutex);
+      convert_out(output_buffer, mix_buffer, period_frames * 2, headroom_gain);
+      backend->play(output_buffer, period_frames);
+      if (backend->delay == NULL)
+        audio_nominal_clock_frames_sent(&backend_clock, period_frames);
+      mixed = 1;
+    }
+    pthread_cleanup_pop(1); // unlock the mutex
+    if (mixed == 0)
+      usleep(period_ns / 2000); // a cancellation point
+  }
+  pthread_exit(NULL);
+}
+
+static void help(void) {
+  printf("    The mixer backend mixes concurrent play sessions into the backend given in the mixer "
+         "\"output\" setting.\n"
+         "    Any command line options are passed to that backend.\n");
+}
+
+static int init(int argc, char **argv) {
+  const char *str;
+  int value;
+  double dvalue;
+  char *output_name = NULL;
+
+  if (config.cfg != NULL) {
+    if (config_lookup_string(config.cfg, "mixer.output", &str))
+      output_name = strdup(str);
+    if (config_lookup_int(config.cfg, "mixer.maximum_sources", &value)) {
+      if ((value < 1) || (value > MIXER_MAXIMUM_SOURCES))
+        warn("Invalid mixer maximum_sources setting \"%d\". It should be between 1 and %d. The "
+             "default of %d will be used.",
+             value, MIXER_MAXIMUM_SOURCES, maximum_sources);
+      else
+        maximum_sources = value;
+    }
+    if (config_lookup_float(config.cfg, "mixer.headroom_in_db", &dvalue)) {
+      if ((dvalue < -30.0) || (dvalue > 0.0))
+        warn("Invalid mixer headroom_in_db setting \"%f\". It should be between -30.0 and 0.0. "
+             "The default of %f will be used.",
+             dvalue, headroom_db);
+      else
+        headroom_db = dvalue;
+    }
+    if (config_lookup_float(config.cfg, "mixer.buffer_length_in_seconds", &dvalue)) {
+      if ((dvalue < 0.02) || (dvalue > 1.0))
+        warn("Invalid mixer buffer_length_in_seconds setting \"%f\". It should be between 0.02 "
+             "and 1.0. The default of %f will be used.",
+             dvalue, mixer_buffer_length);
+      else
+        mixer_buffer_length = dvalue;
+    }
+  }
+  if (output_name == NULL)
+    die("mixer: the backend to use must be given in the mixer \"output\" setting.");
+  backend = audio_get_output(output_name);
+  if ((backend == NULL) || (backend == &audio_mixer))
+    die("mixer: \"%s\" is not an audio backend that can be used here.", output_name);
+  free(output_name);
+
+  if (backend->init(argc, argv) != 0)
+    die("mixer: the \"%s\" backend failed to initialise.", backend->name);
+
+  // the sources and the backend all use one format, which the mixer has to be able to read
+  switch (config.output_format) {
+  case SPS_FORMAT_S16:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  case SPS_FORMAT_S16_LE:
+#else
+  case SPS_FORMAT_S16_BE:
+#endif
+    sample_type = mixer_s16;
+    break;
+  case SPS_FORMAT_S32:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  case SPS_FORMAT_S32_LE:
+#else
+  case SPS_FORMAT_S32_BE:
+#endif
+    sample_type = mixer_s32;
+    break;
+  case SPS_FORMAT_FLOAT:
+    sample_type = mixer_float;
+    break;
+  default:
+    if (config.output_format_auto_requested == 0)
+      warn("mixer: the \"%s\" output format can not be mixed. \"S32\" will be used instead.",
+           sps_format_description_string(config.output_format));
+    config.output_format = SPS_FORMAT_S32;
+    sample_type = mixer_s32;
+    break;
+  }
+  config.output_format_auto_requested = 0;
+
+  // The backend is kept as full as it asks to be; the sources are kept further ahead, by the
+  // length of the mixer's own buffer.
+  backend_target_frames = (long)(config.audio_backend_buffer_desired_length * config.output_rate);
+  config.audio_backend_buffer_desired_length += mixer_buffer_length;
+
+  period_frames = config.output_rate / 100;
+  // room for a generous amount of silence from the player at the start of a session
+  double timeline_length = 2 * config.audio_backend_buffer_desired_length;
+  if (timeline_length < 1.0)
+    timeline_length = 1.0;
+  timeline_frames = (int64_t)(timeline_length * config.output_rate);
+
+  memset(sources, 0, sizeof(sources));
+  int i;
+  for (i = 0; i < maximum_sources; i++) {
+    sources[i].samples = malloc(timeline_frames * 2 * sizeof(float));
+    if (sources[i].samples == NULL)
+      die("mixer: can't allocate a timeline of %f seconds.", timeline_length);
+  }
+  mix_buffer = malloc(period_frames * 2 * sizeof(float));
+  output_buffer = malloc(period_frames * 2 * sizeof(float)); // big enough for any of the formats
+  if ((mix_buffer == NULL) || (output_buffer == NULL))
+    die("mixer: can't allocate the mixing buffers.");
+
+  headroom_gain = pow(10.0, headroom_db / 20.0);
+  config.maximum_concurrent_sessions = maximum_sources;
+
+  // the player controls each session's volume in software, so no volume, mute or parameters
+  audio_mixer.prepare = backend->prepare;
+
+  if (pthread_create(&mixer_thread, NULL, &mixer_thread_code, NULL) != 0)
+    die("mixer: can't create the mixer thread.");
+  mixer_thread_running = 1;
+
+  debug(1,
+        "mixer: mixing up to %d sources into the \"%s\" backend in \"%s\" format, with %f dB "
+        "of headroom.",
+        maximum_sources, backend->name, sps_format_description_string(config.output_format),
+        headroom_db);
+  return 0;
+}
+
+static void deinit(void) {
+  if (mixer_thread_running) {
+    pthread_cancel(mixer_thread);
+    pthread_join(mixer_thread, NULL);
+    mixer_thread_running = 0;
+  }
+  if (backend_running) {
+    if (backend->stop)
+      backend->stop();
+    backend_running = 0;
+  }
+  if ((backend) && (backend->deinit))
+    backend->deinit();
+  int i;
+  for (i = 0; i < MIXER_MAXIMUM_SOURCES; i++) {
+    free(sources[i].samples);
+    sources[i].samples = NULL;
+  }
+  free(mix_buffer);
+  mix_buffer = NULL;
+  free(output_buffer);
+  output_buffer = NULL;
+}
+
+static void start(int sample_rate, int sample_format) {
+  pthread_mutex_lock(&backend_mutex);
+  if (backend_running == 0) {
+    if (backend->start)
+      backend->start(sample_rate, sample_format);
+    audio_nominal_clock_start(&backend_clock, sample_rate);
+    backend_running = 1;
+    pthread_cond_signal(&backend_cv);
+  }
+  pthread_mutex_lock(&mixer_mutex);
+  mixer_source *s = find_source();
+  if (s == NULL) {
+    int i;
+    for (i = 0; (i < maximum_sources) && (s == NULL); i++)
+      if (sources[i].in_use == 0)
+        s = &sources[i];
+    if (s == NULL)
+      die("mixer: more than %d sources have been started.", maximum_sources);
+    s->in_use = 1;
+    s->player_thread = pthread_self();
+    // nothing from the timeline's previous user may be mixed
+    memset(s->samples, 0, timeline_frames * 2 * sizeof(float));
+    number_of_sources++;
+  }
+  s->started = 0;
+  s->frames_played = 0;
+  s->underruns = 0;
+  pthread_mutex_unlock(&mixer_mutex);
+  pthread_mutex_unlock(&backend_mutex);
+}
+
+static int play(void *buf, int samples) {
+  int response = 0;
+  uint8_t *p = (uint8_t *)buf;
+  size_t bytes_per_sample = sample_type == mixer_s16 ? 2 : 4;
+  pthread_mutex_lock(&mixer_mutex);
+  pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&mixer_mutex);
+  mixer_source *s = find_source();
+  if (s == NULL) {
+    debug(1, "mixer: play called by a thread that isn't a source.");
+    response = -1;
+  } else {
+    start_source(s);
+    if (s->write_position < read_position) {
+      // this source's audio ran out before the mixer got to it
+      s->underruns++;
+      skip_to(s, read_position + period_frames);
+    }
+    int64_t remaining = samples;
+    while (remaining > 0) {
+      int64_t space = read_position + timeline_frames - s->write_position;
+      if (space <= 0) {
+        pthread_cond_wait(&space_cv, &mixer_mutex); // this is a cancellation point
+      } else {
+        int64_t frames = remaining < space ? remaining : space;
+        int64_t index = s->write_position % timeline_frames;
+        if (index + frames > timeline_frames)
+          frames = timeline_frames - index;
+        convert_in(s->samples + index * 2, p, frames * 2);
+        p += frames * 2 * bytes_per_sample;
+        s->write_position += frames;
+        remaining -= frames;
+      }
+    }
+  }
+  pthread_cleanup_pop(1); // unlock the mutex
+  return response;
+}
+
+static int delay(long *the_delay) {
+  int response = 0;
+  pthread_mutex_lock(&backend_mutex);
+  long backend_frames = backend_running ? backend_delay() : 0;
+  pthread_mutex_lock(&mixer_mutex);
+  mixer_source *s = find_source();
+  if (s == NULL) {
+    response = -1;
+  } else {
+    start_source(s);
+    int64_t frames_ahead = s->write_position - read_position;
+    if (frames_ahead < 0)
+      frames_ahead = 0;
+    *the_delay = backend_frames + frames_ahead;
+  }
+  pthread_mutex_unlock(&mixer_mutex);
+  pthread_mutex_unlock(&backend_mutex);
+  return response;
+}
+
+static void flush(void) {
+  pthread_mutex_lock(&mixer_mutex);
+  mixer_source *s = find_source();
+  if (s)
+    s->started = 0; // what's left of its timeline is no longer mixed
+  pthread_mutex_unlock(&mixer_mutex);
+}
+
+static void stop(void) {
+  pthread_mutex_lock(&backend_mutex);
+  pthread_mutex_lock(&mixer_mutex);
+  mixer_source *s = find_source();
+  if (s) {
+    debug(2, "mixer: source stopped after %" PRIu64 " frames, with %" PRIu64 " underruns.",
+          s->frames_played, s->underruns);
+    s->in_use = 0;
+    s->started = 0;
+    number_of_sources--;
+  }
+  int last_source = (number_of_sources == 0);
+  pthread_mutex_unlock(&mixer_mutex);
+  if ((last_source) && (backend_running)) {
+    if (backend->stop)
+      backend->stop();
+    audio_nominal_clock_reset(&backend_clock);
+    backend_running = 0;
+  }
+  pthread_mutex_unlock(&backend_mutex);
+}
+
+// prepare is filled in from the backend at init
+audio_output audio_mixer = {.name = "mixer",
+                            .help = &help,
+                            .init = &init,
+                            .deinit = &deinit,
+                            .prepare = NULL,
+                            .start = &start,
+                            .stop = &stop,
+                            .is_running = NULL,
+                            .flush = &flush,
+                            .delay = &delay,
+                            .rate_info = NULL,
+                            .presentation_time = NULL,
+                            .play = &play,
+                            .volume = NULL,
+                            .parameters = NULL,
+                            .mute = NULL};
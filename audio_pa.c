@@ -29,6 +29,7 @@
 
 #include "audio.h"
 #include "common.h"
+#include "ring_buffer.h"
 #include <errno.h>
 #include <pthread.h>
 #include <pulse/pulseaudio.h>
@@ -43,8 +44,6 @@
 // Four seconds buffer -- should be plenty
 #define buffer_allocation 44100 * 4 * 2 * 2
 
-static pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 /*
 static struct {
   char *server;
@@ -57,9 +56,9 @@ pa_threaded_mainloop *mainloop;
 pa_mainloop_api *mainloop_api;
 pa_context *context;
 pa_stream *stream;
-char *audio_lmb, *audio_umb, *audio_toq, *audio_eoq;
-size_t audio_size = buffer_allocation;
-size_t audio_occupancy;
+// the player thread writes into this and the pulseaudio write callback reads from it,
+// without locking
+ring_buffer audio_ring;
 
 void context_state_cb(pa_context *context, void *mainloop);
 void stream_state_cb(pa_stream *s, void *mainloop);
@@ -104,12 +103,8 @@ static int init(__attribute__((unused)) int argc, __attribute__((unused)) char *
   // finish collecting settings
 
   // allocate space for the audio buffer
-  audio_lmb = malloc(audio_size);
-  if (audio_lmb == NULL)
-    die("Can't allocate %d bytes for pulseaudio buffer.", audio_size);
-  audio_toq = audio_eoq = audio_lmb;
-  audio_umb = audio_lmb + audio_size;
-  audio_occupancy = 0;
+  if (ring_buffer_init(&audio_ring, buffer_allocation) != 0)
+    die("Can't allocate %d bytes for pulseaudio buffer.", buffer_allocation);
 
   // Get a mainloop and its context
   mainloop = pa_threaded_mainloop_new();
@@ -155,6 +150,7 @@ static int init(__attribute__((unused)) int argc, __attribute__((unused)) char *
 static void deinit(void) {
   pa_threaded_mainloop_stop(mainloop);
   pa_threaded_mainloop_free(mainloop);
+  ring_buffer_free(&audio_ring);
   // debug(1, "pa deinit done");
 }
 
@@ -227,23 +223,13 @@ static int play(void *buf, int samples) {
   // debug(1,"pa_play of %d samples.",samples);
   // copy the samples into the queue
   size_t bytes_to_transfer = samples * 2 * 2;
-  size_t space_to_end_of_buffer = audio_umb - audio_eoq;
-  if (space_to_end_of_buffer >= bytes_to_transfer) {
-    memcpy(audio_eoq, buf, bytes_to_transfer);
-    audio_occupancy += bytes_to_transfer;
-    pthread_mutex_lock(&buffer_mutex);
-    audio_eoq += bytes_to_transfer;
-    pthread_mutex_unlock(&buffer_mutex);
-  } else {
-    memcpy(audio_eoq, buf, space_to_end_of_buffer);
-    buf += space_to_end_of_buffer;
-    memcpy(audio_lmb, buf, bytes_to_transfer - space_to_end_of_buffer);
-    pthread_mutex_lock(&buffer_mutex);
-    audio_occupancy += bytes_to_transfer;
-    pthread_mutex_unlock(&buffer_mutex);
-    audio_eoq = audio_lmb + bytes_to_transfer - space_to_end_of_buffer;
+  size_t space = ring_buffer_space(&audio_ring);
+  if (space < bytes_to_transfer) {
+    debug(1, "pa: buffer overflow -- %zu frames dropped.", (bytes_to_transfer - space) / (2 * 2));
+    bytes_to_transfer = space - space % (2 * 2); // whole frames only
   }
-  if ((audio_occupancy >= 11025 * 2 * 2) && (pa_stream_is_corked(stream))) {
+  ring_buffer_write(&audio_ring, buf, bytes_to_transfer);
+  if ((ring_buffer_occupancy(&audio_ring) >= 11025 * 2 * 2) && (pa_stream_is_corked(stream))) {
     // debug(1,"Uncorked");
     pa_threaded_mainloop_lock(mainloop);
     pa_stream_cork(stream, 0, stream_success_cb, mainloop);
@@ -267,7 +253,7 @@ int pa_delay(long *the_delay) {
     // debug(1,"Error %d getting latency.",gl);
     reply = -EIO;
   } else {
-    result = (audio_occupancy / (2 * 2)) + (latency * 44100) / 1000000;
+    result = (ring_buffer_occupancy(&audio_ring) / (2 * 2)) + (latency * 44100) / 1000000;
     reply = 0;
   }
   *the_delay = result;
@@ -283,9 +269,7 @@ void flush(void) {
     pa_stream_cork(stream, 1, stream_success_cb, mainloop);
   }
   pa_threaded_mainloop_unlock(mainloop);
-  audio_toq = audio_eoq = audio_lmb;
-  audio_umb = audio_lmb + audio_size;
-  audio_occupancy = 0;
+  ring_buffer_reset(&audio_ring);
 }
 
 static void stop(void) {
@@ -297,9 +281,7 @@ static void stop(void) {
     pa_stream_cork(stream, 1, stream_success_cb, mainloop);
   }
   pa_threaded_mainloop_unlock(mainloop);
-  audio_toq = audio_eoq = audio_lmb;
-  audio_umb = audio_lmb + audio_size;
-  audio_occupancy = 0;
+  ring_buffer_reset(&audio_ring);
 
   // debug(1,"pa stop");
   pa_stream_disconnect(stream);
@@ -360,11 +342,12 @@ void stream_write_cb(pa_stream *stream, size_t requested_bytes,
       }
     }
   */
-  int bytes_to_transfer = requested_bytes;
-  int bytes_transferred = 0;
+  // the audio is copied straight from the ring buffer into pulseaudio's own buffer
+  size_t bytes_to_transfer = requested_bytes;
+  size_t audio_occupancy;
   uint8_t *buffer = NULL;
 
-  while ((bytes_to_transfer > 0) && (audio_occupancy > 0)) {
+  while ((bytes_to_transfer > 0) && ((audio_occupancy = ring_buffer_occupancy(&audio_ring)) > 0)) {
     size_t bytes_we_can_transfer = bytes_to_transfer;
     if (audio_occupancy < bytes_we_can_transfer) {
       // debug(1, "Underflow? We have %d bytes but we are asked for %d bytes", audio_occupancy,
@@ -376,36 +359,16 @@ void stream_write_cb(pa_stream *stream, size_t requested_bytes,
 
     // bytes we can transfer will never be greater than the bytes available
 
-    pa_stream_begin_write(stream, (void **)&buffer, &bytes_we_can_transfer);
-    if (bytes_we_can_transfer <= (size_t)(audio_umb - audio_toq)) {
-      // the bytes are all in a row in the audo buffer
-      memcpy(buffer, audio_toq, bytes_we_can_transfer);
-      audio_toq += bytes_we_can_transfer;
-      // lock
-      pthread_mutex_lock(&buffer_mutex);
-      audio_occupancy -= bytes_we_can_transfer;
-      pthread_mutex_unlock(&buffer_mutex);
-      // unlock
-      pa_stream_write(stream, buffer, bytes_we_can_transfer, NULL, 0LL, PA_SEEK_RELATIVE);
-      bytes_transferred += bytes_we_can_transfer;
-    } else {
-      // the bytes are in two places in the audio buffer
-      size_t first_portion_to_write = audio_umb - audio_toq;
-      if (first_portion_to_write != 0)
-        memcpy(buffer, audio_toq, first_portion_to_write);
-      uint8_t *new_buffer = buffer + first_portion_to_write;
-      memcpy(new_buffer, audio_lmb, bytes_we_can_transfer - first_portion_to_write);
-      pa_stream_write(stream, buffer, bytes_we_can_transfer, NULL, 0LL, PA_SEEK_RELATIVE);
-      bytes_transferred += bytes_we_can_transfer;
-      audio_toq = audio_lmb + bytes_we_can_transfer - first_portion_to_write;
-      // lock
-      pthread_mutex_lock(&buffer_mutex);
-      audio_occupancy -= bytes_we_can_transfer;
-      pthread_mutex_unlock(&buffer_mutex);
-      // unlock
+    if ((pa_stream_begin_write(stream, (void **)&buffer, &bytes_we_can_transfer) != 0) ||
+        (buffer == NULL))
+      break;
+    size_t bytes_transferred = ring_buffer_read(&audio_ring, buffer, bytes_we_can_transfer);
+    if (bytes_transferred == 0) { // it was flushed in the meantime
+      pa_stream_cancel_write(stream);
+      break;
     }
-    bytes_to_transfer -= bytes_we_can_transfer;
-    // debug(1,"audio_toq is %llx",audio_toq);
+    pa_stream_write(stream, buffer, bytes_transferred, NULL, 0LL, PA_SEEK_RELATIVE);
+    bytes_to_transfer -= bytes_transferred;
   }
 
   // debug(1,"<<<Frames requested %d, written to pa: %d, corked status:
@@ -30,69 +30,182 @@
 
 #include "audio.h"
 #include "common.h"
+#include "ring_buffer.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <memory.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-static int fd = -1;
+// Audio is copied into a ring buffer by the player thread and written to the pipe by a writer
+// thread of its own, so that a slow or stalled reader can't hold up the player.
+
+typedef enum {
+  pipe_overflow_drop_oldest = 0,
+  pipe_overflow_drop_newest,
+  pipe_overflow_block,
+} pipe_overflow_policy_type;
+
+static volatile int fd = -1; // only opened and closed by the writer thread
 
 char *pipename = NULL;
 
-static void start(__attribute__((unused)) int sample_rate,
-                  __attribute__((unused)) int sample_format) {
-
-  // this will leave fd as -1 if a reader hasn't been attached to the pipe
-  // we check that it's not a "real" error though. From the "man 2 open" page:
-  // "ENXIO  O_NONBLOCK | O_WRONLY is set, the named file is a FIFO, and no process has the FIFO
-  // open for reading."
-
-	fd = try_to_open_pipe_for_writing(pipename);
-	// we check that it's not a "real" error. From the "man 2 open" page:
-	// "ENXIO  O_NONBLOCK | O_WRONLY is set, the named file is a FIFO, and no process has the FIFO
-	// open for reading." Which is okay.
-	if ((fd == -1) && (errno != ENXIO)) {
-		char errorstring[1024];
-		strerror_r(errno, (char *)errorstring, sizeof(errorstring));
-		debug(1, "audio_pipe start -- error %d (\"%s\") opening pipe: \"%s\".", errno,
-					(char *)errorstring, pipename);
-		warn("can not open audio pipe -- error %d (\"%s\") opening pipe: \"%s\".", errno,
-					(char *)errorstring, pipename);
-	}
+static ring_buffer pipe_ring;
+static int pipe_bytes_per_frame = 4;
+static double pipe_buffer_length = 1.0; // seconds of audio the ring buffer can hold
+static pipe_overflow_policy_type pipe_overflow_policy = pipe_overflow_block;
+static double pipe_block_timeout = 0.25; // seconds to wait for space in the block policy
+
+// A reader that keeps up is assumed to take frames at the nominal rate, as with stdout. The
+// audio waiting in the ring buffer and in the pipe is used instead if there is more of it.
+static audio_nominal_clock pipe_clock;
+
+static pthread_t pipe_writer_thread;
+static pthread_mutex_t pipe_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipe_writer_cv = PTHREAD_COND_INITIALIZER; // signalled when data arrives
+static pthread_cond_t pipe_space_cv = PTHREAD_COND_INITIALIZER;  // signalled when data is taken
+
+// statistics
+volatile uint64_t pipe_bytes_written = 0; // bytes actually written to the pipe
+volatile uint64_t pipe_overrun_count = 0; // times the ring buffer overflowed
+volatile uint64_t pipe_bytes_dropped = 0; // bytes lost because of overflows
+
+static void pipe_writer_cleanup_handler(__attribute__((unused)) void *arg) {
+  if (fd > 0) {
+    close(fd);
+    fd = -1;
+  }
 }
 
-static int play(void *buf, int samples) {
-  // if the file is not open, try to open it.
+static void *pipe_writer_thread_code(__attribute__((unused)) void *arg) {
   char errorstring[1024];
-  if (fd == -1) {
-  	fd = try_to_open_pipe_for_writing(pipename);
+  uint8_t chunk[16384];
+  pthread_cleanup_push(pipe_writer_cleanup_handler, NULL);
+  while (1) {
+    size_t bytes_to_write;
+    pthread_mutex_lock(&pipe_writer_mutex);
+    pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&pipe_writer_mutex);
+    while (ring_buffer_occupancy(&pipe_ring) == 0)
+      pthread_cond_wait(&pipe_writer_cv, &pipe_writer_mutex); // this is a cancellation point
+    // take the audio with the mutex held, so that a player waiting for room can't miss the signal
+    bytes_to_write = ring_buffer_read(&pipe_ring, chunk, sizeof(chunk));
+    pthread_cond_signal(&pipe_space_cv);
+    pthread_cleanup_pop(1); // unlock the mutex
+    // if the pipe is not open, try to open it. If there is no reader, the audio is discarded.
+    if (fd == -1)
+      fd = try_to_open_pipe_for_writing(pipename);
+    size_t bytes_written = 0;
+    while ((fd > 0) && (bytes_written < bytes_to_write)) {
+      ssize_t rc = write(fd, chunk + bytes_written, bytes_to_write - bytes_written);
+      if (rc > 0) {
+        bytes_written += rc;
+        pipe_bytes_written += rc;
+      } else if ((rc < 0) && (errno != EINTR)) {
+        if (errno != EPIPE) {
+          strerror_r(errno, (char *)errorstring, 1024);
+          debug(1, "audio_pipe: error %d writing to the pipe named \"%s\": \"%s\".", errno,
+                pipename, errorstring);
+        }
+        // the reader has gone away -- try again when there's more audio
+        close(fd);
+        fd = -1;
+      }
+    }
   }
-  // if it's got a reader, write to it.
-  if (fd > 0) {
-    //int rc = non_blocking_write(fd, buf, samples * 4);
-    int rc = write(fd, buf, samples * 4);
-    if ((rc < 0) && (errno != EPIPE)) {
-      strerror_r(errno, (char *)errorstring, 1024);
-      debug(1, "audio_pip play: error %d writing to the pipe named \"%s\": \"%s\".", errno, pipename, errorstring);
+  pthread_cleanup_pop(1);
+  pthread_exit(NULL);
+}
+
+static void start(int sample_rate, __attribute__((unused)) int sample_format) {
+  // the pipe is opened by the writer thread when audio arrives
+  pipe_bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
+  audio_nominal_clock_start(&pipe_clock, sample_rate);
+}
+
+static int play(void *buf, int samples) {
+  size_t length = samples * pipe_bytes_per_frame;
+  size_t space = ring_buffer_space(&pipe_ring);
+  if (space < length) {
+    if (pipe_overflow_policy == pipe_overflow_block) {
+      // wait for the writer thread to make room
+      struct timespec time_limit;
+      clock_gettime(CLOCK_REALTIME, &time_limit);
+      uint64_t limit_ns =
+          (uint64_t)time_limit.tv_nsec + (uint64_t)(pipe_block_timeout * 1000000000);
+      time_limit.tv_sec += limit_ns / 1000000000;
+      time_limit.tv_nsec = limit_ns % 1000000000;
+      int rc = 0;
+      pthread_mutex_lock(&pipe_writer_mutex);
+      pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&pipe_writer_mutex);
+      while (((space = ring_buffer_space(&pipe_ring)) < length) && (rc == 0))
+        rc = pthread_cond_timedwait(&pipe_space_cv, &pipe_writer_mutex,
+                                    &time_limit); // this is a cancellation point
+      pthread_cleanup_pop(1); // unlock the mutex
+    } else if (pipe_overflow_policy == pipe_overflow_drop_oldest) {
+      // make room, keeping the ring buffer aligned to whole frames
+      size_t excess = length - space;
+      if (excess % pipe_bytes_per_frame)
+        excess += pipe_bytes_per_frame - excess % pipe_bytes_per_frame;
+      pipe_bytes_dropped += ring_buffer_discard(&pipe_ring, excess);
+      space = ring_buffer_space(&pipe_ring);
+    }
+    if (space < length) {
+      if ((pipe_overrun_count % 100) == 0)
+        debug(1, "audio_pipe: the pipe isn't being read fast enough -- %" PRIu64 " overruns.",
+              pipe_overrun_count + 1);
+      pipe_overrun_count++;
     }
   }
+  size_t written = ring_buffer_write(&pipe_ring, buf, length - length % pipe_bytes_per_frame);
+  pipe_bytes_dropped += length - written;
+  audio_nominal_clock_frames_sent(&pipe_clock, written / pipe_bytes_per_frame);
+  pthread_mutex_lock(&pipe_writer_mutex);
+  pthread_cond_signal(&pipe_writer_cv);
+  pthread_mutex_unlock(&pipe_writer_mutex);
+  return 0;
+}
+
+static int delay(long *the_delay) {
+  // the audio in the ring buffer plus whatever is in the pipe itself
+  size_t bytes_queued = ring_buffer_occupancy(&pipe_ring);
+  int bytes_in_pipe = 0;
+  int local_fd = fd;
+  if ((local_fd > 0) && (ioctl(local_fd, FIONREAD, &bytes_in_pipe) == 0) && (bytes_in_pipe > 0))
+    bytes_queued += bytes_in_pipe;
+  long frames_queued = bytes_queued / pipe_bytes_per_frame;
+  // a fast reader, such as a program writing to a file, empties the pipe as soon as audio arrives,
+  // so the queue alone would tell the player that the audio had already been heard
+  *the_delay = audio_nominal_clock_delay(&pipe_clock);
+  if (frames_queued > *the_delay)
+    *the_delay = frames_queued;
   return 0;
 }
 
+static void flush(void) {
+  ring_buffer_reset(&pipe_ring);
+  audio_nominal_clock_reset(&pipe_clock);
+}
+
 static void stop(void) {
+  audio_nominal_clock_reset(&pipe_clock);
   // Don't close the pipe just because a play session has stopped.
-
+  debug(2,
+        "audio_pipe: %" PRIu64 " bytes written, %" PRIu64 " overruns, %" PRIu64 " bytes dropped.",
+        pipe_bytes_written, pipe_overrun_count, pipe_bytes_dropped);
 }
 
 static int init(int argc, char **argv) {
   //  debug(1, "pipe init");
   //  const char *str;
   //  int value;
-  //  double dvalue;
+  double dvalue;
 
   // set up default values first
 
@@ -111,6 +224,39 @@ static int init(int argc, char **argv) {
 
     if ((pipename) && (strcasecmp(pipename, "STDOUT") == 0))
       die("Can't use \"pipe\" backend for STDOUT. Use the \"stdout\" backend instead.");
+
+    /* Get the size of the buffer between the player and the pipe. */
+    if (config_lookup_float(config.cfg, "pipe.buffer_length_in_seconds", &dvalue)) {
+      if ((dvalue < 0.1) || (dvalue > 10.0))
+        warn("Invalid pipe buffer_length_in_seconds setting \"%f\". It should be between 0.1 and "
+             "10.0. The default of %f will be used.",
+             dvalue, pipe_buffer_length);
+      else
+        pipe_buffer_length = dvalue;
+    }
+
+    /* Get what to do if the buffer is full. */
+    if (config_lookup_string(config.cfg, "pipe.overflow_policy", &str)) {
+      if (strcasecmp(str, "drop_oldest") == 0)
+        pipe_overflow_policy = pipe_overflow_drop_oldest;
+      else if (strcasecmp(str, "drop_newest") == 0)
+        pipe_overflow_policy = pipe_overflow_drop_newest;
+      else if (strcasecmp(str, "block") == 0)
+        pipe_overflow_policy = pipe_overflow_block;
+      else
+        warn("Invalid pipe overflow_policy choice \"%s\". It should be \"drop_oldest\", "
+             "\"drop_newest\" or \"block\". It is set to \"block\".",
+             str);
+    }
+
+    if (config_lookup_float(config.cfg, "pipe.overflow_block_timeout_in_seconds", &dvalue)) {
+      if ((dvalue < 0.0) || (dvalue > 5.0))
+        warn("Invalid pipe overflow_block_timeout_in_seconds setting \"%f\". It should be "
+             "between 0.0 and 5.0. The default of %f will be used.",
+             dvalue, pipe_block_timeout);
+      else
+        pipe_block_timeout = dvalue;
+    }
   }
 
   if ((pipename == NULL) && (argc != 1))
@@ -127,12 +273,24 @@ static int init(int argc, char **argv) {
 
   debug(1, "audio pipe name is \"%s\"", pipename);
 
+  pipe_bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
+  if (ring_buffer_init(&pipe_ring, (size_t)(pipe_buffer_length * config.output_rate) *
+                                       pipe_bytes_per_frame) != 0)
+    die("audio_pipe: can't allocate a buffer of %f seconds.", pipe_buffer_length);
+  debug(1, "audio pipe buffer is %f seconds; the overflow policy is \"%s\".", pipe_buffer_length,
+        pipe_overflow_policy == pipe_overflow_drop_oldest
+            ? "drop_oldest"
+            : pipe_overflow_policy == pipe_overflow_drop_newest ? "drop_newest" : "block");
+
+  pthread_create(&pipe_writer_thread, NULL, &pipe_writer_thread_code, NULL);
+
   return 0;
 }
 
 static void deinit(void) {
-  if (fd > 0)
-    close(fd);
+  pthread_cancel(pipe_writer_thread);
+  pthread_join(pipe_writer_thread, NULL); // the writer thread closes the pipe
+  ring_buffer_free(&pipe_ring);
 }
 
 static void help(void) { printf("    specify the pathname of the pipe to write to.\n"); }
@@ -145,8 +303,8 @@ audio_output audio_pipe = {.name = "pipe",
                            .start = &start,
                            .stop = &stop,
                            .is_running = NULL,
-                           .flush = NULL,
-                           .delay = NULL,
+                           .flush = &flush,
+                           .delay = &delay,
                            .play = &play,
                            .volume = NULL,
                            .parameters = NULL,
@@ -0,0 +1,202 @@
+/*
+ * Shared memory output driver. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Audio is published in a shared memory ring of blocks, each with a presentation time and a
+// sequence number, so that any number of local programs can read it directly and in time.
+// See audio_shm.h for the layout.
+
+#include "audio.h"
+#include "audio_shm.h"
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SHM_BLOCK_FRAMES 1024
+
+static char *shm_name = "/shairport-sync-audio";
+static double shm_buffer_length = 2.0; // seconds of audio held in the ring of blocks
+
+static shm_audio_header *shm_header = NULL;
+static shm_audio_block *shm_blocks = NULL;
+static uint8_t *shm_data = NULL;
+static size_t shm_size = 0;
+
+static uint64_t next_sequence = 1;
+static uint64_t next_presentation_time = 0; // zero if not known
+static int bytes_per_frame = 4;
+
+static void presentation_time(uint64_t local_time) { next_presentation_time = local_time; }
+
+static void start(__attribute__((unused)) int sample_rate,
+                  __attribute__((unused)) int sample_format) {
+  bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
+  if ((shm_header->rate != config.output_rate) || (shm_header->format != config.output_format)) {
+    // the generation is odd while the parameters are changing, so readers can't mix old and new
+    __atomic_add_fetch(&shm_header->format_generation, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&shm_header->rate, config.output_rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm_header->format, config.output_format, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm_header->bytes_per_frame, bytes_per_frame, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shm_header->format_generation, 1, __ATOMIC_RELEASE);
+  }
+  next_presentation_time = 0;
+}
+
+static int play(void *buf, int samples) {
+  uint8_t *p = buf;
+  while (samples > 0) {
+    int frames = samples;
+    if (frames > SHM_BLOCK_FRAMES)
+      frames = SHM_BLOCK_FRAMES;
+    uint64_t sequence = next_sequence++;
+    shm_audio_block *block = &shm_blocks[sequence % shm_header->block_count];
+    // mark the block as being written, so that readers will ignore it until it's done
+    __atomic_store_n(&block->sequence, 0, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    block->presentation_time = next_presentation_time;
+    block->frames = frames;
+    block->format_generation = shm_header->format_generation; // only this thread changes it
+    memcpy(shm_data + (sequence % shm_header->block_count) * shm_header->block_data_size, p,
+           frames * bytes_per_frame);
+    __atomic_store_n(&block->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm_header->latest_sequence, sequence, __ATOMIC_RELEASE);
+    // the next block follows on from this one, unless the player says otherwise
+    if (next_presentation_time)
+      next_presentation_time += ((uint64_t)frames * 1000000000) / config.output_rate;
+    p += frames * bytes_per_frame;
+    samples -= frames;
+  }
+  return 0;
+}
+
+static void stop(void) { next_presentation_time = 0; }
+
+static void flush(void) { next_presentation_time = 0; }
+
+static int init(__attribute__((unused)) int argc, __attribute__((unused)) char **argv) {
+  double dvalue;
+  // set up default values first
+  config.audio_backend_buffer_desired_length = 1.0;
+  config.audio_backend_latency_offset = 0;
+
+  // get settings from settings file
+  // do the "general" audio  options. Note, these options are in the "general" stanza!
+  parse_general_audio_options();
+
+  if (config.cfg != NULL) {
+    const char *str;
+    /* Get the name of the shared memory object. */
+    if (config_lookup_string(config.cfg, "shm.name", &str)) {
+      if (str[0] != '/')
+        die("Invalid shm name \"%s\". It must begin with a \"/\".", str);
+      shm_name = (char *)str;
+    }
+    /* Get the length of the ring of blocks in seconds. */
+    if (config_lookup_float(config.cfg, "shm.buffer_length_in_seconds", &dvalue)) {
+      if ((dvalue < 0.5) || (dvalue > 10.0))
+        warn("Invalid shm buffer_length_in_seconds setting \"%f\". It should be between 0.5 and "
+             "10.0. The default of %f will be used.",
+             dvalue, shm_buffer_length);
+      else
+        shm_buffer_length = dvalue;
+    }
+  }
+
+  // leave room for the largest frame the output formats use
+  uint32_t block_data_size = SHM_BLOCK_FRAMES * 8;
+  uint32_t block_count = (uint32_t)(shm_buffer_length * config.output_rate) / SHM_BLOCK_FRAMES + 1;
+  uint32_t header_size = (sizeof(shm_audio_header) + 63) & ~63;
+  size_t descriptors_size = (block_count * sizeof(shm_audio_block) + 63) & ~63;
+  shm_size = header_size + descriptors_size + (size_t)block_count * block_data_size;
+
+  int shm_fd = shm_open(shm_name, O_RDWR | O_CREAT, 0644);
+  if (shm_fd == -1)
+    die("audio_shm: can't open shared memory object \"%s\": %s.", shm_name, strerror(errno));
+  if (ftruncate(shm_fd, shm_size) != 0)
+    die("audio_shm: can't size shared memory object \"%s\": %s.", shm_name, strerror(errno));
+  void *shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  if (shm == MAP_FAILED)
+    die("audio_shm: can't map shared memory object \"%s\": %s.", shm_name, strerror(errno));
+  memset(shm, 0, shm_size);
+
+  shm_header = (shm_audio_header *)shm;
+  shm_blocks = (shm_audio_block *)((uint8_t *)shm + header_size);
+  shm_data = (uint8_t *)shm + header_size + descriptors_size;
+
+  bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
+  shm_header->header_size = header_size;
+  shm_header->block_count = block_count;
+  shm_header->block_frames = SHM_BLOCK_FRAMES;
+  shm_header->block_data_size = block_data_size;
+  shm_header->rate = config.output_rate;
+  shm_header->format = config.output_format;
+  shm_header->channels = 2;
+  shm_header->bytes_per_frame = bytes_per_frame;
+  shm_header->version = SHM_AUDIO_VERSION;
+  __atomic_store_n(&shm_header->magic, SHM_AUDIO_MAGIC, __ATOMIC_RELEASE);
+
+  debug(1, "audio shm name is \"%s\", with %u blocks of %u frames.", shm_name, block_count,
+        SHM_BLOCK_FRAMES);
+  return 0;
+}
+
+static void deinit(void) {
+  if (shm_header) {
+    munmap(shm_header, shm_size);
+    shm_header = NULL;
+  }
+  shm_unlink(shm_name);
+}
+
+static void help(void) {
+  printf("    There are no command-line options for the shm backend.\n"
+         "    The shared memory object is called \"%s\" by default.\n",
+         shm_name);
+}
+
+audio_output audio_shm = {.name = "shm",
+                          .help = &help,
+                          .init = &init,
+                          .deinit = &deinit,
+                          .prepare = NULL,
+                          .start = &start,
+                          .stop = &stop,
+                          .is_running = NULL,
+                          .flush = &flush,
+                          .delay = NULL,
+                          .play = &play,
+                          .presentation_time = &presentation_time,
+                          .volume = NULL,
+                          .parameters = NULL,
+                          .mute = NULL};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+// The layout of the shared memory published by the "shm" audio backend, for programs that read it.
+//
+// The shared memory object begins with a shm_audio_header, followed by an array of block_count
+// shm_audio_block descriptors, followed by block_count blocks of audio data, each
+// block_data_size bytes long. The audio is interleaved stereo in the format given in the
+// header (an sps_format_t value -- see common.h), at the rate given.
+//
+// The rate, format and bytes_per_frame fields can change when a play session starts. The
+// format_generation field is odd while they are being changed, and is even otherwise. To read
+// them:
+//   1. read format_generation -- if it's odd, try again;
+//   2. read the rate, format and bytes_per_frame;
+//   3. read format_generation again -- if it has changed, try again.
+//
+// Blocks are written in turn, each with the next sequence number, starting from 1. The block with
+// sequence number n is in slot n % block_count. To read it:
+//   1. read the block's sequence number -- if it's not n, the block has been overwritten or
+//      isn't there yet;
+//   2. read the presentation time, frame count, format generation and audio;
+//   3. read the block's sequence number again -- if it's still n, what was read is valid.
+// A block's format_generation is the low 32 bits of the header's format_generation when the block
+// was written. If it isn't the one the rate and format were read under, read them again; if it
+// still differs, the block was written with parameters that have since changed, so skip it.
+// The latest_sequence field of the header is the sequence number of the most recently completed
+// block. Presentation times are in nanoseconds on the CLOCK_MONOTONIC clock, and give the time
+// at which the first frame of the block should be heard. A presentation time of zero means the
+// time isn't known, e.g. for silence played while waiting for audio.
+
+#define SHM_AUDIO_MAGIC 0x53505341 // "SPSA"
+#define SHM_AUDIO_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size; // bytes from the start to the first shm_audio_block
+  uint32_t block_count;
+  uint32_t block_frames;    // the maximum number of frames in a block
+  uint32_t block_data_size; // bytes of audio data space per block
+  uint32_t rate;
+  uint32_t format; // an sps_format_t
+  uint32_t channels;
+  uint32_t bytes_per_frame;
+  volatile uint64_t latest_sequence; // zero if no block has been written yet
+  volatile uint64_t format_generation; // odd while rate, format or bytes_per_frame are changing
+} shm_audio_header;
+
+typedef struct {
+  volatile uint64_t sequence; // zero while the block is being written
+  uint64_t presentation_time; // CLOCK_MONOTONIC nanoseconds, or zero if not known
+  uint32_t frames;
+  uint32_t format_generation; // the low 32 bits of the header's format_generation when written
+} shm_audio_block;
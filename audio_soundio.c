@@ -7,21 +7,35 @@
 
 #include <soundio/soundio.h>
 
-struct SoundIoOutStream *outstream;
+struct SoundIoOutStream *outstream = NULL;
 struct SoundIo *soundio;
 struct SoundIoDevice *device;
 struct SoundIoRingBuffer *ring_buffer = NULL;
 
+// soundio_outstream_get_latency can only be called from the write callback, so the callback notes
+// when the audio it has handed to the device will have been played, in nanoseconds, for delay()
+static uint64_t device_drain_time = 0;
+
 static int min_int(int a, int b) { return (a < b) ? a : b; }
 
+static void note_device_latency(struct SoundIoOutStream *outstream) {
+  double device_latency;
+  if (soundio_outstream_get_latency(outstream, &device_latency) == 0)
+    __atomic_store_n(&device_drain_time,
+                     get_absolute_time_in_ns() + (uint64_t)(device_latency * 1000000000.0),
+                     __ATOMIC_RELEASE);
+}
+
 static void write_callback(struct SoundIoOutStream *outstream, int frame_count_min,
                            int frame_count_max) {
   struct SoundIoChannelArea *areas;
   // int frame_count;
   int err;
 
-  char *read_ptr = soundio_ring_buffer_read_ptr(ring_buffer);
-  int fill_bytes = soundio_ring_buffer_fill_count(ring_buffer);
+  if ((ring_buffer == NULL) && (frame_count_min == 0))
+    return; // there is no audio, and no need to play silence yet
+  char *read_ptr = ring_buffer ? soundio_ring_buffer_read_ptr(ring_buffer) : NULL;
+  int fill_bytes = ring_buffer ? soundio_ring_buffer_fill_count(ring_buffer) : 0;
   int fill_count = fill_bytes / outstream->bytes_per_frame;
 
   debug(3,
@@ -29,7 +43,7 @@ static void write_callback(struct SoundIoOutStream *outstream, int frame_count_m
         "outstream->bytes_per_frame: %d",
         frame_count_min, frame_count_max, fill_bytes, fill_count, outstream->bytes_per_frame);
 
-  if (frame_count_min > fill_count) {
+  if ((frame_count_min > fill_count) || (ring_buffer == NULL)) {
     int frame_count = frame_count_min;
     if ((err = soundio_outstream_begin_write(outstream, &areas, &frame_count))) {
       debug(0, "[--->>] begin write error: %s", soundio_strerror(err));
@@ -42,6 +56,7 @@ static void write_callback(struct SoundIoOutStream *outstream, int frame_count_m
     }
     if ((err = soundio_outstream_end_write(outstream)))
       debug(0, "[--->>] end write error: %s", soundio_strerror(err));
+    note_device_latency(outstream);
     return;
   }
 
@@ -73,6 +88,7 @@ static void write_callback(struct SoundIoOutStream *outstream, int frame_count_m
 
   debug(3, "[--->>]  Wrote: %d", read_count * outstream->bytes_per_frame);
   soundio_ring_buffer_advance_read_ptr(ring_buffer, read_count * outstream->bytes_per_frame);
+  note_device_latency(outstream);
 }
 
 static void underflow_callback(__attribute__((unused)) struct SoundIoOutStream *outstream) {
@@ -83,7 +99,8 @@ static void underflow_callback(__attribute__((unused)) struct SoundIoOutStream *
 static int init(__attribute__((unused)) int argc, __attribute__((unused)) char **argv) {
   int err;
 
-  config.audio_backend_buffer_desired_length = 2.0;
+  // must be comfortably less than the one second the ring buffer can hold
+  config.audio_backend_buffer_desired_length = 0.5;
   config.audio_backend_latency_offset = 0;
 
   // get settings from settings file
@@ -131,6 +148,8 @@ static void start(int sample_rate, int sample_format) {
 
   debug(1, "soundion rate: %d, format: %d", sample_rate, sample_format);
 
+  __atomic_store_n(&device_drain_time, 0, __ATOMIC_RELEASE);
+
   // soundio_device_sort_channel_layouts(device);
 
   outstream = soundio_outstream_create(device);
@@ -150,10 +169,9 @@ static void start(int sample_rate, int sample_format) {
   int capacity = outstream->sample_rate * outstream->bytes_per_frame;
   ring_buffer = soundio_ring_buffer_create(soundio, capacity);
   if (!ring_buffer)
-    debug(0, "unable to create ring buffer: out of memory");
-  char *buf = soundio_ring_buffer_write_ptr(ring_buffer);
-  memset(buf, 0, capacity);
-  soundio_ring_buffer_advance_write_ptr(ring_buffer, capacity);
+    warn("soundio: unable to create ring buffer: out of memory");
+  // Don't prefill the ring buffer with silence -- the write callback plays silence if it runs
+  // short, and the player sends its own silent lead-in based on what delay() reports.
 
   if ((err = soundio_outstream_start(outstream))) {
     debug(0, "unable to start outstream: %s", soundio_strerror(err));
@@ -164,6 +182,8 @@ static void start(int sample_rate, int sample_format) {
 
 static int play(void *buf, int samples) {
   // int err;
+  if (ring_buffer == NULL)
+    return -1;
   int free_bytes = soundio_ring_buffer_free_count(ring_buffer);
   int written_bytes = 0;
   int write_bytes = 0;
@@ -193,14 +213,32 @@ static void parameters(audio_parameters *info) {
   debug(2, "Maximum Volume dB: %d\n", info->maximum_volume_dB);
 }
 
+static int delay(long *the_delay) {
+  if ((outstream == NULL) || (ring_buffer == NULL))
+    return -1;
+  // frames waiting in our ring buffer, plus whatever is still queued in the device
+  long device_frames = 0;
+  uint64_t drain_time = __atomic_load_n(&device_drain_time, __ATOMIC_ACQUIRE);
+  uint64_t time_now = get_absolute_time_in_ns();
+  if (drain_time > time_now)
+    device_frames = (long)(((drain_time - time_now) * outstream->sample_rate) / 1000000000);
+  long frames_in_ring_buffer =
+      soundio_ring_buffer_fill_count(ring_buffer) / outstream->bytes_per_frame;
+  *the_delay = frames_in_ring_buffer + device_frames;
+  return 0;
+}
+
 static void stop(void) {
   soundio_outstream_destroy(outstream);
-  soundio_ring_buffer_clear(ring_buffer);
+  outstream = NULL;
+  if (ring_buffer)
+    soundio_ring_buffer_clear(ring_buffer);
   debug(1, "libsoundio output stopped\n");
 }
 
 static void flush(void) {
-  soundio_ring_buffer_clear(ring_buffer);
+  if (ring_buffer)
+    soundio_ring_buffer_clear(ring_buffer);
   debug(1, "libsoundio output flushed\n");
 }
 
@@ -215,7 +253,7 @@ audio_output audio_soundio = {.name = "soundio",
                               .stop = &stop,
                               .is_running = NULL,
                               .flush = &flush,
-                              .delay = NULL,
+                              .delay = &delay,
                               .play = &play,
                               .volume = NULL,
                               .parameters = &parameters,
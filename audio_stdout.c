@@ -38,9 +38,12 @@
 
 static int fd = -1;
 
-static void start(__attribute__((unused)) int sample_rate,
-                  __attribute__((unused)) int sample_format) {
+// we can't know how far behind the consumer is, so assume it takes frames at the nominal rate
+static audio_nominal_clock stdout_clock;
+
+static void start(int sample_rate, __attribute__((unused)) int sample_format) {
   fd = STDOUT_FILENO;
+  audio_nominal_clock_start(&stdout_clock, sample_rate);
 }
 
 static int play(void *buf, int samples) {
@@ -52,13 +55,20 @@ static int play(void *buf, int samples) {
     warn("Error %d writing to stdout: \"%s\".", errno, errorstring);
     warned = 1;
   }
+  if (rc > 0)
+    audio_nominal_clock_frames_sent(&stdout_clock, rc / 4);
   return rc;
 }
 
-static void stop(void) {
-  // Do nothing when play stops
+static int delay(long *the_delay) {
+  *the_delay = audio_nominal_clock_delay(&stdout_clock);
+  return 0;
 }
 
+static void flush(void) { audio_nominal_clock_reset(&stdout_clock); }
+
+static void stop(void) { audio_nominal_clock_reset(&stdout_clock); }
+
 static int init(__attribute__((unused)) int argc, __attribute__((unused)) char **argv) {
   // set up default values first
   config.audio_backend_buffer_desired_length = 1.0;
@@ -82,8 +92,8 @@ audio_output audio_stdout = {.name = "stdout",
                              .start = &start,
                              .stop = &stop,
                              .is_running = NULL,
-                             .flush = NULL,
-                             .delay = NULL,
+                             .flush = &flush,
+                             .delay = &delay,
                              .play = &play,
                              .volume = NULL,
                              .parameters = NULL,
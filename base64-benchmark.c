@@ -0,0 +1,482 @@
+/*
+ * base64 benchmark. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// This times the base64 codec in common.c against the implementations it replaced: the
+// base64_enc and base64_dec of the TLS library Shairport Sync is built with, and rtsp.c's
+// base64_encode_so, which encoded the metadata. Copies of those are kept here for the purpose.
+// The sizes are those of an Apple-Challenge, an AES key, a metadata item and a piece of artwork.
+// Before timing anything, each old implementation's output is checked against the codec's.
+
+#include "common.h"
+#include <inttypes.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CONFIG_OPENSSL
+#include <openssl/bio.h>
+#include <openssl/buffer.h>
+#include <openssl/evp.h>
+#endif
+
+#ifdef CONFIG_MBEDTLS
+#include <mbedtls/base64.h>
+#endif
+
+#ifdef CONFIG_POLARSSL
+#include <polarssl/base64.h>
+#endif
+
+#ifdef CONFIG_ALSA
+// common.c hands the ALSA backend the device named by the on-start command, but there's no
+// ALSA backend here.
+void set_alsa_out_dev(__attribute__((unused)) char *device) {}
+#endif
+
+// The old implementations, as they were, but for their names.
+
+#ifdef CONFIG_OPENSSL
+#define OLD_TLS_LIBRARY "OpenSSL"
+static char *old_tls_base64_enc(uint8_t *input, int length) {
+  int oldState;
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+  BIO *bmem, *b64;
+  BUF_MEM *bptr;
+  b64 = BIO_new(BIO_f_base64());
+  bmem = BIO_new(BIO_s_mem());
+  b64 = BIO_push(b64, bmem);
+  BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+  BIO_write(b64, input, length);
+  (void)BIO_flush(b64);
+  BIO_get_mem_ptr(b64, &bptr);
+
+  char *buf = (char *)malloc(bptr->length);
+  if (buf == NULL)
+    die("could not allocate memory for buf in base64_enc");
+  if (bptr->length) {
+    memcpy(buf, bptr->data, bptr->length - 1);
+    buf[bptr->length - 1] = 0;
+  }
+
+  BIO_free_all(b64);
+
+  pthread_setcancelstate(oldState, NULL);
+  return buf;
+}
+
+static uint8_t *old_tls_base64_dec(char *input, int *outlen) {
+  int oldState;
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+  BIO *bmem, *b64;
+  int inlen = strlen(input);
+
+  b64 = BIO_new(BIO_f_base64());
+  BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+  bmem = BIO_new(BIO_s_mem());
+  b64 = BIO_push(b64, bmem);
+
+  // Apple cut the padding off their challenges; restore it
+  BIO_write(bmem, input, inlen);
+  while (inlen++ & 3)
+    BIO_write(bmem, "=", 1);
+  (void)BIO_flush(bmem);
+
+  int bufsize = strlen(input) * 3 / 4 + 1;
+  uint8_t *buf = malloc(bufsize);
+  int nread;
+
+  nread = BIO_read(b64, buf, bufsize);
+
+  BIO_free_all(b64);
+
+  *outlen = nread;
+  pthread_setcancelstate(oldState, NULL);
+  return buf;
+}
+#endif
+
+#ifdef CONFIG_MBEDTLS
+#define OLD_TLS_LIBRARY "mbed TLS"
+static char *old_tls_base64_enc(uint8_t *input, int length) {
+  char *buf = NULL;
+  size_t dlen = 0;
+  int rc = mbedtls_base64_encode(NULL, 0, &dlen, input, length);
+  if (rc && (rc != MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL))
+    debug(1, "Error %d getting length of base64 encode.", rc);
+  else {
+    buf = (char *)malloc(dlen);
+    rc = mbedtls_base64_encode((unsigned char *)buf, dlen, &dlen, input, length);
+    if (rc != 0)
+      debug(1, "Error %d encoding base64.", rc);
+  }
+  return buf;
+}
+
+static uint8_t *old_tls_base64_dec(char *input, int *outlen) {
+  // slight problem here is that Apple cut the padding off their challenges. We must restore it
+  // before passing it in to the decoder, it seems
+  uint8_t *buf = NULL;
+  size_t dlen = 0;
+  int inbufsize = ((strlen(input) + 3) / 4) * 4; // this is the size of the input buffer we will
+                                                 // send to the decoder, but we need space for 3
+                                                 // extra "="s and a NULL
+  char *inbuf = malloc(inbufsize + 4);
+  if (inbuf == 0)
+    debug(1, "Can't malloc memory  for inbuf in base64_decode.");
+  else {
+    strcpy(inbuf, input);
+    strcat(inbuf, "===");
+    int rc = mbedtls_base64_decode(NULL, 0, &dlen, (unsigned char *)inbuf, inbufsize);
+    if (rc && (rc != MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL))
+      debug(1, "Error %d getting decode length, result is %d.", rc, dlen);
+    else {
+      buf = malloc(dlen);
+      if (buf == 0)
+        debug(1, "Can't allocate memory in base64_dec.");
+      else {
+        rc = mbedtls_base64_decode(buf, dlen, &dlen, (unsigned char *)inbuf, inbufsize);
+        if (rc != 0)
+          debug(1, "Error %d in base64_dec.", rc);
+      }
+    }
+    free(inbuf);
+  }
+  *outlen = dlen;
+  return buf;
+}
+#endif
+
+#ifdef CONFIG_POLARSSL
+#define OLD_TLS_LIBRARY "PolarSSL"
+static char *old_tls_base64_enc(uint8_t *input, int length) {
+  char *buf = NULL;
+  size_t dlen = 0;
+  int rc = base64_encode(NULL, &dlen, input, length);
+  if (rc && (rc != POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL))
+    debug(1, "Error %d getting length of base64 encode.", rc);
+  else {
+    buf = (char *)malloc(dlen);
+    rc = base64_encode((unsigned char *)buf, &dlen, input, length);
+    if (rc != 0)
+      debug(1, "Error %d encoding base64.", rc);
+  }
+  return buf;
+}
+
+static uint8_t *old_tls_base64_dec(char *input, int *outlen) {
+  // slight problem here is that Apple cut the padding off their challenges. We must restore it
+  // before passing it in to the decoder, it seems
+  uint8_t *buf = NULL;
+  size_t dlen = 0;
+  int inbufsize = ((strlen(input) + 3) / 4) * 4; // this is the size of the input buffer we will
+                                                 // send to the decoder, but we need space for 3
+                                                 // extra "="s and a NULL
+  char *inbuf = malloc(inbufsize + 4);
+  if (inbuf == 0)
+    debug(1, "Can't malloc memory  for inbuf in base64_decode.");
+  else {
+    strcpy(inbuf, input);
+    strcat(inbuf, "===");
+    int rc = base64_decode(buf, &dlen, (unsigned char *)inbuf, inbufsize);
+    if (rc && (rc != POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL))
+      debug(1, "Error %d getting decode length, result is %d.", rc, dlen);
+    else {
+      buf = malloc(dlen);
+      if (buf == 0)
+        debug(1, "Can't allocate memory in base64_dec.");
+      else {
+        rc = base64_decode(buf, &dlen, (unsigned char *)inbuf, inbufsize);
+        if (rc != 0)
+          debug(1, "Error %d in base64_dec.", rc);
+      }
+    }
+    free(inbuf);
+  }
+  *outlen = dlen;
+  return buf;
+}
+#endif
+
+// rtsp.c's encoder, from Stack Overflow, with thanks:
+// http://stackoverflow.com/questions/342409/how-do-i-base64-encode-decode-in-c
+
+static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+                                'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+                                'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+                                'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+                                '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
+
+static size_t mod_table[] = {0, 2, 1};
+
+static char *old_base64_encode_so(const unsigned char *data, size_t input_length,
+                                  char *encoded_data, size_t *output_length) {
+
+  size_t calculated_output_length = 4 * ((input_length + 2) / 3);
+  if (calculated_output_length > *output_length)
+    return (NULL);
+  *output_length = calculated_output_length;
+
+  size_t i, j;
+  for (i = 0, j = 0; i < input_length;) {
+
+    uint32_t octet_a = i < input_length ? (unsigned char)data[i++] : 0;
+    uint32_t octet_b = i < input_length ? (unsigned char)data[i++] : 0;
+    uint32_t octet_c = i < input_length ? (unsigned char)data[i++] : 0;
+
+    uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
+
+    encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
+    encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
+    encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
+    encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+  }
+
+  for (i = 0; i < mod_table[input_length % 3]; i++)
+    encoded_data[*output_length - 1 - i] = '=';
+
+  return encoded_data;
+}
+
+// The contenders. Each does one encoding or decoding of the input and returns the length of its
+// output, or -1 if it failed. Those that allocate their output free it again, as a caller must.
+
+typedef struct {
+  uint8_t *data;
+  size_t length;
+  char *encoded; // NUL-terminated, by the codec
+  size_t encoded_length;
+  char *unpadded; // the same, with the padding cut off, as Apple sends challenges
+  char *output;   // room for an encoding or decoding
+} benchmark_input;
+
+typedef struct {
+  const char *name;
+  long (*run)(benchmark_input *in);
+  long shortfall; // how many characters short of the whole encoding its output is
+} benchmark_contender;
+
+static long codec_encode_into(benchmark_input *in) {
+  return base64_encode_into(in->data, in->length, in->output, 0);
+}
+
+static long codec_base64_enc(benchmark_input *in) {
+  char *out = base64_enc(in->data, in->length);
+  if (out == NULL)
+    return -1;
+  long length = strlen(out);
+  free(out);
+  return length;
+}
+
+static long old_encode_so(benchmark_input *in) {
+  size_t length = base64_encoded_length(in->length, 0);
+  if (old_base64_encode_so(in->data, in->length, in->output, &length) == NULL)
+    return -1;
+  return length;
+}
+
+#ifdef OLD_TLS_LIBRARY
+static long old_tls_encode(benchmark_input *in) {
+  char *out = old_tls_base64_enc(in->data, in->length);
+  if (out == NULL)
+    return -1;
+  long length = strlen(out);
+  free(out);
+  return length;
+}
+
+static long old_tls_decode(benchmark_input *in) {
+  int length;
+  uint8_t *out = old_tls_base64_dec(in->unpadded, &length);
+  if (out == NULL)
+    return -1;
+  free(out);
+  return length;
+}
+#endif
+
+static long codec_base64_dec(benchmark_input *in) {
+  int length;
+  uint8_t *out = base64_dec(in->unpadded, &length);
+  if (out == NULL)
+    return -1;
+  free(out);
+  return length;
+}
+
+static long codec_decoder(benchmark_input *in) {
+  base64_decoder d;
+  base64_decoder_init(&d);
+  int length = base64_decoder_update(&d, in->unpadded, strlen(in->unpadded), (uint8_t *)in->output);
+  if (length < 0)
+    return -1;
+  int rest = base64_decoder_final(&d, (uint8_t *)in->output + length);
+  if (rest < 0)
+    return -1;
+  return length + rest;
+}
+
+// The old OpenSSL base64_enc cut the last character off, taking it for a newline. It was only
+// used for the Apple-Challenge response, whose padding is removed anyway, so no harm was done.
+#ifdef CONFIG_OPENSSL
+#define OLD_TLS_ENCODER_SHORTFALL 1
+#else
+#define OLD_TLS_ENCODER_SHORTFALL 0
+#endif
+
+static benchmark_contender encoders[] = {
+    {"codec, base64_encode_into", codec_encode_into, 0},
+    {"codec, base64_enc", codec_base64_enc, 0},
+    {"old rtsp.c base64_encode_so", old_encode_so, 0},
+#ifdef OLD_TLS_LIBRARY
+    {"old " OLD_TLS_LIBRARY " base64_enc", old_tls_encode, OLD_TLS_ENCODER_SHORTFALL},
+#endif
+    {NULL, NULL, 0}};
+
+static benchmark_contender decoders[] = {
+    {"codec, base64_decoder_update", codec_decoder, 0},
+    {"codec, base64_dec", codec_base64_dec, 0},
+#ifdef OLD_TLS_LIBRARY
+    {"old " OLD_TLS_LIBRARY " base64_dec", old_tls_decode, 0},
+#endif
+    {NULL, NULL, 0}};
+
+static struct {
+  const char *description;
+  size_t length;
+} sizes[] = {{"Apple-Challenge", 16},
+             {"RSA-wrapped AES key", 256},
+             {"metadata item", 1024},
+             {"artwork", 256 * 1024},
+             {NULL, 0}};
+
+static int check_contenders(benchmark_contender *contenders, benchmark_input *in, int decoding) {
+  int failures = 0;
+  benchmark_contender *c;
+  for (c = contenders; c->name != NULL; c++) {
+    memset(in->output, 0, in->encoded_length + 1);
+    long length = c->run(in);
+    long expected = decoding ? (long)in->length : (long)in->encoded_length - c->shortfall;
+    int output_checked = (c->run == codec_encode_into) || (c->run == old_encode_so);
+    int mismatch = (length != expected);
+    if ((mismatch == 0) && (output_checked))
+      mismatch = memcmp(in->output, in->encoded, in->encoded_length) != 0;
+    if ((mismatch == 0) && (c->run == codec_decoder))
+      mismatch = memcmp(in->output, in->data, in->length) != 0;
+    if (mismatch) {
+      fprintf(stderr, "%s gave a wrong result for %zu bytes: length %ld, expected %ld.\n",
+              c->name, in->length, length, expected);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+static void time_contenders(benchmark_contender *contenders, benchmark_input *in,
+                            const char *description, double minimum_time, int decoding) {
+  benchmark_contender *c;
+  for (c = contenders; c->name != NULL; c++) {
+    // run it enough times to take the minimum time, doubling the count until it does
+    uint64_t runs = 1;
+    uint64_t elapsed;
+    for (;;) {
+      uint64_t start = get_absolute_time_in_ns();
+      uint64_t i;
+      for (i = 0; i < runs; i++)
+        c->run(in);
+      elapsed = get_absolute_time_in_ns() - start;
+      if ((elapsed * 1.0E-9 >= minimum_time) || (runs >= (UINT64_C(1) << 40)))
+        break;
+      runs *= 2;
+    }
+    double ns_per_run = (1.0 * elapsed) / runs;
+    printf("%-6s %7zu bytes (%-19s)  %-34s %11.1f ns %9.1f MB/s\n",
+           decoding ? "decode" : "encode", in->length, description, c->name, ns_per_run,
+           (1000.0 * in->length) / ns_per_run);
+  }
+}
+
+int main(int argc, char **argv) {
+  double minimum_time = 0.2;
+  int seed = 0;
+
+  struct poptOption optionsTable[] = {
+      {"time", 't', POPT_ARG_DOUBLE, &minimum_time, 0,
+       "How long to time each contender at each size for -- the default is 0.2.", "SECONDS"},
+      {"seed", 's', POPT_ARG_INT, &seed, 0, "The seed for the random input.", "NUMBER"},
+      POPT_AUTOHELP{NULL, 0, 0, NULL, 0, NULL, NULL}};
+
+  poptContext optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0);
+  int c;
+  while ((c = poptGetNextOpt(optCon)) >= 0) {
+  }
+  if (c < -1) {
+    fprintf(stderr, "%s: %s\n", poptBadOption(optCon, POPT_BADOPTION_NOALIAS), poptStrerror(c));
+    return 1;
+  }
+  poptFreeContext(optCon);
+
+  log_to_stderr();
+  r64init(seed);
+
+  printf("The codec's vector instructions: %s.\n", base64_encoder_instructions());
+  int failures = 0;
+  int i;
+  for (i = 0; sizes[i].description != NULL; i++) {
+    benchmark_input in;
+    in.length = sizes[i].length;
+    in.encoded_length = base64_encoded_length(in.length, 0);
+    in.data = malloc(in.length);
+    in.encoded = malloc(in.encoded_length + 1);
+    in.unpadded = malloc(in.encoded_length + 1);
+    in.output = malloc(in.encoded_length + 4);
+    if ((in.data == NULL) || (in.encoded == NULL) || (in.unpadded == NULL) || (in.output == NULL))
+      die("Can not allocate memory for the benchmark.");
+    size_t j;
+    for (j = 0; j < in.length; j++)
+      in.data[j] = r64u();
+    base64_encode_into(in.data, in.length, in.encoded, 0);
+    in.encoded[in.encoded_length] = '\0';
+    strcpy(in.unpadded, in.encoded);
+    char *padding = strchr(in.unpadded, '=');
+    if (padding != NULL)
+      *padding = '\0';
+
+    failures += check_contenders(encoders, &in, 0);
+    failures += check_contenders(decoders, &in, 1);
+    time_contenders(encoders, &in, sizes[i].description, minimum_time, 0);
+    time_contenders(decoders, &in, sizes[i].description, minimum_time, 1);
+
+    free(in.output);
+    free(in.unpadded);
+    free(in.encoded);
+    free(in.data);
+  }
+  if (failures)
+    fprintf(stderr, "%d results were wrong.\n", failures);
+  return failures ? 1 : 0;
+}
@@ -51,6 +51,11 @@ typedef enum {
   ST_auto,      // use soxr if compiled for it and if the soxr_index is low enough
 } stuffing_type;
 
+typedef enum {
+  MPO_drop = 0, // drop an item that the metadata pipe's backlog has no room for
+  MPO_wait,     // wait up to the pipe timeout for room, then drop it
+} metadata_pipe_overflow_policy_type;
+
 typedef enum {
   ST_stereo = 0,
   ST_mono,
@@ -93,11 +98,13 @@ typedef enum {
   SPS_FORMAT_S32,
   SPS_FORMAT_S32_LE,
   SPS_FORMAT_S32_BE,
+  SPS_FORMAT_FLOAT, // native-endian 32-bit float, full scale is +/- 1.0
   SPS_FORMAT_AUTO,
   SPS_FORMAT_INVALID,
 } sps_format_t;
 
 const char *sps_format_description_string(sps_format_t format);
+int sps_format_bytes_per_frame(sps_format_t format); // for a stereo frame sent to the output
 
 typedef struct {
   double missing_port_dacp_scan_interval_seconds; // if no DACP port number can be found, check at
@@ -130,6 +137,10 @@ typedef struct {
   char *metadata_sockaddr;
   int metadata_sockport;
   size_t metadata_sockmsglength;
+  int metadata_sockpacing; // milliseconds between bursts of packets, 0 for none
+  int metadata_pipe_timeout; // milliseconds
+  size_t metadata_pipe_backlog_size;
+  metadata_pipe_overflow_policy_type metadata_pipe_overflow_policy;
   int get_coverart;
 #endif
 #ifdef CONFIG_MQTT
@@ -146,6 +157,10 @@ typedef struct {
   int mqtt_publish_raw;
   int mqtt_publish_parsed;
   int mqtt_publish_cover;
+  int mqtt_publish_json;
+  int mqtt_retain_state;
+  int mqtt_qos;
+  int mqtt_queue_length;
   int mqtt_enable_remote;
 #endif
   uint8_t hw_addr[6];
@@ -161,6 +176,7 @@ typedef struct {
                           // Zero means never
                           // resync.
   int allow_session_interruption;
+  int maximum_concurrent_sessions; // more than one only if the mixer backend can mix them
   int timeout; // while in play mode, exit if no packets of audio come in for more than this number
                // of seconds . Zero means never exit.
   int dont_check_timeout; // this is used to maintain backward compatibility with the old -t option
@@ -261,9 +277,13 @@ typedef struct {
 #if defined(CONFIG_MPRIS_INTERFACE)
   dbus_session_type mpris_service_bus_type;
 #endif
+#if defined(CONFIG_DBUS_INTERFACE) || defined(CONFIG_MPRIS_INTERFACE)
+  int dbus_update_interval; // milliseconds between property updates
+#endif
 
 #ifdef CONFIG_METADATA_HUB
   char *cover_art_cache_dir;
+  size_t cover_art_cache_size; // bytes
   int retain_coverart;
 
   int scan_interval_when_active;   // number of seconds between DACP server scans when playing
@@ -274,6 +294,8 @@ typedef struct {
                                    // (10)
   int scan_max_inactive_count;     // number of scans to do before stopping if not made active again
                                    // (about 15 minutes worth)
+  int dacp_long_poll_timeout;      // seconds a playstatusupdate long poll may wait for a change,
+                                   // 0 to scan instead (30)
 #endif
   int disable_resend_requests; // set this to stop resend request being made for missing packets
   double diagnostic_drop_packet_fraction; // pseudo randomly drop this fraction of packets, for
@@ -326,6 +348,40 @@ void r64init(uint64_t seed);
 uint64_t r64u();
 int64_t r64i();
 
+// The player's decision, made afresh for each block, on whether to add a frame (1), drop one (-1)
+// or leave the block alone (0) to work off a sync error, given in frames (positive means late).
+int stuffing_for_sync_error(int64_t sync_error, double tolerance_in_frames);
+
+// What the player does with a block, given its sync error, when the backend reports its delay.
+// It is here rather than in the player so that the sync simulator runs the same code.
+typedef enum {
+  sync_action_play,         // play the block, with amount_to_stuff frames added or removed
+  sync_action_flush,        // resynchronise by flushing frames_to_drop frames, this block included
+  sync_action_play_silence, // resynchronise by playing silence_length frames instead of the block
+} sync_action;
+
+typedef struct {
+  sync_action action;
+  int64_t sync_error;     // in frames, positive if late, less any padding
+  int64_t padding;        // frames of silence to play before the first block, if it's early
+  int64_t frames_to_drop; // in output frames
+  int64_t silence_length;
+  int amount_to_stuff;
+} sync_decision;
+
+// Stuffing is held off for the first five seconds after the first packet of a session is due
+// to be played, to keep the corrections definitely below 1 in 1000 audio frames.
+int stuffing_is_held_off(uint64_t time_now, uint64_t first_packet_time_to_play);
+
+// first_block is set for the first block of a play session, which is padded with silence if it's
+// early. blocks_out_of_bounds counts blocks in a row with a sync error beyond the resync
+// threshold, and starts at zero. Resynchronising is done only if may_resync is set -- it isn't
+// for a block standing in for a missing packet -- and the threshold is positive. The amount to
+// stuff is zero unless may_stuff is set.
+void sync_decide(int64_t sync_error, int first_block, int *blocks_out_of_bounds,
+                 double tolerance_in_frames, double resync_threshold_in_frames, int may_resync,
+                 int may_stuff, sync_decision *d);
+
 // if you are breaking in to a session, you need to avoid the ports of the current session
 // if you are law-abiding, then you can reuse the ports.
 // so, you can reset the free UDP ports minder when you're legit, and leave it otherwise
@@ -349,6 +405,42 @@ void _debug(const char *filename, const int linenumber, int level, const char *f
 #define warn(...) _warn(__FILE__, __LINE__, __VA_ARGS__)
 #define inform(...) _inform(__FILE__, __LINE__, __VA_ARGS__)
 
+// base64 -- see common.c
+// The encoder and decoder can be given their input in pieces. The encoder puts a newline between
+// lines of line_length characters (a multiple of four) or, if it's zero, makes one long line.
+typedef struct {
+  size_t line_length;
+  size_t line_position;
+  uint8_t carry[3]; // input bytes waiting for a third
+  size_t carry_length;
+} base64_encoder;
+
+typedef struct {
+  uint32_t bits;
+  int sextets; // characters waiting for a fourth
+  int padding; // a "=" has been seen
+} base64_decoder;
+
+// the number of characters that length bytes encode to, not counting a terminating NUL
+size_t base64_encoded_length(size_t length, size_t line_length);
+void base64_encoder_init(base64_encoder *e, size_t line_length);
+// these return the number of characters written to out, which must have room for
+// base64_encoded_length(length + 2, line_length) or 4 characters and a newline, respectively
+size_t base64_encoder_update(base64_encoder *e, const uint8_t *input, size_t length, char *out);
+size_t base64_encoder_final(base64_encoder *e, char *out);
+// all in one go -- no NUL is added. (PolarSSL has a base64_encode of its own.)
+size_t base64_encode_into(const uint8_t *input, size_t length, char *out, size_t line_length);
+// the vector instructions used for whole blocks -- "AVX2", "SSSE3", "NEON" or "none"
+const char *base64_encoder_instructions(void);
+
+void base64_decoder_init(base64_decoder *d);
+// these return the number of bytes written to out, or -1 if the input isn't valid base64.
+// White space is skipped and padding is optional. The update needs room for 3 * (length + 3) / 4
+// bytes, the final for 2
+int base64_decoder_update(base64_decoder *d, const char *input, size_t length, uint8_t *out);
+int base64_decoder_final(base64_decoder *d, uint8_t *out);
+
+// these return malloc'ed memory, or NULL on failure
 uint8_t *base64_dec(char *input, int *outlen);
 char *base64_enc(uint8_t *input, int length);
 
@@ -368,6 +460,17 @@ double vol2attn(double vol, long max_db, long min_db);
 // uint64_t get_absolute_time_in_fp(void); // obselete
 uint64_t get_absolute_time_in_ns(void);
 
+// get_absolute_time_in_ns() normally reads the system's monotonic clock, via
+// get_system_time_in_ns(), but another source of time, such as the simulated clock, can be
+// substituted. Do it before any threads are started. NULL restores the system clock.
+typedef uint64_t (*time_source_function)(void);
+void set_time_source(time_source_function source);
+uint64_t get_system_time_in_ns(void);
+
+uint64_t get_simulated_time_in_ns(void);
+void set_simulated_time_in_ns(uint64_t time_in_ns);
+void advance_simulated_time_in_ns(uint64_t interval_in_ns);
+
 // time at startup for debugging timing
 extern uint64_t ns_time_at_startup, ns_time_at_last_debug_message;
 
@@ -62,6 +62,9 @@ typedef struct {
 
 int dacp_monitor_initialised = 0;
 pthread_t dacp_monitor_thread;
+// while the monitor thread is waiting on a long poll, this thread keeps the volume up to date
+pthread_t dacp_volume_monitor_thread;
+int dacp_long_poll_in_progress = 0; // accessed atomically
 dacp_server_record dacp_server;
 void *mdns_dacp_monitor_private_storage_pointer;
 
@@ -71,6 +74,7 @@ struct HttpResponse {
   ssize_t malloced_size; // this will be its allocated size
   ssize_t size;          // the current size of the content
   int code;
+  int close_connection; // the server will close the connection after this response
 };
 
 void *response_realloc(__attribute__((unused)) void *opaque, void *ptr, int size) {
@@ -101,10 +105,13 @@ void response_body(void *opaque, const char *data, int size) {
   response->size += size;
 }
 
-static void
-response_header(__attribute__((unused)) void *opaque, __attribute__((unused)) const char *ckey,
-                __attribute__((unused)) int nkey, __attribute__((unused)) const char *cvalue,
-                __attribute__((unused)) int nvalue) { /* example doesn't care about headers */
+static void response_header(void *opaque, const char *ckey, int nkey, const char *cvalue,
+                            int nvalue) {
+  // the only header of interest is "Connection: close"
+  struct HttpResponse *response = (struct HttpResponse *)opaque;
+  if ((nkey == 10) && (strncasecmp(ckey, "connection", 10) == 0) && (nvalue == 5) &&
+      (strncasecmp(cvalue, "close", 5) == 0))
+    response->close_connection = 1;
 }
 
 static void response_code(void *opaque, int code) {
@@ -137,18 +144,310 @@ void mutex_lock_cleanup(void *arg) {
     debug(1, "Error releasing mutex.");
 }
 
-void connect_cleanup(void *arg) {
-  int *fd = (int *)arg;
-  // debug(2, "dacp_send_command: close socket %d.",*fd);
-  close(*fd);
-}
-
 void http_cleanup(void *arg) {
   // debug(1, "http cleanup called.");
   struct http_roundtripper *rt = (struct http_roundtripper *)arg;
   http_free(rt);
 }
 
+void response_cleanup(void *arg) {
+  struct HttpResponse *response = (struct HttpResponse *)arg;
+  free(response->body);
+  response->body = NULL;
+}
+
+// A connection to the DACP server is kept open from one request to the next, and the server's
+// address is looked up only when the server changes. Commands share one connection, used under
+// the dacp_conversation_lock. Playstatusupdate long polls, which can wait a long time for an
+// answer, have one of their own, used only by the monitor thread.
+typedef struct {
+  int fd;
+  pthread_mutex_t fd_lock; // held while the fd is changed, so that it can be interrupted safely
+  char server[1040];       // "server port" of the cached address, if any
+  struct sockaddr_storage address;
+  socklen_t address_length;
+  uint64_t connections_made;
+  uint64_t connections_reused;
+} dacp_connection;
+
+static dacp_connection dacp_command_connection = {.fd = -1,
+                                                  .fd_lock = PTHREAD_MUTEX_INITIALIZER};
+static dacp_connection dacp_long_poll_connection = {.fd = -1,
+                                                    .fd_lock = PTHREAD_MUTEX_INITIALIZER};
+
+// latency statistics, per command
+typedef struct {
+  char command[48]; // the command, without its arguments
+  uint64_t count;
+  uint64_t failures;
+  uint64_t total_time; // nanoseconds
+  uint64_t max_time;
+} dacp_command_statistics;
+
+#define DACP_COMMAND_STATISTICS_SIZE 32
+static dacp_command_statistics dacp_statistics[DACP_COMMAND_STATISTICS_SIZE];
+
+static void dacp_log_command_statistics(int level, dacp_command_statistics *s) {
+  debug(level,
+        "DACP \"%s\": %" PRIu64 " sent, %" PRIu64 " failed, average %.3f ms, maximum %.3f ms.",
+        s->command, s->count, s->failures, (0.000001 * s->total_time) / s->count,
+        0.000001 * s->max_time);
+}
+
+static void dacp_record_command_statistics(const char *command, int code, uint64_t time) {
+  size_t length = strcspn(command, "?");
+  dacp_command_statistics *s = NULL;
+  int i;
+  for (i = 0; (i < DACP_COMMAND_STATISTICS_SIZE) && (s == NULL); i++) {
+    if (dacp_statistics[i].command[0] == '\0') {
+      if (length >= sizeof(dacp_statistics[i].command))
+        length = sizeof(dacp_statistics[i].command) - 1;
+      memcpy(dacp_statistics[i].command, command, length);
+      dacp_statistics[i].command[length] = '\0';
+      s = &dacp_statistics[i];
+    } else if ((strncmp(dacp_statistics[i].command, command, length) == 0) &&
+               (dacp_statistics[i].command[length] == '\0')) {
+      s = &dacp_statistics[i];
+    }
+  }
+  if (s) { // if the table is full, new commands aren't recorded
+    s->count++;
+    if ((code != 200) && (code != 204))
+      s->failures++;
+    s->total_time += time;
+    if (time > s->max_time)
+      s->max_time = time;
+    if ((s->count % 100) == 0)
+      dacp_log_command_statistics(3, s);
+  }
+}
+
+static void dacp_connection_close(dacp_connection *c, int abort) {
+  pthread_mutex_lock(&c->fd_lock);
+  if (c->fd != -1) {
+    if (abort) {
+      // reset the connection rather than leaving it in TIME_WAIT
+      struct linger so_linger;
+      so_linger.l_onoff = 1; // "true"
+      so_linger.l_linger = 0;
+      if (setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof so_linger))
+        debug(1, "Could not set the dacp socket to abort on closing.");
+    }
+    // debug(2, "dacp_send_command: close socket %d.",c->fd);
+    close(c->fd);
+    c->fd = -1;
+  }
+  pthread_mutex_unlock(&c->fd_lock);
+}
+
+void dacp_connection_cleanup(void *arg) {
+  // if cancelled in the middle of a conversation, the connection can't be used again
+  dacp_connection_close((dacp_connection *)arg, 1);
+}
+
+// make a request waiting on the connection give up at once
+static void dacp_connection_interrupt(dacp_connection *c) {
+  pthread_mutex_lock(&c->fd_lock);
+  if (c->fd != -1)
+    shutdown(c->fd, SHUT_RDWR);
+  pthread_mutex_unlock(&c->fd_lock);
+}
+
+// open a connection to the server unless one is open already. Returns 0 or an error code.
+static int dacp_connection_open(dacp_connection *c, const char *server, const char *portstring) {
+  char key[sizeof(c->server)];
+  snprintf(key, sizeof(key), "%s %s", server, portstring);
+  if (strcmp(key, c->server) != 0) {
+    // the server has changed
+    dacp_connection_close(c, 0);
+    c->server[0] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // debug(1, "DACP port string is \"%s:%s\".", server, portstring);
+    int ires = getaddrinfo(server, portstring, &hints, &res);
+    if (ires) {
+      // debug(1,"Error %d \"%s\" at getaddrinfo.",ires,gai_strerror(ires));
+      return 498; // Bad Address information for the DACP server
+    }
+    memcpy(&c->address, res->ai_addr, res->ai_addrlen);
+    c->address_length = res->ai_addrlen;
+    freeaddrinfo(res);
+    strcpy(c->server, key);
+  }
+
+  if (c->fd != -1)
+    return 0;
+
+  // make a socket:
+  int sockfd = socket(c->address.ss_family, SOCK_STREAM, 0);
+  if (sockfd == -1) {
+    // debug(1, "DACP socket could not be created -- error %d:
+    // \"%s\".",errno,strerror(errno));
+    return 497; // Can't establish a socket to the DACP server
+  }
+  // debug(2, "dacp_send_command: open socket %d.",sockfd);
+
+  // This is for limiting the time to be spent waiting to send.
+  struct timeval tv;
+  tv.tv_sec = 0;
+  tv.tv_usec = 500000;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof tv) == -1)
+    debug(1, "dacp_send_command: error %d setting send timeout.", errno);
+
+  // connect!
+  // debug(1, "DACP socket created.");
+  pthread_mutex_lock(&c->fd_lock);
+  c->fd = sockfd; // so that a cancellation will close it
+  pthread_mutex_unlock(&c->fd_lock);
+  if (connect(sockfd, (struct sockaddr *)&c->address, c->address_length) < 0) {
+    // debug(1, "dacp_send_command: connect failed with errno %d.", errno);
+    int code = 496; // Can't connect to the DACP server
+    if (errno == ECONNREFUSED)
+      code = 491; // DACP server doesn't want to talk anymore...
+    dacp_connection_close(c, 0);
+    c->server[0] = '\0'; // look the server up again next time
+    return code;
+  }
+  // debug(1,"DACP connect succeeded.");
+  c->connections_made++;
+  return 0;
+}
+
+// send the message on the open connection and parse the response, waiting up to timeout
+// microseconds for each piece of it. If nothing at all comes back, *silent is set, so that the
+// caller can tell that a kept-alive connection had been closed.
+static void dacp_exchange(dacp_connection *c, const char *message, struct HttpResponse *response,
+                          uint64_t timeout, int *silent) {
+  *silent = 0;
+  ssize_t wresp = send(c->fd, message, strlen(message), 0);
+  if (wresp != (ssize_t)strlen(message)) {
+    if (wresp == -1) {
+      char errorstring[1024];
+      strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+      debug(2, "dacp_send_command: write error %d: \"%s\".", errno, (char *)errorstring);
+      if ((errno == EPIPE) || (errno == ECONNRESET))
+        *silent = 1;
+    }
+    // debug(1, "dacp_send_command: send failed.");
+    response->code = 493; // Client failed to send a message
+    return;
+  }
+
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000000;
+  tv.tv_usec = timeout % 1000000;
+  if (setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv) == -1)
+    debug(1, "dacp_send_command: error %d setting receive timeout.", errno);
+
+  response->body = malloc(2048); // it can resize this if necessary
+  response->malloced_size = 2048;
+
+  struct http_roundtripper rt;
+  http_init(&rt, responseFuncs, response);
+  pthread_cleanup_push(http_cleanup, &rt);
+
+  int needmore = 1;
+  int looperror = 0;
+  ssize_t received = 0;
+  char buffer[8192];
+  memset(buffer, 0, sizeof(buffer));
+  while (needmore && !looperror) {
+    const char *data = buffer;
+    ssize_t ndata = recv(c->fd, buffer, sizeof(buffer), 0);
+    // debug(3, "Received %d bytes: \"%s\".", ndata, buffer);
+    if (ndata <= 0) {
+      if (ndata == -1) {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        debug(2, "dacp_send_command: receiving error %d: \"%s\".", errno, (char *)errorstring);
+      }
+      if ((received == 0) && ((ndata == 0) || (errno == ECONNRESET)))
+        *silent = 1;
+      free(response->body);
+      response->body = NULL;
+      response->malloced_size = 0;
+      response->size = 0;
+      response->code = 495; // Error receiving response
+      looperror = 1;
+    } else {
+      received += ndata;
+    }
+
+    while (needmore && ndata > 0 && !looperror) {
+      int read;
+      needmore = http_data(&rt, data, ndata, &read);
+      ndata -= read;
+      data += read;
+    }
+  }
+
+  if (http_iserror(&rt)) {
+    debug(3, "dacp_send_command: error parsing data.");
+    free(response->body);
+    response->body = NULL;
+    response->malloced_size = 0;
+    response->size = 0;
+    response->close_connection = 1;
+  }
+  // debug(1,"Size of response body is %d",response.size);
+  pthread_cleanup_pop(1); // this should call http_cleanup
+}
+
+// Reads can be sent again safely. Other commands, such as volumeup or nextitem, might have been
+// carried out by a server that then closed the connection without answering.
+static int dacp_command_can_be_repeated(const char *command) {
+  return (strncmp(command, "getproperty", strlen("getproperty")) == 0) ||
+         (strncmp(command, "playstatusupdate", strlen("playstatusupdate")) == 0);
+}
+
+// send the command to the DACP server on the connection and get the response
+static void dacp_request(dacp_connection *c, const char *command, struct HttpResponse *response,
+                         uint64_t timeout) {
+  char portstring[10], server[1024], message[1024];
+  memset(&portstring, 0, sizeof(portstring));
+  if (dacp_server.connection_family == AF_INET6) {
+    snprintf(server, sizeof(server), "%s%%%u", dacp_server.ip_string, dacp_server.scope_id);
+  } else {
+    strcpy(server, dacp_server.ip_string);
+  }
+  snprintf(portstring, sizeof(portstring), "%u", dacp_server.port);
+
+  snprintf(message, sizeof(message),
+           "GET /ctrl-int/1/%s HTTP/1.1\r\nHost: %s:%u\r\nActive-Remote: %u\r\n\r\n", command,
+           dacp_server.ip_string, dacp_server.port, dacp_server.active_remote_id);
+
+  // A kept-alive connection may have been closed by the server since it was last used. If
+  // so, nothing comes back, and the command is sent again on a new connection -- if it couldn't
+  // be sent at all, or if it's a read that can safely be repeated.
+  int attempts = 2;
+  while (attempts--) {
+    int reusing = (c->fd != -1);
+    response->code = dacp_connection_open(c, server, portstring);
+    if (response->code == 0) {
+      int silent;
+      // Send command
+      debug(3, "dacp_send_command: \"%s\".", command);
+      dacp_exchange(c, message, response, timeout, &silent);
+      if ((response->code == 493) || (response->code == 495) || (response->close_connection)) {
+        dacp_connection_close(c, (silent == 0) && (response->close_connection == 0));
+        if ((reusing) && (silent) &&
+            ((response->code == 493) || (dacp_command_can_be_repeated(command)))) {
+          debug(3, "dacp_send_command: kept-alive connection was closed -- reconnecting.");
+          response->close_connection = 0;
+          continue;
+        }
+      } else if (reusing) {
+        c->connections_reused++;
+      }
+    }
+    attempts = 0;
+  }
+}
+
 int dacp_send_command(const char *command, char **body, ssize_t *bodysize) {
   int result;
   // debug(1,"dacp_send_command: command is: \"%s\".",command);
@@ -171,190 +470,44 @@ int dacp_send_command(const char *command, char **body, ssize_t *bodysize) {
     //  491 Client refused connection
     //  490 No port specified
 
-    struct addrinfo hints, *res;
-    int sockfd;
-
     struct HttpResponse response;
     response.body = NULL;
     response.malloced_size = 0;
     response.size = 0;
     response.code = 0;
-
-    char portstring[10], server[1024], message[1024];
-    memset(&portstring, 0, sizeof(portstring));
-    if (dacp_server.connection_family == AF_INET6) {
-      snprintf(server, sizeof(server), "%s%%%u", dacp_server.ip_string, dacp_server.scope_id);
-    } else {
-      strcpy(server, dacp_server.ip_string);
-    }
-    snprintf(portstring, sizeof(portstring), "%u", dacp_server.port);
-
-    // first, load up address structs with getaddrinfo():
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    // debug(1, "DACP port string is \"%s:%s\".", server, portstring);
-
-    int ires = getaddrinfo(server, portstring, &hints, &res);
-    if (ires) {
-      // debug(1,"Error %d \"%s\" at getaddrinfo.",ires,gai_strerror(ires));
-      response.code = 498; // Bad Address information for the DACP server
+    response.close_connection = 0;
+
+    uint64_t start_time = get_absolute_time_in_ns();
+    // only do this one at a time -- not sure it is necessary, but better safe than sorry
+
+    int mutex_reply = sps_pthread_mutex_timedlock(&dacp_conversation_lock, 2000000, command, 1);
+    // int mutex_reply = pthread_mutex_lock(&dacp_conversation_lock);
+    if (mutex_reply == 0) {
+      pthread_cleanup_push(mutex_lock_cleanup, (void *)&dacp_conversation_lock);
+      pthread_cleanup_push(dacp_connection_cleanup, (void *)&dacp_command_connection);
+      pthread_cleanup_push(response_cleanup, (void *)&response);
+
+      dacp_request(&dacp_command_connection, command, &response, 500000);
+      dacp_record_command_statistics(command, response.code,
+                                     get_absolute_time_in_ns() - start_time);
+
+      pthread_cleanup_pop(0); // the response body goes to the caller
+      pthread_cleanup_pop(0); // the connection stays open
+      pthread_cleanup_pop(1); // this should unlock the dacp_conversation_lock);
+      // pthread_mutex_unlock(&dacp_conversation_lock);
+      // debug(1,"Sent command\"%s\" with a response body of size %d.",command,response.size);
+      // debug(1,"dacp_conversation_lock released.");
     } else {
-      uint64_t start_time = get_absolute_time_in_ns();
-      pthread_cleanup_push(addrinfo_cleanup, (void *)&res);
-      // only do this one at a time -- not sure it is necessary, but better safe than sorry
-
-      int mutex_reply = sps_pthread_mutex_timedlock(&dacp_conversation_lock, 2000000, command, 1);
-      // int mutex_reply = pthread_mutex_lock(&dacp_conversation_lock);
-      if (mutex_reply == 0) {
-        pthread_cleanup_push(mutex_lock_cleanup, (void *)&dacp_conversation_lock);
-
-        // make a socket:
-        sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-
-        if (sockfd == -1) {
-          // debug(1, "DACP socket could not be created -- error %d:
-          // \"%s\".",errno,strerror(errno));
-          response.code = 497; // Can't establish a socket to the DACP server
-        } else {
-          pthread_cleanup_push(connect_cleanup, (void *)&sockfd);
-          // debug(2, "dacp_send_command: open socket %d.",sockfd);
-
-          // This is for limiting the time to be spent waiting for a response.
-
-          struct timeval tv;
-          tv.tv_sec = 0;
-          tv.tv_usec = 500000;
-          if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv) == -1)
-            debug(1, "dacp_send_command: error %d setting receive timeout.", errno);
-          if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof tv) == -1)
-            debug(1, "dacp_send_command: error %d setting send timeout.", errno);
-
-          // connect!
-          // debug(1, "DACP socket created.");
-          if (connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
-            // debug(1, "dacp_send_command: connect failed with errno %d.", errno);
-            if (errno == ECONNREFUSED)
-              response.code = 491; // DACP server doesn't want to talk anymore...
-            else
-              response.code = 496; // Can't connect to the DACP server
-          } else {
-            // debug(1,"DACP connect succeeded.");
-
-            snprintf(message, sizeof(message),
-                     "GET /ctrl-int/1/%s HTTP/1.1\r\nHost: %s:%u\r\nActive-Remote: %u\r\n\r\n",
-                     command, dacp_server.ip_string, dacp_server.port,
-                     dacp_server.active_remote_id);
-
-            // Send command
-            debug(3, "dacp_send_command: \"%s\".", command);
-            ssize_t wresp = send(sockfd, message, strlen(message), 0);
-            if (wresp == -1) {
-              char errorstring[1024];
-              strerror_r(errno, (char *)errorstring, sizeof(errorstring));
-              debug(2, "dacp_send_command: write error %d: \"%s\".", errno, (char *)errorstring);
-              struct linger so_linger;
-              so_linger.l_onoff = 1; // "true"
-              so_linger.l_linger = 0;
-              int err = setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof so_linger);
-              if (err)
-                debug(1, "Could not set the dacp socket to abort due to a write error on closing.");
-            }
-            if (wresp != (ssize_t)strlen(message)) {
-              // debug(1, "dacp_send_command: send failed.");
-              response.code = 493; // Client failed to send a message
-
-            } else {
-
-              response.body = malloc(2048); // it can resize this if necessary
-              response.malloced_size = 2048;
-              pthread_cleanup_push(malloc_cleanup, response.body);
-
-              struct http_roundtripper rt;
-              http_init(&rt, responseFuncs, &response);
-              pthread_cleanup_push(http_cleanup, &rt);
-
-              int needmore = 1;
-              int looperror = 0;
-              char buffer[8192];
-              memset(buffer, 0, sizeof(buffer));
-              while (needmore && !looperror) {
-                const char *data = buffer;
-                if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv) == -1)
-                  debug(1, "dacp_send_command: error %d setting receive timeout.", errno);
-                ssize_t ndata = recv(sockfd, buffer, sizeof(buffer), 0);
-                // debug(3, "Received %d bytes: \"%s\".", ndata, buffer);
-                if (ndata <= 0) {
-                  if (ndata == -1) {
-                    char errorstring[1024];
-                    strerror_r(errno, (char *)errorstring, sizeof(errorstring));
-                    debug(2, "dacp_send_command: receiving error %d: \"%s\".", errno,
-                          (char *)errorstring);
-                    struct linger so_linger;
-                    so_linger.l_onoff = 1; // "true"
-                    so_linger.l_linger = 0;
-                    int err =
-                        setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof so_linger);
-                    if (err)
-                      debug(
-                          1,
-                          "Could not set the dacp socket to abort due to a read error on closing.");
-                  }
-
-                  free(response.body);
-                  response.body = NULL;
-                  response.malloced_size = 0;
-                  response.size = 0;
-                  response.code = 495; // Error receiving response
-                  looperror = 1;
-                }
-
-                while (needmore && ndata && !looperror) {
-                  int read;
-                  needmore = http_data(&rt, data, ndata, &read);
-                  ndata -= read;
-                  data += read;
-                }
-              }
-
-              if (http_iserror(&rt)) {
-                debug(3, "dacp_send_command: error parsing data.");
-                free(response.body);
-                response.body = NULL;
-                response.malloced_size = 0;
-                response.size = 0;
-              }
-              // debug(1,"Size of response body is %d",response.size);
-              pthread_cleanup_pop(1); // this should call http_cleanup
-              // http_free(&rt);
-              pthread_cleanup_pop(
-                  0); // this should *not* free the malloced buffer -- just pop the malloc cleanup
-            }
-          }
-          pthread_cleanup_pop(1); // this should close the socket
-                                  // close(sockfd);
-                                  // debug(1,"DACP socket closed.");
-        }
-        pthread_cleanup_pop(1); // this should unlock the dacp_conversation_lock);
-        // pthread_mutex_unlock(&dacp_conversation_lock);
-        // debug(1,"Sent command\"%s\" with a response body of size %d.",command,response.size);
-        // debug(1,"dacp_conversation_lock released.");
-      } else {
-        debug(3,
-              "dacp_send_command: could not acquire a lock on the dacp transmit/receive section "
-              "when attempting to "
-              "send the command \"%s\". Possible timeout?",
-              command);
-        response.code = 494; // This client is already busy
-      }
-      pthread_cleanup_pop(1); // this should free the addrinfo
-      // freeaddrinfo(res);
-      uint64_t et = get_absolute_time_in_ns() - start_time; // this will be in nanoseconds
-      debug(3, "dacp_send_command: %f seconds, response code %d, command \"%s\".",
-            (1.0 * et) / 1000000000, response.code, command);
+      debug(3,
+            "dacp_send_command: could not acquire a lock on the dacp transmit/receive section "
+            "when attempting to "
+            "send the command \"%s\". Possible timeout?",
+            command);
+      response.code = 494; // This client is already busy
     }
+    uint64_t et = get_absolute_time_in_ns() - start_time; // this will be in nanoseconds
+    debug(3, "dacp_send_command: %f seconds, response code %d, command \"%s\".",
+          (1.0 * et) / 1000000000, response.code, command);
     *body = response.body;
     *bodysize = response.size;
     result = response.code;
@@ -362,6 +515,33 @@ int dacp_send_command(const char *command, char **body, ssize_t *bodysize) {
   return result;
 }
 
+// Ask for a playstatusupdate newer than revision_number. A server that supports long polling
+// holds the request until something changes, so this can take up to
+// config.dacp_long_poll_timeout seconds. Only the monitor thread calls this.
+static int dacp_long_poll(int32_t revision_number, char **body, ssize_t *bodysize) {
+  if (dacp_server.port == 0)
+    return 490; // no port specified
+
+  struct HttpResponse response;
+  response.body = NULL;
+  response.malloced_size = 0;
+  response.size = 0;
+  response.code = 0;
+  response.close_connection = 0;
+
+  char command[64];
+  snprintf(command, sizeof(command), "playstatusupdate?revision-number=%d", revision_number);
+  pthread_cleanup_push(dacp_connection_cleanup, (void *)&dacp_long_poll_connection);
+  pthread_cleanup_push(response_cleanup, (void *)&response);
+  dacp_request(&dacp_long_poll_connection, command, &response,
+               (uint64_t)config.dacp_long_poll_timeout * 1000000);
+  pthread_cleanup_pop(0); // the response body goes to the caller
+  pthread_cleanup_pop(0); // the connection stays open
+  *body = response.body;
+  *bodysize = response.size;
+  return response.code;
+}
+
 int send_simple_dacp_command(const char *command) {
   int reply = 0;
   char *server_reply = NULL;
@@ -403,6 +583,7 @@ void set_dacp_server_information(rtsp_conn_info *conn) {
       dacp_server.dacp_id[0] = '\0';
     dacp_server.port = 0;
     dacp_server.scan_enable = 0;
+    dacp_connection_interrupt(&dacp_long_poll_connection); // it's waiting on the old server
     dacp_server.connection_family = conn->connection_ip_family;
     dacp_server.scope_id = conn->self_scope_id;
     strncpy(dacp_server.ip_string, conn->client_ip_string, INET6_ADDRSTRLEN);
@@ -458,6 +639,8 @@ void dacp_monitor_port_update_callback(char *dacp_id, uint16_t port) {
         "number %d.",
         dacp_id, dacp_server.dacp_id, port);
   if (strcmp(dacp_id, dacp_server.dacp_id) == 0) {
+    if (port != dacp_server.port)
+      dacp_connection_interrupt(&dacp_long_poll_connection);
     dacp_server.port = port;
     if (port == 0)
       dacp_server.scan_enable = 0;
@@ -481,6 +664,32 @@ void dacp_monitor_thread_code_cleanup(__attribute__((unused)) void *arg) {
   pthread_mutex_unlock(&dacp_server_information_lock);
 }
 
+static void dacp_note_volume(int32_t the_volume) {
+  metadata_hub_modify_prolog();
+  int diff = metadata_store.speaker_volume != the_volume;
+  if (diff)
+    metadata_store.speaker_volume = the_volume;
+  metadata_hub_modify_epilog(diff);
+}
+
+// A long poll only returns when the play status changes, and a volume change made at the remote
+// isn't a play status change, so the volume is read on the command connection as often as the
+// monitor thread would otherwise have scanned.
+void *dacp_volume_monitor_thread_code(__attribute__((unused)) void *na) {
+  while (1) {
+    if (metadata_store.player_thread_active)
+      sleep(config.scan_interval_when_active);
+    else
+      sleep(config.scan_interval_when_inactive);
+    if (__atomic_load_n(&dacp_long_poll_in_progress, __ATOMIC_ACQUIRE)) {
+      int32_t the_volume;
+      if (dacp_get_volume(&the_volume) == 200)
+        dacp_note_volume(the_volume);
+    }
+  }
+  pthread_exit(NULL);
+}
+
 void *dacp_monitor_thread_code(__attribute__((unused)) void *na) {
   int scan_index = 0;
   int always_use_revision_number_1 = 0;
@@ -490,6 +699,11 @@ void *dacp_monitor_thread_code(__attribute__((unused)) void *na) {
   int32_t revision_number = 1;
   int bad_result_count = 0;
   int idle_scan_count = 0;
+  // Long polling is tried with every new DACP server, and abandoned if the server turns out not
+  // to hold playstatusupdate requests.
+  char long_poll_dacp_id[256] = "";
+  int long_polls_supported = 0;
+  int quick_long_poll_count = 0;
   while (1) {
     int result = 0;
     sps_pthread_mutex_timedlock(
@@ -553,6 +767,11 @@ void *dacp_monitor_thread_code(__attribute__((unused)) void *na) {
 
     always_use_revision_number_1 =
         dacp_server.always_use_revision_number_1; // set this while access is locked
+    if (strcmp(long_poll_dacp_id, dacp_server.dacp_id) != 0) {
+      strcpy(long_poll_dacp_id, dacp_server.dacp_id);
+      long_polls_supported = (config.dacp_long_poll_timeout != 0);
+      quick_long_poll_count = 0;
+    }
 
     result = dacp_get_volume(&the_volume); // just want the http code
     pthread_cleanup_pop(1);
@@ -563,6 +782,7 @@ void *dacp_monitor_thread_code(__attribute__((unused)) void *na) {
         mdns_dacp_monitor_set_id(dacp_server.dacp_id);
       }
     } else {
+      int skip_scan_interval = 0;
       scan_index++;
       // debug(1,"DACP Scan Result: %d.", result);
 
@@ -638,22 +858,45 @@ void *dacp_monitor_thread_code(__attribute__((unused)) void *na) {
       //      dacp_server.ip_string, dacp_server.port, scan_index);
 
       if (result == 200) {
-        metadata_hub_modify_prolog();
-        int diff = metadata_store.speaker_volume != the_volume;
-        if (diff)
-          metadata_store.speaker_volume = the_volume;
-        metadata_hub_modify_epilog(diff);
+        dacp_note_volume(the_volume);
 
         ssize_t le;
         char *response = NULL;
         int32_t item_size;
         char command[1024] = "";
-        if (always_use_revision_number_1 != 0) // for forked-daapd
+        // forked-daapd holds the request until something changes, which is just what a long
+        // poll wants
+        if ((always_use_revision_number_1 != 0) && (long_polls_supported == 0))
           revision_number = 1;
-        snprintf(command, sizeof(command) - 1, "playstatusupdate?revision-number=%d",
-                 revision_number);
-        // debug(1,"dacp_monitor_thread_code: command: \"%s\"",command);
-        result = dacp_send_command(command, &response, &le);
+        // revision 1 is always answered at once, with the full status
+        int long_poll = (long_polls_supported != 0) && (revision_number > 1);
+        uint64_t poll_start_time = get_absolute_time_in_ns();
+        if (long_poll) {
+          __atomic_store_n(&dacp_long_poll_in_progress, 1, __ATOMIC_RELEASE);
+          result = dacp_long_poll(revision_number, &response, &le);
+          __atomic_store_n(&dacp_long_poll_in_progress, 0, __ATOMIC_RELEASE);
+        } else {
+          snprintf(command, sizeof(command) - 1, "playstatusupdate?revision-number=%d",
+                   revision_number);
+          // debug(1,"dacp_monitor_thread_code: command: \"%s\"",command);
+          result = dacp_send_command(command, &response, &le);
+        }
+        if (long_poll) {
+          uint64_t poll_time = get_absolute_time_in_ns() - poll_start_time;
+          // A server that doesn't hold the request answers at once, with 403 if there's nothing
+          // new. Three changes in a row, each reported at once, mean the same thing.
+          if ((result == 200) && (poll_time < 50000000))
+            quick_long_poll_count++;
+          else
+            quick_long_poll_count = 0;
+          if ((result == 403) || (quick_long_poll_count == 3)) {
+            debug(2, "DACP server doesn't hold playstatusupdate requests -- scanning instead.");
+            long_polls_supported = 0;
+          } else if ((result == 200) || ((result == 495) && (poll_time >= 1000000000))) {
+            // something changed, or nothing did for a long time -- poll again straight away
+            skip_scan_interval = 1;
+          }
+        }
         // debug(1,"Response to \"%s\" is %d.",command,result);
         // remember: unless the revision_number you pass in is 1,
         // response will be 200 only if there's something new to report.
@@ -913,10 +1156,12 @@ void *dacp_monitor_thread_code(__attribute__((unused)) void *na) {
         response = NULL;
       }
       */
-      if (metadata_store.player_thread_active)
-        sleep(config.scan_interval_when_active);
-      else
-        sleep(config.scan_interval_when_inactive);
+      if (skip_scan_interval == 0) {
+        if (metadata_store.player_thread_active)
+          sleep(config.scan_interval_when_active);
+        else
+          sleep(config.scan_interval_when_inactive);
+      }
     }
   }
   debug(1, "DACP monitor thread exiting -- should never happen.");
@@ -986,14 +1231,26 @@ void dacp_monitor_start() {
   memset(&dacp_server, 0, sizeof(dacp_server_record));
 
   pthread_create(&dacp_monitor_thread, NULL, dacp_monitor_thread_code, NULL);
+  pthread_create(&dacp_volume_monitor_thread, NULL, dacp_volume_monitor_thread_code, NULL);
   dacp_monitor_initialised = 1;
 }
 
 void dacp_monitor_stop() {
   if (dacp_monitor_initialised) { // only if it's been started and initialised
     debug(2, "dacp_monitor_stop");
+    pthread_cancel(dacp_volume_monitor_thread);
+    pthread_join(dacp_volume_monitor_thread, NULL);
     pthread_cancel(dacp_monitor_thread);
     pthread_join(dacp_monitor_thread, NULL);
+    pthread_mutex_lock(&dacp_conversation_lock);
+    dacp_connection_close(&dacp_command_connection, 0);
+    dacp_connection_close(&dacp_long_poll_connection, 0);
+    debug(2, "DACP connections made: %" PRIu64 ", reused: %" PRIu64 ".",
+          dacp_command_connection.connections_made, dacp_command_connection.connections_reused);
+    int i;
+    for (i = 0; (i < DACP_COMMAND_STATISTICS_SIZE) && (dacp_statistics[i].command[0]); i++)
+      dacp_log_command_statistics(2, &dacp_statistics[i]);
+    pthread_mutex_unlock(&dacp_conversation_lock);
     pthread_mutex_destroy(&dacp_server_information_lock);
     debug(3, "DACP Conversation Lock Mutex Destroyed");
     pthread_mutex_destroy(&dacp_conversation_lock);
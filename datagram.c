@@ -0,0 +1,144 @@
+/*
+ * Send a run of datagrams with as few system calls as possible.
+ *
+ * This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// This is a file of its own because glibc only declares sendmmsg and recvmmsg with _GNU_SOURCE,
+// which would also change strerror_r for the rest of a file.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "datagram.h"
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+
+#define DATAGRAMS_PER_CALL 64
+
+#ifdef HAVE_SENDMMSG
+
+unsigned int send_datagrams(int sock, const struct sockaddr *to, socklen_t to_length,
+                            struct iovec *iov, unsigned int iov_per_datagram, unsigned int count) {
+  struct mmsghdr messages[DATAGRAMS_PER_CALL];
+  unsigned int sent = 0;
+  while (sent < count) {
+    unsigned int batch = count - sent;
+    if (batch > DATAGRAMS_PER_CALL)
+      batch = DATAGRAMS_PER_CALL;
+    unsigned int i;
+    memset(messages, 0, sizeof(struct mmsghdr) * batch);
+    for (i = 0; i < batch; i++) {
+      messages[i].msg_hdr.msg_name = (void *)to;
+      messages[i].msg_hdr.msg_namelen = to_length;
+      messages[i].msg_hdr.msg_iov = iov + (sent + i) * iov_per_datagram;
+      messages[i].msg_hdr.msg_iovlen = iov_per_datagram;
+    }
+    int ret = sendmmsg(sock, messages, batch, 0);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    sent += ret;
+  }
+  return sent;
+}
+
+#else
+
+unsigned int send_datagrams(int sock, const struct sockaddr *to, socklen_t to_length,
+                            struct iovec *iov, unsigned int iov_per_datagram, unsigned int count) {
+  unsigned int sent = 0;
+  while (sent < count) {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = (void *)to;
+    message.msg_namelen = to_length;
+    message.msg_iov = iov + sent * iov_per_datagram;
+    message.msg_iovlen = iov_per_datagram;
+    if (sendmsg(sock, &message, 0) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    sent++;
+  }
+  return sent;
+}
+
+#endif
+
+#ifdef HAVE_RECVMMSG
+
+unsigned int receive_datagrams(int sock, struct iovec *iov, size_t *lengths,
+                               struct sockaddr_storage *from, unsigned int count) {
+  struct mmsghdr messages[DATAGRAMS_PER_CALL];
+  if (count > DATAGRAMS_PER_CALL)
+    count = DATAGRAMS_PER_CALL;
+  unsigned int i;
+  memset(messages, 0, sizeof(struct mmsghdr) * count);
+  for (i = 0; i < count; i++) {
+    if (from) {
+      messages[i].msg_hdr.msg_name = &from[i];
+      messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+    messages[i].msg_hdr.msg_iov = &iov[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  int ret;
+  do {
+    ret = recvmmsg(sock, messages, count, MSG_WAITFORONE, NULL);
+  } while ((ret < 0) && (errno == EINTR));
+  if (ret < 0)
+    return 0;
+  for (i = 0; i < (unsigned int)ret; i++)
+    lengths[i] = messages[i].msg_len;
+  return ret;
+}
+
+#else
+
+unsigned int receive_datagrams(int sock, struct iovec *iov, size_t *lengths,
+                               struct sockaddr_storage *from, unsigned int count) {
+  unsigned int received = 0;
+  while (received < count) {
+    socklen_t from_length = sizeof(struct sockaddr_storage);
+    ssize_t ret = recvfrom(sock, iov[received].iov_base, iov[received].iov_len,
+                           received ? MSG_DONTWAIT : 0,
+                           from ? (struct sockaddr *)&from[received] : NULL,
+                           from ? &from_length : NULL);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    lengths[received++] = ret;
+  }
+  return received;
+}
+
+#endif
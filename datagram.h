@@ -0,0 +1,19 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Send count datagrams to one address, each made up of iov_per_datagram pieces taken in turn from
+// iov. Where the system has sendmmsg they go in as few calls as possible; elsewhere it's a
+// sendmsg each. Returns the number sent, which is less than count if an error stopped it, in
+// which case errno is set.
+unsigned int send_datagrams(int sock, const struct sockaddr *to, socklen_t to_length,
+                            struct iovec *iov, unsigned int iov_per_datagram, unsigned int count);
+
+// Receive up to count datagrams. The first is waited for as the socket would wait; the rest are
+// taken only if they have already arrived. Datagram i goes into iov[i], its length into
+// lengths[i] and, if from isn't NULL, its sender into from[i]. With recvmmsg it's one call.
+// Returns the number received, 0 if the first receive failed, in which case errno is set.
+unsigned int receive_datagrams(int sock, struct iovec *iov, size_t *lengths,
+                               struct sockaddr_storage *from, unsigned int count);
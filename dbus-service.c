@@ -25,6 +25,7 @@
  */
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,7 +57,57 @@ ShairportSyncAdvancedRemoteControl *shairportSyncAdvancedRemoteControlSkeleton =
 
 guint ownerID = 0;
 
-void dbus_metadata_watcher(struct metadata_bundle *argc, __attribute__((unused)) void *userdata) {
+// The watcher doesn't set the properties itself. It schedules a flush on the main loop, at most one
+// every config.dbus_update_interval milliseconds, and changes arriving meanwhile are folded into it.
+// The flush sets all the properties from the latest metadata and emits one PropertiesChanged
+// signal for each interface, listing everything that changed.
+
+static pthread_mutex_t dbus_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static guint dbus_flush_source = 0; // the pending flush, if any
+static uint64_t dbus_last_flush_time = 0;
+static uint64_t dbus_flushes = 0;
+static uint64_t dbus_changes_coalesced = 0;
+
+static void dbus_update_properties(struct metadata_bundle *argc);
+
+static gboolean dbus_flush_properties(__attribute__((unused)) gpointer user_data) {
+  pthread_mutex_lock(&dbus_flush_lock);
+  dbus_flush_source = 0;
+  dbus_last_flush_time = get_absolute_time_in_ns();
+  dbus_flushes++;
+  if ((dbus_flushes % 100) == 0)
+    debug(2, "D-Bus properties flushed %" PRIu64 " times, with %" PRIu64 " changes coalesced.",
+          dbus_flushes, dbus_changes_coalesced);
+  pthread_mutex_unlock(&dbus_flush_lock);
+
+  metadata_bundle *snapshot = metadata_hub_snapshot_acquire();
+  if (snapshot) {
+    dbus_update_properties(snapshot);
+    metadata_hub_snapshot_release(snapshot);
+  }
+  g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(shairportSyncRemoteControlSkeleton));
+  g_dbus_interface_skeleton_flush(
+      G_DBUS_INTERFACE_SKELETON(shairportSyncAdvancedRemoteControlSkeleton));
+  return G_SOURCE_REMOVE;
+}
+
+void dbus_metadata_watcher(__attribute__((unused)) struct metadata_bundle *argc,
+                           __attribute__((unused)) void *userdata) {
+  pthread_mutex_lock(&dbus_flush_lock);
+  if (dbus_flush_source) {
+    dbus_changes_coalesced++;
+  } else {
+    uint64_t now = get_absolute_time_in_ns();
+    uint64_t due = dbus_last_flush_time + (uint64_t)config.dbus_update_interval * 1000000;
+    guint delay = 0; // in milliseconds
+    if (due > now)
+      delay = (due - now) / 1000000;
+    dbus_flush_source = g_timeout_add(delay, dbus_flush_properties, NULL);
+  }
+  pthread_mutex_unlock(&dbus_flush_lock);
+}
+
+static void dbus_update_properties(struct metadata_bundle *argc) {
   char response[100];
   gboolean current_status, new_status;
 
@@ -724,7 +775,10 @@ gboolean notify_loop_status_callback(ShairportSyncAdvancedRemoteControl *skeleto
     send_simple_dacp_command("setproperty?dacp.repeatstate=2");
   else if (strcasecmp(th, "not available") != 0) {
     warn("Illegal Loop Request: \"%s\".", th);
-    switch (metadata_store.repeat_status) {
+    metadata_bundle *snapshot = metadata_hub_snapshot_acquire();
+    repeat_status_type repeat_status = snapshot ? snapshot->repeat_status : RS_NOT_AVAILABLE;
+    metadata_hub_snapshot_release(snapshot);
+    switch (repeat_status) {
     case RS_NOT_AVAILABLE:
       shairport_sync_advanced_remote_control_set_loop_status(skeleton, "Not Available");
       break;
@@ -1087,6 +1141,14 @@ int start_dbus_service() {
 
 void stop_dbus_service() {
   debug(2, "stopping dbus service");
+  pthread_mutex_lock(&dbus_flush_lock);
+  if (dbus_flush_source) {
+    g_source_remove(dbus_flush_source);
+    dbus_flush_source = 0;
+  }
+  debug(2, "D-Bus properties were flushed %" PRIu64 " times, with %" PRIu64 " changes coalesced.",
+        dbus_flushes, dbus_changes_coalesced);
+  pthread_mutex_unlock(&dbus_flush_lock);
   if (ownerID)
     g_bus_unown_name(ownerID);
   else
@@ -2,9 +2,6 @@
 #include "common.h"
 #include <math.h>
 
-loudness_processor loudness_r;
-loudness_processor loudness_l;
-
 void _loudness_set_volume(loudness_processor *p, float volume) {
   float gain = -(volume - config.loudness_reference_volume_db) * 0.5;
   if (gain < 0)
@@ -39,12 +36,12 @@ float loudness_process(loudness_processor *p, float i0) {
   return o0;
 }
 
-void loudness_set_volume(float volume) {
+void loudness_set_volume(loudness_processor *left, loudness_processor *right, float volume) {
   float gain = -(volume - config.loudness_reference_volume_db) * 0.5;
   if (gain < 0)
     gain = 0;
 
   debug(2, "Volume: %.1f dB - Loudness gain @10Hz: %.1f dB", volume, gain);
-  _loudness_set_volume(&loudness_l, volume);
-  _loudness_set_volume(&loudness_r, volume);
+  _loudness_set_volume(left, volume);
+  _loudness_set_volume(right, volume);
 }
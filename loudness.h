@@ -7,8 +7,6 @@ typedef struct {
   float i1, i2, o1, o2;
 } loudness_processor;
 
-extern loudness_processor loudness_r;
-extern loudness_processor loudness_l;
-
-void loudness_set_volume(float volume);
+// each playing session keeps its own left and right processors
+void loudness_set_volume(loudness_processor *left, loudness_processor *right, float volume);
 float loudness_process(loudness_processor *p, float sample);
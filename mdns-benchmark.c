@@ -0,0 +1,255 @@
+/*
+ * mDNS responder benchmark. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// This fires floods of synthetic queries at the tinysvcmdns responder, set up with the records
+// Shairport Sync publishes, and times how long it takes to answer them. Each kind of query is
+// flooded on its own, then all of them mixed together, with queries for other devices' services
+// among them, as on a busy network. The responder is started offline, so the queries are handed
+// straight to the code its thread runs for each datagram, and no replies reach the network.
+
+#include "common.h"
+#include "tinysvcmdns.h"
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCHMARK_HOSTNAME "benchmark.local"
+#define BENCHMARK_SERVICE_TYPE "_raop._tcp.local"
+#define BENCHMARK_INSTANCE "0123456789AB@Benchmark"
+#define BENCHMARK_TTL 4500
+
+#ifdef CONFIG_ALSA
+// common.c hands the ALSA backend the device named by the on-start command, but there's no
+// ALSA backend here.
+void set_alsa_out_dev(__attribute__((unused)) char *device) {}
+#endif
+
+typedef struct {
+  const char *description;
+  char name[256];
+  uint16_t type;
+  int known_answer; // include our own PTR record as an answer the querier already knows
+  int expect_reply;
+  uint8_t pkt[512];
+  size_t len;
+} query_kind;
+
+// put a name into a packet as a sequence of labels, returning its length
+static size_t put_name(uint8_t *p, const char *name) {
+  size_t len = 0;
+  while (*name) {
+    const char *dot = strchr(name, '.');
+    size_t label_length = dot ? (size_t)(dot - name) : strlen(name);
+    p[len++] = label_length;
+    memcpy(p + len, name, label_length);
+    len += label_length;
+    name += label_length;
+    if (*name == '.')
+      name++;
+  }
+  p[len++] = 0;
+  return len;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+static void build_query(query_kind *q) {
+  uint8_t *p = q->pkt;
+  memset(p, 0, 12);
+  put_u16(p + 4, 1);                       // one question
+  put_u16(p + 6, q->known_answer ? 1 : 0); // and perhaps one known answer
+  size_t len = 12;
+  len += put_name(p + len, q->name);
+  put_u16(p + len, q->type);
+  put_u16(p + len + 2, 1); // class IN
+  len += 4;
+  if (q->known_answer) {
+    len += put_name(p + len, q->name);
+    put_u16(p + len, RR_PTR);
+    put_u16(p + len + 2, 1);
+    put_u16(p + len + 4, BENCHMARK_TTL >> 16);
+    put_u16(p + len + 6, BENCHMARK_TTL & 0xffff);
+    char target[256];
+    snprintf(target, sizeof(target), "%s.%s", BENCHMARK_INSTANCE, q->name);
+    size_t rdlength = put_name(p + len + 10, target);
+    put_u16(p + len + 8, rdlength);
+    len += 10 + rdlength;
+  }
+  q->len = len;
+}
+
+// answer count queries, each of a kind picked from kinds[0 .. number_of_kinds - 1], checking
+// that the replies carry the queries' IDs and that only the kinds expecting a reply get one
+static int flood(struct mdnsd *svr, query_kind *kinds, int number_of_kinds, uint64_t count,
+                 const char *description) {
+  uint64_t replies = 0, reply_bytes = 0, wrong = 0;
+  uint64_t start = get_absolute_time_in_ns();
+  uint64_t i;
+  for (i = 0; i < count; i++) {
+    query_kind *q = &kinds[number_of_kinds == 1 ? 0 : (r64u() % number_of_kinds)];
+    uint16_t id = i & 0xffff;
+    put_u16(q->pkt, id);
+    uint8_t *reply;
+    size_t len = mdnsd_answer_packet(svr, q->pkt, q->len, &reply);
+    if (len) {
+      replies++;
+      reply_bytes += len;
+      if ((q->expect_reply == 0) || (len < 12) || (((reply[0] << 8) | reply[1]) != id))
+        wrong++;
+    } else if (q->expect_reply) {
+      wrong++;
+    }
+  }
+  uint64_t elapsed = get_absolute_time_in_ns() - start;
+  double ns_per_query = (1.0 * elapsed) / count;
+  printf("%-40s %10.1f ns %9.0f queries/s %9" PRIu64 " replies of %6.1f bytes\n", description,
+         ns_per_query, 1.0E9 / ns_per_query, replies,
+         replies ? (1.0 * reply_bytes) / replies : 0.0);
+  if (wrong)
+    fprintf(stderr, "%s: %" PRIu64 " replies were wrong or missing.\n", description, wrong);
+  return wrong != 0;
+}
+
+int main(int argc, char **argv) {
+  int queries = 1000000;
+  int services = 1;
+  int foreign_services = 16;
+  int seed = 0;
+  int verbosity = 0;
+
+  struct poptOption optionsTable[] = {
+      {"queries", 'n', POPT_ARG_INT, &queries, 0,
+       "The number of queries in each flood -- the default is 1000000.", "NUMBER"},
+      {"services", 'S', POPT_ARG_INT, &services, 0,
+       "The number of AirPlay services the responder publishes, as for several zones -- the "
+       "default is 1.",
+       "NUMBER"},
+      {"foreign-services", 'f', POPT_ARG_INT, &foreign_services, 0,
+       "The number of other devices' service types asked about in the mixed flood -- the "
+       "default is 16.",
+       "NUMBER"},
+      {"seed", 's', POPT_ARG_INT, &seed, 0, "The seed for the random choice of queries.",
+       "NUMBER"},
+      {"verbose", 'v', POPT_ARG_NONE, NULL, 'v',
+       "Print debug messages, including the responder's reply cache statistics.", NULL},
+      POPT_AUTOHELP{NULL, 0, 0, NULL, 0, NULL, NULL}};
+
+  poptContext optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0);
+  int c;
+  while ((c = poptGetNextOpt(optCon)) >= 0) {
+    if (c == 'v')
+      verbosity++;
+  }
+  if (c < -1) {
+    fprintf(stderr, "%s: %s\n", poptBadOption(optCon, POPT_BADOPTION_NOALIAS), poptStrerror(c));
+    return 1;
+  }
+  poptFreeContext(optCon);
+  if ((queries < 1) || (services < 1) || (foreign_services < 0)) {
+    fprintf(stderr, "There must be at least one query and one service.\n");
+    return 1;
+  }
+
+  log_to_stderr();
+  debuglev = verbosity + 1; // the responder's statistics are at level 2
+  r64init(seed);
+
+  struct mdnsd *svr = mdnsd_start_offline();
+  mdnsd_set_hostname(svr, BENCHMARK_HOSTNAME, inet_addr("192.168.1.10"));
+  // the records mdns.h publishes
+  const char *txt[] = {"sf=0x4",   "fv=76400.10", "am=ShairportSync", "vs=105.1", "tp=TCP,UDP",
+                       "vn=65537", "md=0,1,2",    "ss=16",            "sr=44100", "da=true",
+                       "sv=false", "et=0,1",      "ek=1",             "cn=0,1",   "ch=2",
+                       "txtvers=1", "pw=false",   NULL};
+  int i;
+  for (i = 0; i < services; i++) {
+    char instance[64];
+    if (i == 0)
+      snprintf(instance, sizeof(instance), "%s", BENCHMARK_INSTANCE);
+    else
+      snprintf(instance, sizeof(instance), "%s %d", BENCHMARK_INSTANCE, i + 1);
+    struct mdns_service *svc =
+        mdnsd_register_svc(svr, instance, BENCHMARK_SERVICE_TYPE, 5000 + i, NULL, txt);
+    mdns_service_destroy(svc);
+  }
+
+  int number_of_kinds = 7 + foreign_services;
+  query_kind *kinds = calloc(number_of_kinds, sizeof(query_kind));
+  if (kinds == NULL)
+    die("Can not allocate memory for the benchmark.");
+  kinds[0].description = "PTR " BENCHMARK_SERVICE_TYPE;
+  snprintf(kinds[0].name, sizeof(kinds[0].name), "%s", BENCHMARK_SERVICE_TYPE);
+  kinds[0].type = RR_PTR;
+  // with more than one service, the known answer suppresses only one of the answers
+  kinds[1].description = "PTR " BENCHMARK_SERVICE_TYPE ", answer known";
+  snprintf(kinds[1].name, sizeof(kinds[1].name), "%s", BENCHMARK_SERVICE_TYPE);
+  kinds[1].type = RR_PTR;
+  kinds[1].known_answer = 1;
+  kinds[2].description = "PTR _services._dns-sd._udp.local";
+  snprintf(kinds[2].name, sizeof(kinds[2].name), "_services._dns-sd._udp.local");
+  kinds[2].type = RR_PTR;
+  kinds[3].description = "SRV of the service";
+  snprintf(kinds[3].name, sizeof(kinds[3].name), "%s.%s", BENCHMARK_INSTANCE,
+           BENCHMARK_SERVICE_TYPE);
+  kinds[3].type = RR_SRV;
+  kinds[4].description = "TXT of the service";
+  snprintf(kinds[4].name, sizeof(kinds[4].name), "%s.%s", BENCHMARK_INSTANCE,
+           BENCHMARK_SERVICE_TYPE);
+  kinds[4].type = RR_TXT;
+  kinds[5].description = "ANY " BENCHMARK_HOSTNAME;
+  snprintf(kinds[5].name, sizeof(kinds[5].name), "%s", BENCHMARK_HOSTNAME);
+  kinds[5].type = RR_ANY;
+  kinds[6].description = "PTR of another device's service";
+  snprintf(kinds[6].name, sizeof(kinds[6].name), "_googlecast._tcp.local");
+  kinds[6].type = RR_PTR;
+  for (i = 7; i < number_of_kinds; i++) {
+    kinds[i].description = kinds[6].description;
+    snprintf(kinds[i].name, sizeof(kinds[i].name), "_other-service-%d._tcp.local", i - 7);
+    kinds[i].type = RR_PTR;
+  }
+  for (i = 0; i < number_of_kinds; i++) {
+    kinds[i].expect_reply = (i <= 5) && ((i != 1) || (services > 1));
+    build_query(&kinds[i]);
+  }
+
+  int failures = 0;
+  for (i = 0; i <= 6; i++)
+    failures += flood(svr, &kinds[i], 1, queries, kinds[i].description);
+  char description[64];
+  snprintf(description, sizeof(description), "mixed, with %d other services",
+           foreign_services + 1);
+  failures += flood(svr, kinds, number_of_kinds, queries, description);
+
+  mdnsd_stop(svr);
+  free(kinds);
+  return failures ? 1 : 0;
+}
@@ -32,39 +32,67 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <dirent.h>
-#include <errno.h>
-#include <fcntl.h>
 #include <inttypes.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <unistd.h>
+#include <stddef.h>
 
 #include "config.h"
 
+#include "artwork_cache.h"
 #include "common.h"
 #include "dacp.h"
 #include "metadata_hub.h"
 
-#ifdef CONFIG_MBEDTLS
-#include <mbedtls/md5.h>
-#include <mbedtls/version.h>
-#endif
-
-#ifdef CONFIG_POLARSSL
-#include <polarssl/md5.h>
-#endif
-
-#ifdef CONFIG_OPENSSL
-#include <openssl/md5.h>
-#endif
-
 struct metadata_bundle metadata_store;
 
 int metadata_hub_initialised = 0;
 
 pthread_rwlock_t metadata_hub_re_lock = PTHREAD_RWLOCK_INITIALIZER;
 
+// Writers change metadata_store with the write lock held, as before. When they're done, an
+// immutable, reference-counted copy of it -- a snapshot -- is made and published, and the
+// watchers are run on it after the write lock has been released. Readers take a reference to
+// the current snapshot, so neither they nor the watchers hold up the writers.
+// A snapshot is allocated in one piece, with its strings in an arena at the end.
+
+typedef struct {
+  metadata_bundle bundle; // first, so that a pointer to it is a pointer to the snapshot
+  int references;
+  char strings[];
+} metadata_snapshot;
+
+static const size_t metadata_string_fields[] = {
+    offsetof(metadata_bundle, client_ip),
+    offsetof(metadata_bundle, server_ip),
+    offsetof(metadata_bundle, progress_string),
+    offsetof(metadata_bundle, cover_art_pathname),
+    offsetof(metadata_bundle, track_name),
+    offsetof(metadata_bundle, artist_name),
+    offsetof(metadata_bundle, album_artist_name),
+    offsetof(metadata_bundle, album_name),
+    offsetof(metadata_bundle, genre),
+    offsetof(metadata_bundle, comment),
+    offsetof(metadata_bundle, composer),
+    offsetof(metadata_bundle, file_kind),
+    offsetof(metadata_bundle, song_description),
+    offsetof(metadata_bundle, song_album_artist),
+    offsetof(metadata_bundle, sort_name),
+    offsetof(metadata_bundle, sort_artist),
+    offsetof(metadata_bundle, sort_album),
+    offsetof(metadata_bundle, sort_composer)};
+
+static metadata_snapshot *current_snapshot = NULL;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER; // just for taking a reference
+static pthread_mutex_t watchers_lock = PTHREAD_MUTEX_INITIALIZER; // watchers see them in order
+
+// the URI of cover art that's being written, to be used when it's ready, if nothing has come since
+static char *cover_art_pending_uri = NULL;
+
+// update a string from metadata, which may not be NUL-terminated, if it's different
+static int metadata_hub_string_update(char **str, int *flag, char *data, uint32_t length) {
+  size_t len = data ? strnlen(data, length) : 0;
+  return string_update_with_size(str, flag, data, len);
+}
+
 int string_update(char **str, int *flag, char *s) {
   if (s)
     return string_update_with_size(str, flag, s, strlen(s));
@@ -72,13 +100,96 @@ int string_update(char **str, int *flag, char *s) {
     return string_update_with_size(str, flag, NULL, 0);
 }
 
+static void metadata_hub_cover_art_ready(const char *pathname) {
+  char uri[2048];
+  snprintf(uri, sizeof(uri), "file://%s", pathname);
+  int changed = 0;
+  metadata_hub_modify_prolog();
+  if ((cover_art_pending_uri) && (strcmp(cover_art_pending_uri, uri) == 0)) {
+    changed = string_update(&metadata_store.cover_art_pathname,
+                            &metadata_store.cover_art_pathname_changed, uri);
+    free(cover_art_pending_uri);
+    cover_art_pending_uri = NULL;
+  }
+  metadata_hub_modify_epilog(changed);
+}
+
+// take a copy of the metadata_store, with a reference for the caller and one for the hub
+static metadata_snapshot *metadata_hub_make_snapshot(void) {
+  unsigned int i;
+  size_t strings_size = 0;
+  for (i = 0; i < sizeof(metadata_string_fields) / sizeof(size_t); i++) {
+    char *str = *(char **)((char *)&metadata_store + metadata_string_fields[i]);
+    if (str)
+      strings_size += strlen(str) + 1;
+  }
+  metadata_snapshot *snapshot = malloc(sizeof(metadata_snapshot) + strings_size);
+  if (snapshot == NULL) {
+    debug(1, "Can't allocate memory for a metadata snapshot.");
+    return NULL;
+  }
+  snapshot->bundle = metadata_store;
+  snapshot->references = 2;
+  char *p = snapshot->strings;
+  for (i = 0; i < sizeof(metadata_string_fields) / sizeof(size_t); i++) {
+    char **field = (char **)((char *)&snapshot->bundle + metadata_string_fields[i]);
+    if (*field) {
+      size_t length = strlen(*field) + 1;
+      memcpy(p, *field, length);
+      *field = p;
+      p += length;
+    }
+  }
+  return snapshot;
+}
+
+static void metadata_hub_publish_snapshot(metadata_snapshot *snapshot) {
+  pthread_mutex_lock(&snapshot_lock);
+  metadata_snapshot *old_snapshot = current_snapshot;
+  current_snapshot = snapshot;
+  pthread_mutex_unlock(&snapshot_lock);
+  if (old_snapshot)
+    metadata_hub_snapshot_release(&old_snapshot->bundle);
+}
+
+metadata_bundle *metadata_hub_snapshot_acquire(void) {
+  pthread_mutex_lock(&snapshot_lock);
+  metadata_snapshot *snapshot = current_snapshot;
+  if (snapshot)
+    __atomic_fetch_add(&snapshot->references, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&snapshot_lock);
+  return snapshot ? &snapshot->bundle : NULL;
+}
+
+void metadata_hub_snapshot_release(metadata_bundle *bundle) {
+  if (bundle) {
+    metadata_snapshot *snapshot = (metadata_snapshot *)bundle;
+    if (__atomic_sub_fetch(&snapshot->references, 1, __ATOMIC_ACQ_REL) == 0)
+      free(snapshot);
+  }
+}
+
 void metadata_hub_init(void) {
   // debug(1, "Metadata bundle initialisation.");
   memset(&metadata_store, 0, sizeof(metadata_store));
+  metadata_snapshot *snapshot = metadata_hub_make_snapshot();
+  if (snapshot) {
+    snapshot->references = 1; // just the hub's
+    metadata_hub_publish_snapshot(snapshot);
+  }
+  artwork_cache_init(metadata_hub_cover_art_ready);
   metadata_hub_initialised = 1;
 }
 
-void metadata_hub_stop(void) {}
+void metadata_hub_stop(void) {
+  artwork_cache_stop();
+  pthread_mutex_lock(&snapshot_lock);
+  metadata_snapshot *snapshot = current_snapshot;
+  current_snapshot = NULL;
+  pthread_mutex_unlock(&snapshot_lock);
+  if (snapshot)
+    metadata_hub_snapshot_release(&snapshot->bundle);
+}
 
 void add_metadata_watcher(metadata_watcher fn, void *userdata) {
   int i;
@@ -92,14 +203,16 @@ void add_metadata_watcher(metadata_watcher fn, void *userdata) {
   }
 }
 
-void run_metadata_watchers(void) {
+static void run_metadata_watchers(metadata_bundle *snapshot) {
   int i;
   for (i = 0; i < number_of_watchers; i++) {
-    if (metadata_store.watchers[i]) {
-      metadata_store.watchers[i](&metadata_store, metadata_store.watchers_data[i]);
+    if (snapshot->watchers[i]) {
+      snapshot->watchers[i](snapshot, snapshot->watchers_data[i]);
     }
   }
-  // turn off changed flags
+}
+
+static void metadata_hub_clear_changed_flags(void) {
   metadata_store.cover_art_pathname_changed = 0;
   metadata_store.client_ip_changed = 0;
   metadata_store.server_ip_changed = 0;
@@ -116,6 +229,7 @@ void run_metadata_watchers(void) {
   metadata_store.file_kind_changed = 0;
   metadata_store.song_description_changed = 0;
   metadata_store.song_album_artist_changed = 0;
+  metadata_store.sort_name_changed = 0;
   metadata_store.sort_artist_changed = 0;
   metadata_store.sort_album_changed = 0;
   metadata_store.sort_composer_changed = 0;
@@ -156,8 +270,17 @@ void _metadata_hub_modify_prolog(const char *filename, const int linenumber) {
 void _metadata_hub_modify_epilog(int modified, const char *filename, const int linenumber) {
   metadata_store.dacp_server_has_been_active =
       metadata_store.dacp_server_active; // set the scanner_has_been_active now.
+  metadata_snapshot *snapshot = NULL;
+  int oldState;
   if (modified) {
-    run_metadata_watchers();
+    snapshot = metadata_hub_make_snapshot();
+    metadata_hub_clear_changed_flags();
+    if (snapshot) {
+      metadata_hub_publish_snapshot(snapshot);
+      // take the watchers lock before letting go of the hub, so that snapshots are seen in order
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+      pthread_mutex_lock(&watchers_lock);
+    }
   }
   if (metadata_hub_re_lock_access_is_delayed) {
 		if (last_metadata_hub_modify_prolog_file) {
@@ -170,6 +293,12 @@ void _metadata_hub_modify_epilog(int modified, const char *filename, const int l
   }
   pthread_rwlock_unlock(&metadata_hub_re_lock);
   // debug(3, "Metadata_hub write lock unlocked.");
+  if (snapshot) {
+    run_metadata_watchers(&snapshot->bundle);
+    pthread_mutex_unlock(&watchers_lock);
+    metadata_hub_snapshot_release(&snapshot->bundle);
+    pthread_setcancelstate(oldState, NULL);
+  }
 }
 
 /*
@@ -189,135 +318,6 @@ void _metadata_hub_read_epilog(const char *filename, const int linenumber) {
   pthread_rwlock_unlock(&metadata_hub_re_lock);
 }
 */
-char *metadata_write_image_file(const char *buf, int len) {
-
-  // warning -- this removes all files from the directory apart from this one, if it exists
-  // it will return a path to the image file allocated with malloc.
-  // free it if you don't need it.
-
-  char *path = NULL;                                 // this will be what is returned
-  if (strcmp(config.cover_art_cache_dir, "") != 0) { // an empty string means do not write the file
-
-    uint8_t img_md5[16];
-    // uint8_t ap_md5[16];
-
-#ifdef CONFIG_OPENSSL
-    MD5_CTX ctx;
-    MD5_Init(&ctx);
-    MD5_Update(&ctx, buf, len);
-    MD5_Final(img_md5, &ctx);
-#endif
-
-#ifdef CONFIG_MBEDTLS
-#if MBEDTLS_VERSION_MINOR >= 7
-    mbedtls_md5_context tctx;
-    mbedtls_md5_starts_ret(&tctx);
-    mbedtls_md5_update_ret(&tctx, (const unsigned char *)buf, len);
-    mbedtls_md5_finish_ret(&tctx, img_md5);
-#else
-    mbedtls_md5_context tctx;
-    mbedtls_md5_starts(&tctx);
-    mbedtls_md5_update(&tctx, (const unsigned char *)buf, len);
-    mbedtls_md5_finish(&tctx, img_md5);
-#endif
-#endif
-
-#ifdef CONFIG_POLARSSL
-    md5_context tctx;
-    md5_starts(&tctx);
-    md5_update(&tctx, (const unsigned char *)buf, len);
-    md5_finish(&tctx, img_md5);
-#endif
-
-    char img_md5_str[33];
-    memset(img_md5_str, 0, sizeof(img_md5_str));
-    char *ext;
-    char png[] = "png";
-    char jpg[] = "jpg";
-    int i;
-    for (i = 0; i < 16; i++)
-      snprintf(&img_md5_str[i * 2], 3, "%02x", (uint8_t)img_md5[i]);
-    // see if the file is a jpeg or a png
-    if (strncmp(buf, "\xFF\xD8\xFF", 3) == 0)
-      ext = jpg;
-    else if (strncmp(buf, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 8) == 0)
-      ext = png;
-    else {
-      debug(1, "Unidentified image type of cover art -- jpg extension used.");
-      ext = jpg;
-    }
-    mode_t oldumask = umask(000);
-    int result = mkpath(config.cover_art_cache_dir, 0777);
-    umask(oldumask);
-    if ((result == 0) || (result == -EEXIST)) {
-      // see if the file exists by opening it.
-      // if it exists, we're done
-      char *prefix = "cover-";
-
-      size_t pl = strlen(config.cover_art_cache_dir) + 1 + strlen(prefix) + strlen(img_md5_str) +
-                  1 + strlen(ext);
-
-      path = malloc(pl + 1);
-      snprintf(path, pl + 1, "%s/%s%s.%s", config.cover_art_cache_dir, prefix, img_md5_str, ext);
-      int cover_fd = open(path, O_WRONLY | O_CREAT | O_EXCL, S_IRWXU | S_IRGRP | S_IROTH);
-      if (cover_fd > 0) {
-        // write the contents
-        if (write(cover_fd, buf, len) < len) {
-          warn("Writing cover art file \"%s\" failed!", path);
-          free(path);
-          path = NULL;
-        }
-        close(cover_fd);
-
-        // now delete all other files, if requested
-        if (config.retain_coverart == 0) {
-          DIR *d;
-          struct dirent *dir;
-          d = opendir(config.cover_art_cache_dir);
-          if (d) {
-            int fnl = strlen(prefix) + strlen(img_md5_str) + 1 + strlen(ext) + 1;
-
-            char *full_filename = malloc(fnl);
-            if (full_filename == NULL)
-              die("Can't allocate memory at metadata_write_image_file.");
-            memset(full_filename, 0, fnl);
-            snprintf(full_filename, fnl, "%s%s.%s", prefix, img_md5_str, ext);
-            int dir_fd = open(config.cover_art_cache_dir, O_DIRECTORY);
-            if (dir_fd > 0) {
-              while ((dir = readdir(d)) != NULL) {
-                if (dir->d_type == DT_REG) {
-                  if (strcmp(full_filename, dir->d_name) != 0) {
-                    if (unlinkat(dir_fd, dir->d_name, 0) != 0) {
-                      debug(1, "Error %d deleting cover art file \"%s\".", errno, dir->d_name);
-                    }
-                  }
-                }
-              }
-            } else {
-              debug(1, "Can't open the directory for deletion.");
-            }
-            free(full_filename);
-            closedir(d);
-          }
-        }
-      } else {
-        //      if (errno == EEXIST)
-        //        debug(1, "Cover art file \"%s\" already exists!", path);
-        //      else {
-        if (errno != EEXIST) {
-          warn("Could not open file \"%s\" for writing cover art", path);
-          free(path);
-          path = NULL;
-        }
-      }
-    } else {
-      debug(1, "Couldn't access or create the cover art cache directory \"%s\".",
-            config.cover_art_cache_dir);
-    }
-  }
-  return path;
-}
-
 void metadata_hub_process_metadata(uint32_t type, uint32_t code, char *data, uint32_t length) {
   // metadata coming in from the audio source or from Shairport Sync itself passes through here
   // this has more information about tags, which might be relevant:
@@ -333,7 +333,6 @@ void metadata_hub_process_metadata(uint32_t type, uint32_t code, char *data, uin
   metadata_hub_modify_prolog();
   pthread_cleanup_push(metadata_hub_unlock_hub_mutex_cleanup, NULL);
 
-  char *cs;
   if (type == 'core') {
     switch (code) {
     case 'mper': {
@@ -362,110 +361,94 @@ void metadata_hub_process_metadata(uint32_t type, uint32_t code, char *data, uin
       }
     } break;
     case 'asal':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.album_name, &metadata_store.album_name_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.album_name, &metadata_store.album_name_changed,
+                                     data, length)) {
         debug(2, "MH Album name set to: \"%s\"", metadata_store.album_name);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'asar':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.artist_name, &metadata_store.artist_name_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.artist_name,
+                                     &metadata_store.artist_name_changed, data, length)) {
         debug(2, "MH Artist name set to: \"%s\"", metadata_store.artist_name);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'assl':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.album_artist_name,
-                        &metadata_store.album_artist_name_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.album_artist_name,
+                                     &metadata_store.album_artist_name_changed, data, length)) {
         debug(2, "MH Album Artist name set to: \"%s\"", metadata_store.album_artist_name);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'ascm':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.comment, &metadata_store.comment_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.comment, &metadata_store.comment_changed,
+                                     data, length)) {
         debug(2, "MH Comment set to: \"%s\"", metadata_store.comment);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'asgn':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.genre, &metadata_store.genre_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.genre, &metadata_store.genre_changed,
+                                     data, length)) {
         debug(2, "MH Genre set to: \"%s\"", metadata_store.genre);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'minm':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.track_name, &metadata_store.track_name_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.track_name, &metadata_store.track_name_changed,
+                                     data, length)) {
         debug(2, "MH Track Name set to: \"%s\"", metadata_store.track_name);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'ascp':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.composer, &metadata_store.composer_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.composer, &metadata_store.composer_changed,
+                                     data, length)) {
         debug(2, "MH Composer set to: \"%s\"", metadata_store.composer);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'asdt':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.song_description, &metadata_store.song_description_changed,
-                        cs)) {
+      if (metadata_hub_string_update(&metadata_store.song_description,
+                                     &metadata_store.song_description_changed, data, length)) {
         debug(2, "MH Song Description set to: \"%s\"", metadata_store.song_description);
       }
-      free(cs);
       break;
     case 'asaa':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.song_album_artist,
-                        &metadata_store.song_album_artist_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.song_album_artist,
+                                     &metadata_store.song_album_artist_changed, data, length)) {
         debug(2, "MH Song Album Artist set to: \"%s\"", metadata_store.song_album_artist);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'assn':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.sort_name, &metadata_store.sort_name_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.sort_name, &metadata_store.sort_name_changed,
+                                     data, length)) {
         debug(2, "MH Sort Name set to: \"%s\"", metadata_store.sort_name);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'assa':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.sort_artist, &metadata_store.sort_artist_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.sort_artist,
+                                     &metadata_store.sort_artist_changed, data, length)) {
         debug(2, "MH Sort Artist set to: \"%s\"", metadata_store.sort_artist);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'assu':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.sort_album, &metadata_store.sort_album_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.sort_album, &metadata_store.sort_album_changed,
+                                     data, length)) {
         debug(2, "MH Sort Album set to: \"%s\"", metadata_store.sort_album);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
       break;
     case 'assc':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.sort_composer, &metadata_store.sort_composer_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.sort_composer,
+                                     &metadata_store.sort_composer_changed, data, length)) {
         debug(2, "MH Sort Composer set to: \"%s\"", metadata_store.sort_composer);
         metadata_packet_item_changed = 1;
       }
-      free(cs);
     default:
       /*
           {
@@ -506,19 +489,25 @@ void metadata_hub_process_metadata(uint32_t type, uint32_t code, char *data, uin
       debug(2, "MH Picture received, length %u bytes.", length);
 
       char uri[2048];
+      int ready = 1;
+      uri[0] = '\0';
       if ((length > 16) && (strcmp(config.cover_art_cache_dir,"")!=0)) { // if it's okay to write the file
       	// make this uncancellable
 				int oldState;
 				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
-        char *pathname = metadata_write_image_file(data, length);
-        snprintf(uri, sizeof(uri), "file://%s", pathname);
+        char *pathname = artwork_cache_store(data, length, &ready);
+        if (pathname)
+          snprintf(uri, sizeof(uri), "file://%s", pathname);
         free(pathname);
         pthread_setcancelstate(oldState, NULL);
-
-      } else {
-        uri[0] = '\0';
       }
-      if (string_update(&metadata_store.cover_art_pathname,
+      free(cover_art_pending_uri);
+      cover_art_pending_uri = NULL;
+      if (ready == 0) {
+        // it's being written -- it'll be picked up when it's ready
+        cover_art_pending_uri = strdup(uri);
+        changed = 0;
+      } else if (string_update(&metadata_store.cover_art_pathname,
                         &metadata_store.cover_art_pathname_changed,
                         uri)) // if the picture's file path is different from the stored one...
         changed = 1;
@@ -527,29 +516,25 @@ void metadata_hub_process_metadata(uint32_t type, uint32_t code, char *data, uin
 //      pthread_cleanup_pop(0); // don't remove the lock -- it'll have been done
       break;
     case 'clip':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.client_ip, &metadata_store.client_ip_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.client_ip, &metadata_store.client_ip_changed,
+                                     data, length)) {
         changed = 1;
         debug(2, "MH Client IP set to: \"%s\"", metadata_store.client_ip);
       }
-      free(cs);
       break;
     case 'prgr':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.progress_string, &metadata_store.progress_string_changed,
-                        cs)) {
+      if (metadata_hub_string_update(&metadata_store.progress_string,
+                                     &metadata_store.progress_string_changed, data, length)) {
         changed = 1;
         debug(2, "MH Progress String set to: \"%s\"", metadata_store.progress_string);
       }
-      free(cs);
       break;
     case 'svip':
-      cs = strndup(data, length);
-      if (string_update(&metadata_store.server_ip, &metadata_store.server_ip_changed, cs)) {
+      if (metadata_hub_string_update(&metadata_store.server_ip, &metadata_store.server_ip_changed,
+                                     data, length)) {
         changed = 1;
         debug(2, "MH Server IP set to: \"%s\"", metadata_store.server_ip);
       }
-      free(cs);
       break;
     case 'abeg':
       changed = (metadata_store.active_state != AM_ACTIVE);
@@ -140,6 +140,11 @@ extern struct metadata_bundle metadata_store;
 
 void add_metadata_watcher(metadata_watcher fn, void *userdata);
 
+// Watchers are called with a snapshot of the metadata, after the hub has been unlocked. Anyone
+// else wanting to read it should take a snapshot, which stays the same until it's released.
+metadata_bundle *metadata_hub_snapshot_acquire(void); // NULL if there's no hub
+void metadata_hub_snapshot_release(metadata_bundle *snapshot);
+
 void metadata_hub_init(void);
 void metadata_hub_stop(void);
 void metadata_hub_process_metadata(uint32_t type, uint32_t code, char *data, uint32_t length);
@@ -24,6 +24,7 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -61,8 +62,53 @@ double mpris_volume_to_airplay_volume(double sp) {
   return sp;
 }
 
-void mpris_metadata_watcher(struct metadata_bundle *argc, __attribute__((unused)) void *userdata) {
-  // debug(1, "MPRIS metadata watcher called");
+// As in the native D-Bus service, changes are gathered up and flushed from the main loop, at most
+// once every config.dbus_update_interval milliseconds.
+
+static pthread_mutex_t mpris_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static guint mpris_flush_source = 0; // the pending flush, if any
+static uint64_t mpris_last_flush_time = 0;
+static uint64_t mpris_flushes = 0;
+static uint64_t mpris_changes_coalesced = 0;
+
+static void mpris_update_properties(struct metadata_bundle *argc);
+
+static gboolean mpris_flush_properties(__attribute__((unused)) gpointer user_data) {
+  pthread_mutex_lock(&mpris_flush_lock);
+  mpris_flush_source = 0;
+  mpris_last_flush_time = get_absolute_time_in_ns();
+  mpris_flushes++;
+  if ((mpris_flushes % 100) == 0)
+    debug(2, "MPRIS properties flushed %" PRIu64 " times, with %" PRIu64 " changes coalesced.",
+          mpris_flushes, mpris_changes_coalesced);
+  pthread_mutex_unlock(&mpris_flush_lock);
+
+  metadata_bundle *snapshot = metadata_hub_snapshot_acquire();
+  if (snapshot) {
+    mpris_update_properties(snapshot);
+    metadata_hub_snapshot_release(snapshot);
+  }
+  g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(mprisPlayerPlayerSkeleton));
+  return G_SOURCE_REMOVE;
+}
+
+void mpris_metadata_watcher(__attribute__((unused)) struct metadata_bundle *argc,
+                            __attribute__((unused)) void *userdata) {
+  pthread_mutex_lock(&mpris_flush_lock);
+  if (mpris_flush_source) {
+    mpris_changes_coalesced++;
+  } else {
+    uint64_t now = get_absolute_time_in_ns();
+    uint64_t due = mpris_last_flush_time + (uint64_t)config.dbus_update_interval * 1000000;
+    guint delay = 0; // in milliseconds
+    if (due > now)
+      delay = (due - now) / 1000000;
+    mpris_flush_source = g_timeout_add(delay, mpris_flush_properties, NULL);
+  }
+  pthread_mutex_unlock(&mpris_flush_lock);
+}
+
+static void mpris_update_properties(struct metadata_bundle *argc) {
   char response[100];
   media_player2_player_set_volume(mprisPlayerPlayerSkeleton,
                                   airplay_volume_to_mpris_volume(argc->airplay_volume));
@@ -1,3 +1,5 @@
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +21,48 @@ struct mosquitto *global_mosq = NULL;
 char *topic = NULL;
 int connected = 0;
 
+// Messages are published from a thread of their own, so that the metadata thread never waits for
+// the broker. They wait in a bounded queue. A message for a topic that holds state, such as the
+// volume or the title, replaces one for the same topic that hasn't gone yet. If the queue is full,
+// the new message is dropped and counted.
+
+typedef struct {
+  char *topic; // under config.mqtt_topic
+  char *payload;
+  uint32_t length;
+  int retain;
+  int coalesce; // may be replaced by a later message for the same topic
+} mqtt_message;
+
+static mqtt_message *mqtt_queue = NULL;
+static unsigned int mqtt_queue_first = 0;
+static unsigned int mqtt_queue_count = 0;
+static pthread_mutex_t mqtt_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mqtt_queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_t mqtt_publisher_thread;
+
+static uint64_t mqtt_messages_published = 0;
+static uint64_t mqtt_messages_coalesced = 0;
+static uint64_t mqtt_messages_dropped = 0;
+
+// the parsed track state, for the now_playing object
+typedef struct {
+  char *artist;
+  char *album;
+  char *title;
+  char *genre;
+  char *format;
+  char *songalbum;
+  char *volume;
+  char *client_ip;
+  const char *state;
+} mqtt_now_playing_type;
+
+static mqtt_now_playing_type now_playing = {NULL, NULL, NULL, NULL, NULL,
+                                            NULL, NULL, NULL, "stopped"};
+static int in_metadata_bundle = 0; // between 'mdst' and 'mden'
+static int now_playing_changed = 0;
+
 // mosquitto logging
 void _cb_log(__attribute__((unused)) struct mosquitto *mosq, __attribute__((unused)) void *userdata,
              int level, const char *str) {
@@ -90,24 +134,181 @@ void on_connect(struct mosquitto *mosq, __attribute__((unused)) void *userdata,
   }
 }
 
-// helper function to publish under a topic and automatically append the main topic
-void mqtt_publish(char *topic, char *data, uint32_t length) {
-  char fulltopic[strlen(config.mqtt_topic) + strlen(topic) + 3];
-  snprintf(fulltopic, strlen(config.mqtt_topic) + strlen(topic) + 2, "%s/%s", config.mqtt_topic,
-           topic);
-  debug(2, "[MQTT]: publishing under %s", fulltopic);
-
-  int rc;
-  if ((rc = mosquitto_publish(global_mosq, NULL, fulltopic, length, data, 0, 0)) !=
-      MOSQ_ERR_SUCCESS) {
-    switch (rc) {
-    case MOSQ_ERR_NO_CONN:
+static void mqtt_message_free(mqtt_message *m) {
+  free(m->topic);
+  free(m->payload);
+}
+
+static void mqtt_enqueue(const char *topic, const char *data, uint32_t length, int retain,
+                         int coalesce) {
+  char *payload = NULL;
+  if (length) {
+    payload = malloc(length);
+    if (payload == NULL) {
+      debug(1, "[MQTT]: can't allocate memory for a message.");
+      return;
+    }
+    memcpy(payload, data, length);
+  }
+  pthread_mutex_lock(&mqtt_queue_lock);
+  unsigned int i;
+  if (coalesce) {
+    for (i = 0; i < mqtt_queue_count; i++) {
+      mqtt_message *m = &mqtt_queue[(mqtt_queue_first + i) % config.mqtt_queue_length];
+      if ((m->coalesce) && (strcmp(m->topic, topic) == 0)) {
+        free(m->payload);
+        m->payload = payload;
+        m->length = length;
+        m->retain = retain;
+        mqtt_messages_coalesced++;
+        pthread_mutex_unlock(&mqtt_queue_lock);
+        return;
+      }
+    }
+  }
+  if (mqtt_queue_count == (unsigned int)config.mqtt_queue_length) {
+    mqtt_messages_dropped++;
+    if ((mqtt_messages_dropped % 100) == 1)
+      debug(1,
+            "[MQTT]: the broker isn't keeping up -- %" PRIu64 " messages dropped, %" PRIu64
+            " published and %" PRIu64 " coalesced so far.",
+            mqtt_messages_dropped, mqtt_messages_published, mqtt_messages_coalesced);
+    pthread_mutex_unlock(&mqtt_queue_lock);
+    free(payload);
+    return;
+  }
+  mqtt_message *m =
+      &mqtt_queue[(mqtt_queue_first + mqtt_queue_count) % config.mqtt_queue_length];
+  m->topic = strdup(topic);
+  m->payload = payload;
+  m->length = length;
+  m->retain = retain;
+  m->coalesce = coalesce;
+  mqtt_queue_count++;
+  pthread_cond_signal(&mqtt_queue_not_empty);
+  pthread_mutex_unlock(&mqtt_queue_lock);
+}
+
+static void *mqtt_publisher_thread_code(__attribute__((unused)) void *arg) {
+  while (1) {
+    pthread_mutex_lock(&mqtt_queue_lock);
+    while (mqtt_queue_count == 0)
+      pthread_cond_wait(&mqtt_queue_not_empty, &mqtt_queue_lock); // a cancellation point
+    mqtt_message m = mqtt_queue[mqtt_queue_first];
+    mqtt_queue_first = (mqtt_queue_first + 1) % config.mqtt_queue_length;
+    mqtt_queue_count--;
+    pthread_mutex_unlock(&mqtt_queue_lock);
+
+    int oldState;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+    size_t tl = strlen(config.mqtt_topic) + strlen(m.topic) + 2;
+    char fulltopic[tl];
+    snprintf(fulltopic, tl, "%s/%s", config.mqtt_topic, m.topic);
+    debug(2, "[MQTT]: publishing under %s", fulltopic);
+    int rc = mosquitto_publish(global_mosq, NULL, fulltopic, m.length, m.payload, config.mqtt_qos,
+                               m.retain);
+    if (rc == MOSQ_ERR_SUCCESS) {
+      pthread_mutex_lock(&mqtt_queue_lock);
+      mqtt_messages_published++;
+      pthread_mutex_unlock(&mqtt_queue_lock);
+    } else if (rc == MOSQ_ERR_NO_CONN) {
       debug(1, "[MQTT]: Publish failed: not connected to broker");
-      break;
-    default:
+    } else {
       debug(1, "[MQTT]: Publish failed: unknown error");
-      break;
     }
+    mqtt_message_free(&m);
+    pthread_setcancelstate(oldState, NULL);
+  }
+  pthread_exit(NULL);
+}
+
+// helper function to publish under a topic and automatically append the main topic
+void mqtt_publish(char *topic, char *data, uint32_t length) {
+  mqtt_enqueue(topic, data, length, 0, 0);
+}
+
+// publish a piece of the track state, which a new subscriber should get straight away
+static void mqtt_publish_state(char *topic, char *data, uint32_t length) {
+  mqtt_enqueue(topic, data, length, config.mqtt_retain_state, 1);
+}
+
+// append a JSON string, escaped, to the buffer
+static size_t json_append_string(char *p, const char *str) {
+  char *start = p;
+  if (str == NULL) {
+    memcpy(p, "null", 4);
+    return 4;
+  }
+  *p++ = '"';
+  for (; *str; str++) {
+    unsigned char c = *str;
+    if ((c == '"') || (c == '\\')) {
+      *p++ = '\\';
+      *p++ = c;
+    } else if (c < 0x20) {
+      p += sprintf(p, "\\u%04x", c);
+    } else {
+      *p++ = c;
+    }
+  }
+  *p++ = '"';
+  return p - start;
+}
+
+static void mqtt_publish_now_playing(void) {
+  const char *names[] = {"artist", "album",  "title",     "genre", "format",
+                         "songalbum", "volume", "client_ip", "state"};
+  const char *values[] = {now_playing.artist,    now_playing.album,  now_playing.title,
+                          now_playing.genre,     now_playing.format, now_playing.songalbum,
+                          now_playing.volume,    now_playing.client_ip, now_playing.state};
+  size_t i, size = 2;
+  for (i = 0; i < sizeof(names) / sizeof(char *); i++)
+    size += strlen(names[i]) + 4 + (values[i] ? strlen(values[i]) * 6 + 2 : 4);
+  char *json = malloc(size + 1);
+  if (json == NULL)
+    return;
+  char *p = json;
+  *p++ = '{';
+  for (i = 0; i < sizeof(names) / sizeof(char *); i++) {
+    if (i)
+      *p++ = ',';
+    p += json_append_string(p, names[i]);
+    *p++ = ':';
+    p += json_append_string(p, values[i]);
+  }
+  *p++ = '}';
+  mqtt_enqueue("now_playing", json, p - json, config.mqtt_retain_state, 1);
+  free(json);
+  now_playing_changed = 0;
+}
+
+static void now_playing_update(char **field, char *data, uint32_t length) {
+  free(*field);
+  *field = NULL;
+  if (length) {
+    size_t len = strnlen(data, length);
+    *field = malloc(len + 1);
+    if (*field) {
+      memcpy(*field, data, len);
+      (*field)[len] = '\0';
+    }
+  }
+  now_playing_changed = 1;
+}
+
+// a piece of track state, published under its own topic or as part of the now_playing object
+static void mqtt_parsed_state(char *topic, char **field, char *data, uint32_t length) {
+  if (config.mqtt_publish_json)
+    now_playing_update(field, data, length);
+  else
+    mqtt_publish_state(topic, data, length);
+}
+
+static void mqtt_parsed_event(char *topic, const char *state) {
+  mqtt_publish(topic, NULL, 0);
+  if ((state) && (config.mqtt_publish_json)) {
+    now_playing.state = state;
+    now_playing_changed = 1;
   }
 }
 
@@ -131,57 +332,66 @@ void mqtt_process_metadata(uint32_t type, uint32_t code, char *data, uint32_t le
     if (type == 'core') {
       switch (code) {
       case 'asar':
-        mqtt_publish("artist", data, length);
+        mqtt_parsed_state("artist", &now_playing.artist, data, length);
         break;
       case 'asal':
-        mqtt_publish("album", data, length);
+        mqtt_parsed_state("album", &now_playing.album, data, length);
         break;
       case 'minm':
-        mqtt_publish("title", data, length);
+        mqtt_parsed_state("title", &now_playing.title, data, length);
         break;
       case 'asgn':
-        mqtt_publish("genre", data, length);
+        mqtt_parsed_state("genre", &now_playing.genre, data, length);
         break;
       case 'asfm':
-        mqtt_publish("format", data, length);
+        mqtt_parsed_state("format", &now_playing.format, data, length);
         break;
       }
     } else if (type == 'ssnc') {
       switch (code) {
+      case 'mdst':
+        in_metadata_bundle = 1;
+        break;
+      case 'mden':
+        in_metadata_bundle = 0;
+        break;
       case 'asal':
-        mqtt_publish("songalbum", data, length);
+        mqtt_parsed_state("songalbum", &now_playing.songalbum, data, length);
         break;
       case 'pvol':
-        mqtt_publish("volume", data, length);
+        mqtt_parsed_state("volume", &now_playing.volume, data, length);
         break;
       case 'clip':
-        mqtt_publish("client_ip", data, length);
+        mqtt_parsed_state("client_ip", &now_playing.client_ip, data, length);
         break;
       case 'abeg':
-        mqtt_publish("active_start", data, length);
+        mqtt_parsed_event("active_start", NULL);
         break;
       case 'aend':
-        mqtt_publish("active_end", data, length);
+        mqtt_parsed_event("active_end", NULL);
         break;
       case 'pbeg':
-        mqtt_publish("play_start", data, length);
+        mqtt_parsed_event("play_start", "playing");
         break;
       case 'pend':
-        mqtt_publish("play_end", data, length);
+        mqtt_parsed_event("play_end", "stopped");
         break;
       case 'pfls':
-        mqtt_publish("play_flush", data, length);
+        mqtt_parsed_event("play_flush", "paused");
         break;
       case 'prsm':
-        mqtt_publish("play_resume", data, length);
+        mqtt_parsed_event("play_resume", "playing");
         break;
       case 'PICT':
         if (config.mqtt_publish_cover) {
-          mqtt_publish("cover", data, length);
+          mqtt_publish_state("cover", data, length);
         }
         break;
       }
     }
+    // the items of a metadata bundle go out together, as one object
+    if ((now_playing_changed) && (in_metadata_bundle == 0))
+      mqtt_publish_now_playing();
   }
 
   return;
@@ -219,6 +429,12 @@ int initialise_mqtt() {
     mosquitto_message_callback_set(global_mosq, on_message);
   }
 
+  mqtt_queue = calloc(config.mqtt_queue_length, sizeof(mqtt_message));
+  if (mqtt_queue == NULL)
+    die("[MQTT]: can't allocate the message queue.");
+  if (pthread_create(&mqtt_publisher_thread, NULL, mqtt_publisher_thread_code, NULL) != 0)
+    die("[MQTT]: can't create the publisher thread.");
+
   mosquitto_disconnect_callback_set(global_mosq, on_disconnect);
   mosquitto_connect_callback_set(global_mosq, on_connect);
   if (mosquitto_connect(global_mosq, config.mqtt_hostname, config.mqtt_port, keepalive)) {
@@ -455,7 +455,6 @@ static void free_audio_buffers(rtsp_conn_info *conn) {
     free(conn->audio_buffer[i].data);
 }
 
-int first_possibly_missing_frame = -1;
 
 void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t *data, int len,
                        rtsp_conn_info *conn) {
@@ -549,15 +548,15 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t *data, in
 
 			int x; // this is the first frame to be checked
 			// if we detected a first empty frame before and if it's still in the buffer!
-			if ((first_possibly_missing_frame >= 0) &&
-					(position_in_modulo_uint16_t_buffer(first_possibly_missing_frame, conn->ab_read,
+			if ((conn->first_possibly_missing_frame >= 0) &&
+					(position_in_modulo_uint16_t_buffer(conn->first_possibly_missing_frame, conn->ab_read,
 																							conn->ab_write, NULL))) {
-				x = first_possibly_missing_frame;
+				x = conn->first_possibly_missing_frame;
 			} else {
 				x = conn->ab_read;
 			}
 
-			first_possibly_missing_frame = -1; // has not been set
+			conn->first_possibly_missing_frame = -1; // has not been set
 
 			int missing_frame_run_count = 0;
 			int start_of_missing_frame_run = -1;
@@ -565,8 +564,8 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t *data, in
 			while (x != conn->ab_write) {
 				abuf_t *check_buf = conn->audio_buffer + BUFIDX(x);
 				if (!check_buf->ready) {
-					if (first_possibly_missing_frame < 0)
-						first_possibly_missing_frame = x;
+					if (conn->first_possibly_missing_frame < 0)
+						conn->first_possibly_missing_frame = x;
 					number_of_missing_frames++;
 					// debug(1, "frame %u's initialisation_time is 0x%" PRIx64 ", latency_time is 0x%"
 					// PRIx64 ", time_now is 0x%" PRIx64 ", minimum_remaining_time is 0x%" PRIx64 ".", x,
@@ -630,7 +629,7 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t *data, in
 				}
 			}
 			if (number_of_missing_frames == 0)
-				first_possibly_missing_frame = conn->ab_write;
+				conn->first_possibly_missing_frame = conn->ab_write;
 		}
   }
   debug_mutex_unlock(&conn->ab_mutex, 0);
@@ -735,6 +734,9 @@ static inline void process_sample(int32_t sample, char **outp, sps_format_t form
     case SPS_FORMAT_U8:
       dither_mask = (int64_t)1 << (64 - 8);
       break;
+    case SPS_FORMAT_FLOAT:
+      dither_mask = 1; // i.e. no dither -- a float has more than enough resolution already
+      break;
     case SPS_FORMAT_UNKNOWN:
       die("Unexpected SPS_FORMAT_UNKNOWN while calculating dither mask.");
       break;
@@ -877,6 +879,11 @@ static inline void process_sample(int32_t sample, char **outp, sps_format_t form
     *op = hyper_sample;
     result = 1;
     break;
+  case SPS_FORMAT_FLOAT:
+    // full scale of the int64_t is +/- 1.0
+    *(float *)op = (float)hyper_sample * (1.0f / 9223372036854775808.0f);
+    result = 4;
+    break;
   case SPS_FORMAT_UNKNOWN:
     die("Unexpected SPS_FORMAT_UNKNOWN while outputting samples");
     break;
@@ -1479,19 +1486,13 @@ static int stuff_buffer_basic_32(int32_t *inptr, int length, sps_format_t l_outp
 // (d) outputs the result in the approprate format
 // formats accepted so far include U8, S8, S16, S24, S24_3LE, S24_3BE and S32
 
-int32_t stat_n = 0;
-double stat_mean = 0.0;
-double stat_M2 = 0.0;
-double longest_soxr_execution_time = 0.0;
-int64_t packets_processed = 0;
-
 int stuff_buffer_soxr_32(int32_t *inptr, int32_t *scratchBuffer, int length,
                          sps_format_t l_output_format, char *outptr, int stuff, int dither,
                          rtsp_conn_info *conn) {
   if (scratchBuffer == NULL) {
     die("soxr scratchBuffer not initialised.");
   }
-  packets_processed++;
+  conn->soxr_packets_processed++;
   int tstuff = stuff;
   if ((stuff > 1) || (stuff < -1) || (length < 100)) {
     // debug(1, "Stuff argument to stuff_buffer must be from -1 to +1 and length >100.");
@@ -1529,12 +1530,12 @@ int stuff_buffer_soxr_32(int32_t *inptr, int32_t *scratchBuffer, int length,
 
     double soxr_execution_time = (get_absolute_time_in_ns() - soxr_start_time) * 0.000000001;
     // debug(1,"soxr_execution_time_us: %10.1f",soxr_execution_time_us);
-    if (soxr_execution_time > longest_soxr_execution_time)
-      longest_soxr_execution_time = soxr_execution_time;
-    stat_n += 1;
-    double stat_delta = soxr_execution_time - stat_mean;
-    stat_mean += stat_delta / stat_n;
-    stat_M2 += stat_delta * (soxr_execution_time - stat_mean);
+    if (soxr_execution_time > conn->soxr_longest_execution_time)
+      conn->soxr_longest_execution_time = soxr_execution_time;
+    conn->soxr_stat_n += 1;
+    double stat_delta = soxr_execution_time - conn->soxr_stat_mean;
+    conn->soxr_stat_mean += stat_delta / conn->soxr_stat_n;
+    conn->soxr_stat_M2 += stat_delta * (soxr_execution_time - conn->soxr_stat_mean);
 
     int i;
     int32_t *ip, *op;
@@ -1579,17 +1580,19 @@ int stuff_buffer_soxr_32(int32_t *inptr, int32_t *scratchBuffer, int length,
     };
   }
 
-  if (packets_processed % 1250 == 0) {
+  if (conn->soxr_packets_processed % 1250 == 0) {
     debug(3,
           "soxr_oneshot execution time in nanoseconds: mean, standard deviation and max "
           "for %" PRId32 " interpolations in the last "
           "1250 packets. %10.6f, %10.6f, %10.6f.",
-          stat_n, stat_mean, stat_n <= 1 ? 0.0 : sqrtf(stat_M2 / (stat_n - 1)),
-          longest_soxr_execution_time);
-    stat_n = 0;
-    stat_mean = 0.0;
-    stat_M2 = 0.0;
-    longest_soxr_execution_time = 0.0;
+          conn->soxr_stat_n, conn->soxr_stat_mean,
+          conn->soxr_stat_n <= 1 ? 0.0
+                                 : sqrtf(conn->soxr_stat_M2 / (conn->soxr_stat_n - 1)),
+          conn->soxr_longest_execution_time);
+    conn->soxr_stat_n = 0;
+    conn->soxr_stat_mean = 0.0;
+    conn->soxr_stat_M2 = 0.0;
+    conn->soxr_longest_execution_time = 0.0;
   }
 
   conn->amountStuffed = tstuff;
@@ -1597,6 +1600,78 @@ int stuff_buffer_soxr_32(int32_t *inptr, int32_t *scratchBuffer, int length,
 }
 #endif
 
+// this takes the left and right channels of the DSP output and (a) removes or inserts a frame as
+// specified in stuff, by interpolation or, if use_soxr is set, with libsoxr,
+// (b) multiplies each sample by the fixedvolume, unless the loudness filter has done it already
+// (c) interleaves the result into outptr as SPS_FORMAT_FLOAT
+// so that the DSP output reaches a float backend without being quantised to 32-bit integers.
+// Returns the number of frames output.
+static int stuff_buffer_float(float *left, float *right, int length, char *outptr, int stuff,
+                              __attribute__((unused)) int use_soxr, rtsp_conn_info *conn) {
+  int tstuff = stuff;
+  if ((stuff > 1) || (stuff < -1) || (length < 100))
+    tstuff = 0; // if any of these conditions hold, don't stuff anything
+
+  // the DSP works at the scale of an int32_t sample, so full scale is +/- 2^31
+  float scale = 1.0f / 2147483648.0f;
+  if (config.loudness == 0) // the loudness filter has applied the volume already
+    scale *= conn->fix_volume / 65536.0f;
+
+  float *op = (float *)outptr;
+  int i;
+#ifdef CONFIG_SOXR
+  if ((tstuff) && (use_soxr)) {
+    float *ip = (float *)conn->sbuf; // the scratch buffer is big enough for 32-bit samples
+    for (i = 0; i < length; i++) {
+      *ip++ = left[i] * scale;
+      *ip++ = right[i] * scale;
+    }
+    soxr_io_spec_t io_spec;
+    io_spec.itype = SOXR_FLOAT32_I;
+    io_spec.otype = SOXR_FLOAT32_I;
+    io_spec.scale = 1.0;
+    io_spec.e = NULL;
+    io_spec.flags = 0;
+    size_t odone;
+    soxr_error_t error = soxr_oneshot(length, length + tstuff, 2, conn->sbuf, length, NULL, op,
+                                      length + tstuff, &odone, &io_spec, NULL, NULL);
+    if (error)
+      die("soxr error: %s\n", soxr_strerror(error));
+    // keep the first and last few frames, as stuff_buffer_soxr_32 does, to mitigate the Gibbs
+    // phenomenon
+    const int gpm = 5;
+    ip = (float *)conn->sbuf;
+    for (i = 0; i < gpm * 2; i++) {
+      op[i] = ip[i];
+      op[(length + tstuff - gpm) * 2 + i] = ip[(length - gpm) * 2 + i];
+    }
+    conn->amountStuffed = tstuff;
+    return length + tstuff;
+  }
+#endif
+
+  int stuffsamp = length;
+  if (tstuff)
+    stuffsamp = (rand() % (length - 2)) + 1; // ensure there's always a frame before and after it
+  for (i = 0; i < stuffsamp; i++) {
+    *op++ = left[i] * scale;
+    *op++ = right[i] * scale;
+  }
+  if (tstuff == 1) {
+    // interpolate one frame
+    *op++ = (left[i - 1] + left[i]) * 0.5f * scale;
+    *op++ = (right[i - 1] + right[i]) * 0.5f * scale;
+  } else if (tstuff == -1) {
+    i++; // skip one frame
+  }
+  for (; i < length; i++) {
+    *op++ = left[i] * scale;
+    *op++ = right[i] * scale;
+  }
+  conn->amountStuffed = tstuff;
+  return length + tstuff;
+}
+
 void player_thread_initial_cleanup_handler(__attribute__((unused)) void *arg) {
   rtsp_conn_info *conn = (rtsp_conn_info *)arg;
   debug(3, "Connection %d: player thread main loop exit via player_thread_initial_cleanup_handler.",
@@ -1663,6 +1738,12 @@ void player_thread_cleanup_handler(void *arg) {
     free(conn->tbuf);
     conn->tbuf = NULL;
   }
+#ifdef CONFIG_CONVOLUTION
+  if (conn->convolver) {
+    convolver_free(conn->convolver);
+    conn->convolver = NULL;
+  }
+#endif
 
   if (conn->statistics) {
   	free(conn->statistics);
@@ -1677,6 +1758,40 @@ void player_thread_cleanup_handler(void *arg) {
   pthread_setcancelstate(oldState, NULL);
 }
 
+// if the output device wants to know, tell it when the first frame of the packet with this
+// timestamp should be heard
+
+void signal_presentation_time(uint32_t timestamp, rtsp_conn_info *conn) {
+  if (config.output->presentation_time) {
+    uint64_t presentation_time;
+    frame_to_local_time(timestamp + conn->latency, &presentation_time,
+                        conn); // this will go modulo 2^32
+    presentation_time += (int64_t)(config.audio_backend_latency_offset * 1000000000);
+    config.output->presentation_time(presentation_time);
+  }
+}
+
+#ifdef CONFIG_METADATA
+// if items have been dropped at the metadata pipe since the last report, say so in the statistics
+// and in an 'mdrp' metadata item, so that the pipe's reader can tell it has missed some
+static void report_metadata_pipe_overruns(uint64_t *items_dropped_reported) {
+  uint64_t items_written, items_dropped, bytes_dropped;
+  metadata_pipe_statistics(&items_written, &items_dropped, &bytes_dropped);
+  if (items_dropped != *items_dropped_reported) {
+    if (config.statistics_requested)
+      inform("Metadata pipe overrun: %" PRIu64 " items (%" PRIu64 " bytes) dropped, %" PRIu64
+             " written.",
+             items_dropped, bytes_dropped, items_written);
+    char totals[72];
+    snprintf(totals, sizeof(totals), "%" PRIu64 ",%" PRIu64 ",%" PRIu64, items_dropped,
+             bytes_dropped, items_written);
+    // don't wait for room -- if the item is dropped, it's sent again next time
+    if (send_ssnc_metadata('mdrp', totals, strlen(totals), 0) == 0)
+      *items_dropped_reported = items_dropped;
+  }
+}
+#endif
+
 void *player_thread_func(void *arg) {
   rtsp_conn_info *conn = (rtsp_conn_info *)arg;
   // pthread_cleanup_push(player_thread_initial_cleanup_handler, arg);
@@ -1693,6 +1808,22 @@ void *player_thread_func(void *arg) {
   conn->flush_rtp_timestamp = 0; // it seems this number has a special significance -- it seems to
                                  // be used as a null operand, so we'll use it like that too
   conn->fix_volume = 0x10000;
+  conn->first_possibly_missing_frame = -1;
+  memset(&conn->loudness_l, 0, sizeof(conn->loudness_l));
+  memset(&conn->loudness_r, 0, sizeof(conn->loudness_r));
+  loudness_set_volume(&conn->loudness_l, &conn->loudness_r, 0.0); // flat until the volume is set
+#ifdef CONFIG_CONVOLUTION
+  conn->convolver = convolver_create();
+  if (conn->convolver == NULL)
+    die("Failed to allocate memory for the convolver.");
+#endif
+#ifdef CONFIG_SOXR
+  conn->soxr_stat_n = 0;
+  conn->soxr_stat_mean = 0.0;
+  conn->soxr_stat_M2 = 0.0;
+  conn->soxr_longest_execution_time = 0.0;
+  conn->soxr_packets_processed = 0;
+#endif
 
   if (conn->latency == 0) {
     debug(3, "No latency has (yet) been specified. Setting 88,200 (2 seconds) frames "
@@ -1737,25 +1868,7 @@ void *player_thread_func(void *arg) {
                                      // rate, multiply it by the frame ratio.
                                      // but, on some occasions, more than one frame could be added
 
-  switch (config.output_format) {
-  case SPS_FORMAT_S24_3LE:
-  case SPS_FORMAT_S24_3BE:
-    conn->output_bytes_per_frame = 6;
-    break;
-
-  case SPS_FORMAT_S24:
-  case SPS_FORMAT_S24_LE:
-  case SPS_FORMAT_S24_BE:
-    conn->output_bytes_per_frame = 8;
-    break;
-  case SPS_FORMAT_S32:
-  case SPS_FORMAT_S32_LE:
-  case SPS_FORMAT_S32_BE:
-    conn->output_bytes_per_frame = 8;
-    break;
-  default:
-    conn->output_bytes_per_frame = 4;
-  }
+  conn->output_bytes_per_frame = sps_format_bytes_per_frame(config.output_format);
 
   debug(3, "Output frame bytes is %d.", conn->output_bytes_per_frame);
 
@@ -1791,6 +1904,12 @@ void *player_thread_func(void *arg) {
   uint64_t minimum_dac_queue_size = UINT64_MAX;
   int32_t minimum_buffer_occupancy = INT32_MAX;
   int32_t maximum_buffer_occupancy = INT32_MIN;
+#ifdef CONFIG_METADATA
+  // only overruns during this play session are reported
+  uint64_t metadata_pipe_items_written, metadata_pipe_items_dropped, metadata_pipe_bytes_dropped;
+  metadata_pipe_statistics(&metadata_pipe_items_written, &metadata_pipe_items_dropped,
+                           &metadata_pipe_bytes_dropped);
+#endif
 
   conn->playstart = time(NULL);
 
@@ -1844,6 +1963,7 @@ void *player_thread_func(void *arg) {
   case SPS_FORMAT_S32:
   case SPS_FORMAT_S32_LE:
   case SPS_FORMAT_S32_BE:
+  case SPS_FORMAT_FLOAT:
     output_bit_depth = 32;
     break;
   case SPS_FORMAT_UNKNOWN:
@@ -1871,6 +1991,10 @@ void *player_thread_func(void *arg) {
       (config.playback_mode == ST_mono))
     conn->enable_dither = 1;
 
+  // a float has more than enough resolution already, so it's never dithered
+  if (config.output_format == SPS_FORMAT_FLOAT)
+    conn->enable_dither = 0;
+
   // remember, the output device may never have been initialised prior to this call
   config.output->start(config.output_rate, config.output_format); // will need a corresponding stop
 
@@ -2041,9 +2165,10 @@ void *player_thread_func(void *arg) {
           }
         } else {
 
-          if (((config.output->parameters == NULL) && (config.ignore_volume_control == 0) &&
-               (config.airplay_volume != 0.0)) ||
-              (conn->input_bit_depth > output_bit_depth) || (config.playback_mode == ST_mono))
+          if ((config.output_format != SPS_FORMAT_FLOAT) &&
+              (((config.output->parameters == NULL) && (config.ignore_volume_control == 0) &&
+                (config.airplay_volume != 0.0)) ||
+               (conn->input_bit_depth > output_bit_depth) || (config.playback_mode == ST_mono)))
             conn->enable_dither = 1;
           else
             conn->enable_dither = 0;
@@ -2244,35 +2369,40 @@ void *player_thread_func(void *arg) {
                          (int64_t)(config.audio_backend_latency_offset *
                                    config.output_rate)); // int64_t from int64_t - int32_t, so okay
 
-            if (at_least_one_frame_seen_this_session == 0) {
-            	at_least_one_frame_seen_this_session = 1;
+            int first_block = (at_least_one_frame_seen_this_session == 0);
+            at_least_one_frame_seen_this_session = 1;
 
-              // debug(2,"first frame real sync error (positive --> late): %" PRId64 " frames.", sync_error);
+            int may_stuff =
+                (config.no_sync == 0) &&
+                (stuffing_is_held_off(local_time_now, conn->first_packet_time_to_play) == 0);
 
-            	// this is a sneaky attempt to make a final adjustment to the timing of the first packet
+            // timestamp of zero means an inserted silent frame in place of a missing frame
+            sync_decision decision;
+            sync_decide(sync_error, first_block, &sync_error_out_of_bounds,
+                        config.tolerance * config.output_rate,
+                        config.resyncthreshold * config.output_rate,
+                        (config.no_sync == 0) && (inframe->given_timestamp != 0), may_stuff,
+                        &decision);
 
+            if (first_block) {
             	// the very first packet generally has a first_frame_early_bias subtracted from its timing
             	// to make it more likely that it will be early than late,
             	// making it possible to compensate for it be adding a few frames of silence.
 
-              // debug(2,"first frame real sync error (positive --> late): %" PRId64 " frames.", sync_error);
-
             	// remove the bias when reporting the error to make it the true error
 
             	debug(2,"first frame sync error (positive --> late): %" PRId64 " frames, %.3f mS at %d frames per second output.", sync_error+first_frame_early_bias, (1000.0*(sync_error+first_frame_early_bias))/config.output_rate, config.output_rate);
 
             	// if the packet is early, add the frames needed to put it in sync.
-            	if (sync_error < 0) {
-            	  size_t final_adjustment_length_sized = -sync_error;
+            	if (decision.padding) {
+            	  size_t final_adjustment_length_sized = decision.padding;
                 char *final_adjustment_silence = malloc(conn->output_bytes_per_frame * final_adjustment_length_sized);
                 if (final_adjustment_silence) {
 
                   conn->previous_random_number =
                       generate_zero_frames(final_adjustment_silence, final_adjustment_length_sized, config.output_format,
                                            conn->enable_dither, conn->previous_random_number);
-                  int final_adjustment = -sync_error;
-                  final_adjustment = final_adjustment - first_frame_early_bias;
-                  debug(2, "final sync adjustment: %" PRId64 " silent frames added with a bias of %" PRId64 " frames.", -sync_error, first_frame_early_bias);
+                  debug(2, "final sync adjustment: %" PRId64 " silent frames added with a bias of %" PRId64 " frames.", decision.padding, first_frame_early_bias);
                   config.output->play(final_adjustment_silence, final_adjustment_length_sized);
                   free(final_adjustment_silence);
                 } else {
@@ -2280,135 +2410,47 @@ void *player_thread_func(void *arg) {
                        "sync error of %d frames.",
                        final_adjustment_length_sized, sync_error);
                 }
-                sync_error = 0; // say the error was fixed!
               }
             }
-            // not too sure if abs() is implemented for int64_t, so we'll do it manually
-            int64_t abs_sync_error = sync_error;
-            if (abs_sync_error < 0)
-              abs_sync_error = -abs_sync_error;
-
-            if ((config.no_sync == 0) && (inframe->given_timestamp != 0) &&
-                (config.resyncthreshold > 0.0) &&
-                (abs_sync_error > config.resyncthreshold * config.output_rate)) {
-              /*
-              if (abs_sync_error > 3 * config.output_rate) {
+            sync_error = decision.sync_error;
 
-                warn("Very large sync error: %" PRId64 " frames, with should_be_frame: %" PRId64
-                     ",  nt: %" PRId64 ", current_delay: %" PRId64 ", given timestamp %" PRIX32
-                     ", reference timestamp %" PRIX32 ", should_be_frame %" PRIX32 ".",
-                     sync_error, should_be_frame, nt, current_delay, inframe->given_timestamp,
-                     reference_timestamp, should_be_frame_32);
-              }
-              */
-              sync_error_out_of_bounds++;
-            } else {
-              sync_error_out_of_bounds = 0;
-            }
+            if (decision.action == sync_action_flush) {
+              debug(2, "Large positive sync error: %" PRId64 ".", sync_error);
+              int64_t local_frames_to_drop = decision.frames_to_drop / conn->output_sample_ratio;
+              uint32_t frames_to_drop_sized = local_frames_to_drop;
 
-            if (sync_error_out_of_bounds > 3) {
-              // debug(1, "New lost sync with source for %d consecutive packets -- flushing and "
-              //          "resyncing. Error: %lld.",
-              //        sync_error_out_of_bounds, sync_error);
-              sync_error_out_of_bounds = 0;
-
-              int64_t filler_length =
-                  (int64_t)(config.resyncthreshold * config.output_rate); // number of samples
-              if ((sync_error > 0) && (sync_error > filler_length)) {
-                debug(2, "Large positive sync error: %" PRId64 ".", sync_error);
-                int64_t local_frames_to_drop = sync_error / conn->output_sample_ratio;
-                uint32_t frames_to_drop_sized = local_frames_to_drop;
-
-                debug_mutex_lock(&conn->flush_mutex, 1000, 1);
-                conn->flush_rtp_timestamp =
-                    inframe->given_timestamp +
-                    frames_to_drop_sized; // flush all packets up to (and including?) this
-                reset_input_flow_metrics(conn);
-                debug_mutex_unlock(&conn->flush_mutex, 3);
-
-              } else if ((sync_error < 0) && ((-sync_error) > filler_length)) {
-                debug(2,
-                      "Large negative sync error: %" PRId64 " with should_be_frame_32 of %" PRIu32
-                      ", nt of %" PRId64 " and current_delay of %" PRId64 ".",
-                      sync_error, should_be_frame_32, nt, current_delay);
-                int64_t silence_length = -sync_error;
-                if (silence_length > (filler_length * 5))
-                  silence_length = filler_length * 5;
-                size_t silence_length_sized = silence_length;
-                char *long_silence = malloc(conn->output_bytes_per_frame * silence_length_sized);
-                if (long_silence) {
+              debug_mutex_lock(&conn->flush_mutex, 1000, 1);
+              conn->flush_rtp_timestamp =
+                  inframe->given_timestamp +
+                  frames_to_drop_sized; // flush all packets up to (and including?) this
+              reset_input_flow_metrics(conn);
+              debug_mutex_unlock(&conn->flush_mutex, 3);
 
-                  conn->previous_random_number =
-                      generate_zero_frames(long_silence, silence_length_sized, config.output_format,
-                                           conn->enable_dither, conn->previous_random_number);
+            } else if (decision.action == sync_action_play_silence) {
+              debug(2,
+                    "Large negative sync error: %" PRId64 " with should_be_frame_32 of %" PRIu32
+                    ", nt of %" PRId64 " and current_delay of %" PRId64 ".",
+                    sync_error, should_be_frame_32, nt, current_delay);
+              size_t silence_length_sized = decision.silence_length;
+              char *long_silence = malloc(conn->output_bytes_per_frame * silence_length_sized);
+              if (long_silence) {
+
+                conn->previous_random_number =
+                    generate_zero_frames(long_silence, silence_length_sized, config.output_format,
+                                         conn->enable_dither, conn->previous_random_number);
 
-                  debug(2, "Play a silence of %d frames.", silence_length_sized);
-                  config.output->play(long_silence, silence_length_sized);
-                  free(long_silence);
-                } else {
-                  warn("Failed to allocate memory for a long_silence buffer of %d frames for a "
-                       "sync error of %d frames.",
-                       silence_length_sized, sync_error);
-                }
-                reset_input_flow_metrics(conn);
+                debug(2, "Play a silence of %d frames.", silence_length_sized);
+                config.output->play(long_silence, silence_length_sized);
+                free(long_silence);
+              } else {
+                warn("Failed to allocate memory for a long_silence buffer of %d frames for a "
+                     "sync error of %d frames.",
+                     silence_length_sized, sync_error);
               }
+              reset_input_flow_metrics(conn);
             } else {
 
-              /*
-              // before we finally commit to this frame, check its sequencing and timing
-              // require a certain error before bothering to fix it...
-              if (sync_error > config.tolerance * config.output_rate) { // int64_t > int, okay
-                amount_to_stuff = -1;
-              }
-              if (sync_error < -config.tolerance * config.output_rate) {
-                amount_to_stuff = 1;
-              }
-              */
-
-              if (amount_to_stuff == 0) {
-                // use a "V" shaped function to decide if stuffing should occur
-                int64_t s = r64i();
-                s = s >> 31;
-                s = s * config.tolerance * config.output_rate;
-                s = (s >> 32) + config.tolerance * config.output_rate; // should be a number from 0
-                                                                       // to config.tolerance *
-                                                                       // config.output_rate;
-                if ((sync_error > 0) && (sync_error > s)) {
-                  // debug(1,"Extra stuff -1");
-                  amount_to_stuff = -1;
-                }
-                if ((sync_error < 0) && (sync_error < (-s))) {
-                  // debug(1,"Extra stuff +1");
-                  amount_to_stuff = 1;
-                }
-              }
-
-              // try to keep the corrections definitely below 1 in 1000 audio frames
-
-              // calculate the time elapsed since the play session started.
-
-              if (amount_to_stuff) {
-                if ((local_time_now) && (conn->first_packet_time_to_play) &&
-                    (local_time_now >= conn->first_packet_time_to_play)) {
-
-                  int64_t tp =
-                      (local_time_now - conn->first_packet_time_to_play) /
-                      1000000000; // seconds int64_t from uint64_t which is always positive, so ok
-
-                  if (tp < 5)
-                    amount_to_stuff = 0; // wait at least five seconds
-                  /*
-                  else if (tp < 30) {
-                    if ((random() % 1000) >
-                        352) // keep it to about 1:1000 for the first thirty seconds
-                      amount_to_stuff = 0;
-                  }
-                  */
-                }
-              }
-
-              if (config.no_sync != 0)
-                amount_to_stuff = 0; // no stuffing if it's been disabled
+              amount_to_stuff = decision.amount_to_stuff;
 
               // Apply DSP here
 
@@ -2417,9 +2459,22 @@ void *player_thread_func(void *arg) {
 
               int do_loudness = config.loudness;
 
+              int use_soxr = 0;
+#ifdef CONFIG_SOXR
+              if ((current_delay >= conn->dac_buffer_queue_minimum_length) &&
+                  (config.packet_stuffing != ST_basic) &&
+                  (config.soxr_delay_index != 0) && // computed already
+                  ((config.packet_stuffing != ST_auto) ||
+                   (config.soxr_delay_index <=
+                    config.soxr_delay_threshold))) // unless the CPU is deemed too slow
+                use_soxr = 1;
+#endif
+
+              int dsp_output_played = 0; // set if the DSP has filled the output buffer itself
+
 #ifdef CONFIG_CONVOLUTION
               int do_convolution = 0;
-              if ((config.convolution) && (config.convolver_valid))
+              if ((config.convolution) && (config.convolver_valid) && (conn->convolver))
                 do_convolution = 1;
 
               // we will apply the convolution gain if convolution is enabled, even if there is no
@@ -2449,8 +2504,8 @@ void *player_thread_func(void *arg) {
 #ifdef CONFIG_CONVOLUTION
                 // Apply convolution
                 if (do_convolution) {
-                  convolver_process_l(fbuf_l, inbuflength);
-                  convolver_process_r(fbuf_r, inbuflength);
+                  convolver_process_l(conn->convolver, fbuf_l, inbuflength);
+                  convolver_process_r(conn->convolver, fbuf_r, inbuflength);
                 }
                 if (convolution_is_enabled) {
                   float gain = pow(10.0, config.convolution_gain / 20.0);
@@ -2470,38 +2525,39 @@ void *player_thread_func(void *arg) {
                   // debug(1, "Applying soft volume dB: %f k: %f", gain_db, gain);
 
                   for (i = 0; i < inbuflength; ++i) {
-                    fbuf_l[i] = loudness_process(&loudness_l, fbuf_l[i] * gain);
-                    fbuf_r[i] = loudness_process(&loudness_r, fbuf_r[i] * gain);
+                    fbuf_l[i] = loudness_process(&conn->loudness_l, fbuf_l[i] * gain);
+                    fbuf_r[i] = loudness_process(&conn->loudness_r, fbuf_r[i] * gain);
                   }
                 }
 
-                // Interleave and convert back to int32_t
-                for (i = 0; i < inbuflength; ++i) {
-                  tbuf32[2 * i] = fbuf_l[i];
-                  tbuf32[2 * i + 1] = fbuf_r[i];
+                if (config.output_format == SPS_FORMAT_FLOAT) {
+                  // a float backend takes the DSP output as it is
+                  play_samples = stuff_buffer_float(fbuf_l, fbuf_r, inbuflength, conn->outbuf,
+                                                    amount_to_stuff, use_soxr, conn);
+                  dsp_output_played = 1;
+                } else {
+                  // Interleave and convert back to int32_t
+                  for (i = 0; i < inbuflength; ++i) {
+                    tbuf32[2 * i] = fbuf_l[i];
+                    tbuf32[2 * i + 1] = fbuf_r[i];
+                  }
                 }
               }
 
+              if (dsp_output_played == 0) {
 #ifdef CONFIG_SOXR
-              if ((current_delay < conn->dac_buffer_queue_minimum_length) ||
-                  (config.packet_stuffing == ST_basic) ||
-                  (config.soxr_delay_index == 0) || // not computed yet
-                  ((config.packet_stuffing == ST_auto) &&
-                   (config.soxr_delay_index >
-                    config.soxr_delay_threshold)) // if the CPU is deemed too slow
-              ) {
+                if (use_soxr) // soxr requested or auto requested with the index less or equal to
+                              // the threshold
+                  play_samples = stuff_buffer_soxr_32(
+                      (int32_t *)conn->tbuf, (int32_t *)conn->sbuf, inbuflength,
+                      config.output_format, conn->outbuf, amount_to_stuff, conn->enable_dither,
+                      conn);
+                else
 #endif
-                play_samples =
-                    stuff_buffer_basic_32((int32_t *)conn->tbuf, inbuflength, config.output_format,
-                                          conn->outbuf, amount_to_stuff, conn->enable_dither, conn);
-#ifdef CONFIG_SOXR
-              } else { // soxr requested or auto requested with the index less or equal to the
-                       // threshold
-                play_samples = stuff_buffer_soxr_32((int32_t *)conn->tbuf, (int32_t *)conn->sbuf,
-                                                    inbuflength, config.output_format, conn->outbuf,
-                                                    amount_to_stuff, conn->enable_dither, conn);
+                  play_samples = stuff_buffer_basic_32((int32_t *)conn->tbuf, inbuflength,
+                                                       config.output_format, conn->outbuf,
+                                                       amount_to_stuff, conn->enable_dither, conn);
               }
-#endif
 
               /*
               {
@@ -2528,6 +2584,7 @@ void *player_thread_func(void *arg) {
                     generate_zero_frames(conn->outbuf, play_samples, config.output_format,
                                          conn->enable_dither, conn->previous_random_number);
                   }
+                  signal_presentation_time(inframe->given_timestamp, conn);
                   config.output->play(conn->outbuf, play_samples);
                 }
               }
@@ -2596,6 +2653,7 @@ void *player_thread_func(void *arg) {
                 generate_zero_frames(conn->outbuf, play_samples, config.output_format,
                                      conn->enable_dither, conn->previous_random_number);
               }
+              signal_presentation_time(inframe->given_timestamp, conn);
               config.output->play(conn->outbuf, play_samples); // remove the (short*)!
             }
           }
@@ -2791,6 +2849,9 @@ void *player_thread_func(void *arg) {
               inform("No frames received in the last sampling interval.");
             }
           }
+#ifdef CONFIG_METADATA
+          report_metadata_pipe_overruns(&metadata_pipe_items_dropped);
+#endif
           minimum_dac_queue_size = UINT64_MAX;   // hack reset
           maximum_buffer_occupancy = INT32_MIN; // can't be less than this
           minimum_buffer_occupancy = INT32_MAX; // can't be more than this
@@ -2986,7 +3047,7 @@ void player_volume_without_notification(double airplay_volume, rtsp_conn_info *c
         conn->fix_volume = temp_fix_volume;
 
         // if (config.loudness)
-        loudness_set_volume(software_attenuation / 100);
+        loudness_set_volume(&conn->loudness_l, &conn->loudness_r, software_attenuation / 100);
       }
 
       if (config.logOutputLevel) {
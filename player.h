@@ -23,6 +23,11 @@
 
 #include "alac.h"
 #include "audio.h"
+#include "loudness.h"
+
+#ifdef CONFIG_CONVOLUTION
+#include <FFTConvolver/convolver.h>
+#endif
 
 #define time_ping_history_power_of_two 7
 #define time_ping_history (1 << time_ping_history_power_of_two) // 2^7 is 128. At 1 per three seconds, approximately six minutes of records
@@ -83,6 +88,7 @@ typedef struct {
 
 typedef struct {
   int connection_number;     // for debug ID purposes, nothing else...
+  int concurrent_session;    // set if this session is being mixed in alongside playing_conn
   int resend_interval;       // this is really just for debugging
   char *UserAgent;           // free this on teardown
   int AirPlayVersion;        // zero if not an AirPlay session. Used to help calculate latency
@@ -180,6 +186,19 @@ typedef struct {
 
   int amountStuffed;
 
+  // per-session state, so that sessions don't share anything but the configuration
+  int first_possibly_missing_frame; // where the next scan for missing packets starts, or -1
+  loudness_processor loudness_l, loudness_r;
+#ifdef CONFIG_CONVOLUTION
+  convolver_t *convolver;
+#endif
+#ifdef CONFIG_SOXR
+  // soxr execution time statistics
+  int32_t soxr_stat_n;
+  double soxr_stat_mean, soxr_stat_M2, soxr_longest_execution_time;
+  int64_t soxr_packets_processed;
+#endif
+
   int32_t framesProcessedInThisEpoch;
   int32_t framesGeneratedInThisEpoch;
   int32_t correctionsRequestedInThisEpoch;
@@ -0,0 +1,115 @@
+/*
+ * Lock-free single producer, single consumer byte ring.
+ *
+ * This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring_buffer.h"
+
+int ring_buffer_init(ring_buffer *rb, size_t size) {
+  rb->data = malloc(size);
+  rb->size = size;
+  rb->write_count = 0;
+  rb->read_count = 0;
+  if (rb->data == NULL) {
+    rb->size = 0;
+    return -1;
+  }
+  return 0;
+}
+
+void ring_buffer_free(ring_buffer *rb) {
+  free(rb->data);
+  rb->data = NULL;
+  rb->size = 0;
+}
+
+size_t ring_buffer_occupancy(ring_buffer *rb) {
+  uint64_t r = __atomic_load_n(&rb->read_count, __ATOMIC_ACQUIRE);
+  uint64_t w = __atomic_load_n(&rb->write_count, __ATOMIC_ACQUIRE);
+  return w - r;
+}
+
+size_t ring_buffer_space(ring_buffer *rb) { return rb->size - ring_buffer_occupancy(rb); }
+
+size_t ring_buffer_write(ring_buffer *rb, const void *src, size_t length) {
+  uint64_t w = __atomic_load_n(&rb->write_count, __ATOMIC_RELAXED);
+  uint64_t r = __atomic_load_n(&rb->read_count, __ATOMIC_ACQUIRE);
+  size_t space = rb->size - (w - r);
+  if (length > space)
+    length = space;
+  if (length) {
+    size_t offset = w % rb->size;
+    size_t first_part = rb->size - offset;
+    if (first_part > length)
+      first_part = length;
+    memcpy(rb->data + offset, src, first_part);
+    memcpy(rb->data, (const uint8_t *)src + first_part, length - first_part);
+    __atomic_store_n(&rb->write_count, w + length, __ATOMIC_RELEASE);
+  }
+  return length;
+}
+
+size_t ring_buffer_read(ring_buffer *rb, void *dst, size_t length) {
+  size_t n;
+  uint64_t r;
+  do {
+    r = __atomic_load_n(&rb->read_count, __ATOMIC_ACQUIRE);
+    uint64_t w = __atomic_load_n(&rb->write_count, __ATOMIC_ACQUIRE);
+    n = w - r;
+    if (n > length)
+      n = length;
+    if (n == 0)
+      return 0;
+    size_t offset = r % rb->size;
+    size_t first_part = rb->size - offset;
+    if (first_part > n)
+      first_part = n;
+    memcpy(dst, rb->data + offset, first_part);
+    memcpy((uint8_t *)dst + first_part, rb->data, n - first_part);
+    // if the oldest data was discarded while we were copying it, what we have may be torn
+  } while (!__atomic_compare_exchange_n(&rb->read_count, &r, r + n, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+  return n;
+}
+
+size_t ring_buffer_discard(ring_buffer *rb, size_t length) {
+  size_t n;
+  uint64_t r;
+  do {
+    r = __atomic_load_n(&rb->read_count, __ATOMIC_ACQUIRE);
+    uint64_t w = __atomic_load_n(&rb->write_count, __ATOMIC_ACQUIRE);
+    n = w - r;
+    if (n > length)
+      n = length;
+  } while ((n != 0) && (!__atomic_compare_exchange_n(&rb->read_count, &r, r + n, 0,
+                                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)));
+  return n;
+}
+
+void ring_buffer_reset(ring_buffer *rb) { ring_buffer_discard(rb, SIZE_MAX); }
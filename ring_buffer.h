@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A lock-free byte ring for one producer thread and one consumer thread.
+// The write and read counts only ever increase, so the occupancy is always write_count -
+// read_count. The producer may also discard the oldest data, so the consumer commits what it has
+// read with a compare-and-swap and tries again if the data was discarded from under it.
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  volatile uint64_t write_count; // only changed by the producer
+  volatile uint64_t read_count;  // changed by the consumer, or by ring_buffer_discard
+} ring_buffer;
+
+int ring_buffer_init(ring_buffer *rb, size_t size); // returns 0 on success
+void ring_buffer_free(ring_buffer *rb);
+
+size_t ring_buffer_occupancy(ring_buffer *rb);
+size_t ring_buffer_space(ring_buffer *rb);
+
+// producer: copy in up to length bytes, returns the number copied
+size_t ring_buffer_write(ring_buffer *rb, const void *src, size_t length);
+
+// consumer: copy out up to length bytes, returns the number copied
+size_t ring_buffer_read(ring_buffer *rb, void *dst, size_t length);
+
+// either side: throw away up to length of the oldest bytes, returns the number thrown away
+size_t ring_buffer_discard(ring_buffer *rb, size_t length);
+
+// either side: throw away everything
+void ring_buffer_reset(ring_buffer *rb);
@@ -0,0 +1,685 @@
+/*
+ * RTSP request parser benchmark. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// This replays a captured RTSP session, as a client sends it, through rtsp_read_request() --
+// the parser the RTSP conversation threads use -- and through a copy of the parser it replaced,
+// which allocated a read buffer, a message and a copy of every header name and value for each
+// request. Each request is written into one end of a socket pair and read from the other, as it
+// would be from a client, and only the reading and parsing is timed. The header each parser
+// gives for the CSeq of each request is checked.
+// A session from an iOS device is built in. A capture of your own can be replayed instead: save
+// the client's side of the conversation as raw bytes, e.g. with Wireshark's "Follow TCP Stream".
+// Requests bigger than the read buffer, such as those carrying artwork, are left out, because
+// both parsers wait 80 ms before reading a content that didn't arrive with its headers.
+
+#include "common.h"
+#include "mdns.h"
+#include "player.h"
+#include "rtp.h"
+#include "rtsp.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef CONFIG_METADATA_HUB
+#include "metadata_hub.h"
+#endif
+
+#ifdef CONFIG_MQTT
+#include "mqtt.h"
+#endif
+
+#define BENCHMARK_READ_BUFFER_SIZE 4096 // the size of rtsp_read_request()'s read buffer
+#define BENCHMARK_MAXIMUM_REQUESTS 1024
+
+// rtsp.c hands requests on to the player, RTP, mDNS and metadata code, none of which is needed
+// to read them
+
+int player_play(__attribute__((unused)) rtsp_conn_info *conn) { return 0; }
+int player_stop(__attribute__((unused)) rtsp_conn_info *conn) { return 0; }
+void player_volume(__attribute__((unused)) double f, __attribute__((unused)) rtsp_conn_info *conn) {
+}
+void player_flush(__attribute__((unused)) uint32_t timestamp,
+                  __attribute__((unused)) rtsp_conn_info *conn) {}
+void rtp_initialise(__attribute__((unused)) rtsp_conn_info *conn) {}
+void rtp_terminate(__attribute__((unused)) rtsp_conn_info *conn) {}
+void rtp_setup(__attribute__((unused)) SOCKADDR *local, __attribute__((unused)) SOCKADDR *remote,
+               __attribute__((unused)) uint16_t controlport,
+               __attribute__((unused)) uint16_t timingport,
+               __attribute__((unused)) rtsp_conn_info *conn) {}
+void mdns_register(void) {}
+void mdns_unregister(void) {}
+
+#ifdef CONFIG_METADATA_HUB
+void metadata_hub_process_metadata(__attribute__((unused)) uint32_t type,
+                                   __attribute__((unused)) uint32_t code,
+                                   __attribute__((unused)) char *data,
+                                   __attribute__((unused)) uint32_t length) {}
+#endif
+
+#ifdef CONFIG_MQTT
+void mqtt_process_metadata(__attribute__((unused)) uint32_t type,
+                           __attribute__((unused)) uint32_t code,
+                           __attribute__((unused)) char *data,
+                           __attribute__((unused)) uint32_t length) {}
+#endif
+
+#ifdef CONFIG_ALSA
+// common.c hands the ALSA backend the device named by the on-start command, but there's no
+// ALSA backend here.
+void set_alsa_out_dev(__attribute__((unused)) char *device) {}
+#endif
+
+// The parser rtsp_read_request() replaced, less its debug messages and its handling of
+// cancellation and stalled transfers.
+
+typedef struct {
+  int index_number;
+  uint32_t referenceCount;
+  unsigned int nheaders;
+  char *name[16];
+  char *value[16];
+
+  int contentlength;
+  char *content;
+
+  // for requests
+  char method[16];
+
+  // for responses
+  int respcode;
+} previous_rtsp_message;
+
+static int previous_msg_indexes = 1;
+static pthread_mutex_t previous_reference_counter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static previous_rtsp_message *previous_msg_init(void) {
+  previous_rtsp_message *msg = malloc(sizeof(previous_rtsp_message));
+  if (msg) {
+    memset(msg, 0, sizeof(previous_rtsp_message));
+    msg->referenceCount = 1;
+    msg->index_number = previous_msg_indexes++;
+  } else {
+    die("previous_msg_init -- can not allocate memory for rtsp_message %d.",
+        previous_msg_indexes);
+  }
+  return msg;
+}
+
+static int previous_msg_add_header(previous_rtsp_message *msg, char *name, char *value) {
+  if (msg->nheaders >= sizeof(msg->name) / sizeof(char *)) {
+    warn("too many headers?!");
+    return 1;
+  }
+
+  msg->name[msg->nheaders] = strdup(name);
+  msg->value[msg->nheaders] = strdup(value);
+  msg->nheaders++;
+
+  return 0;
+}
+
+static char *previous_msg_get_header(previous_rtsp_message *msg, char *name) {
+  unsigned int i;
+  for (i = 0; i < msg->nheaders; i++)
+    if (!strcasecmp(msg->name[i], name))
+      return msg->value[i];
+  return NULL;
+}
+
+static void previous_msg_free(previous_rtsp_message **msgh) {
+  pthread_mutex_lock(&previous_reference_counter_lock);
+  if (*msgh != NULL) {
+    previous_rtsp_message *msg = *msgh;
+    msg->referenceCount--;
+    if (msg->referenceCount == 0) {
+      unsigned int i;
+      for (i = 0; i < msg->nheaders; i++) {
+        free(msg->name[i]);
+        free(msg->value[i]);
+      }
+      if (msg->content)
+        free(msg->content);
+      free(msg);
+      *msgh = NULL;
+    }
+  }
+  pthread_mutex_unlock(&previous_reference_counter_lock);
+}
+
+static char *previous_nextline(char *in, int inbuf) {
+  char *out = NULL;
+  while (inbuf) {
+    if (*in == '\r') {
+      *in++ = 0;
+      out = in;
+      inbuf--;
+    }
+    if ((*in == '\n') && (inbuf)) {
+      *in++ = 0;
+      out = in;
+    }
+
+    if (out)
+      break;
+
+    in++;
+    inbuf--;
+  }
+  return out;
+}
+
+static int previous_msg_handle_line(previous_rtsp_message **pmsg, char *line) {
+  previous_rtsp_message *msg = *pmsg;
+
+  if (!msg) {
+    msg = previous_msg_init();
+    *pmsg = msg;
+    char *sp, *p;
+    sp = NULL;
+
+    p = strtok_r(line, " ", &sp);
+    if (!p)
+      goto fail;
+    strncpy(msg->method, p, sizeof(msg->method) - 1);
+
+    p = strtok_r(NULL, " ", &sp);
+    if (!p)
+      goto fail;
+
+    p = strtok_r(NULL, " ", &sp);
+    if (!p)
+      goto fail;
+    if (strcmp(p, "RTSP/1.0"))
+      goto fail;
+
+    return -1;
+  }
+
+  if (strlen(line)) {
+    char *p;
+    p = strstr(line, ": ");
+    if (!p) {
+      warn("bad header: >>%s<<", line);
+      goto fail;
+    }
+    *p = 0;
+    p += 2;
+    previous_msg_add_header(msg, line, p);
+    return -1;
+  } else {
+    char *cl = previous_msg_get_header(msg, "Content-Length");
+    if (cl)
+      return atoi(cl);
+    else
+      return 0;
+  }
+
+fail:
+  previous_msg_free(pmsg);
+  *pmsg = NULL;
+  return 0;
+}
+
+static enum rtsp_read_request_response
+previous_rtsp_read_request(int fd, previous_rtsp_message **the_packet) {
+  *the_packet = NULL;
+
+  enum rtsp_read_request_response reply = rtsp_read_request_response_ok;
+  ssize_t buflen = 4096;
+  char *buf = malloc(buflen + 1); // add a NUL at the end
+  if (!buf)
+    return (rtsp_read_request_response_error);
+  ssize_t nread;
+  ssize_t inbuf = 0;
+  int msg_size = -1;
+
+  while (msg_size < 0) {
+    nread = read(fd, buf + inbuf, buflen - inbuf);
+    if (nread == 0) {
+      reply = rtsp_read_request_response_channel_closed;
+      goto shutdown;
+    }
+    if (nread < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      reply = rtsp_read_request_response_read_error;
+      goto shutdown;
+    }
+    inbuf += nread;
+
+    char *next;
+    while (msg_size < 0 && (next = previous_nextline(buf, inbuf))) {
+      msg_size = previous_msg_handle_line(the_packet, buf);
+      if (!(*the_packet)) {
+        reply = rtsp_read_request_response_bad_packet;
+        goto shutdown;
+      }
+      inbuf -= next - buf;
+      if (inbuf)
+        memmove(buf, next, inbuf);
+    }
+  }
+
+  if (msg_size > buflen) {
+    buf = realloc(buf, msg_size + 1);
+    if (!buf) {
+      reply = rtsp_read_request_response_error;
+      goto shutdown;
+    }
+    buflen = msg_size;
+  }
+
+  while (inbuf < msg_size) {
+    usleep(80000); // wait about 80 milliseconds between reads of up to about 64 kB
+    nread = read(fd, buf + inbuf, msg_size - inbuf);
+    if (nread <= 0) {
+      if ((nread < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+        continue;
+      reply = rtsp_read_request_response_read_error;
+      goto shutdown;
+    }
+    inbuf += nread;
+  }
+
+  previous_rtsp_message *msg = *the_packet;
+  msg->contentlength = inbuf;
+  msg->content = buf;
+  buf[inbuf] = '\0';
+shutdown:
+  if (reply != rtsp_read_request_response_ok) {
+    previous_msg_free(the_packet);
+    free(buf);
+  }
+  return reply;
+}
+
+// the requests of a session, as the client sends them
+
+typedef struct {
+  char *data;
+  size_t length;
+  char method[16];
+  char cseq[16];           // empty if the request has none
+  char content_length[16]; // empty if the request has none
+} benchmark_request;
+
+static benchmark_request requests[BENCHMARK_MAXIMUM_REQUESTS];
+static int number_of_requests = 0;
+
+// note the method, CSeq and Content-Length of a request, as a client would send them
+static void add_request(char *data, size_t length) {
+  if (number_of_requests == BENCHMARK_MAXIMUM_REQUESTS)
+    die("There are more than %d requests in the capture.", BENCHMARK_MAXIMUM_REQUESTS);
+  benchmark_request *r = &requests[number_of_requests++];
+  memset(r, 0, sizeof(benchmark_request));
+  r->data = data;
+  r->length = length;
+  sscanf(data, "%15s", r->method);
+  char *line = strstr(data, "\r\n");
+  while ((line != NULL) && (line[2] != '\r')) {
+    line += 2;
+    if (strncasecmp(line, "CSeq: ", strlen("CSeq: ")) == 0)
+      sscanf(line + strlen("CSeq: "), "%15s", r->cseq);
+    else if (strncasecmp(line, "Content-Length: ", strlen("Content-Length: ")) == 0)
+      sscanf(line + strlen("Content-Length: "), "%15s", r->content_length);
+    line = strstr(line, "\r\n");
+  }
+}
+
+// add a request from an iOS device to the built-in session
+static void add_ios_request(const char *request_line, int cseq, const char *headers,
+                            const char *content_type, const uint8_t *content,
+                            size_t content_length) {
+  char header_block[2048];
+  int length = snprintf(header_block, sizeof(header_block),
+                        "%s RTSP/1.0\r\nCSeq: %d\r\n%sDACP-ID: 14413BE4996FEA4D\r\n"
+                        "Active-Remote: 2543110914\r\nUser-Agent: AirPlay/409.16\r\n",
+                        request_line, cseq, headers);
+  if (content_length)
+    length += snprintf(header_block + length, sizeof(header_block) - length,
+                       "Content-Type: %s\r\nContent-Length: %zu\r\n", content_type,
+                       content_length);
+  length += snprintf(header_block + length, sizeof(header_block) - length, "\r\n");
+  char *data = malloc(length + content_length + 1);
+  if (data == NULL)
+    die("Can not allocate memory for the benchmark.");
+  memcpy(data, header_block, length);
+  if (content_length)
+    memcpy(data + length, content, content_length);
+  data[length + content_length] = '\0';
+  add_request(data, length + content_length);
+}
+
+// add a DMAP item with a string value to the buffer, returning its length
+static size_t put_dmap_item(uint8_t *p, const char *tag, const char *value) {
+  size_t length = strlen(value);
+  memcpy(p, tag, 4);
+  p[4] = length >> 24;
+  p[5] = length >> 16;
+  p[6] = length >> 8;
+  p[7] = length;
+  memcpy(p + 8, value, length);
+  return 8 + length;
+}
+
+static void build_ios_session(void) {
+  uint8_t random_bytes[256];
+  int i;
+  for (i = 0; i < 256; i++)
+    random_bytes[i] = r64u();
+  char *challenge = base64_enc(random_bytes, 16);
+  char *aes_key = base64_enc(random_bytes, 256);
+  char *aes_iv = base64_enc(random_bytes + 16, 16);
+  if ((challenge == NULL) || (aes_key == NULL) || (aes_iv == NULL))
+    die("Can not allocate memory for the benchmark.");
+
+  char headers[256];
+  snprintf(headers, sizeof(headers), "X-Apple-Device-ID: 0xa4d1d2800b68\r\nApple-Challenge: %s\r\n",
+           challenge);
+  add_ios_request("OPTIONS *", 0, headers, NULL, NULL, 0);
+
+  char sdp[1024];
+  size_t sdp_length = snprintf(sdp, sizeof(sdp),
+                               "v=0\r\no=AirTunes 3413821438 0 IN IP4 192.168.1.20\r\n"
+                               "s=AirTunes\r\nc=IN IP4 192.168.1.20\r\nt=0 0\r\n"
+                               "m=audio 0 RTP/AVP 96\r\na=rtpmap:96 AppleLossless\r\n"
+                               "a=fmtp:96 352 0 16 40 10 14 2 255 0 0 44100\r\n"
+                               "a=rsaaeskey:%s\r\na=aesiv:%s\r\n"
+                               "a=min-latency:11025\r\na=max-latency:88200\r\n",
+                               aes_key, aes_iv);
+  add_ios_request("ANNOUNCE rtsp://192.168.1.10/3413821438", 1, "", "application/sdp",
+                  (uint8_t *)sdp, sdp_length);
+  add_ios_request("SETUP rtsp://192.168.1.10/3413821438", 2,
+                  "Transport: RTP/AVP/UDP;unicast;interleaved=0-1;mode=record;control_port=6001;"
+                  "timing_port=6002\r\n",
+                  NULL, NULL, 0);
+  add_ios_request("RECORD rtsp://192.168.1.10/3413821438", 3,
+                  "Range: npt=0-\r\nSession: 1\r\nRTP-Info: seq=16341;rtptime=1146221540\r\n",
+                  NULL, NULL, 0);
+  const char *volume = "volume: -20.000000\r\n";
+  add_ios_request("SET_PARAMETER rtsp://192.168.1.10/3413821438", 4, "Session: 1\r\n",
+                  "text/parameters", (const uint8_t *)volume, strlen(volume));
+
+  uint8_t dmap[1024];
+  size_t dmap_length = 8;
+  memcpy(dmap, "mlit", 4);
+  dmap_length += put_dmap_item(dmap + dmap_length, "minm", "Autumn Leaves");
+  dmap_length += put_dmap_item(dmap + dmap_length, "asar", "Cannonball Adderley");
+  dmap_length += put_dmap_item(dmap + dmap_length, "asal", "Somethin' Else");
+  dmap_length += put_dmap_item(dmap + dmap_length, "asgn", "Jazz");
+  dmap_length += put_dmap_item(dmap + dmap_length, "ascp", "Joseph Kosma");
+  dmap_length += put_dmap_item(dmap + dmap_length, "asaa", "Cannonball Adderley");
+  uint32_t container_length = dmap_length - 8;
+  dmap[4] = container_length >> 24;
+  dmap[5] = container_length >> 16;
+  dmap[6] = container_length >> 8;
+  dmap[7] = container_length;
+  add_ios_request("SET_PARAMETER rtsp://192.168.1.10/3413821438", 5, "Session: 1\r\n",
+                  "application/x-dmap-tagged", dmap, dmap_length);
+
+  const char *progress = "progress: 1146221540/1146549156/1195701740\r\n";
+  add_ios_request("SET_PARAMETER rtsp://192.168.1.10/3413821438", 6, "Session: 1\r\n",
+                  "text/parameters", (const uint8_t *)progress, strlen(progress));
+  const char *get_volume = "volume\r\n";
+  add_ios_request("GET_PARAMETER rtsp://192.168.1.10/3413821438", 7, "Session: 1\r\n",
+                  "text/parameters", (const uint8_t *)get_volume, strlen(get_volume));
+  volume = "volume: -15.500000\r\n";
+  add_ios_request("SET_PARAMETER rtsp://192.168.1.10/3413821438", 8, "Session: 1\r\n",
+                  "text/parameters", (const uint8_t *)volume, strlen(volume));
+  add_ios_request("FLUSH rtsp://192.168.1.10/3413821438", 9,
+                  "Session: 1\r\nRTP-Info: seq=16400;rtptime=1146300000\r\n", NULL, NULL, 0);
+  add_ios_request("TEARDOWN rtsp://192.168.1.10/3413821438", 10, "Session: 1\r\n", NULL, NULL,
+                  0);
+
+  free(challenge);
+  free(aes_key);
+  free(aes_iv);
+}
+
+// split a capture of the client's side of a conversation into its requests
+static int load_capture(const char *filename, int *left_out) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Can not open the capture \"%s\": %s.\n", filename, strerror(errno));
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *capture = malloc(size + 1);
+  if (capture == NULL)
+    die("Can not allocate memory for the capture.");
+  if (fread(capture, 1, size, f) != (size_t)size) {
+    fprintf(stderr, "Can not read the capture \"%s\".\n", filename);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  capture[size] = '\0';
+
+  char *p = capture;
+  while (p < capture + size) {
+    char *end_of_headers = strstr(p, "\r\n\r\n");
+    if (end_of_headers == NULL)
+      break;
+    size_t length = end_of_headers + 4 - p;
+    // find the Content-Length, if there is one
+    char *line = p;
+    while ((line = strstr(line, "\r\n")) && (line < end_of_headers)) {
+      line += 2;
+      if (strncasecmp(line, "Content-Length: ", strlen("Content-Length: ")) == 0)
+        length += atol(line + strlen("Content-Length: "));
+    }
+    if (p + length > capture + size)
+      break; // the capture ends part way through the request
+    // each request gets its own copy, with a NUL after it
+    char *data = malloc(length + 1);
+    if (data == NULL)
+      die("Can not allocate memory for the capture.");
+    memcpy(data, p, length);
+    data[length] = '\0';
+    if (length > BENCHMARK_READ_BUFFER_SIZE) {
+      (*left_out)++;
+      free(data);
+    } else {
+      add_request(data, length);
+    }
+    p += length;
+  }
+  free(capture);
+  return 0;
+}
+
+// the contenders read a request from the socket and check its CSeq and Content-Length headers
+
+static rtsp_conn_info benchmark_conn;
+
+static int check_header(char *value, const char *expected) {
+  if (expected[0] == '\0')
+    return value == NULL;
+  return (value != NULL) && (strcmp(value, expected) == 0);
+}
+
+static int current_parser(int fd, benchmark_request *r) {
+  benchmark_conn.fd = fd;
+  rtsp_message *msg = NULL;
+  int ok = (rtsp_read_request(&benchmark_conn, &msg) == rtsp_read_request_response_ok);
+  if (ok)
+    ok = check_header(msg_get_header(msg, "CSeq"), r->cseq) &&
+         check_header(msg_get_header(msg, "Content-Length"), r->content_length);
+  msg_free(&msg);
+  return ok;
+}
+
+static int previous_parser(int fd, benchmark_request *r) {
+  previous_rtsp_message *msg = NULL;
+  int ok = (previous_rtsp_read_request(fd, &msg) == rtsp_read_request_response_ok);
+  if (ok)
+    ok = check_header(previous_msg_get_header(msg, "CSeq"), r->cseq) &&
+         check_header(previous_msg_get_header(msg, "Content-Length"), r->content_length);
+  previous_msg_free(&msg);
+  return ok;
+}
+
+typedef struct {
+  const char *name;
+  int (*parse)(int fd, benchmark_request *r);
+  uint64_t *time; // per request, in nanoseconds
+} benchmark_contender;
+
+static benchmark_contender contenders[] = {
+    {"previous parser (malloc and strdup)", &previous_parser, NULL},
+    {"rtsp_read_request (pooled)", &current_parser, NULL},
+    {NULL, NULL, NULL}};
+
+// replay the session the given number of times, returning the number of requests misread
+static uint64_t replay(benchmark_contender *c, int sockets[2], int sessions) {
+  uint64_t failures = 0;
+  int s, i;
+  for (s = 0; s < sessions; s++) {
+    for (i = 0; i < number_of_requests; i++) {
+      benchmark_request *r = &requests[i];
+      size_t written = 0;
+      while (written < r->length) {
+        ssize_t rc = write(sockets[0], r->data + written, r->length - written);
+        if (rc < 0)
+          die("Can not write the request to the socket: %s.", strerror(errno));
+        written += rc;
+      }
+      uint64_t start = get_absolute_time_in_ns();
+      if (c->parse(sockets[1], r) == 0)
+        failures++;
+      c->time[i] += get_absolute_time_in_ns() - start;
+    }
+  }
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  int sessions = 20000;
+  char *capture = NULL;
+  int seed = 0;
+
+  struct poptOption optionsTable[] = {
+      {"sessions", 'n', POPT_ARG_INT, &sessions, 0,
+       "The number of times to replay the session -- the default is 20000.", "NUMBER"},
+      {"capture", 'c', POPT_ARG_STRING, &capture, 0,
+       "A file holding the raw bytes a client sent, to replay instead of the built-in session.",
+       "FILE"},
+      {"seed", 's', POPT_ARG_INT, &seed, 0, "The seed for the built-in session's keys.",
+       "NUMBER"},
+      POPT_AUTOHELP{NULL, 0, 0, NULL, 0, NULL, NULL}};
+
+  poptContext optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0);
+  int c;
+  while ((c = poptGetNextOpt(optCon)) >= 0) {
+  }
+  if (c < -1) {
+    fprintf(stderr, "%s: %s\n", poptBadOption(optCon, POPT_BADOPTION_NOALIAS), poptStrerror(c));
+    return 1;
+  }
+  poptFreeContext(optCon);
+  if (sessions < 1) {
+    fprintf(stderr, "The session must be replayed at least once.\n");
+    return 1;
+  }
+
+  log_to_stderr();
+  r64init(seed);
+
+  if (capture) {
+    int left_out = 0;
+    if (load_capture(capture, &left_out) != 0)
+      return 1;
+    if (left_out)
+      printf("%d requests bigger than %d bytes are left out.\n", left_out,
+             BENCHMARK_READ_BUFFER_SIZE);
+    if (number_of_requests == 0) {
+      fprintf(stderr, "There are no requests to replay in \"%s\".\n", capture);
+      return 1;
+    }
+  } else {
+    build_ios_session();
+  }
+
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    die("Can not create a socket pair: %s.", strerror(errno));
+  benchmark_conn.connection_number = 1;
+
+  int failures = 0;
+  benchmark_contender *contender;
+  for (contender = contenders; contender->name != NULL; contender++) {
+    contender->time = calloc(number_of_requests, sizeof(uint64_t));
+    if (contender->time == NULL)
+      die("Can not allocate memory for the benchmark.");
+    uint64_t misread = replay(contender, sockets, sessions);
+    if (misread) {
+      fprintf(stderr, "%s: %" PRIu64 " requests were misread.\n", contender->name, misread);
+      failures++;
+    }
+  }
+
+  // the time for each request, then for the session
+  printf("%-16s %7s", "request", "bytes");
+  for (contender = contenders; contender->name != NULL; contender++)
+    printf(" %37s", contender->name);
+  printf("\n");
+  int i;
+  for (i = 0; i <= number_of_requests; i++) {
+    if (i < number_of_requests)
+      printf("%-16s %7zu", requests[i].method, requests[i].length);
+    else
+      printf("%-16s %7s", "whole session", "");
+    for (contender = contenders; contender->name != NULL; contender++) {
+      uint64_t time = 0;
+      if (i < number_of_requests) {
+        time = contender->time[i];
+      } else {
+        int j;
+        for (j = 0; j < number_of_requests; j++)
+          time += contender->time[j];
+      }
+      printf(" %34.1f ns", (1.0 * time) / sessions);
+    }
+    printf("\n");
+  }
+
+  close(sockets[0]);
+  close(sockets[1]);
+  for (contender = contenders; contender->name != NULL; contender++)
+    free(contender->time);
+  for (i = 0; i < number_of_requests; i++)
+    free(requests[i].data);
+  return failures ? 1 : 0;
+}
@@ -28,8 +28,10 @@
  */
 
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <memory.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -42,6 +44,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "config.h"
@@ -60,6 +63,7 @@
 #endif
 
 #include "common.h"
+#include "datagram.h"
 #include "player.h"
 #include "rtp.h"
 #include "rtsp.h"
@@ -80,15 +84,6 @@
 
 #define METADATA_SNDBUF (4 * 1024 * 1024)
 
-enum rtsp_read_request_response {
-  rtsp_read_request_response_ok,
-  rtsp_read_request_response_immediate_shutdown_requested,
-  rtsp_read_request_response_bad_packet,
-  rtsp_read_request_response_channel_closed,
-  rtsp_read_request_response_read_error,
-  rtsp_read_request_response_error
-};
-
 rtsp_conn_info *playing_conn;
 rtsp_conn_info **conns;
 
@@ -96,6 +91,7 @@ int metadata_running = 0;
 
 // always lock use this when accessing the playing conn value
 static pthread_mutex_t playing_conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static int concurrent_sessions = 0; // sessions being mixed in alongside the playing conn
 
 // every time we want to retain or release a reference count, lock it with this
 // if a reference count is read as zero, it means the it's being deallocated.
@@ -109,41 +105,61 @@ static pthread_mutex_t reference_counter_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int RTSP_connection_index = 1;
 
-#ifdef CONFIG_METADATA
-typedef struct {
-  pthread_mutex_t pc_queue_lock;
-  pthread_cond_t pc_queue_item_added_signal;
-  pthread_cond_t pc_queue_item_removed_signal;
-  char *name;
-	size_t item_size;  // number of bytes in each item
-  uint32_t count;    // number of items in the queue
-  uint32_t capacity; // maximum number of items
-  uint32_t toq;      // first item to take
-  uint32_t eoq;      // free space at end of queue
-  void *items;       // a pointer to where the items are actually stored
-} pc_queue;          // producer-consumer queue
-#endif
-
 static int msg_indexes = 1;
 
-typedef struct {
+// Messages are recycled through a pool rather than allocated for each request and response.
+// Header names and values are kept in space within the message, and a content that's no bigger
+// than the message's buffer is read directly into it, so the common messages need no allocation.
+#define RTSP_MESSAGE_MAXIMUM_HEADERS 16
+#define RTSP_MESSAGE_BUFFER_SIZE 4096
+// any header line that fits in the buffer fits here, whatever the split between name and value
+#define RTSP_MESSAGE_STRING_SPACE RTSP_MESSAGE_BUFFER_SIZE
+#define RTSP_MESSAGE_POOL_SIZE 16
+
+struct rtsp_message_struct {
   int index_number;
   uint32_t referenceCount; // we might start using this...
   unsigned int nheaders;
-  char *name[16];
-  char *value[16];
+  char *name[RTSP_MESSAGE_MAXIMUM_HEADERS];
+  char *value[RTSP_MESSAGE_MAXIMUM_HEADERS];
+  uint32_t name_hash[RTSP_MESSAGE_MAXIMUM_HEADERS]; // to avoid most string comparisons
+  char strings[RTSP_MESSAGE_STRING_SPACE];          // the header names and values live here
+  size_t strings_used;
 
   int contentlength;
-  char *content;
+  char *content; // freed with the message unless it points to the buffer
+  char buffer[RTSP_MESSAGE_BUFFER_SIZE + 1]; // read buffer and home of small contents
 
   // for requests
   char method[16];
 
   // for responses
   int respcode;
-} rtsp_message;
+
+  struct rtsp_message_struct *next_free; // when in the pool
+};
+
+// protected by the reference_counter_lock
+static rtsp_message *msg_pool = NULL;
+static int msg_pool_count = 0;
+
+void msg_cleanup_function(void *arg);
 
 #ifdef CONFIG_METADATA
+// Metadata goes to its consumers -- the pipe, multicast, hub and MQTT threads -- through a single
+// ring. Producers claim a slot with a compare-and-swap and publish it with its sequence number,
+// so sending metadata never takes a lock. Each consumer reads every item with a cursor of its
+// own, and the last one to finish with an item releases it and frees the slot, so an item's
+// carrier is retained, or its data copied, just once, however many consumers there are.
+// A consumer with nothing to do sleeps on a pipe, and a producer writes a byte to wake it only
+// if it's asleep.
+// If the ring is full, an item is dropped, unless it's sent with the block flag set, in which
+// case the sender waits, for a while, for the slowest consumer to release a slot.
+
+#define METADATA_RING_SIZE 512 // must be a power of two
+#define METADATA_MAXIMUM_CONSUMERS 4
+#define METADATA_BLOCKING_SEND_TIMEOUT_MS 1000
+
 typedef struct {
   uint32_t type;
   uint32_t code;
@@ -152,40 +168,65 @@ typedef struct {
   rtsp_message *carrier;
 } metadata_package;
 
-void pc_queue_init(pc_queue *the_queue, char *items, size_t item_size, uint32_t number_of_items, const char* name) {
-	if (name)
-		debug(2, "Creating metadata queue \"%s\".", name);
-	else
-		debug(1, "Creating an unnamed metadata queue.");
-  pthread_mutex_init(&the_queue->pc_queue_lock, NULL);
-  pthread_cond_init(&the_queue->pc_queue_item_added_signal, NULL);
-  pthread_cond_init(&the_queue->pc_queue_item_removed_signal, NULL);
-  the_queue->item_size = item_size;
-  the_queue->items = items;
-  the_queue->count = 0;
-  the_queue->capacity = number_of_items;
-  the_queue->toq = 0;
-  the_queue->eoq = 0;
-  if (name == NULL)
-  	the_queue->name = NULL;
-  else
-  	the_queue->name = strdup(name);
-}
-
-void pc_queue_delete(pc_queue *the_queue) {
-	if (the_queue->name)
-		debug(2, "Deleting metadata queue \"%s\".", the_queue->name);
-	else
-		debug(1, "Deleting an unnamed metadata queue.");
-	if (the_queue->name != NULL)
-		free(the_queue->name);
-	// debug(2, "destroying pc_queue_item_removed_signal");
-  pthread_cond_destroy(&the_queue->pc_queue_item_removed_signal);
-	// debug(2, "destroying pc_queue_item_added_signal");
-  pthread_cond_destroy(&the_queue->pc_queue_item_added_signal);
-	// debug(2, "destroying pc_queue_lock");
-  pthread_mutex_destroy(&the_queue->pc_queue_lock);
-	// debug(2, "destroying signals and locks done");
+typedef struct {
+  uint32_t sequence; // the ring position it's free for, or that position + 1 when it's filled
+  uint32_t readers_remaining; // the number of consumers yet to finish with the package
+  metadata_package pack;
+} metadata_slot;
+
+typedef struct {
+  const char *name;
+  uint32_t read_position;
+  metadata_slot *current; // the slot being processed, if any
+  int sleeping;           // set while waiting for an item; cleared by whoever wakes it
+  int doorbell[2];        // a pipe; a byte is written to wake the consumer
+} metadata_consumer;
+
+static metadata_slot metadata_ring[METADATA_RING_SIZE];
+static uint32_t metadata_write_position = 0;
+static metadata_consumer metadata_consumers[METADATA_MAXIMUM_CONSUMERS];
+static int number_of_metadata_consumers = 0;
+static uint32_t metadata_items_dropped = 0;
+
+// senders waiting for a slot to be released wait on this, and are counted so that consumers only
+// take the mutex when someone is waiting
+static pthread_mutex_t metadata_release_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metadata_release_cv = PTHREAD_COND_INITIALIZER;
+static int metadata_waiting_senders = 0;
+
+void metadata_ring_init(void) {
+  uint32_t i;
+  for (i = 0; i < METADATA_RING_SIZE; i++) {
+    metadata_ring[i].sequence = i;
+    metadata_ring[i].readers_remaining = 0;
+    memset(&metadata_ring[i].pack, 0, sizeof(metadata_package));
+  }
+  metadata_write_position = 0;
+  number_of_metadata_consumers = 0;
+  metadata_items_dropped = 0;
+}
+
+// consumers must all be added before any metadata is sent
+metadata_consumer *metadata_add_consumer(const char *name) {
+  if (number_of_metadata_consumers == METADATA_MAXIMUM_CONSUMERS)
+    die("Too many metadata consumers.");
+  metadata_consumer *c = &metadata_consumers[number_of_metadata_consumers];
+  memset(c, 0, sizeof(metadata_consumer));
+  c->name = name;
+  if (pipe(c->doorbell) != 0)
+    die("Can not create a pipe for the metadata consumer \"%s\".", name);
+  debug(2, "Creating metadata consumer \"%s\".", name);
+  number_of_metadata_consumers++;
+  return c;
+}
+
+void metadata_delete_consumers(void) {
+  int i;
+  for (i = 0; i < number_of_metadata_consumers; i++) {
+    close(metadata_consumers[i].doorbell[0]);
+    close(metadata_consumers[i].doorbell[1]);
+  }
+  number_of_metadata_consumers = 0;
 }
 
 int send_metadata(uint32_t type, uint32_t code, char *data, uint32_t length, rtsp_message *carrier,
@@ -195,99 +236,58 @@ int send_ssnc_metadata(uint32_t code, char *data, uint32_t length, int block) {
   return send_metadata('ssnc', code, data, length, NULL, block);
 }
 
-void pc_queue_cleanup_handler(void *arg) {
-  // debug(1, "pc_queue_cleanup_handler called.");
-  pc_queue *the_queue = (pc_queue *)arg;
-  int rc = pthread_mutex_unlock(&the_queue->pc_queue_lock);
-  if (rc)
-    debug(1, "Error unlocking for pc_queue_add_item or pc_queue_get_item.");
-}
-
-int pc_queue_add_item(pc_queue *the_queue, const void *the_stuff, int block) {
-	int response = 0;
-  int rc;
-  if (the_queue) {
-    if (block == 0) {
-      rc = debug_mutex_lock(&the_queue->pc_queue_lock, 10000, 2);
-      if (rc == EBUSY)
-        return EBUSY;
-    } else
-      rc = pthread_mutex_lock(&the_queue->pc_queue_lock);
-    if (rc)
-      debug(1, "Error locking for pc_queue_add_item");
-    pthread_cleanup_push(pc_queue_cleanup_handler, (void *)the_queue);
-    // leave this out if you want this to return if the queue is already full
-    // irrespective of the block flag.
-    /*
-		while (the_queue->count == the_queue->capacity) {
-			rc = pthread_cond_wait(&the_queue->pc_queue_item_removed_signal, &the_queue->pc_queue_lock);
-			if (rc)
-				debug(1, "Error waiting for item to be removed");
-		}
-		*/
-    if (the_queue->count < the_queue->capacity) {
-			uint32_t i = the_queue->eoq;
-			void *p = the_queue->items + the_queue->item_size * i;
-			//    void * p = &the_queue->qbase + the_queue->item_size*the_queue->eoq;
-			memcpy(p, the_stuff, the_queue->item_size);
-
-			// update the pointer
-			i++;
-			if (i == the_queue->capacity)
-				// fold pointer if necessary
-				i = 0;
-			the_queue->eoq = i;
-			the_queue->count++;
-			//debug(2,"metadata queue+ \"%s\" %d/%d.", the_queue->name, the_queue->count, the_queue->capacity);
-			if (the_queue->count == the_queue->capacity)
-				debug(3, "metadata queue \"%s\": is now full with %d items in it!", the_queue->name, the_queue->count);
-			rc = pthread_cond_signal(&the_queue->pc_queue_item_added_signal);
-			if (rc)
-				debug(1, "metadata queue \"%s\": error signalling after pc_queue_add_item", the_queue->name);
-    } else {
-    	response = EWOULDBLOCK; // a bit arbitrary, this.
-    	debug(3,"metadata queue \"%s\": is already full with %d items in it. Not adding this item to the queue.", the_queue->name, the_queue->count);
+// wait for this consumer's next item -- contains a cancellation point
+// if writable_fd isn't -1, this also returns, with NULL, as soon as writable_fd can be written to
+metadata_package *metadata_consumer_get_item(metadata_consumer *c, int writable_fd) {
+  uint32_t position = c->read_position;
+  metadata_slot *slot = &metadata_ring[position & (METADATA_RING_SIZE - 1)];
+  while (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != position + 1) {
+    __atomic_store_n(&c->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) == position + 1) {
+      if (__atomic_exchange_n(&c->sleeping, 0, __ATOMIC_SEQ_CST) == 1)
+        continue; // nobody else knew we were going to sleep
+      // otherwise a producer has cleared the flag and is ringing the doorbell, so answer it
+    } else if (writable_fd != -1) {
+      struct pollfd fds[2];
+      fds[0].fd = c->doorbell[0];
+      fds[0].events = POLLIN;
+      fds[1].fd = writable_fd;
+      fds[1].events = POLLOUT;
+      if ((poll(fds, 2, -1) > 0) && ((fds[0].revents & POLLIN) == 0)) {
+        // only writable_fd is ready
+        if (__atomic_exchange_n(&c->sleeping, 0, __ATOMIC_SEQ_CST) == 1)
+          return NULL;
+        // a producer is ringing the doorbell after all, so answer it before going on
+      }
     }
-    pthread_cleanup_pop(1); // unlock the queue lock.
-  } else {
-    debug(1, "Adding an item to a NULL queue");
-  }
-  return response;
-}
-
-int pc_queue_get_item(pc_queue *the_queue, void *the_stuff) {
-  int rc;
-  if (the_queue) {
-    rc = pthread_mutex_lock(&the_queue->pc_queue_lock);
-    if (rc)
-      debug(1, "metadata queue \"%s\": error locking for pc_queue_get_item", the_queue->name);
-    pthread_cleanup_push(pc_queue_cleanup_handler, (void *)the_queue);
-    while (the_queue->count == 0) {
-      rc = pthread_cond_wait(&the_queue->pc_queue_item_added_signal, &the_queue->pc_queue_lock);
-      if (rc)
-        debug(1, "metadata queue \"%s\": error waiting for item to be added", the_queue->name);
+    char doorbell;
+    if ((read(c->doorbell[0], &doorbell, 1) < 0) && (errno != EINTR))
+      debug(1, "metadata consumer \"%s\": error %d waiting for an item.", c->name, errno);
+  }
+  c->current = slot;
+  return &slot->pack;
+}
+
+// finish with the consumer's current item, releasing it if no other consumer needs it
+void metadata_consumer_done(metadata_consumer *c) {
+  metadata_slot *slot = c->current;
+  if (slot) {
+    if (__atomic_sub_fetch(&slot->readers_remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+      if (slot->pack.carrier)
+        msg_free(&slot->pack.carrier); // release the message
+      else if (slot->pack.data)
+        free(slot->pack.data);
+      slot->pack.data = NULL;
+      __atomic_store_n(&slot->sequence, c->read_position + METADATA_RING_SIZE, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&metadata_waiting_senders, __ATOMIC_SEQ_CST) != 0) {
+        pthread_mutex_lock(&metadata_release_mutex);
+        pthread_cond_broadcast(&metadata_release_cv);
+        pthread_mutex_unlock(&metadata_release_mutex);
+      }
     }
-    uint32_t i = the_queue->toq;
-    //    void * p = &the_queue->qbase + the_queue->item_size*the_queue->toq;
-    void *p = the_queue->items + the_queue->item_size * i;
-    memcpy(the_stuff, p, the_queue->item_size);
-
-    // update the pointer
-    i++;
-    if (i == the_queue->capacity)
-      // fold pointer if necessary
-      i = 0;
-    the_queue->toq = i;
-    the_queue->count--;
-    debug(3,"metadata queue- \"%s\" %d/%d.", the_queue->name, the_queue->count, the_queue->capacity);
-    rc = pthread_cond_signal(&the_queue->pc_queue_item_removed_signal);
-    if (rc)
-      debug(1, "metadata queue \"%s\": error signalling after pc_queue_get_item", the_queue->name);
-    pthread_cleanup_pop(1); // unlock the queue lock.
-  } else {
-    debug(1, "Removing an item from a NULL queue");
+    c->current = NULL;
+    c->read_position++;
   }
-  return 0;
 }
 
 #endif
@@ -295,12 +295,22 @@ int pc_queue_get_item(pc_queue *the_queue, void *the_stuff) {
 int have_player(rtsp_conn_info *conn) {
   int response = 0;
   debug_mutex_lock(&playing_conn_lock, 1000000, 3);
-  if (playing_conn == conn) // this connection definitely has the play lock
+  if ((playing_conn == conn) || (conn->concurrent_session)) // this connection has the play lock
     response = 1;
   debug_mutex_unlock(&playing_conn_lock, 3);
   return response;
 }
 
+// call with the playing_conn_lock held
+static void release_player(rtsp_conn_info *conn) {
+  if (playing_conn == conn) {
+    playing_conn = NULL;
+  } else if (conn->concurrent_session) {
+    conn->concurrent_session = 0;
+    concurrent_sessions--;
+  }
+}
+
 void player_watchdog_thread_cleanup_handler(void *arg) {
   rtsp_conn_info *conn = (rtsp_conn_info *)arg;
   debug(3, "Connection %d: Watchdog Exit.", conn->connection_number);
@@ -457,27 +467,70 @@ void msg_retain(rtsp_message *msg) {
 }
 
 rtsp_message *msg_init(void) {
-  rtsp_message *msg = malloc(sizeof(rtsp_message));
+  debug_mutex_lock(&reference_counter_lock, 1000, 0);
+  rtsp_message *msg = msg_pool;
   if (msg) {
-    memset(msg, 0, sizeof(rtsp_message));
+    msg_pool = msg->next_free;
+    msg_pool_count--;
+  } else {
+    msg = malloc(sizeof(rtsp_message));
+  }
+  if (msg) {
+    msg->nheaders = 0;
+    msg->strings_used = 0;
+    msg->contentlength = 0;
+    msg->content = NULL;
+    msg->method[0] = '\0';
+    msg->respcode = 0;
+    msg->next_free = NULL;
     msg->referenceCount = 1; // from now on, any access to this must be protected with the lock
     msg->index_number = msg_indexes++;
     debug(3,"msg_init message %d", msg->index_number);
   } else {
     die("msg_init -- can not allocate memory for rtsp_message %d.", msg_indexes);
   }
+  debug_mutex_unlock(&reference_counter_lock, 0);
   // debug(1,"msg_init -- create item %d.", msg->index_number);
   return msg;
 }
 
+// a case-insensitive FNV-1a hash of a header name
+static uint32_t msg_header_name_hash(const char *name) {
+  uint32_t hash = 2166136261U;
+  while (*name) {
+    hash ^= (uint8_t)tolower((unsigned char)*name++);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static char *msg_store_string(rtsp_message *msg, const char *str) {
+  size_t length = strlen(str) + 1;
+  if (msg->strings_used + length > sizeof(msg->strings))
+    return NULL;
+  char *stored = msg->strings + msg->strings_used;
+  memcpy(stored, str, length);
+  msg->strings_used += length;
+  return stored;
+}
+
 int msg_add_header(rtsp_message *msg, char *name, char *value) {
-  if (msg->nheaders >= sizeof(msg->name) / sizeof(char *)) {
+  if (msg->nheaders >= RTSP_MESSAGE_MAXIMUM_HEADERS) {
     warn("too many headers?!");
     return 1;
   }
 
-  msg->name[msg->nheaders] = strdup(name);
-  msg->value[msg->nheaders] = strdup(value);
+  size_t strings_used = msg->strings_used;
+  char *stored_name = msg_store_string(msg, name);
+  char *stored_value = msg_store_string(msg, value);
+  if ((stored_name == NULL) || (stored_value == NULL)) {
+    msg->strings_used = strings_used;
+    warn("headers too long?!");
+    return 1;
+  }
+  msg->name[msg->nheaders] = stored_name;
+  msg->value[msg->nheaders] = stored_value;
+  msg->name_hash[msg->nheaders] = msg_header_name_hash(name);
   msg->nheaders++;
 
   return 0;
@@ -485,8 +538,9 @@ int msg_add_header(rtsp_message *msg, char *name, char *value) {
 
 char *msg_get_header(rtsp_message *msg, char *name) {
   unsigned int i;
+  uint32_t hash = msg_header_name_hash(name);
   for (i = 0; i < msg->nheaders; i++)
-    if (!strcasecmp(msg->name[i], name))
+    if ((msg->name_hash[i] == hash) && (!strcasecmp(msg->name[i], name)))
       return msg->value[i];
   return NULL;
 }
@@ -529,12 +583,7 @@ void msg_free(rtsp_message **msgh) {
   	if (msg->referenceCount)
   		debug(3,"msg_free decrement reference counter message %d to %d", msg->index_number, msg->referenceCount);
     if (msg->referenceCount == 0) {
-      unsigned int i;
-      for (i = 0; i < msg->nheaders; i++) {
-        free(msg->name[i]);
-        free(msg->value[i]);
-      }
-      if (msg->content)
+      if ((msg->content) && (msg->content != msg->buffer))
         free(msg->content);
       // debug(1,"msg_free item %d -- free.",msg->index_number);
       uintptr_t index = (msg->index_number) & 0xFFFF;
@@ -543,7 +592,13 @@ void msg_free(rtsp_message **msgh) {
       *msgh =
           (rtsp_message *)(index); // put a version of the index number of the freed message in here
 		  debug(3,"msg_free freed message %d", msg->index_number);
-      free(msg);
+      if (msg_pool_count < RTSP_MESSAGE_POOL_SIZE) {
+        msg->next_free = msg_pool;
+        msg_pool = msg;
+        msg_pool_count++;
+      } else {
+        free(msg);
+      }
     } else {
       // debug(1,"msg_free item %d -- decrement reference to
       // %d.",msg->index_number,msg->referenceCount);
@@ -560,9 +615,7 @@ void msg_free(rtsp_message **msgh) {
 int msg_handle_line(rtsp_message **pmsg, char *line) {
   rtsp_message *msg = *pmsg;
 
-  if (!msg) {
-    msg = msg_init();
-    *pmsg = msg;
+  if (msg->method[0] == '\0') { // the request line hasn't been seen yet
     char *sp, *p;
     sp = NULL; // this is to quieten a compiler warning
 
@@ -595,7 +648,9 @@ int msg_handle_line(rtsp_message **pmsg, char *line) {
     }
     *p = 0;
     p += 2;
-    msg_add_header(msg, line, p);
+    // a header that can't be kept, such as the Content-Length or CSeq, can't be ignored either
+    if (msg_add_header(msg, line, p) != 0)
+      goto fail;
     debug(3, "    %s: %s.", line, p);
     return -1;
   } else {
@@ -615,17 +670,13 @@ fail:
 
 enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info *conn, rtsp_message **the_packet) {
 
-  *the_packet = NULL; // need this for error handling
-
   enum rtsp_read_request_response reply = rtsp_read_request_response_ok;
-  ssize_t buflen = 4096;
-  int release_buffer = 0;         // on exit, don't deallocate the buffer if everything was okay
-  char *buf = malloc(buflen + 1); // add a NUL at the end
-  if (!buf) {
-    warn("Connection %d: rtsp_read_request: can't get a buffer.", conn->connection_number);
-    return (rtsp_read_request_response_error);
-  }
-  pthread_cleanup_push(malloc_cleanup, buf);
+  // the message's own buffer is used to read the request line and headers, and holds the content
+  // too unless it's too big
+  *the_packet = msg_init();
+  pthread_cleanup_push(msg_cleanup_function, (void *)the_packet);
+  ssize_t buflen = RTSP_MESSAGE_BUFFER_SIZE;
+  char *buf = (*the_packet)->buffer; // there's room for a NUL at the end
   ssize_t nread;
   ssize_t inbuf = 0;
   int msg_size = -1;
@@ -692,12 +743,15 @@ enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info *conn, rtsp_mes
   }
 
   if (msg_size > buflen) {
-    buf = realloc(buf, msg_size + 1);
-    if (!buf) {
+    char *content = malloc(msg_size + 1);
+    if (!content) {
       warn("Connection %d: too much content.", conn->connection_number);
       reply = rtsp_read_request_response_error;
       goto shutdown;
     }
+    memcpy(content, buf, inbuf);
+    buf = content;
+    (*the_packet)->content = buf; // so that it's freed with the message, whatever happens
     buflen = msg_size;
   }
 
@@ -766,11 +820,9 @@ enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info *conn, rtsp_mes
   *jp = '\0';
   *the_packet = msg;
 shutdown:
-  if (reply != rtsp_read_request_response_ok) {
+  pthread_cleanup_pop(0);
+  if (reply != rtsp_read_request_response_ok)
     msg_free(the_packet);
-    release_buffer = 1; // allow the buffer to be released
-  }
-  pthread_cleanup_pop(release_buffer);
   return reply;
 }
 
@@ -1057,8 +1109,7 @@ void handle_setup(rtsp_conn_info *conn, rtsp_message *req, rtsp_message *resp) {
     if (resp->respcode != 200) {
       debug(1, "Connection %d: SETUP error -- releasing the player lock.", conn->connection_number);
       debug_mutex_lock(&playing_conn_lock, 1000000, 3);
-      if (playing_conn == conn) // if we have the player
-        playing_conn = NULL;    // let it go
+      release_player(conn); // if we have the player, let it go
       debug_mutex_unlock(&playing_conn_lock, 3);
     }
 
@@ -1201,97 +1252,57 @@ void handle_set_parameter_parameter(rtsp_conn_info *conn, rtsp_message *req,
 //		Can be an IPv4 or an IPv6 number.
 //		`dapo` -- the payload is the port number (as text) on the server to which remote
 // control commands should be sent. It is 3689 for iTunes but varies for iOS devices.
+//    'mdrp' -- items have been dropped because the reader of the metadata pipe wasn't
+//    keeping up. The payload is a string -- "items_dropped,bytes_dropped,items_written" --
+//    of totals since Shairport Sync started. It is sent with the playing statistics, at
+//    most every few seconds, when more items have been dropped since it was last sent.
 
 //		A special sub-protocol is used for sending large data items over UDP
 //    If the payload exceeded 4 MB, it is chunked using the following format:
 //    "ssnc", "chnk", packet_ix, packet_counts, packet_tag, packet_type, chunked_data.
 //    Notice that the number of items is different to the standard
 
-// including a simple base64 encoder to minimise malloc/free activity
-
-// From Stack Overflow, with thanks:
-// http://stackoverflow.com/questions/342409/how-do-i-base64-encode-decode-in-c
-// minor mods to make independent of C99.
-// more significant changes make it not malloc memory
-// needs to initialise the docoding table first
-
-// add _so to end of name to avoid confusion with polarssl's implementation
-
-static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
-                                'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
-                                'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
-                                'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
-                                '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
-
-static size_t mod_table[] = {0, 2, 1};
-
-// pass in a pointer to the data, its length, a pointer to the output buffer and
-// a pointer to an int
-// containing its maximum length
-// the actual length will be returned.
-
-char *base64_encode_so(const unsigned char *data, size_t input_length, char *encoded_data,
-                       size_t *output_length) {
-
-  size_t calculated_output_length = 4 * ((input_length + 2) / 3);
-  if (calculated_output_length > *output_length)
-    return (NULL);
-  *output_length = calculated_output_length;
-
-  size_t i, j;
-  for (i = 0, j = 0; i < input_length;) {
-
-    uint32_t octet_a = i < input_length ? (unsigned char)data[i++] : 0;
-    uint32_t octet_b = i < input_length ? (unsigned char)data[i++] : 0;
-    uint32_t octet_c = i < input_length ? (unsigned char)data[i++] : 0;
-
-    uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
-
-    encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-    encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-    encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-    encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
-  }
-
-  for (i = 0; i < mod_table[input_length % 3]; i++)
-    encoded_data[*output_length - 1 - i] = '=';
-
-  return encoded_data;
-}
-
-// with thanks!
-//
-
 static int fd = -1;
 // static int dirty = 0;
 
+// The pipe is written without blocking. Each item is put together in item_buffer and written,
+// after whatever is left over from earlier items, with one writev. What the pipe won't take is
+// kept in the backlog, up to config.metadata_pipe_backlog_size bytes, and written as the pipe
+// makes room. An item that has been partly written is always kept whole, so that the reader never
+// sees a broken item. An item that won't fit is dropped, straight away or after waiting, as
+// set by config.metadata_pipe_overflow_policy.
+static char *item_buffer = NULL;
+static size_t item_buffer_size = 0;
+static char *backlog = NULL;
+static size_t backlog_size = 0;   // allocated
+static size_t backlog_start = 0;  // the first byte not yet written
+static size_t backlog_length = 0; // the end of the bytes not yet written
+// statistics, written by the metadata thread and read by metadata_pipe_statistics()
+static uint64_t metadata_pipe_items_written = 0;
+static uint64_t metadata_pipe_items_dropped = 0;
+static uint64_t metadata_pipe_bytes_dropped = 0;
+
 
 
-pc_queue metadata_queue;
-#define metadata_queue_size 500
-metadata_package metadata_queue_items[metadata_queue_size];
 pthread_t metadata_thread;
 
 #ifdef CONFIG_METADATA_HUB
-pc_queue metadata_hub_queue;
-#define metadata_hub_queue_size 500
-metadata_package metadata_hub_queue_items[metadata_hub_queue_size];
 pthread_t metadata_hub_thread;
 #endif
 
 #ifdef CONFIG_MQTT
-pc_queue metadata_mqtt_queue;
-#define metadata_mqtt_queue_size 500
-metadata_package metadata_mqtt_queue_items[metadata_mqtt_queue_size];
 pthread_t metadata_mqtt_thread;
 #endif
 
 static int metadata_sock = -1;
 static struct sockaddr_in metadata_sockaddr;
-static char *metadata_sockmsg;
-pc_queue metadata_multicast_queue;
-#define metadata_multicast_queue_size 500
-metadata_package metadata_multicast_queue_items[metadata_queue_size];
+// An item is sent as a run of packets, each made of a header and a slice of the item's data, which
+// is sent where it is rather than copied. The headers and the iovecs pointing at them and at the
+// data are kept for the next item.
+static char *metadata_sockheaders;
+static struct iovec *metadata_sockiov;
+static uint32_t metadata_sockchunks; // the number of packets there's room for
+#define METADATA_PACING_BURST 16 // packets sent between pauses, if pacing is on
 pthread_t metadata_multicast_thread;
 
 
@@ -1313,12 +1324,6 @@ void metadata_create_multicast_socket(void) {
       metadata_sockaddr.sin_family = AF_INET;
       metadata_sockaddr.sin_addr.s_addr = inet_addr(config.metadata_sockaddr);
       metadata_sockaddr.sin_port = htons(config.metadata_sockport);
-      metadata_sockmsg = malloc(config.metadata_sockmsglength);
-      if (metadata_sockmsg) {
-        memset(metadata_sockmsg, 0, config.metadata_sockmsglength);
-      } else {
-        die("Could not malloc metadata multicast socket buffer");
-      }
     }
   }
 }
@@ -1328,8 +1333,11 @@ void metadata_delete_multicast_socket(void) {
     return;
   shutdown(metadata_sock, SHUT_RDWR); // we want to immediately deallocate the buffer
   close(metadata_sock);
-  if (metadata_sockmsg)
-    free(metadata_sockmsg);
+  free(metadata_sockheaders);
+  metadata_sockheaders = NULL;
+  free(metadata_sockiov);
+  metadata_sockiov = NULL;
+  metadata_sockchunks = 0;
 }
 
 
@@ -1344,6 +1352,11 @@ void metadata_open(void) {
 
   fd = try_to_open_pipe_for_writing(path);
   free(path);
+  if (fd >= 0) {
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1))
+      debug(1, "metadata_open -- error %d making the pipe non-blocking.", errno);
+  }
 }
 
 static void metadata_close(void) {
@@ -1351,36 +1364,47 @@ static void metadata_close(void) {
     return;
   close(fd);
   fd = -1;
+  backlog_start = 0; // a new reader mustn't get the end of an item
+  backlog_length = 0;
 }
 
 void metadata_multicast_process(uint32_t type, uint32_t code, char *data, uint32_t length) {
   // debug(1, "Process multicast metadata with type %x, code %x and length %u.", type, code, length);
-  if (metadata_sock >= 0 && length < config.metadata_sockmsglength - 8) {
-    char *ptr = metadata_sockmsg;
-    uint32_t v;
-    v = htonl(type);
-    memcpy(ptr, &v, 4);
-    ptr += 4;
-    v = htonl(code);
-    memcpy(ptr, &v, 4);
-    ptr += 4;
-    memcpy(ptr, data, length);
-    sendto(metadata_sock, metadata_sockmsg, length + 8, 0, (struct sockaddr *)&metadata_sockaddr,
-           sizeof(metadata_sockaddr));
-  } else if (metadata_sock >= 0) {
+  if (metadata_sock < 0)
+    return;
+  uint32_t chunk_total = 1;
+  size_t header_length = 8;
+  size_t chunk_length = length;
+  if (length >= config.metadata_sockmsglength - 8) {
     // send metadata in numbered chunks using the protocol:
     // ("ssnc", "chnk", packet_ix, packet_counts, packet_tag, packet_type, chunked_data)
-
-    uint32_t chunk_ix = 0;
-    uint32_t chunk_total = length / (config.metadata_sockmsglength - 24);
-    if (chunk_total * (config.metadata_sockmsglength - 24) < length) {
-      chunk_total++;
+    header_length = 24;
+    chunk_length = config.metadata_sockmsglength - 24;
+    chunk_total = (length + chunk_length - 1) / chunk_length;
+  }
+  if (chunk_total > metadata_sockchunks) {
+    char *headers = realloc(metadata_sockheaders, chunk_total * 24);
+    if (headers)
+      metadata_sockheaders = headers;
+    struct iovec *iov = realloc(metadata_sockiov, chunk_total * 2 * sizeof(struct iovec));
+    if (iov)
+      metadata_sockiov = iov;
+    if ((headers == NULL) || (iov == NULL)) {
+      debug(1, "Could not allocate memory to send a metadata item of %u bytes.", length);
+      return;
     }
-    uint32_t remaining = length;
+    metadata_sockchunks = chunk_total;
+  }
+  uint32_t chunk_ix;
+  uint32_t remaining = length;
+  char *data_crsr = data;
+  for (chunk_ix = 0; chunk_ix < chunk_total; chunk_ix++) {
+    char *ptr = metadata_sockheaders + chunk_ix * 24;
+    struct iovec *iov = metadata_sockiov + chunk_ix * 2;
     uint32_t v;
-    char *data_crsr = data;
-    do {
-      char *ptr = metadata_sockmsg;
+    iov[0].iov_base = ptr;
+    iov[0].iov_len = header_length;
+    if (header_length == 24) {
       memcpy(ptr, "ssncchnk", 8);
       ptr += 8;
       v = htonl(chunk_ix);
@@ -1389,134 +1413,227 @@ void metadata_multicast_process(uint32_t type, uint32_t code, char *data, uint32
       v = htonl(chunk_total);
       memcpy(ptr, &v, 4);
       ptr += 4;
-      v = htonl(type);
-      memcpy(ptr, &v, 4);
-      ptr += 4;
-      v = htonl(code);
-      memcpy(ptr, &v, 4);
-      ptr += 4;
-      size_t datalen = remaining;
-      if (datalen > config.metadata_sockmsglength - 24) {
-        datalen = config.metadata_sockmsglength - 24;
-      }
-      memcpy(ptr, data_crsr, datalen);
-      data_crsr += datalen;
-      sendto(metadata_sock, metadata_sockmsg, datalen + 24, 0,
-             (struct sockaddr *)&metadata_sockaddr, sizeof(metadata_sockaddr));
-      chunk_ix++;
-      remaining -= datalen;
-      if (remaining == 0)
-        break;
-    } while (1);
+    }
+    v = htonl(type);
+    memcpy(ptr, &v, 4);
+    ptr += 4;
+    v = htonl(code);
+    memcpy(ptr, &v, 4);
+    size_t datalen = remaining;
+    if (datalen > chunk_length)
+      datalen = chunk_length;
+    iov[1].iov_base = data_crsr;
+    iov[1].iov_len = datalen;
+    data_crsr += datalen;
+    remaining -= datalen;
+  }
+  // send them all at once or, if pacing, in bursts with a pause between them
+  uint32_t burst = chunk_total;
+  if ((config.metadata_sockpacing) && (burst > METADATA_PACING_BURST))
+    burst = METADATA_PACING_BURST;
+  for (chunk_ix = 0; chunk_ix < chunk_total; chunk_ix += burst) {
+    if (chunk_ix)
+      usleep(config.metadata_sockpacing * 1000);
+    uint32_t count = chunk_total - chunk_ix;
+    if (count > burst)
+      count = burst;
+    if (send_datagrams(metadata_sock, (struct sockaddr *)&metadata_sockaddr,
+                       sizeof(metadata_sockaddr), metadata_sockiov + chunk_ix * 2, 2,
+                       count) != count) {
+      debug(2, "Error %d sending metadata to the multicast socket.", errno);
+      break;
+    }
   }
 }
 
-void metadata_process(uint32_t type, uint32_t code, char *data, uint32_t length) {
-  // debug(1, "Process metadata with type %x, code %x and length %u.", type, code, length);
-  int ret = 0;
-  // readers may go away and come back
+// make sure there's room for size bytes in the buffer
+static char *metadata_buffer_reserve(char **buffer, size_t *buffer_size, size_t size) {
+  if (size > *buffer_size) {
+    char *new_buffer = realloc(*buffer, size);
+    if (new_buffer == NULL)
+      return NULL;
+    *buffer = new_buffer;
+    *buffer_size = size;
+  }
+  return *buffer;
+}
 
-  if (fd < 0)
-    metadata_open();
-  if (fd < 0)
-    return;
-  char thestring[1024];
-  snprintf(thestring, 1024, "<item><type>%x</type><code>%x</code><length>%u</length>", type, code,
-           length);
-  // ret = non_blocking_write(fd, thestring, strlen(thestring));
-  ret = write(fd, thestring, strlen(thestring));
+static void metadata_pipe_log_drop(size_t length) {
+  uint64_t items_dropped = __atomic_add_fetch(&metadata_pipe_items_dropped, 1, __ATOMIC_RELAXED);
+  uint64_t bytes_dropped =
+      __atomic_add_fetch(&metadata_pipe_bytes_dropped, length, __ATOMIC_RELAXED);
+  if ((items_dropped % 100) == 1)
+    debug(1,
+          "metadata pipe overrun: the reader isn't keeping up. %" PRIu64 " items (%" PRIu64
+          " bytes) dropped; %" PRIu64 " written.",
+          items_dropped, bytes_dropped, metadata_pipe_items_written);
+}
+
+void metadata_pipe_statistics(uint64_t *items_written, uint64_t *items_dropped,
+                              uint64_t *bytes_dropped) {
+  *items_written = __atomic_load_n(&metadata_pipe_items_written, __ATOMIC_RELAXED);
+  *items_dropped = __atomic_load_n(&metadata_pipe_items_dropped, __ATOMIC_RELAXED);
+  *bytes_dropped = __atomic_load_n(&metadata_pipe_bytes_dropped, __ATOMIC_RELAXED);
+}
+
+// write the backlog and then the item -- which may be NULL -- as far as the pipe will take them
+// returns the number of bytes of the item written, or -1 if the pipe has gone away
+static ssize_t metadata_pipe_writev(const char *item, size_t item_length) {
+  struct iovec iov[2];
+  int iovcnt = 0;
+  size_t pending = backlog_length - backlog_start;
+  if (pending) {
+    iov[iovcnt].iov_base = backlog + backlog_start;
+    iov[iovcnt].iov_len = pending;
+    iovcnt++;
+  }
+  if (item_length) {
+    iov[iovcnt].iov_base = (void *)item;
+    iov[iovcnt].iov_len = item_length;
+    iovcnt++;
+  }
+  if (iovcnt == 0)
+    return 0;
+  ssize_t ret = writev(fd, iov, iovcnt);
   if (ret < 0) {
-    // debug(1,"metadata_process error %d exit 1",ret);
-    return;
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return 0;
+    if (errno != EPIPE)
+      debug(1, "metadata pipe: error %d writing.", errno);
+    metadata_close(); // the reader has gone -- reopen the pipe with the next item
+    return -1;
   }
-  if ((data != NULL) && (length > 0)) {
-    snprintf(thestring, 1024, "\n<data encoding=\"base64\">\n");
-    // ret = non_blocking_write(fd, thestring, strlen(thestring));
-    ret = write(fd, thestring, strlen(thestring));
-    if (ret < 0) {
-      // debug(1,"metadata_process error %d exit 2",ret);
+  size_t written = ret;
+  if (written >= pending) {
+    backlog_start = 0;
+    backlog_length = 0;
+    return written - pending;
+  }
+  backlog_start += written;
+  return 0;
+}
+
+// write an item, or just the backlog if item is NULL
+static void metadata_pipe_write(const char *item, size_t item_length) {
+  uint64_t time_limit =
+      get_absolute_time_in_ns() + (uint64_t)config.metadata_pipe_timeout * 1000000;
+  size_t item_written = 0;
+  while (fd >= 0) {
+    ssize_t ret = metadata_pipe_writev(item + item_written, item_length - item_written);
+    if (ret < 0)
+      return;
+    item_written += ret;
+    if (item == NULL)
+      return;
+    if (item_written == item_length) {
+      __atomic_add_fetch(&metadata_pipe_items_written, 1, __ATOMIC_RELAXED);
       return;
     }
-    // here, we write the data in base64 form using our nice base64 encoder
-    // but, we break it into lines of 76 output characters, except for the last
-    // one.
-    // thus, we send groups of (76/4)*3 =  57 bytes to the encoder at a time
-    size_t remaining_count = length;
-    char *remaining_data = data;
-    // size_t towrite_count;
-    char outbuf[76];
-    while ((remaining_count) && (ret >= 0)) {
-      size_t towrite_count = remaining_count;
-      if (towrite_count > 57)
-        towrite_count = 57;
-      size_t outbuf_size = 76; // size of output buffer on entry, length of result on exit
-      if (base64_encode_so((unsigned char *)remaining_data, towrite_count, outbuf, &outbuf_size) ==
-          NULL)
-        debug(1, "Error encoding base64 data.");
-      // debug(1,"Remaining count: %d ret: %d, outbuf_size:
-      // %d.",remaining_count,ret,outbuf_size);
-      //ret = non_blocking_write(fd, outbuf, outbuf_size);
-      ret = write(fd, outbuf, outbuf_size);
-      if (ret < 0) {
-        // debug(1,"metadata_process error %d exit 3",ret);
+    size_t remainder = item_length - item_written;
+    size_t pending = backlog_length - backlog_start;
+    if ((item_written != 0) || (pending + remainder <= config.metadata_pipe_backlog_size)) {
+      // keep the rest of it for later
+      if (backlog_start != 0) {
+        memmove(backlog, backlog + backlog_start, pending);
+        backlog_start = 0;
+        backlog_length = pending;
+      }
+      if (metadata_buffer_reserve(&backlog, &backlog_size, pending + remainder) == NULL) {
+        // the reader would get a broken item, so start again with it
+        warn("metadata pipe: can not allocate a backlog of %zu bytes.", pending + remainder);
+        metadata_close();
         return;
       }
-      remaining_data += towrite_count;
-      remaining_count -= towrite_count;
+      memcpy(backlog + backlog_length, item + item_written, remainder);
+      backlog_length += remainder;
+      __atomic_add_fetch(&metadata_pipe_items_written, 1, __ATOMIC_RELAXED);
+      return;
     }
-    snprintf(thestring, 1024, "</data>");
-    // ret = non_blocking_write(fd, thestring, strlen(thestring));
-    ret = write(fd, thestring, strlen(thestring));
-    if (ret < 0) {
-      // debug(1,"metadata_process error %d exit 4",ret);
+    uint64_t time_now = get_absolute_time_in_ns();
+    if ((config.metadata_pipe_overflow_policy == MPO_wait) && (time_now < time_limit)) {
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      int timeout = (time_limit - time_now + 999999) / 1000000;
+      poll(&pfd, 1, timeout); // a cancellation point
+    } else {
+      metadata_pipe_log_drop(item_length);
       return;
     }
   }
-  snprintf(thestring, 1024, "</item>\n");
-  //ret = non_blocking_write(fd, thestring, strlen(thestring));
-  ret = write(fd, thestring, strlen(thestring));
-  if (ret < 0) {
-    // debug(1,"metadata_process error %d exit 5",ret);
+}
+
+void metadata_process(uint32_t type, uint32_t code, char *data, uint32_t length) {
+  // debug(1, "Process metadata with type %x, code %x and length %u.", type, code, length);
+  // readers may go away and come back
+
+  if (fd < 0)
+    metadata_open();
+  if (fd < 0)
+    return;
+
+  // put the item together -- the data goes in base64 form, all on one line
+  static const char data_start[] = "\n<data encoding=\"base64\">\n";
+  static const char data_end[] = "</data>";
+  static const char item_end[] = "</item>\n";
+  size_t encoded_length = base64_encoded_length(length, 0);
+  size_t maximum_length = 128 + sizeof(data_start) + encoded_length + sizeof(data_end) +
+                          sizeof(item_end);
+  if (metadata_buffer_reserve(&item_buffer, &item_buffer_size, maximum_length) == NULL) {
+    debug(1, "metadata pipe: can not allocate %zu bytes for an item.", maximum_length);
+    metadata_pipe_log_drop(maximum_length);
     return;
   }
+  char *p = item_buffer;
+  p += snprintf(p, 128, "<item><type>%x</type><code>%x</code><length>%u</length>", type, code,
+                length);
+  if ((data != NULL) && (length > 0)) {
+    memcpy(p, data_start, sizeof(data_start) - 1);
+    p += sizeof(data_start) - 1;
+    p += base64_encode_into((uint8_t *)data, length, p, 0);
+    memcpy(p, data_end, sizeof(data_end) - 1);
+    p += sizeof(data_end) - 1;
+  }
+  memcpy(p, item_end, sizeof(item_end) - 1);
+  p += sizeof(item_end) - 1;
+
+  metadata_pipe_write(item_buffer, p - item_buffer);
 }
 
 void metadata_pack_cleanup_function(void *arg) {
   // debug(1, "metadata_pack_cleanup_function called");
-  metadata_package *pack = (metadata_package *)arg;
-  if (pack->carrier)
-    msg_free(&pack->carrier); // release the message
-  else if (pack->data)
-    free(pack->data);
+  metadata_consumer_done((metadata_consumer *)arg);
   // debug(1, "metadata_pack_cleanup_function exit");
 }
 
 void metadata_thread_cleanup_function(__attribute__((unused)) void *arg) {
   // debug(2, "metadata_thread_cleanup_function called");
   metadata_close();
-  pc_queue_delete(&metadata_queue);
 }
 
-void *metadata_thread_function(__attribute__((unused)) void *ignore) {
-  // create a pc_queue for passing information to a threaded metadata handler
-  pc_queue_init(&metadata_queue, (char *)&metadata_queue_items, sizeof(metadata_package),
-                metadata_queue_size, "pipe");
+void *metadata_thread_function(void *arg) {
+  metadata_consumer *consumer = (metadata_consumer *)arg;
   metadata_create_multicast_socket();
-  metadata_package pack;
   pthread_cleanup_push(metadata_thread_cleanup_function, NULL);
   while (1) {
-    pc_queue_get_item(&metadata_queue, &pack);
-    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
-    if (config.metadata_enabled) {
-    	if (pack.carrier) {
-    		debug(3, "     pipe: type %x, code %x, length %u, message %d.", pack.type, pack.code, pack.length, pack.carrier->index_number);
-    	} else {
-    		debug(3, "     pipe: type %x, code %x, length %u.", pack.type, pack.code, pack.length);
-    	}
-      metadata_process(pack.type, pack.code, pack.data, pack.length);
-      debug(3, "     pipe: done.");
+    // while there's a backlog, wake up when the pipe can take more of it, too
+    int backlog_fd = ((fd >= 0) && (backlog_length != backlog_start)) ? fd : -1;
+    metadata_package *pack = metadata_consumer_get_item(consumer, backlog_fd);
+    if (pack == NULL) {
+      metadata_pipe_write(NULL, 0);
+    } else {
+      pthread_cleanup_push(metadata_pack_cleanup_function, (void *)consumer);
+      if (config.metadata_enabled) {
+        if (pack->carrier) {
+          debug(3, "     pipe: type %x, code %x, length %u, message %d.", pack->type, pack->code, pack->length, pack->carrier->index_number);
+        } else {
+          debug(3, "     pipe: type %x, code %x, length %u.", pack->type, pack->code, pack->length);
+        }
+        metadata_process(pack->type, pack->code, pack->data, pack->length);
+        debug(3, "     pipe: done.");
+      }
+      pthread_cleanup_pop(1);
     }
-    pthread_cleanup_pop(1);
   }
   pthread_cleanup_pop(1); // will never happen
   pthread_exit(NULL);
@@ -1525,26 +1642,22 @@ void *metadata_thread_function(__attribute__((unused)) void *ignore) {
 void metadata_multicast_thread_cleanup_function(__attribute__((unused)) void *arg) {
   // debug(2, "metadata_multicast_thread_cleanup_function called");
   metadata_delete_multicast_socket();
-  pc_queue_delete(&metadata_multicast_queue);
 }
 
-void *metadata_multicast_thread_function(__attribute__((unused)) void *ignore) {
-  // create a pc_queue for passing information to a threaded metadata handler
-  pc_queue_init(&metadata_multicast_queue, (char *)&metadata_multicast_queue_items, sizeof(metadata_package),
-                metadata_multicast_queue_size, "multicast");
+void *metadata_multicast_thread_function(void *arg) {
+  metadata_consumer *consumer = (metadata_consumer *)arg;
   metadata_create_multicast_socket();
-  metadata_package pack;
   pthread_cleanup_push(metadata_multicast_thread_cleanup_function, NULL);
   while (1) {
-    pc_queue_get_item(&metadata_multicast_queue, &pack);
-    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
+    metadata_package *pack = metadata_consumer_get_item(consumer, -1);
+    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)consumer);
     if (config.metadata_enabled) {
-    	if (pack.carrier) {
-    		debug(3, "                                                                    multicast: type %x, code %x, length %u, message %d.", pack.type, pack.code, pack.length, pack.carrier->index_number);
+    	if (pack->carrier) {
+    		debug(3, "                                                                    multicast: type %x, code %x, length %u, message %d.", pack->type, pack->code, pack->length, pack->carrier->index_number);
     	} else {
-    		debug(3, "                                                                    multicast: type %x, code %x, length %u.", pack.type, pack.code, pack.length);
+    		debug(3, "                                                                    multicast: type %x, code %x, length %u.", pack->type, pack->code, pack->length);
     	}
-      metadata_multicast_process(pack.type, pack.code, pack.data, pack.length);
+      metadata_multicast_process(pack->type, pack->code, pack->data, pack->length);
       debug(3, "                                                                    multicast: done.");
     }
     pthread_cleanup_pop(1);
@@ -1561,10 +1674,10 @@ void metadata_hub_close(void) {
 void metadata_hub_thread_cleanup_function(__attribute__((unused)) void *arg) {
   // debug(2, "metadata_hub_thread_cleanup_function called");
   metadata_hub_close();
-  pc_queue_delete(&metadata_hub_queue);
 }
 
-void *metadata_hub_thread_function(__attribute__((unused)) void *ignore) {
+void *metadata_hub_thread_function(void *arg) {
+  metadata_consumer *consumer = (metadata_consumer *)arg;
 
   // create the fifo, if necessary
   size_t pl = strlen(config.metadata_pipename) + 1;
@@ -1592,20 +1705,16 @@ void *metadata_hub_thread_function(__attribute__((unused)) void *ignore) {
 	}
   free(path);
 
-  // create a pc_queue for passing information to a threaded metadata handler
-  pc_queue_init(&metadata_hub_queue, (char *)&metadata_hub_queue_items, sizeof(metadata_package),
-                metadata_hub_queue_size, "hub");
-  metadata_package pack;
   pthread_cleanup_push(metadata_hub_thread_cleanup_function, NULL);
   while (1) {
-    pc_queue_get_item(&metadata_hub_queue, &pack);
-    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
-    	if (pack.carrier) {
-    		debug(3, "                    hub: type %x, code %x, length %u, message %d.", pack.type, pack.code, pack.length, pack.carrier->index_number);
+    metadata_package *pack = metadata_consumer_get_item(consumer, -1);
+    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)consumer);
+    	if (pack->carrier) {
+    		debug(3, "                    hub: type %x, code %x, length %u, message %d.", pack->type, pack->code, pack->length, pack->carrier->index_number);
     	} else {
-    		debug(3, "                    hub: type %x, code %x, length %u.", pack.type, pack.code, pack.length);
+    		debug(3, "                    hub: type %x, code %x, length %u.", pack->type, pack->code, pack->length);
     	}
-		metadata_hub_process_metadata(pack.type, pack.code, pack.data, pack.length);
+		metadata_hub_process_metadata(pack->type, pack->code, pack->data, pack->length);
 		debug(3, "                    hub: done.");
     pthread_cleanup_pop(1);
   }
@@ -1621,26 +1730,22 @@ void metadata_mqtt_close(void) {
 void metadata_mqtt_thread_cleanup_function(__attribute__((unused)) void *arg) {
   // debug(2, "metadata_mqtt_thread_cleanup_function called");
   metadata_mqtt_close();
-  pc_queue_delete(&metadata_mqtt_queue);
   // debug(2, "metadata_mqtt_thread_cleanup_function done");
 }
 
-void *metadata_mqtt_thread_function(__attribute__((unused)) void *ignore) {
-  // create a pc_queue for passing information to a threaded metadata handler
-  pc_queue_init(&metadata_mqtt_queue, (char *)&metadata_mqtt_queue_items, sizeof(metadata_package),
-                metadata_mqtt_queue_size, "mqtt");
-  metadata_package pack;
+void *metadata_mqtt_thread_function(void *arg) {
+  metadata_consumer *consumer = (metadata_consumer *)arg;
   pthread_cleanup_push(metadata_mqtt_thread_cleanup_function, NULL);
   while (1) {
-    pc_queue_get_item(&metadata_mqtt_queue, &pack);
-    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
+    metadata_package *pack = metadata_consumer_get_item(consumer, -1);
+    pthread_cleanup_push(metadata_pack_cleanup_function, (void *)consumer);
 		if (config.mqtt_enabled) {
-    	if (pack.carrier) {
-    		debug(3, "                                        mqtt: type %x, code %x, length %u, message %d.", pack.type, pack.code, pack.length, pack.carrier->index_number);
+    	if (pack->carrier) {
+    		debug(3, "                                        mqtt: type %x, code %x, length %u, message %d.", pack->type, pack->code, pack->length, pack->carrier->index_number);
     	} else {
-    		debug(3, "                                        mqtt: type %x, code %x, length %u.", pack.type, pack.code, pack.length);
+    		debug(3, "                                        mqtt: type %x, code %x, length %u.", pack->type, pack->code, pack->length);
     	}
-			mqtt_process_metadata(pack.type, pack.code, pack.data, pack.length);
+			mqtt_process_metadata(pack->type, pack->code, pack->data, pack->length);
 			debug(3, "                                        mqtt: done.");
 		}
 
@@ -1652,21 +1757,33 @@ void *metadata_mqtt_thread_function(__attribute__((unused)) void *ignore) {
 #endif
 
 void metadata_init(void) {
-  int ret = pthread_create(&metadata_thread, NULL, metadata_thread_function, NULL);
+  // all the consumers are added before any of them starts, so that none of them misses anything
+  metadata_ring_init();
+  metadata_consumer *pipe_consumer = metadata_add_consumer("pipe");
+  metadata_consumer *multicast_consumer = metadata_add_consumer("multicast");
+#ifdef CONFIG_METADATA_HUB
+  metadata_consumer *hub_consumer = metadata_add_consumer("hub");
+#endif
+#ifdef CONFIG_MQTT
+  metadata_consumer *mqtt_consumer = metadata_add_consumer("mqtt");
+#endif
+
+  int ret = pthread_create(&metadata_thread, NULL, metadata_thread_function, pipe_consumer);
   if (ret)
     debug(1, "Failed to create metadata thread!");
 
-  ret = pthread_create(&metadata_multicast_thread, NULL, metadata_multicast_thread_function, NULL);
+  ret = pthread_create(&metadata_multicast_thread, NULL, metadata_multicast_thread_function,
+                       multicast_consumer);
   if (ret)
     debug(1, "Failed to create metadata multicast thread!");
 
 #ifdef CONFIG_METADATA_HUB
-  ret = pthread_create(&metadata_hub_thread, NULL, metadata_hub_thread_function, NULL);
+  ret = pthread_create(&metadata_hub_thread, NULL, metadata_hub_thread_function, hub_consumer);
   if (ret)
     debug(1, "Failed to create metadata hub thread!");
 #endif
 #ifdef CONFIG_MQTT
-  ret = pthread_create(&metadata_mqtt_thread, NULL, metadata_mqtt_thread_function, NULL);
+  ret = pthread_create(&metadata_mqtt_thread, NULL, metadata_mqtt_thread_function, mqtt_consumer);
   if (ret)
     debug(1, "Failed to create metadata mqtt thread!");
 #endif
@@ -1676,6 +1793,7 @@ void metadata_init(void) {
 void metadata_stop(void) {
   if (metadata_running) {
     debug(2, "metadata_stop called.");
+    metadata_running = 0; // stop sending metadata
 #ifdef CONFIG_MQTT
     // debug(2, "metadata stop mqtt thread.");
     pthread_cancel(metadata_mqtt_thread);
@@ -1696,11 +1814,39 @@ void metadata_stop(void) {
     // debug(2, "metadata stop metadata_thread thread.");
     pthread_cancel(metadata_thread);
     pthread_join(metadata_thread, NULL);
+    metadata_delete_consumers();
+    if (metadata_items_dropped)
+      debug(1, "%" PRIu32 " metadata items were dropped because the metadata ring was full.",
+            metadata_items_dropped);
+    if (metadata_pipe_items_dropped)
+      debug(1,
+            "metadata pipe: %" PRIu64 " items written, %" PRIu64 " items (%" PRIu64
+            " bytes) dropped because the reader wasn't keeping up.",
+            metadata_pipe_items_written, metadata_pipe_items_dropped,
+            metadata_pipe_bytes_dropped);
     // debug(2, "metadata_stop finished successfully.");
   }
 }
 
-int send_metadata_to_queue(pc_queue* queue, uint32_t type, uint32_t code, char *data, uint32_t length, rtsp_message *carrier,
+// wait until the slot is free for the position, or the time given has passed
+// returns 0 if the slot is free -- contains a cancellation point
+static int metadata_wait_for_slot(metadata_slot *slot, uint32_t position,
+                                  struct timespec *time_limit) {
+  int response = 0;
+  pthread_mutex_lock(&metadata_release_mutex);
+  pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&metadata_release_mutex);
+  __atomic_add_fetch(&metadata_waiting_senders, 1, __ATOMIC_SEQ_CST);
+  while ((response == 0) &&
+         ((int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) - position) < 0))
+    response = pthread_cond_timedwait(&metadata_release_cv, &metadata_release_mutex, time_limit);
+  if ((int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) - position) >= 0)
+    response = 0; // it was released just as the time ran out
+  __atomic_sub_fetch(&metadata_waiting_senders, 1, __ATOMIC_SEQ_CST);
+  pthread_cleanup_pop(1); // unlock the mutex
+  return response;
+}
+
+int send_metadata(uint32_t type, uint32_t code, char *data, uint32_t length, rtsp_message *carrier,
                   int block) {
 
   // parameters: type, code, pointer to data or NULL, length of data or NULL,
@@ -1710,8 +1856,8 @@ int send_metadata_to_queue(pc_queue* queue, uint32_t type, uint32_t code, char *
   // and must not be
   // freed until the data has been read. So, it is passed to send_metadata to be
   // retained,
-  // sent to the thread where metadata is processed and released (and probably
-  // freed).
+  // sent to the threads where metadata is processed and released (and probably
+  // freed) by the last of them to finish with it.
 
   // The rtsp_message is also sent for certain non-'core' messages.
 
@@ -1719,62 +1865,89 @@ int send_metadata_to_queue(pc_queue* queue, uint32_t type, uint32_t code, char *
   // If the rtsp_message field is non-null, then it represents an rtsp_message
   // and the data pointer is assumed to point to something within it.
   // The reference counter of the rtsp_message is incremented here and
-  // should be decremented by the metadata handler when finished.
+  // is decremented when the last metadata consumer has finished with it.
   // If the reference count reduces to zero, the message will be freed.
 
   // If the rtsp_message is NULL, then if the pointer is non-null then the data it
   // points to, of the length specified, is memcpy'd and passed to the metadata
-  // handler. The handler should free it when done.
+  // consumers. It is freed when the last of them has finished with it.
   // If the rtsp_message is NULL and the pointer is also NULL, nothing further
   // is done.
 
-  metadata_package pack;
-  pack.type = type;
-  pack.code = code;
-  pack.length = length;
-  pack.carrier = carrier;
-  pack.data = data;
-  if (pack.carrier) {
-    msg_retain(pack.carrier);
-  } else {
-  	if (data)
-  		pack.data = memdup(data,length); // only if it's not a null
-  }
-  int rc = pc_queue_add_item(queue, &pack, block);
-  if (rc != 0) {
-    if (pack.carrier) {
-    	if (rc == EWOULDBLOCK)
-    		debug(2, "metadata queue \"%s\" full, dropping message item: type %x, code %x, data %x, length %u, message %d.", queue->name, pack.type, pack.code, pack.data, pack.length, pack.carrier->index_number);
-      msg_free(&pack.carrier);
+  // If the ring is full, the item is dropped, unless block is set. Then the sender waits for up
+  // to METADATA_BLOCKING_SEND_TIMEOUT_MS for a slot to be released before dropping it.
+
+  if (metadata_running == 0)
+    return 0;
+
+  // claim a slot
+  uint32_t position = __atomic_load_n(&metadata_write_position, __ATOMIC_RELAXED);
+  metadata_slot *slot;
+  int may_wait = block;
+  int time_limit_set = 0;
+  struct timespec time_limit;
+  while (1) {
+    slot = &metadata_ring[position & (METADATA_RING_SIZE - 1)];
+    int32_t difference =
+        (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+    if (difference == 0) {
+      if (__atomic_compare_exchange_n(&metadata_write_position, &position, position + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if ((difference < 0) && (may_wait != 0)) {
+      // the ring is full, but this item has to get through if it possibly can
+      if (time_limit_set == 0) {
+        clock_gettime(CLOCK_REALTIME, &time_limit);
+        uint64_t limit_ns = (uint64_t)time_limit.tv_nsec +
+                            (uint64_t)METADATA_BLOCKING_SEND_TIMEOUT_MS * 1000000;
+        time_limit.tv_sec += limit_ns / 1000000000;
+        time_limit.tv_nsec = limit_ns % 1000000000;
+        time_limit_set = 1;
+      }
+      if (metadata_wait_for_slot(slot, position, &time_limit) != 0)
+        may_wait = 0; // the time is up, so drop it
+      position = __atomic_load_n(&metadata_write_position, __ATOMIC_RELAXED);
+    } else if (difference < 0) {
+      // the slot hasn't been released since the ring last went round -- it's full
+      __atomic_add_fetch(&metadata_items_dropped, 1, __ATOMIC_RELAXED);
+      debug(2, "metadata ring full, dropping item: type %x, code %x, length %u.", type, code,
+            length);
+      return EWOULDBLOCK;
     } else {
-    	if (rc == EWOULDBLOCK)
-    		debug(2, "metadata queue \"%s\" full, dropping data item: type %x, code %x, data %x, length %u.", queue->name, pack.type, pack.code, pack.data, pack.length);
-    	if (pack.data)
-      	free(pack.data);
+      position = __atomic_load_n(&metadata_write_position, __ATOMIC_RELAXED);
     }
   }
-  return rc;
-}
-
-int send_metadata(uint32_t type, uint32_t code, char *data, uint32_t length, rtsp_message *carrier,
-                  int block) {
-	int rc;
-	rc = send_metadata_to_queue(&metadata_queue, type, code, data, length, carrier, block);
 
-#ifdef CONFIG_METADATA_HUB
-	rc = send_metadata_to_queue(&metadata_hub_queue, type, code, data, length, carrier, block);
-#endif
-
-#ifdef CONFIG_MQTT
-	rc = send_metadata_to_queue(&metadata_mqtt_queue, type, code, data, length, carrier, block);
-#endif
-
-	return rc;
+  // the consumers wait for this slot to be published, so it mustn't be abandoned now
+  int oldState;
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+  slot->pack.type = type;
+  slot->pack.code = code;
+  slot->pack.length = length;
+  slot->pack.carrier = carrier;
+  slot->pack.data = data;
+  if (carrier)
+    msg_retain(carrier);
+  else if (data)
+    slot->pack.data = memdup(data, length); // only if it's not a null
+  slot->readers_remaining = number_of_metadata_consumers;
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_SEQ_CST); // publish it
+
+  // wake any consumers that are asleep
+  int i;
+  for (i = 0; i < number_of_metadata_consumers; i++) {
+    metadata_consumer *c = &metadata_consumers[i];
+    if ((__atomic_load_n(&c->sleeping, __ATOMIC_SEQ_CST)) &&
+        (__atomic_exchange_n(&c->sleeping, 0, __ATOMIC_SEQ_CST) == 1)) {
+      char doorbell = 0;
+      if (write(c->doorbell[1], &doorbell, 1) != 1)
+        debug(1, "metadata consumer \"%s\": error %d waking it.", c->name, errno);
+    }
+  }
+  pthread_setcancelstate(oldState, NULL);
+  return 0;
 }
 
-
-
-
 static void handle_set_parameter_metadata(__attribute__((unused)) rtsp_conn_info *conn,
                                           rtsp_message *req,
                                           __attribute__((unused)) rtsp_message *resp) {
@@ -1817,13 +1990,9 @@ static void handle_get_parameter(__attribute__((unused)) rtsp_conn_info *conn, r
   if ((req->content) && (req->contentlength == strlen("volume\r\n")) &&
       strstr(req->content, "volume") == req->content) {
     // debug(1,"Current volume sought");
-    char *p = malloc(128); // will be automatically deallocated with the response is deleted
-    if (p) {
-      resp->content = p;
-      resp->contentlength = snprintf(p, 128, "\r\nvolume: %.6f\r\n", config.airplay_volume);
-    } else {
-      debug(1, "Couldn't allocate space for a response.");
-    }
+    resp->content = resp->buffer;
+    resp->contentlength =
+        snprintf(resp->buffer, sizeof(resp->buffer), "\r\nvolume: %.6f\r\n", config.airplay_volume);
   }
   resp->respcode = 200;
 }
@@ -1933,9 +2102,16 @@ static void handle_announce(rtsp_conn_info *conn, rtsp_message *req, rtsp_messag
   if (playing_conn == NULL) {
     playing_conn = conn;
     have_the_player = 1;
-  } else if (playing_conn == conn) {
+  } else if ((playing_conn == conn) || (conn->concurrent_session)) {
     have_the_player = 1;
     warn("Duplicate ANNOUNCE, by the look of it!");
+  } else if ((config.maximum_concurrent_sessions > 1) &&
+             (concurrent_sessions + 1 < config.maximum_concurrent_sessions)) {
+    debug(2, "Connection %d: ANNOUNCE: mixing in alongside playing connection %d.",
+          conn->connection_number, playing_conn->connection_number);
+    conn->concurrent_session = 1;
+    concurrent_sessions++;
+    have_the_player = 1;
   } else if (playing_conn->stop) {
     debug(1, "Connection %d ANNOUNCE is waiting for connection %d to shut down.",
           conn->connection_number, playing_conn->connection_number);
@@ -1977,10 +2153,13 @@ static void handle_announce(rtsp_conn_info *conn, rtsp_message *req, rtsp_messag
   if (have_the_player) {
     debug(3, "Connection %d: ANNOUNCE has acquired play lock.", conn->connection_number);
 
-    // now, if this new session did not break in, then it's okay to reset the next UDP ports
-    // to the start of the range
+    // now, if this new session did not break in, and no other session is being mixed in, then
+    // it's okay to reset the next UDP ports to the start of the range
 
-    if (interrupting_current_session == 0) { // will be zero if it wasn't waiting to break in
+    debug_mutex_lock(&playing_conn_lock, 1000000, 3);
+    int other_sessions_playing = (concurrent_sessions != 0);
+    debug_mutex_unlock(&playing_conn_lock, 3);
+    if ((interrupting_current_session == 0) && (other_sessions_playing == 0)) {
       resetFreeUDPPort();
     }
 
@@ -2105,6 +2284,10 @@ static void handle_announce(rtsp_conn_info *conn, rtsp_message *req, rtsp_messag
       free(aesiv);
 
       uint8_t *rsaaeskey = base64_dec(prsaaeskey, &len);
+      if (rsaaeskey == NULL) {
+        warn("client announced an rsaaeskey that could not be decoded");
+        goto out;
+      }
       uint8_t *aeskey = rsa_apply(rsaaeskey, len, &keylen, RSA_MODE_KEY);
       free(rsaaeskey);
       if (keylen != 16) {
@@ -2210,8 +2393,7 @@ out:
     debug(1, "Connection %d: Error in handling ANNOUNCE. Unlocking the play lock.",
           conn->connection_number);
     debug_mutex_lock(&playing_conn_lock, 1000000, 3); // get it
-    if (playing_conn == conn)                         // if we managed to acquire it
-      playing_conn = NULL;                            // let it go
+    release_player(conn); // if we managed to acquire it, let it go
     debug_mutex_unlock(&playing_conn_lock, 3);
   }
 }
@@ -2240,8 +2422,10 @@ static void apple_challenge(int fd, rtsp_message *req, rtsp_message *resp) {
 
   int chall_len;
   uint8_t *chall = base64_dec(hdr, &chall_len);
-  if (chall == NULL)
-    die("null chall in apple_challenge");
+  if (chall == NULL) {
+    warn("Apple-Challenge could not be decoded");
+    return;
+  }
   uint8_t buf[48], *bp = buf;
   int i;
   memset(buf, 0, sizeof(buf));
@@ -2547,9 +2731,9 @@ void rtsp_conversation_thread_cleanup_function(void *arg) {
 
   debug(3, "Connection %d: Checking play lock.", conn->connection_number);
   debug_mutex_lock(&playing_conn_lock, 1000000, 3); // get it
-  if (playing_conn == conn) {                       // if it's ours
+  if ((playing_conn == conn) || (conn->concurrent_session)) { // if it's ours
     debug(3, "Connection %d: Unlocking play lock.", conn->connection_number);
-    playing_conn = NULL; // let it go
+    release_player(conn); // let it go
   }
   debug_mutex_unlock(&playing_conn_lock, 3);
 
@@ -12,6 +12,23 @@ void rtsp_request_shutdown_stream(void);
 
 void cancel_all_RTSP_threads(void);
 
+// an RTSP request or response, as read or written on a connection
+typedef struct rtsp_message_struct rtsp_message;
+
+enum rtsp_read_request_response {
+  rtsp_read_request_response_ok,
+  rtsp_read_request_response_immediate_shutdown_requested,
+  rtsp_read_request_response_bad_packet,
+  rtsp_read_request_response_channel_closed,
+  rtsp_read_request_response_read_error,
+  rtsp_read_request_response_error
+};
+
+// read the next request from the connection's socket
+enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info *conn, rtsp_message **the_packet);
+char *msg_get_header(rtsp_message *msg, char *name);
+void msg_free(rtsp_message **msgh);
+
 // initialise and completely delete the metadata stuff
 
 void metadata_init(void);
@@ -25,4 +42,9 @@ void metadata_stop(void);
 
 int send_ssnc_metadata(uint32_t code, char *data, uint32_t length, int block);
 
+// the metadata pipe's totals of items written and of items and bytes dropped because its
+// reader wasn't keeping up -- they can be read from any thread
+void metadata_pipe_statistics(uint64_t *items_written, uint64_t *items_dropped,
+                              uint64_t *bytes_dropped);
+
 #endif // _RTSP_H
@@ -64,6 +64,7 @@
 #include "common.h"
 #include "rtp.h"
 #include "rtsp.h"
+#include "zones.h"
 
 #if defined(CONFIG_DACP_CLIENT)
 #include "dacp.h"
@@ -422,6 +423,9 @@ int parse_options(int argc, char **argv) {
       /* Get the metadata setting. */
       config.metadata_enabled = 1; // if metadata support is included, then enable it by default
       config.get_coverart = 1; // if metadata support is included, then enable it by default
+      config.metadata_pipe_timeout = 5000;
+      config.metadata_pipe_backlog_size = 1024 * 1024;
+      config.metadata_pipe_overflow_policy = MPO_drop;
 #endif
 
 #ifdef CONFIG_CONVOLUTION
@@ -431,12 +435,14 @@ int parse_options(int argc, char **argv) {
 
 #ifdef CONFIG_METADATA_HUB
   config.cover_art_cache_dir = "/tmp/shairport-sync/.cache/coverart";
+  config.cover_art_cache_size = 16 * 1024 * 1024;
   config.scan_interval_when_active =
       1; // number of seconds between DACP server scans when playing something
   config.scan_interval_when_inactive =
       1; // number of seconds between DACP server scans when playing nothing
   config.scan_max_bad_response_count =
       5; // number of successive bad results to ignore before giving up
+  config.dacp_long_poll_timeout = 30; // seconds to wait for a change in the play status
   // config.scan_max_inactive_count =
   //    (365 * 24 * 60 * 60) / config.scan_interval_when_inactive; // number of scans to do before
   //    stopping if
@@ -459,11 +465,15 @@ int parse_options(int argc, char **argv) {
     debug(2, "looking for configuration file at full path \"%s\"", config_file_real_path);
     /* Read the file. If there is an error, report it and exit. */
     if (config_read_file(&config_file_stuff, config_file_real_path)) {
-      free(config_file_real_path);
+      // keep the full path -- a zone's worker reads the file again, perhaps after daemonising
+      // has changed the working directory
+      config.configfile = config_file_real_path;
       config_set_auto_convert(&config_file_stuff,
                               1); // allow autoconversion from int/float to int/float
       // make config.cfg point to it
       config.cfg = &config_file_stuff;
+      // in a zone's worker, lay the zone's settings over the others
+      zones_apply_settings(config.cfg);
       /* Get the Service Name. */
       if (config_lookup_string(config.cfg, "general.name", &str)) {
         raw_service_name = (char *)str;
@@ -890,6 +900,35 @@ int parse_options(int argc, char **argv) {
       if (config_lookup_int(config.cfg, "metadata.socket_msglength", &value)) {
         config.metadata_sockmsglength = value < 500 ? 500 : value > 65000 ? 65000 : value;
       }
+      if (config_lookup_int(config.cfg, "metadata.socket_pacing", &value)) {
+        if ((value < 0) || (value > 1000))
+          die("Invalid metadata socket_pacing \"%d\". It must be between 0 and 1000.", value);
+        config.metadata_sockpacing = value;
+      }
+
+      if (config_lookup_int(config.cfg, "metadata.pipe_timeout", &value)) {
+        if (value < 0)
+          die("Invalid metadata pipe_timeout \"%d\". It must be zero or more.", value);
+        config.metadata_pipe_timeout = value;
+      }
+
+      if (config_lookup_int(config.cfg, "metadata.pipe_backlog_size", &value)) {
+        if ((value < 0) || (value > 64 * 1024 * 1024))
+          die("Invalid metadata pipe_backlog_size \"%d\". It must be between 0 and 67108864.",
+              value);
+        config.metadata_pipe_backlog_size = value;
+      }
+
+      if (config_lookup_string(config.cfg, "metadata.pipe_overflow_policy", &str)) {
+        if (strcasecmp(str, "drop") == 0)
+          config.metadata_pipe_overflow_policy = MPO_drop;
+        else if (strcasecmp(str, "wait") == 0)
+          config.metadata_pipe_overflow_policy = MPO_wait;
+        else
+          die("Invalid metadata pipe_overflow_policy choice \"%s\". It should be \"drop\" or "
+              "\"wait\".",
+              str);
+      }
 
 #endif
 
@@ -898,6 +937,14 @@ int parse_options(int argc, char **argv) {
         config.cover_art_cache_dir = (char *)str;
       }
 
+      if (config_lookup_int(config.cfg, "metadata.cover_art_cache_size_in_megabytes", &value)) {
+        if ((value < 0) || (value > 4096))
+          die("Invalid metadata cover_art_cache_size_in_megabytes \"%d\". It must be between 0 "
+              "and 4096.",
+              value);
+        config.cover_art_cache_size = (size_t)value * 1024 * 1024;
+      }
+
       if (config_lookup_string(config.cfg, "diagnostics.retain_cover_art", &str)) {
         if (strcasecmp(str, "no") == 0)
           config.retain_coverart = 0;
@@ -907,6 +954,14 @@ int parse_options(int argc, char **argv) {
           die("Invalid metadata retain_cover_art option choice \"%s\". It should be \"yes\" or "
               "\"no\"");
       }
+
+      if (config_lookup_int(config.cfg, "general.dacp_long_poll_timeout_seconds", &value)) {
+        if ((value < 0) || (value > 600))
+          die("Invalid general dacp_long_poll_timeout_seconds \"%d\". It must be between 0 and "
+              "600.",
+              value);
+        config.dacp_long_poll_timeout = value;
+      }
 #endif
 
       if (config_lookup_string(config.cfg, "sessioncontrol.run_this_before_play_begins", &str)) {
@@ -1070,6 +1125,18 @@ int parse_options(int argc, char **argv) {
     }
 #endif
 
+#if defined(CONFIG_DBUS_INTERFACE) || defined(CONFIG_MPRIS_INTERFACE)
+    config.dbus_update_interval = 100;
+    if (config_lookup_int(config.cfg, "general.dbus_update_interval", &value)) {
+      if ((value < 0) || (value > 5000))
+        die("Invalid dbus_update_interval \"%d\". It should be between 0 and 5000 "
+            "milliseconds, default is 100",
+            value);
+      else
+        config.dbus_update_interval = value;
+    }
+#endif
+
 #ifdef CONFIG_MQTT
     config_set_lookup_bool(config.cfg, "mqtt.enabled", &config.mqtt_enabled);
     if (config.mqtt_enabled && !config.metadata_enabled) {
@@ -1128,6 +1195,24 @@ int parse_options(int argc, char **argv) {
     if (config.mqtt_publish_cover && !config.get_coverart) {
       die("You need to have metadata.include_cover_art enabled in order to use mqtt.publish_cover");
     }
+    config_set_lookup_bool(config.cfg, "mqtt.publish_json", &config.mqtt_publish_json);
+    config.mqtt_retain_state = 1;
+    config_set_lookup_bool(config.cfg, "mqtt.retain_state", &config.mqtt_retain_state);
+    config.mqtt_qos = 0;
+    if (config_lookup_int(config.cfg, "mqtt.qos", &value)) {
+      if ((value < 0) || (value > 2))
+        die("Invalid mqtt qos \"%d\". It should be 0, 1 or 2, default is 0", value);
+      else
+        config.mqtt_qos = value;
+    }
+    config.mqtt_queue_length = 256;
+    if (config_lookup_int(config.cfg, "mqtt.queue_length", &value)) {
+      if ((value < 1) || (value > 65536))
+        die("Invalid mqtt queue_length \"%d\". It should be between 1 and 65536, default is 256",
+            value);
+      else
+        config.mqtt_queue_length = value;
+    }
     config_set_lookup_bool(config.cfg, "mqtt.enable_remote", &config.mqtt_enable_remote);
 #ifndef CONFIG_AVAHI
     if (config.mqtt_enable_remote) {
@@ -1271,6 +1356,12 @@ int parse_options(int argc, char **argv) {
   }
 #endif
 
+  // mDNS supports maximum of 63-character names (we append 13).
+  if (strlen(config.service_name) > 50) {
+    warn("Supplied name too long (max 50 characters)");
+    config.service_name[50] = '\0'; // truncate it and carry on...
+  }
+
 #ifdef CONFIG_LIBDAEMON
 
 // now, check and calculate the pid directory
@@ -1338,7 +1429,8 @@ void exit_function() {
 			#endif
 			*/
 #ifdef CONFIG_DBUS_INTERFACE
-			stop_dbus_service();
+			if (zone_number == 0)
+				stop_dbus_service();
 #endif
 			if (g_main_loop) {
 				debug(2, "Stopping DBUS Loop Thread");
@@ -1388,7 +1480,8 @@ void exit_function() {
 				free(config.regtype);
 
 #ifdef CONFIG_LIBDAEMON
-			if (this_is_the_daemon_process) {
+			// the pid file is the main process's, not a zone's worker's
+			if ((this_is_the_daemon_process) && (zone_number == 0)) {
 				daemon_retval_send(0);
 				daemon_pid_file_remove();
 				daemon_signal_done();
@@ -1581,12 +1674,6 @@ int main(int argc, char **argv) {
   // parse arguments into config -- needed to locate pid_dir
   int audio_arg = parse_options(argc, argv);
 
-  // mDNS supports maximum of 63-character names (we append 13).
-  if (strlen(config.service_name) > 50) {
-    warn("Supplied name too long (max 50 characters)");
-    config.service_name[50] = '\0'; // truncate it and carry on...
-  }
-
   /* Check if we are called with -k or --kill option */
   if (killOption != 0) {
 #ifdef CONFIG_LIBDAEMON
@@ -1730,6 +1817,17 @@ int main(int argc, char **argv) {
   // make sure the program can create files that group and world can read
   umask(S_IWGRP | S_IWOTH);
 
+  // start a worker process for each zone, before any threads are started
+  if (zones_start() != 0) {
+    // this is a zone's worker -- read the settings again, with the zone's laid over them,
+    // keeping the command line's backend options for the main service's backend
+    int main_debuglev = debuglev;
+    parse_options(1, argv);
+    if (debuglev < main_debuglev)
+      debuglev = main_debuglev;
+    audio_arg = argc + 1; // as if there were no backend options
+  }
+
   /* print out version */
 
   char *version_dbs = get_version_string();
@@ -1886,6 +1984,12 @@ int main(int argc, char **argv) {
   debug(1, "mqtt will%s publish raw metadata.", config.mqtt_publish_raw ? "" : " not");
   debug(1, "mqtt will%s publish parsed metadata.", config.mqtt_publish_parsed ? "" : " not");
   debug(1, "mqtt will%s publish cover Art.", config.mqtt_publish_cover ? "" : " not");
+  debug(1, "mqtt will%s publish parsed metadata as a JSON object.",
+        config.mqtt_publish_json ? "" : " not");
+  debug(1, "mqtt will%s ask the broker to retain the track state.",
+        config.mqtt_retain_state ? "" : " not");
+  debug(1, "mqtt qos is %d, the queue holds %d messages.", config.mqtt_qos,
+        config.mqtt_queue_length);
   debug(1, "mqtt remote control is %sabled.", config.mqtt_enable_remote ? "en" : "dis");
 #endif
 
@@ -1949,13 +2053,16 @@ int main(int argc, char **argv) {
 #if defined(CONFIG_DBUS_INTERFACE) || defined(CONFIG_MPRIS_INTERFACE)
   // Start up DBUS services after initial settings are all made
   // debug(1, "Starting up D-Bus services");
-  pthread_create(&dbus_thread, NULL, &dbus_thread_func, NULL);
+  // the D-Bus and MPRIS interfaces are the main service's -- zones' workers don't offer them
+  if (zone_number == 0) {
+    pthread_create(&dbus_thread, NULL, &dbus_thread_func, NULL);
 #ifdef CONFIG_DBUS_INTERFACE
-  start_dbus_service();
+    start_dbus_service();
 #endif
 #ifdef CONFIG_MPRIS_INTERFACE
-  start_mpris_service();
+    start_mpris_service();
 #endif
+  }
 #endif
 
 #ifdef CONFIG_MQTT
@@ -1964,6 +2071,7 @@ int main(int argc, char **argv) {
   }
 #endif
 
+  zones_monitor_start();
   activity_monitor_start();
   rtsp_listen_loop();
   pthread_cleanup_pop(1);
@@ -0,0 +1,333 @@
+/*
+ * Synchronisation simulator. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// This plays a simulated session into the dummy backend's simulated DAC, on the simulated clock,
+// so that hours of playback take a second or two. Each block is sent when the player would send
+// it and its sync error is worked out as the player works it out. What is done about the error
+// -- padding the first block, stuffing, holding stuffing off at the start, and resynchronising
+// by flushing or with silence -- is decided by the player's own code, sync_decide() and
+// stuffing_is_held_off(), so the simulator plays the source's part and the DAC's, not the
+// player's.
+// At the end, the distribution of the sync error, the number of corrections and the delay the
+// DAC reported are printed. The dummy backend logs the true buffer occupancy at debug level 1.
+
+#include "audio.h"
+#include "common.h"
+#include <inttypes.h>
+#include <libconfig.h>
+#include <math.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIMULATOR_RATE 44100
+#define SIMULATOR_FRAMES_PER_BLOCK 352
+#define SIMULATOR_LATENCY_IN_SECONDS 2.0
+
+// The histogram covers sync errors of up to this many resync thresholds either side of zero.
+// Larger ones are counted in the end bins.
+#define SIMULATOR_HISTOGRAM_SPAN 2
+
+extern audio_output audio_dummy;
+
+// The dummy backend reads the general audio options through this. The simulator has none to read,
+// and doesn't link in audio.c, as that would bring every configured backend with it.
+void parse_general_audio_options(void) {}
+
+#ifdef CONFIG_ALSA
+// Nor is there an ALSA backend to take the output device an on-start command names.
+void set_alsa_out_dev(__attribute__((unused)) char *device) {}
+#endif
+
+static int64_t *histogram;
+static int64_t histogram_half_width; // in frames
+static int64_t errors_counted;
+
+static void count_sync_error(int64_t sync_error) {
+  int64_t bin = sync_error;
+  if (bin < -histogram_half_width)
+    bin = -histogram_half_width;
+  if (bin > histogram_half_width)
+    bin = histogram_half_width;
+  histogram[bin + histogram_half_width]++;
+  errors_counted++;
+}
+
+// the sync error, in frames, below which the given proportion of the blocks fell
+static int64_t sync_error_percentile(double proportion) {
+  int64_t target = (int64_t)ceil(proportion * errors_counted);
+  if (target < 1)
+    target = 1;
+  int64_t total = 0;
+  int64_t i;
+  for (i = 0; i <= 2 * histogram_half_width; i++) {
+    total += histogram[i];
+    if (total >= target)
+      break;
+  }
+  return i - histogram_half_width;
+}
+
+static double sync_error_proportion_within(int64_t limit) {
+  int64_t total = 0;
+  int64_t i;
+  for (i = -limit; i <= limit; i++)
+    if ((i >= -histogram_half_width) && (i <= histogram_half_width))
+      total += histogram[i + histogram_half_width];
+  return errors_counted ? (1.0 * total) / errors_counted : 0.0;
+}
+
+static double frames_to_ms(int64_t frames) { return (1000.0 * frames) / SIMULATOR_RATE; }
+
+int main(int argc, char **argv) {
+  double rate_error_in_ppm = 0.0;
+  double dac_latency = 0.0;
+  double jitter = 0.0;
+  double duration = 3600.0;
+  double tolerance = 0.002;
+  double resync_threshold = 0.05;
+  double buffer_length = 0.15;
+  int seed = 0;
+  int verbosity = 1;
+
+  struct poptOption optionsTable[] = {
+      {"rate-error", 'r', POPT_ARG_DOUBLE, &rate_error_in_ppm, 0,
+       "The DAC's rate error in parts per million -- positive means fast.", "PPM"},
+      {"latency", 'l', POPT_ARG_DOUBLE, &dac_latency, 0,
+       "The DAC's latency, added to the delay it reports.", "SECONDS"},
+      {"jitter", 'j', POPT_ARG_DOUBLE, &jitter, 0,
+       "The peak random error in the delay the DAC reports.", "SECONDS"},
+      {"duration", 'd', POPT_ARG_DOUBLE, &duration, 0,
+       "How long a session to simulate -- the default is an hour.", "SECONDS"},
+      {"tolerance", 't', POPT_ARG_DOUBLE, &tolerance, 0,
+       "The sync error allowed before correcting it, as the \"drift_tolerance_in_seconds\" "
+       "setting -- the default is 0.002.",
+       "SECONDS"},
+      {"resync-threshold", 'R', POPT_ARG_DOUBLE, &resync_threshold, 0,
+       "The sync error that causes a resync, as the \"resync_threshold_in_seconds\" setting -- "
+       "the default is 0.05.",
+       "SECONDS"},
+      {"buffer", 'b', POPT_ARG_DOUBLE, &buffer_length, 0,
+       "How far ahead of time blocks are sent to the DAC -- the default is 0.15.", "SECONDS"},
+      {"seed", 's', POPT_ARG_INT, &seed, 0, "The seed for the random numbers.", "NUMBER"},
+      {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Print more debug messages -- repeat for more.",
+       NULL},
+      {"quiet", 'q', POPT_ARG_VAL, &verbosity, 0, "Print no debug messages.", NULL},
+      POPT_AUTOHELP{NULL, 0, 0, NULL, 0, NULL, NULL}};
+
+  poptContext optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0);
+  int c;
+  while ((c = poptGetNextOpt(optCon)) >= 0) {
+    if (c == 'v')
+      verbosity++;
+  }
+  if (c < -1) {
+    fprintf(stderr, "%s: %s\n", poptBadOption(optCon, POPT_BADOPTION_NOALIAS), poptStrerror(c));
+    return 1;
+  }
+  poptFreeContext(optCon);
+
+  if ((duration <= 0.0) || (tolerance < 0.0) || (resync_threshold <= 0.0) ||
+      (buffer_length <= 0.0) || (dac_latency < 0.0) || (jitter < 0.0)) {
+    fprintf(stderr, "The duration, resync threshold and buffer must be positive and the other "
+                    "times must not be negative.\n");
+    return 1;
+  }
+
+  // everything from here on, including the debug messages' timings, runs on the simulated clock
+  set_simulated_time_in_ns(1000000000);
+  set_time_source(get_simulated_time_in_ns);
+  ns_time_at_startup = get_absolute_time_in_ns();
+  ns_time_at_last_debug_message = ns_time_at_startup;
+  log_to_stderr();
+  debuglev = verbosity;
+  r64init(seed);
+  srand48(seed);
+
+  // the dummy backend takes its simulation settings from the configuration, so give it one
+  config_init(&config_file_stuff);
+  char settings[256];
+  snprintf(settings, sizeof(settings),
+           "dummy = { rate_error_in_ppm = %f; latency_in_seconds = %f; jitter_in_seconds = %f; };",
+           rate_error_in_ppm, dac_latency, jitter);
+  if (config_read_string(&config_file_stuff, settings) == CONFIG_FALSE)
+    die("Error in the dummy settings \"%s\": %s.", settings,
+        config_error_text(&config_file_stuff));
+  config.cfg = &config_file_stuff;
+
+  int64_t latency = (int64_t)(SIMULATOR_LATENCY_IN_SECONDS * SIMULATOR_RATE);
+  int64_t lead = (int64_t)(buffer_length * SIMULATOR_RATE);
+  int64_t filler_length = (int64_t)(resync_threshold * SIMULATOR_RATE);
+  double tolerance_in_frames = tolerance * SIMULATOR_RATE;
+
+  histogram_half_width = SIMULATOR_HISTOGRAM_SPAN * filler_length;
+  histogram = calloc(2 * histogram_half_width + 1, sizeof(int64_t));
+  char *block = calloc(SIMULATOR_FRAMES_PER_BLOCK + 1, 4);
+  char *silence = calloc(5 * filler_length + lead, 4);
+  if ((histogram == NULL) || (block == NULL) || (silence == NULL))
+    die("Can not allocate memory for the simulation.");
+
+  audio_dummy.init(0, NULL);
+  audio_dummy.start(SIMULATOR_RATE, SPS_FORMAT_S16_LE);
+
+  struct timespec wall_clock_start, wall_clock_end;
+  clock_gettime(CLOCK_MONOTONIC, &wall_clock_start);
+
+  // the source's frame zero is due to be heard a latency after the session starts
+  uint64_t session_start = get_absolute_time_in_ns();
+  uint64_t first_frame_time = session_start + (uint64_t)(SIMULATOR_LATENCY_IN_SECONDS * 1.0E9);
+  uint64_t session_end = session_start + (uint64_t)(duration * 1.0E9);
+
+  int64_t frames_added = 0, frames_removed = 0;
+  int64_t resyncs_by_dropping = 0, resyncs_by_silence = 0, frames_dropped = 0;
+  int64_t silence_played = 0;
+  int64_t largest_sync_error = 0;
+  double sum_of_sync_errors = 0.0, sum_of_squared_sync_errors = 0.0;
+  long delay_minimum = 0, delay_maximum = 0;
+  double delay_total = 0.0;
+  int sync_error_out_of_bounds = 0;
+  int first_block = 1;
+  sync_decision decision;
+
+  int64_t nt = 0; // the source's number for the first frame of the block
+  for (;;) {
+    // the player sends a block to the backend when it is the buffer length from being heard
+    uint64_t send_time =
+        session_start + (uint64_t)(((nt + latency - lead) * 1.0E9) / SIMULATOR_RATE);
+    if (send_time > session_end)
+      break;
+    set_simulated_time_in_ns(send_time);
+
+    long current_delay;
+    if (audio_dummy.delay(&current_delay) != 0)
+      die("The dummy backend's delay function failed.");
+    if (current_delay < 0)
+      current_delay = 0;
+    if ((errors_counted == 0) || (current_delay < delay_minimum))
+      delay_minimum = current_delay;
+    if ((errors_counted == 0) || (current_delay > delay_maximum))
+      delay_maximum = current_delay;
+    delay_total += current_delay;
+
+    // as in the player: positive means the block will be late
+    int64_t should_be_frame =
+        (int64_t)(((send_time - session_start) * 1.0E-9) * SIMULATOR_RATE);
+    int64_t sync_error = should_be_frame - (nt - current_delay) - latency;
+
+    sync_decide(sync_error, first_block, &sync_error_out_of_bounds, tolerance_in_frames,
+                resync_threshold * SIMULATOR_RATE, 1,
+                stuffing_is_held_off(send_time, first_frame_time) == 0, &decision);
+    first_block = 0;
+    if (decision.padding) {
+      audio_dummy.play(silence, decision.padding);
+      silence_played += decision.padding;
+    }
+    sync_error = decision.sync_error;
+
+    count_sync_error(sync_error);
+    int64_t abs_sync_error = sync_error < 0 ? -sync_error : sync_error;
+    if (abs_sync_error > largest_sync_error)
+      largest_sync_error = abs_sync_error;
+    sum_of_sync_errors += sync_error;
+    sum_of_squared_sync_errors += 1.0 * sync_error * sync_error;
+
+    if (decision.action == sync_action_flush) {
+      // the source's packets are flushed up to the frame that should be playing now
+      int64_t blocks_to_drop =
+          (decision.frames_to_drop + SIMULATOR_FRAMES_PER_BLOCK - 1) / SIMULATOR_FRAMES_PER_BLOCK;
+      debug(2, "Large positive sync error: %" PRId64 ".", sync_error);
+      nt += blocks_to_drop * SIMULATOR_FRAMES_PER_BLOCK;
+      frames_dropped += blocks_to_drop * SIMULATOR_FRAMES_PER_BLOCK;
+      resyncs_by_dropping++;
+    } else if (decision.action == sync_action_play_silence) {
+      // the silence is played instead of the block
+      debug(2, "Large negative sync error: %" PRId64 ".", sync_error);
+      audio_dummy.play(silence, decision.silence_length);
+      silence_played += decision.silence_length;
+      resyncs_by_silence++;
+      nt += SIMULATOR_FRAMES_PER_BLOCK;
+    } else {
+      if (decision.amount_to_stuff > 0)
+        frames_added++;
+      else if (decision.amount_to_stuff < 0)
+        frames_removed++;
+      audio_dummy.play(block, SIMULATOR_FRAMES_PER_BLOCK + decision.amount_to_stuff);
+      nt += SIMULATOR_FRAMES_PER_BLOCK;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &wall_clock_end);
+  audio_dummy.stop();
+  audio_dummy.deinit();
+
+  double wall_clock_time = (wall_clock_end.tv_sec - wall_clock_start.tv_sec) +
+                           (wall_clock_end.tv_nsec - wall_clock_start.tv_nsec) * 1.0E-9;
+  printf("Simulated %.0f seconds of playback in %.3f seconds: DAC rate error %.1f ppm, latency "
+         "%.3f s, jitter +/- %.3f s, tolerance %.3f s, resync threshold %.3f s, buffer %.3f s.\n",
+         duration, wall_clock_time, rate_error_in_ppm, dac_latency, jitter, tolerance,
+         resync_threshold, buffer_length);
+  if (errors_counted == 0) {
+    printf("No blocks were played.\n");
+  } else {
+    double mean = sum_of_sync_errors / errors_counted;
+    double rms = sqrt(sum_of_squared_sync_errors / errors_counted);
+    printf("Sync error over %" PRId64 " blocks (positive means late), in frames and ms:\n",
+           errors_counted);
+    printf("  mean %.1f (%.3f ms), rms %.1f (%.3f ms), largest %" PRId64 " (%.3f ms).\n", mean,
+           (1000.0 * mean) / SIMULATOR_RATE, rms, (1000.0 * rms) / SIMULATOR_RATE,
+           largest_sync_error, frames_to_ms(largest_sync_error));
+    double proportions[] = {0.001, 0.01, 0.05, 0.5, 0.95, 0.99, 0.999};
+    unsigned int i;
+    printf("  percentiles:");
+    for (i = 0; i < sizeof(proportions) / sizeof(double); i++) {
+      int64_t p = sync_error_percentile(proportions[i]);
+      printf(" %g%% %" PRId64 " (%.3f ms)%s", proportions[i] * 100, p, frames_to_ms(p),
+             i + 1 < sizeof(proportions) / sizeof(double) ? "," : ".\n");
+    }
+    double limits_in_ms[] = {0.5, 1.0, 2.0, 5.0, 10.0};
+    printf("  within:");
+    for (i = 0; i < sizeof(limits_in_ms) / sizeof(double); i++) {
+      int64_t limit = (int64_t)(limits_in_ms[i] * SIMULATOR_RATE / 1000);
+      printf(" %g ms %.2f%%%s", limits_in_ms[i], 100.0 * sync_error_proportion_within(limit),
+             i + 1 < sizeof(limits_in_ms) / sizeof(double) ? "," : ".\n");
+    }
+    printf("Corrections: %" PRId64 " frames added, %" PRId64 " frames removed (%.1f per minute), "
+           "%" PRId64 " resyncs dropping %" PRId64 " frames, %" PRId64
+           " resyncs with silence, %" PRId64 " frames of silence in all.\n",
+           frames_added, frames_removed, (60.0 * (frames_added + frames_removed)) / duration,
+           resyncs_by_dropping, frames_dropped, resyncs_by_silence, silence_played);
+    printf("Delay reported by the DAC: minimum %ld, mean %.1f, maximum %ld frames.\n",
+           delay_minimum, delay_total / errors_counted, delay_maximum);
+  }
+
+  config_destroy(&config_file_stuff);
+  free(silence);
+  free(block);
+  free(histogram);
+  return 0;
+}
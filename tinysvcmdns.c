@@ -735,7 +735,7 @@ static size_t mdns_parse_rr(uint8_t *pkt_buf, size_t pkt_len, size_t off, struct
   if (name == NULL)
     goto err;
 
-  // parse the MDNS RR section  p += label_len(pkt_buf, pkt_len, off);
+  p += label_len(pkt_buf, pkt_len, off);
   rr->name = name;
 
   rr->type = mdns_read_u16(p);
@@ -950,9 +950,9 @@ static size_t mdns_encode_name(uint8_t *pkt_buf, __attribute__((unused)) size_t
 }
 
 // encodes an RR entry at the given offset
-// returns the size of the entire RR entry
+// returns the size of the entire RR entry, and the offset of its TTL in ttl_offset if not NULL
 static size_t mdns_encode_rr(uint8_t *pkt_buf, size_t pkt_len, size_t off, struct rr_entry *rr,
-                             struct name_comp *comp) {
+                             struct name_comp *comp, size_t *ttl_offset) {
   uint8_t *p = pkt_buf + off, *p_data;
   size_t l;
   struct rr_data_txt *txt_rec;
@@ -973,6 +973,8 @@ static size_t mdns_encode_rr(uint8_t *pkt_buf, size_t pkt_len, size_t off, struc
   p = mdns_write_u16(p, (rr->rr_class & ~0x8000) | (rr->cache_flush << 15));
 
   // TTL
+  if (ttl_offset)
+    *ttl_offset = p - pkt_buf;
   p = mdns_write_u32(p, rr->ttl);
 
   // data length (filled in later)
@@ -1043,7 +1045,9 @@ static size_t mdns_encode_rr(uint8_t *pkt_buf, size_t pkt_len, size_t off, struc
 
 // encodes a MDNS packet from the given mdns_pkt struct into a buffer
 // returns the size of the entire MDNS packet
-size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len) {
+// if ttl_offsets isn't NULL, the offset of each RR's TTL goes into it, in order
+size_t mdns_encode_pkt_ttls(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len,
+                            size_t *ttl_offsets) {
   struct name_comp *comp;
   uint8_t *p = pkt_buf;
   // uint8_t *e = pkt_buf + pkt_len;
@@ -1086,7 +1090,9 @@ size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len
   for (i = 0; i < sizeof(rr_set) / sizeof(rr_set[0]); i++) {
     struct rr_list *rr = rr_set[i];
     for (; rr; rr = rr->next) {
-      size_t l = mdns_encode_rr(pkt_buf, pkt_len, off, rr->e, comp);
+      size_t l = mdns_encode_rr(pkt_buf, pkt_len, off, rr->e, comp, ttl_offsets);
+      if (ttl_offsets)
+        ttl_offsets++;
       off += l;
 
       if (off >= pkt_len) {
@@ -1106,6 +1112,10 @@ size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len
   return off;
 }
 
+size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len) {
+  return mdns_encode_pkt_ttls(answer, pkt_buf, pkt_len, NULL);
+}
+
 //******************************************************//
 //                      mdnsd.c                         //
 //******************************************************//
@@ -1126,6 +1136,7 @@ size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len
 
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -1134,8 +1145,11 @@ size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "datagram.h"
+
 /*
  * Define a proper IP socket level if not already done.
  * Required to compile on OS X
@@ -1149,6 +1163,37 @@ size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len
 
 #define PACKET_SIZE 65536
 
+// incoming packets are taken in batches, up to the largest size RFC 6762 allows
+#define RECEIVE_BATCH_SIZE 16
+#define RECEIVE_PACKET_SIZE 9000
+
+// Records are looked up through a hash table keyed by name and type. Every record is also filed
+// under its name and RR_ANY, except NSEC records, which RR_ANY queries don't return.
+#define RR_INDEX_SIZE 64
+
+struct rr_index_entry {
+  struct rr_entry *e;
+  enum rr_type type; // the record's type, or RR_ANY
+  uint32_t hash;
+  struct rr_index_entry *next;
+};
+
+// The reply to a query with a single question and no known answers depends only on the question,
+// so it is kept, encoded, and sent again with just the transaction ID and the TTLs patched. The
+// common queries, like those for _raop._tcp, are answered without building a reply at all.
+#define REPLY_CACHE_SIZE 8
+#define REPLY_CACHE_MAX_RRS 16
+
+struct mdns_cached_reply {
+  uint8_t *name; // the question; NULL if this slot is empty
+  enum rr_type type;
+  uint8_t *pkt;
+  size_t len;
+  int num_rr;
+  struct rr_entry *rr[REPLY_CACHE_MAX_RRS];
+  size_t ttl_offset[REPLY_CACHE_MAX_RRS];
+};
+
 #define SERVICES_DNS_SD_NLABEL ((uint8_t *)"\x09_services\x07_dns-sd\x04_udp\x05local")
 
 struct mdnsd {
@@ -1161,6 +1206,20 @@ struct mdnsd {
   struct rr_list *announce;
   struct rr_list *services;
   uint8_t *hostname;
+
+  struct rr_index_entry *index[RR_INDEX_SIZE];
+
+  // only the main loop uses the reply cache; others set reply_cache_stale, under the data_lock
+  struct mdns_cached_reply reply_cache[REPLY_CACHE_SIZE];
+  int reply_cache_next;
+  int reply_cache_stale;
+  uint64_t replies_sent;
+  uint64_t replies_from_cache;
+
+  // for a responder without a network, from mdnsd_start_offline
+  int offline;
+  struct mdns_pkt *offline_reply;
+  uint8_t *offline_pkt_buffer;
 };
 
 struct mdns_service {
@@ -1232,35 +1291,183 @@ static ssize_t send_packet(int fd, const void *data, size_t len) {
   return sendto(fd, data, len, 0, (struct sockaddr *)&toaddr, sizeof(struct sockaddr_in));
 }
 
+static uint32_t rr_index_hash(const uint8_t *name, enum rr_type type) {
+  uint32_t hash = 2166136261u ^ type; // FNV-1a
+  for (; *name; name++) {
+    hash ^= *name;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void rr_index_add_key(struct mdnsd *svr, struct rr_entry *rr, enum rr_type type) {
+  struct rr_index_entry *ie, **tail;
+  uint32_t hash = rr_index_hash(rr->name, type);
+  // append, so that records come out in the order they were added
+  for (tail = &svr->index[hash % RR_INDEX_SIZE]; *tail; tail = &(*tail)->next)
+    if (((*tail)->e == rr) && ((*tail)->type == type))
+      return; // already there
+  MALLOC_ZERO_STRUCT(ie, rr_index_entry);
+  if (ie == NULL)
+    die("can not allocate memory for \"ie\" in tinysvcmdns");
+  ie->e = rr;
+  ie->type = type;
+  ie->hash = hash;
+  *tail = ie;
+}
+
+// adds a record to the server's records and to the index -- call with the data_lock held
+static void mdnsd_group_add(struct mdnsd *svr, struct rr_entry *rr) {
+  rr_group_add(&svr->group, rr);
+  rr_index_add_key(svr, rr, rr->type);
+  if (rr->type != RR_NSEC)
+    rr_index_add_key(svr, rr, RR_ANY);
+  svr->reply_cache_stale = 1;
+}
+
+static void rr_index_destroy(struct mdnsd *svr) {
+  int i;
+  for (i = 0; i < RR_INDEX_SIZE; i++) {
+    struct rr_index_entry *ie = svr->index[i];
+    while (ie) {
+      struct rr_index_entry *next = ie->next;
+      free(ie);
+      ie = next;
+    }
+    svr->index[i] = NULL;
+  }
+}
+
 // populate the specified list which matches the RR name and type
 // type can be RR_ANY, which populates all entries EXCEPT RR_NSEC
 static int populate_answers(struct mdnsd *svr, struct rr_list **rr_head, uint8_t *name,
                             enum rr_type type) {
   int num_ans = 0;
+  uint32_t hash = rr_index_hash(name, type);
 
-  // check if we have the records
   pthread_mutex_lock(&svr->data_lock);
-  struct rr_group *ans_grp = rr_group_find(svr->group, name);
-  if (ans_grp == NULL) {
-    pthread_mutex_unlock(&svr->data_lock);
-    return num_ans;
+  struct rr_index_entry *ie = svr->index[hash % RR_INDEX_SIZE];
+  for (; ie; ie = ie->next) {
+    if ((ie->hash == hash) && (ie->type == type) && (cmp_nlabel(name, ie->e->name) == 0))
+      num_ans += rr_list_append(rr_head, ie->e);
   }
+  pthread_mutex_unlock(&svr->data_lock);
+
+  return num_ans;
+}
 
-  // decide which records should go into answers
-  struct rr_list *n = ans_grp->rr;
-  for (; n; n = n->next) {
-    // exclude NSEC for RR_ANY
-    if (type == RR_ANY && n->e->type == RR_NSEC)
-      continue;
+static void reply_cache_clear(struct mdnsd *svr) {
+  int i;
+  for (i = 0; i < REPLY_CACHE_SIZE; i++) {
+    free(svr->reply_cache[i].name);
+    free(svr->reply_cache[i].pkt);
+    memset(&svr->reply_cache[i], 0, sizeof(struct mdns_cached_reply));
+  }
+}
 
-    if ((type == n->e->type || type == RR_ANY) && cmp_nlabel(name, n->e->name) == 0) {
-      num_ans += rr_list_append(rr_head, n->e);
+// a query that can be answered from the reply cache
+static int reply_cacheable(struct mdns_pkt *pkt) {
+  return ((pkt->flags & MDNS_FLAG_RESP) == 0) && (MDNS_FLAG_GET_OPCODE(pkt->flags) == 0) &&
+         (pkt->num_qn == 1) && (pkt->num_ans_rr == 0) && (pkt->rr_qn->e->unicast_query == 0);
+}
+
+static struct mdns_cached_reply *reply_cache_find(struct mdnsd *svr, struct rr_entry *qn) {
+  pthread_mutex_lock(&svr->data_lock);
+  if (svr->reply_cache_stale) {
+    reply_cache_clear(svr);
+    svr->reply_cache_stale = 0;
+  }
+  pthread_mutex_unlock(&svr->data_lock);
+
+  int i;
+  for (i = 0; i < REPLY_CACHE_SIZE; i++) {
+    struct mdns_cached_reply *c = &svr->reply_cache[i];
+    if ((c->name) && (c->type == qn->type) && (cmp_nlabel(c->name, qn->name) == 0))
+      return c;
+  }
+  return NULL;
+}
+
+// keep a copy of the encoded reply to the question -- a len of zero records that there's no reply
+static void reply_cache_store(struct mdnsd *svr, struct rr_entry *qn, struct mdns_pkt *reply,
+                              uint8_t *pkt_buf, size_t len, size_t *ttl_offsets) {
+  struct mdns_cached_reply *c = &svr->reply_cache[svr->reply_cache_next];
+  struct rr_list *rr_set[] = {reply->rr_ans, reply->rr_auth, reply->rr_add};
+  int num_rr = 0;
+  unsigned int i;
+  for (i = 0; i < sizeof(rr_set) / sizeof(rr_set[0]); i++) {
+    struct rr_list *rr = rr_set[i];
+    for (; rr; rr = rr->next) {
+      if (num_rr == REPLY_CACHE_MAX_RRS)
+        return; // too big to keep
+      num_rr++;
+    }
+  }
+  uint8_t *pkt = NULL;
+  if (len) {
+    pkt = malloc(len);
+    if (pkt == NULL)
+      return;
+    memcpy(pkt, pkt_buf, len);
+  }
+  uint8_t *name = dup_nlabel(qn->name);
+  if (name == NULL) {
+    free(pkt);
+    return;
+  }
+  free(c->name);
+  free(c->pkt);
+  c->name = name;
+  c->type = qn->type;
+  c->pkt = pkt;
+  c->len = len;
+  c->num_rr = 0;
+  for (i = 0; (len) && (i < sizeof(rr_set) / sizeof(rr_set[0])); i++) {
+    struct rr_list *rr = rr_set[i];
+    for (; rr; rr = rr->next) {
+      c->rr[c->num_rr] = rr->e;
+      c->ttl_offset[c->num_rr] = ttl_offsets[c->num_rr];
+      c->num_rr++;
     }
   }
+  svr->reply_cache_next = (svr->reply_cache_next + 1) % REPLY_CACHE_SIZE;
+}
 
+// copy a cached reply into pkt_buf with the ID of the query and the records' current TTLs,
+// returning its length -- zero if there's nothing to say
+static size_t reply_cache_copy(struct mdnsd *svr, struct mdns_cached_reply *c, uint16_t id,
+                               uint8_t *pkt_buf) {
+  int i;
+  if (c->len == 0)
+    return 0;
+  memcpy(pkt_buf, c->pkt, c->len);
+  mdns_write_u16(pkt_buf, id);
+  pthread_mutex_lock(&svr->data_lock);
+  for (i = 0; i < c->num_rr; i++)
+    mdns_write_u32(pkt_buf + c->ttl_offset[i], c->rr[i]->ttl);
   pthread_mutex_unlock(&svr->data_lock);
+  return c->len;
+}
 
-  return num_ans;
+// encode the reply to a query into pkt_buf, keeping it in the reply cache if it's cacheable,
+// and return its length -- zero if there's nothing to send
+static size_t encode_reply(struct mdnsd *svr, struct mdns_pkt *pkt, struct mdns_pkt *reply,
+                           int num_ans, uint8_t *pkt_buf) {
+  size_t ttl_offsets[REPLY_CACHE_MAX_RRS];
+  size_t replylen = 0;
+  int cacheable = reply_cacheable(pkt);
+  if (cacheable && (reply->num_ans_rr + reply->num_auth_rr + reply->num_add_rr >
+                    REPLY_CACHE_MAX_RRS))
+    cacheable = 0;
+
+  if (num_ans) {
+    replylen = mdns_encode_pkt_ttls(reply, pkt_buf, PACKET_SIZE, cacheable ? ttl_offsets : NULL);
+    if (replylen == (size_t)-1)
+      return 0;
+  }
+  if (cacheable)
+    reply_cache_store(svr, pkt->rr_qn->e, reply, pkt_buf, replylen, ttl_offsets);
+  return replylen;
 }
 
 // given a list of RRs, look up related records and add them
@@ -1391,6 +1598,35 @@ static int process_mdns_pkt(struct mdnsd *svr, struct mdns_pkt *pkt, struct mdns
   return 0;
 }
 
+// parse a received packet and put the reply to it, if there is one, in pkt_buf, returning the
+// reply's length, or zero if there's nothing to send
+static size_t answer_packet(struct mdnsd *svr, uint8_t *data, size_t len,
+                            struct mdns_pkt *mdns_reply, uint8_t *pkt_buf) {
+  size_t replylen = 0;
+  DEBUG_PRINTF("data size=%ld\n", (long)len);
+  struct mdns_pkt *mdns = mdns_parse_pkt(data, len);
+  if (mdns != NULL) {
+    struct mdns_cached_reply *cached = NULL;
+    if (reply_cacheable(mdns))
+      cached = reply_cache_find(svr, mdns->rr_qn->e);
+    if (cached) {
+      svr->replies_from_cache++;
+      replylen = reply_cache_copy(svr, cached, mdns->id, pkt_buf);
+    } else {
+      int num_ans = process_mdns_pkt(svr, mdns, mdns_reply);
+      if (num_ans || reply_cacheable(mdns))
+        replylen = encode_reply(svr, mdns, mdns_reply, num_ans, pkt_buf);
+      else if (mdns->num_qn == 0)
+        DEBUG_PRINTF("(no questions in packet)\n\n");
+    }
+    if (replylen)
+      svr->replies_sent++;
+
+    mdns_pkt_destroy(mdns);
+  }
+  return replylen;
+}
+
 int create_pipe(int handles[2]) {
 #ifdef _WIN32
   SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -1472,6 +1708,17 @@ void *main_loop(struct mdnsd *svr) {
   char notify_buf[2]; // buffer for reading of notify_pipe
 
   void *pkt_buffer = malloc(PACKET_SIZE);
+  uint8_t *receive_buffer = malloc(RECEIVE_BATCH_SIZE * RECEIVE_PACKET_SIZE);
+  if ((pkt_buffer == NULL) || (receive_buffer == NULL))
+    die("could not allocate packet buffers in tinysvcmdns");
+  struct iovec receive_iov[RECEIVE_BATCH_SIZE];
+  size_t receive_lengths[RECEIVE_BATCH_SIZE];
+  struct sockaddr_storage receive_from[RECEIVE_BATCH_SIZE];
+  unsigned int b;
+  for (b = 0; b < RECEIVE_BATCH_SIZE; b++) {
+    receive_iov[b].iov_base = receive_buffer + b * RECEIVE_PACKET_SIZE;
+    receive_iov[b].iov_len = RECEIVE_PACKET_SIZE;
+  }
 
   if (svr->notify_pipe[0] > max_fd)
     max_fd = svr->notify_pipe[0];
@@ -1492,26 +1739,17 @@ void *main_loop(struct mdnsd *svr) {
       // flush the notify_pipe
       read_pipe(svr->notify_pipe[0], (char *)&notify_buf, 1);
     } else if (FD_ISSET(svr->sockfd, &sockfd_set)) {
-      struct sockaddr_in fromaddr;
-      socklen_t sockaddr_size = sizeof(struct sockaddr_in);
-
-      ssize_t recvsize = recvfrom(svr->sockfd, pkt_buffer, PACKET_SIZE, 0,
-                                  (struct sockaddr *)&fromaddr, &sockaddr_size);
-      if (recvsize < 0) {
+      // take everything that has arrived, up to a batch, in one call where possible
+      unsigned int received = receive_datagrams(svr->sockfd, receive_iov, receive_lengths,
+                                                receive_from, RECEIVE_BATCH_SIZE);
+      if (received == 0)
         log_message(LOG_ERR, "recv(): %m");
-      }
 
-      DEBUG_PRINTF("data from=%s size=%ld\n", inet_ntoa(fromaddr.sin_addr), (long)recvsize);
-      struct mdns_pkt *mdns = mdns_parse_pkt(pkt_buffer, recvsize);
-      if (mdns != NULL) {
-        if (process_mdns_pkt(svr, mdns, mdns_reply)) {
-          size_t replylen = mdns_encode_pkt(mdns_reply, pkt_buffer, PACKET_SIZE);
+      for (b = 0; b < received; b++) {
+        size_t replylen = answer_packet(svr, receive_iov[b].iov_base, receive_lengths[b],
+                                        mdns_reply, pkt_buffer);
+        if (replylen)
           send_packet(svr->sockfd, pkt_buffer, replylen);
-        } else if (mdns->num_qn == 0) {
-          DEBUG_PRINTF("(no questions in packet)\n\n");
-        }
-
-        mdns_pkt_destroy(mdns);
       }
     }
 
@@ -1564,6 +1802,10 @@ void *main_loop(struct mdnsd *svr) {
   free(mdns_reply);
 
   free(pkt_buffer);
+  free(receive_buffer);
+  reply_cache_clear(svr);
+  debug(2, "mdns: %" PRIu64 " queries answered from the reply cache; %" PRIu64 " replies sent.",
+        svr->replies_from_cache, svr->replies_sent);
 
   close_pipe(svr->sockfd);
 
@@ -1588,8 +1830,8 @@ void mdnsd_set_hostname(struct mdnsd *svr, const char *hostname, uint32_t ip) {
 
   pthread_mutex_lock(&svr->data_lock);
   svr->hostname = create_nlabel(hostname);
-  rr_group_add(&svr->group, a_e);
-  rr_group_add(&svr->group, nsec_e);
+  mdnsd_group_add(svr, a_e);
+  mdnsd_group_add(svr, nsec_e);
   pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1608,14 +1850,14 @@ void mdnsd_set_hostname_v6(struct mdnsd *svr, const char *hostname, struct in6_a
 
   pthread_mutex_lock(&svr->data_lock);
   svr->hostname = create_nlabel(hostname);
-  rr_group_add(&svr->group, aaaa_e);
-  rr_group_add(&svr->group, nsec_e);
+  mdnsd_group_add(svr, aaaa_e);
+  mdnsd_group_add(svr, nsec_e);
   pthread_mutex_unlock(&svr->data_lock);
 }
 
 void mdnsd_add_rr(struct mdnsd *svr, struct rr_entry *rr) {
   pthread_mutex_lock(&svr->data_lock);
-  rr_group_add(&svr->group, rr);
+  mdnsd_group_add(svr, rr);
   pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1667,10 +1909,10 @@ struct mdns_service *mdnsd_register_svc(struct mdnsd *svr, const char *instance_
   pthread_mutex_lock(&svr->data_lock);
 
   if (txt_e)
-    rr_group_add(&svr->group, txt_e);
-  rr_group_add(&svr->group, srv_e);
-  rr_group_add(&svr->group, ptr_e);
-  rr_group_add(&svr->group, bptr_e);
+    mdnsd_group_add(svr, txt_e);
+  mdnsd_group_add(svr, srv_e);
+  mdnsd_group_add(svr, ptr_e);
+  mdnsd_group_add(svr, bptr_e);
 
   // append PTR entry to announce list
   rr_list_append(&svr->announce, ptr_e);
@@ -1733,6 +1975,35 @@ struct mdnsd *mdnsd_start() {
   return server;
 }
 
+struct mdnsd *mdnsd_start_offline() {
+  struct mdnsd *server = malloc(sizeof(struct mdnsd));
+  if (server)
+    memset(server, 0, sizeof(struct mdnsd));
+  else
+    die("could not allocate memory for \"server\" in tinysvcmdns");
+
+  // there's no thread to notify or socket to use
+  server->offline = 1;
+  server->sockfd = -1;
+  server->notify_pipe[0] = -1;
+  server->notify_pipe[1] = -1;
+
+  server->offline_reply = malloc(sizeof(struct mdns_pkt));
+  server->offline_pkt_buffer = malloc(PACKET_SIZE);
+  if ((server->offline_reply == NULL) || (server->offline_pkt_buffer == NULL))
+    die("could not allocate memory for an offline responder in tinysvcmdns");
+  memset(server->offline_reply, 0, sizeof(struct mdns_pkt));
+
+  pthread_mutex_init(&server->data_lock, NULL);
+  return server;
+}
+
+size_t mdnsd_answer_packet(struct mdnsd *svr, uint8_t *pkt, size_t len, uint8_t **reply) {
+  assert(svr->offline);
+  *reply = svr->offline_pkt_buffer;
+  return answer_packet(svr, pkt, len, svr->offline_reply, svr->offline_pkt_buffer);
+}
+
 void mdnsd_stop(struct mdnsd *s) {
   assert(s != NULL);
 
@@ -1741,16 +2012,27 @@ void mdnsd_stop(struct mdnsd *s) {
       .tv_usec = 500 * 1000,
   };
 
-  s->stop_flag = 1;
-  write_pipe(s->notify_pipe[1], ".", 1);
+  if (s->offline) {
+    // do what the main loop would have done on its way out, but for the goodbyes
+    mdns_init_reply(s->offline_reply, 0);
+    free(s->offline_reply);
+    free(s->offline_pkt_buffer);
+    reply_cache_clear(s);
+    debug(2, "mdns: %" PRIu64 " queries answered from the reply cache; %" PRIu64 " replies sent.",
+          s->replies_from_cache, s->replies_sent);
+  } else {
+    s->stop_flag = 1;
+    write_pipe(s->notify_pipe[1], ".", 1);
 
-  while (s->stop_flag != 2)
-    select(0, NULL, NULL, NULL, &tv);
+    while (s->stop_flag != 2)
+      select(0, NULL, NULL, NULL, &tv);
 
-  close_pipe(s->notify_pipe[0]);
-  close_pipe(s->notify_pipe[1]);
+    close_pipe(s->notify_pipe[0]);
+    close_pipe(s->notify_pipe[1]);
+  }
 
   pthread_mutex_destroy(&s->data_lock);
+  rr_index_destroy(s);
   rr_group_destroy(s->group);
   rr_list_destroy(s->announce, 0);
   rr_list_destroy(s->services, 0);
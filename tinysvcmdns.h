@@ -164,6 +164,8 @@ struct mdns_pkt *mdns_parse_pkt(uint8_t *pkt_buf, size_t pkt_len);
 
 void mdns_init_reply(struct mdns_pkt *pkt, uint16_t id);
 size_t mdns_encode_pkt(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len);
+size_t mdns_encode_pkt_ttls(struct mdns_pkt *answer, uint8_t *pkt_buf, size_t pkt_len,
+                            size_t *ttl_offsets);
 
 void mdns_pkt_destroy(struct mdns_pkt *p);
 void rr_group_destroy(struct rr_group *group);
@@ -210,6 +212,14 @@ struct mdns_service;
 // returns NULL if unsuccessful
 struct mdnsd *mdnsd_start();
 
+// starts a MDNS responder instance with no socket or thread, for the benchmark -- the packets it
+// would have received are handed to mdnsd_answer_packet instead
+struct mdnsd *mdnsd_start_offline();
+
+// answers a packet as a responder answers one it receives, returning the length of the reply
+// and pointing reply at it, or returning 0 if nothing would be sent. Offline instances only.
+size_t mdnsd_answer_packet(struct mdnsd *svr, uint8_t *pkt, size_t len, uint8_t **reply);
+
 // stops the given MDNS responder instance
 void mdnsd_stop(struct mdnsd *s);
 
@@ -0,0 +1,244 @@
+/*
+ * Zones. This file is part of Shairport Sync.
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A zone is an extra AirPlay service, with a name and port of its own, played by the same
+// Shairport Sync. Zones are listed in the "zones" setting, each as a group of settings laid over
+// the rest of the configuration file, so a zone need only give what differs from the main
+// service, typically its name, port and output device.
+// The backends keep their device state in globals, so each zone is played by a worker process of
+// its own, forked from the main process once it has read its settings and daemonised, but before
+// it starts any threads. A worker sits on the read end of a pipe whose write end only the main
+// process holds, so that it stops when the main process goes away, however that happens.
+
+#include "zones.h"
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int zone_number = 0;
+
+static int zones_parent_pipe = -1; // in a worker, the read end of the pipe
+static pthread_t zones_monitor_thread;
+
+static int zone_sets(const config_setting_t *zone, const char *group, const char *name) {
+  config_setting_t *settings = config_setting_get_member(zone, group);
+  return (settings != NULL) && (config_setting_get_member(settings, name) != NULL);
+}
+
+// get the member of parent with the given name and type, replacing or adding it if necessary
+static config_setting_t *zones_member(config_setting_t *parent, const char *name, int type) {
+  config_setting_t *setting = config_setting_get_member(parent, name);
+  if ((setting != NULL) && (config_setting_type(setting) != type)) {
+    config_setting_remove(parent, name);
+    setting = NULL;
+  }
+  if (setting == NULL)
+    setting = config_setting_add(parent, name, type);
+  if (setting == NULL)
+    die("Can not add the \"%s\" setting for zone %d.", name, zone_number);
+  return setting;
+}
+
+static void zones_copy(config_setting_t *parent, const config_setting_t *from) {
+  // the name is ignored when the parent is a list or an array
+  config_setting_t *to =
+      config_setting_add(parent, config_setting_name(from), config_setting_type(from));
+  if (to == NULL)
+    die("Can not copy a setting of zone %d.", zone_number);
+  switch (config_setting_type(from)) {
+  case CONFIG_TYPE_INT:
+    config_setting_set_int(to, config_setting_get_int(from));
+    break;
+  case CONFIG_TYPE_INT64:
+    config_setting_set_int64(to, config_setting_get_int64(from));
+    break;
+  case CONFIG_TYPE_FLOAT:
+    config_setting_set_float(to, config_setting_get_float(from));
+    break;
+  case CONFIG_TYPE_BOOL:
+    config_setting_set_bool(to, config_setting_get_bool(from));
+    break;
+  case CONFIG_TYPE_STRING:
+    config_setting_set_string(to, config_setting_get_string(from));
+    break;
+  default: { // a group, list or array
+    int i;
+    for (i = 0; i < config_setting_length(from); i++)
+      zones_copy(to, config_setting_get_elem(from, i));
+  } break;
+  }
+}
+
+// lay the settings in from over those in the group to: groups are merged, member by member,
+// anything else replaces the setting of the same name
+static void zones_merge(config_setting_t *to, const config_setting_t *from, int top_level) {
+  int i;
+  for (i = 0; i < config_setting_length(from); i++) {
+    config_setting_t *setting = config_setting_get_elem(from, i);
+    const char *name = config_setting_name(setting);
+    if ((top_level) && (strcmp(name, "zones") == 0))
+      continue; // zones don't have zones
+    config_setting_t *existing = config_setting_get_member(to, name);
+    if ((existing != NULL) && (config_setting_is_group(existing)) &&
+        (config_setting_is_group(setting))) {
+      zones_merge(existing, setting, 0);
+    } else {
+      if (existing != NULL)
+        config_setting_remove(to, name);
+      zones_copy(to, setting);
+    }
+  }
+}
+
+int zones_start(void) {
+  if (config.cfg == NULL)
+    return 0;
+  config_setting_t *zones = config_lookup(config.cfg, "zones");
+  if (zones == NULL)
+    return 0;
+  if (config_setting_type(zones) != CONFIG_TYPE_LIST)
+    die("The \"zones\" setting should be a list of groups of settings, one for each zone, e.g. "
+        "zones = ( { general = { name = \"Kitchen\"; port = 5100; }; }, ... );");
+  int number_of_zones = config_setting_length(zones);
+  const char *main_name = NULL;
+  config_lookup_string(config.cfg, "general.name", &main_name);
+  const char *names[number_of_zones > 0 ? number_of_zones : 1];
+  int ports[number_of_zones > 0 ? number_of_zones : 1];
+  int i, j;
+  for (i = 0; i < number_of_zones; i++) {
+    config_setting_t *zone = config_setting_get_elem(zones, i);
+    config_setting_t *general = NULL;
+    if (config_setting_is_group(zone))
+      general = config_setting_get_member(zone, "general");
+    if ((general == NULL) || (config_setting_lookup_string(general, "name", &names[i]) == 0) ||
+        (config_setting_lookup_int(general, "port", &ports[i]) == 0))
+      die("Zone %d should be a group of settings with a \"general\" \"name\" and \"port\" of its "
+          "own.",
+          i + 1);
+    if ((ports[i] < 0) || (ports[i] > 65535))
+      die("Invalid port number %d for zone %d. It should be between 0 and 65535.", ports[i],
+          i + 1);
+    if (ports[i] == config.port)
+      die("Zone %d can not use port %d -- the main service is using it.", i + 1, ports[i]);
+    if ((main_name != NULL) && (strcmp(names[i], main_name) == 0))
+      die("Zone %d can not be called \"%s\" -- the main service is called that.", i + 1,
+          names[i]);
+    for (j = 0; j < i; j++) {
+      if (ports[i] == ports[j])
+        die("Zones %d and %d can not both use port %d.", j + 1, i + 1, ports[i]);
+      if (strcmp(names[i], names[j]) == 0)
+        die("Zones %d and %d can not both be called \"%s\".", j + 1, i + 1, names[i]);
+    }
+    if (config_setting_get_member(zone, "zones") != NULL)
+      warn("The \"zones\" setting in zone %d is ignored.", i + 1);
+  }
+  if (number_of_zones == 0)
+    return 0;
+
+  int fd[2];
+  if (pipe(fd) != 0)
+    die("Can not create the pipe for the zones' workers: %s.", strerror(errno));
+  // keep it from the commands run before and after play and the like
+  fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+  fflush(NULL);
+  for (i = 0; i < number_of_zones; i++) {
+    pid_t pid = fork();
+    if (pid < 0)
+      die("Can not start a worker for zone %d: %s.", i + 1, strerror(errno));
+    if (pid == 0) {
+      close(fd[1]);
+      zones_parent_pipe = fd[0];
+      zone_number = i + 1;
+      return zone_number;
+    }
+    debug(1, "zone %d, \"%s\" on port %d, is played by process %d.", i + 1, names[i], ports[i],
+          pid);
+  }
+  close(fd[0]); // the write end stays open until this process exits
+  return 0;
+}
+
+void zones_apply_settings(config_t *cfg) {
+  if (zone_number == 0)
+    return;
+  config_setting_t *zones = config_lookup(cfg, "zones");
+  config_setting_t *zone = NULL;
+  if (zones != NULL)
+    zone = config_setting_get_elem(zones, zone_number - 1);
+  if (zone == NULL)
+    die("Zone %d has gone from the configuration file.", zone_number);
+  config_setting_t *root = config_root_setting(cfg);
+  zones_merge(root, zone, 1);
+
+  // unless the zone says otherwise, keep clear of the main service's and other zones' resources,
+  // using the settings the main service ended up with, which are still in config
+  config_setting_t *general = zones_member(root, "general", CONFIG_TYPE_GROUP);
+  if (zone_sets(zone, "general", "udp_port_base") == 0)
+    config_setting_set_int(zones_member(general, "udp_port_base", CONFIG_TYPE_INT),
+                           config.udp_port_base + zone_number * config.udp_port_range);
+#ifdef CONFIG_METADATA
+  if ((zone_sets(zone, "metadata", "pipe_name") == 0) && (config.metadata_pipename != NULL)) {
+    char pipe_name[PATH_MAX];
+    snprintf(pipe_name, sizeof(pipe_name), "%s-%d", config.metadata_pipename, zone_number);
+    config_setting_t *metadata = zones_member(root, "metadata", CONFIG_TYPE_GROUP);
+    config_setting_set_string(zones_member(metadata, "pipe_name", CONFIG_TYPE_STRING), pipe_name);
+  }
+#endif
+#ifdef CONFIG_MQTT
+  if (zone_sets(zone, "mqtt", "topic") == 0) {
+    // the topic will be made from the zone's name
+    config_setting_t *mqtt = config_setting_get_member(root, "mqtt");
+    if ((mqtt != NULL) && (config_setting_get_member(mqtt, "topic") != NULL))
+      config_setting_remove(mqtt, "topic");
+    config.mqtt_topic = NULL;
+  }
+#endif
+}
+
+static void *zones_monitor_thread_code(__attribute__((unused)) void *arg) {
+  char c;
+  ssize_t r;
+  // nothing is ever written, so this returns only when the main process has closed its end
+  do {
+    r = read(zones_parent_pipe, &c, 1);
+  } while ((r > 0) || ((r < 0) && (errno == EINTR)));
+  debug(1, "zone %d is stopping because the main process has stopped.", zone_number);
+  pthread_cancel(main_thread_id); // as when asked to quit over D-Bus
+  pthread_exit(NULL);
+}
+
+void zones_monitor_start(void) {
+  if (zone_number == 0)
+    return;
+  if (pthread_create(&zones_monitor_thread, NULL, &zones_monitor_thread_code, NULL) != 0)
+    die("Can not start the monitor thread for zone %d.", zone_number);
+}
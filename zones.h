@@ -0,0 +1,9 @@
+#pragma once
+
+#include <libconfig.h>
+
+extern int zone_number; // 0 in the process playing the main service, n in zone n's worker
+
+int zones_start(void); // fork a worker for each zone; returns the zone number, 0 in the parent
+void zones_apply_settings(config_t *cfg); // in a worker, lay its zone's settings over the rest
+void zones_monitor_start(void);           // in a worker, stop when the parent process goes away